@@ -103,6 +103,14 @@
 */
 /* #define FZ_ENABLE_BARCODE 1 */
 
+/**
+	Choose whether to use the NEON cores in the draw code on ARM.
+	They have not yet been built and checked there, so they are
+	disabled by default; scripts/paintcheck.c, affinecheck.c and
+	blendcheck.c compare them with the C code.
+*/
+/* #define FZ_ENABLE_DRAW_NEON 0 */
+
 /**
 	Choose which fonts to include.
 	By default we include the base 14 PDF fonts,
@@ -288,4 +296,8 @@
 #define FZ_ENABLE_BARCODE 1
 #endif
 
+#ifndef FZ_ENABLE_DRAW_NEON
+#define FZ_ENABLE_DRAW_NEON 0
+#endif
+
 #endif /* FZ_CONFIG_H */
@@ -33,6 +33,7 @@
 #endif
 
 typedef struct fz_font_context fz_font_context;
+typedef struct fz_ft_thread_context fz_ft_thread_context;
 typedef struct fz_colorspace_context fz_colorspace_context;
 typedef struct fz_style_context fz_style_context;
 typedef struct fz_tuning_context fz_tuning_context;
@@ -266,6 +267,12 @@ void fz_flush_warnings(fz_context *ctx);
 	when we already hold any lock i, where 0 <= i <= n. In order
 	to verify this, we have some debugging code, that can be
 	enabled by defining FITZ_DEBUG_LOCKING.
+
+	FZ_LOCK_STORE is the first of FZ_STORE_MAX_SHARDS consecutive
+	locks, one for each shard of a sharded resource store (see
+	fz_set_store_shards). Similarly, FZ_LOCK_GLYPHCACHE is the first
+	of FZ_GLYPH_CACHE_SHARDS consecutive locks, one for each shard
+	of the glyph cache.
 */
 
 typedef struct
@@ -275,11 +282,17 @@ typedef struct
 	void (*unlock)(void *user, int lock);
 } fz_locks_context;
 
+enum {
+	FZ_STORE_MAX_SHARDS = 16,
+	FZ_GLYPH_CACHE_SHARDS = 8
+};
+
 enum {
 	FZ_LOCK_ALLOC = 0,
-	FZ_LOCK_FREETYPE,
+	FZ_LOCK_STORE,
+	FZ_LOCK_FREETYPE = FZ_LOCK_STORE + FZ_STORE_MAX_SHARDS,
 	FZ_LOCK_GLYPHCACHE,
-	FZ_LOCK_MAX
+	FZ_LOCK_MAX = FZ_LOCK_GLYPHCACHE + FZ_GLYPH_CACHE_SHARDS
 };
 
 #if defined(MEMENTO) || !defined(NDEBUG)
@@ -875,6 +888,8 @@ struct fz_context
 	int icc_enabled;
 #endif
 	int throw_on_repair;
+	int mmap_files;
+	fz_ft_thread_context *ft_thread;
 
 	/* TODO: should these be unshared? */
 	fz_document_handler_context *handler;
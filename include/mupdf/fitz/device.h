@@ -429,7 +429,21 @@ enum
 	/* Hints */
 	FZ_DONT_INTERPOLATE_IMAGES = 1,
 	FZ_NO_CACHE = 2,
-	FZ_DONT_DECODE_IMAGES = 4
+	FZ_DONT_DECODE_IMAGES = 4,
+	/* Let the draw device merge runs of opaque paths in the same
+	 * color, and paint them together. Much faster for drawings made
+	 * of huge numbers of thin strokes (CAD plans, maps), at the cost
+	 * of slightly different rounding where such paths overlap.
+	 * Batched paths are only painted when the color changes, when
+	 * anything other than an opaque path is drawn, or when the
+	 * device is closed, so until then the pixmap may not show them.
+	 * Don't use this when looking at the pixmap during a run (for
+	 * progressive display, say). */
+	FZ_BATCH_PATHS = 8,
+	/* Let the draw device keep flattened paths and stroke outlines
+	 * in the store, so that drawing the same display list again at
+	 * the same scale (redraws, bands, tiles) need not redo them. */
+	FZ_CACHE_FLATTENED_PATHS = 16
 };
 
 /**
@@ -27,6 +27,8 @@
 #include "mupdf/fitz/context.h"
 #include "mupdf/fitz/geometry.h"
 #include "mupdf/fitz/device.h"
+#include "mupdf/fitz/buffer.h"
+#include "mupdf/fitz/output.h"
 
 /**
 	Display list device -- record and play back device commands.
@@ -139,4 +141,147 @@ fz_image *fz_new_image_from_display_list(fz_context *ctx, float w, float h, fz_d
 */
 int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list);
 
+/**
+	Measure the space taken by the commands in a display list.
+
+	commands: If not NULL, returns the number of commands in the
+	list.
+
+	Returns the number of bytes the commands are encoded in. The
+	objects they refer to (fonts, images, shadings, texts and so
+	on) are not counted.
+*/
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list, size_t *commands);
+
+/**
+	Tile scheduler for rendering a single display list from several
+	threads at once.
+
+	The area to render is split into a grid of tiles. When the
+	scheduler is created the display list is walked once to count
+	how many painting commands touch each tile; tiles that nothing
+	paints into are never handed out, and the remainder are handed
+	out most expensive first so that the slowest tiles start early.
+
+	The scheduler does not create any threads itself. The caller
+	creates a destination pixmap covering the area, clears it, and
+	then calls fz_run_tile_render from as many threads as it likes
+	(each with its own cloned context). Every call keeps taking
+	tiles from the shared queue until none remain.
+*/
+typedef struct fz_tile_render fz_tile_render;
+
+/**
+	Create a tile scheduler for a display list.
+
+	list: The display list to render. A reference is taken.
+
+	ctm: Transform to apply to display list contents.
+
+	area: The device space area to be rendered; normally the bbox
+	of the destination pixmap.
+
+	tile_w, tile_h: The size of each tile in pixels. Values <= 0
+	select a default.
+*/
+fz_tile_render *fz_new_tile_render(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_irect area, int tile_w, int tile_h);
+
+/**
+	Take the next tile to be rendered from the queue.
+
+	Returns 1 and fills in *tile, or 0 once all tiles have been
+	handed out (or the render has been aborted).
+
+	Callers that need more control than fz_run_tile_render gives
+	can use this in its place, running the display list with the
+	tile as scissor into fz_new_pixmap_from_pixmap(dest, tile).
+*/
+int fz_next_render_tile(fz_context *ctx, fz_tile_render *tr, fz_irect *tile);
+
+/**
+	Create the device that renders one tile into tile (a view of
+	the destination pixmap). Typically this is a draw device with
+	the caller's choice of hints.
+*/
+typedef fz_device *(fz_tile_device_fn)(fz_context *ctx, void *arg, fz_pixmap *tile);
+
+/**
+	Render tiles from the queue into dest until none remain.
+
+	Safe to call from several threads at once on the same tile
+	render and the same dest, provided each thread uses its own
+	context. dest must cover the area given at creation, and must
+	already be cleared; tiles that nothing paints into are not
+	touched.
+
+	cookie: Per thread cookie (or NULL). Setting abort stops this
+	worker and every other worker after their current tile.
+
+	new_device: Creates the device for each tile, or NULL for a
+	plain draw device. arg is passed to it.
+
+	If rendering a tile throws, the remaining workers stop taking
+	tiles and the error is rethrown to this caller.
+*/
+void fz_run_tile_render(fz_context *ctx, fz_tile_render *tr, fz_pixmap *dest, fz_cookie *cookie, fz_tile_device_fn *new_device, void *arg);
+
+/**
+	Stop handing out tiles. Workers finish the tile they are
+	currently rendering and return.
+*/
+void fz_abort_tile_render(fz_context *ctx, fz_tile_render *tr);
+
+/**
+	Returns the number of tiles that will be (or were) handed out,
+	i.e. those that at least one painting command touches.
+*/
+int fz_count_render_tiles(fz_context *ctx, fz_tile_render *tr);
+
+/**
+	Drop a tile scheduler and the display list reference it holds.
+	Must not be called while any worker is still running.
+*/
+void fz_drop_tile_render(fz_context *ctx, fz_tile_render *tr);
+
+/**
+	Write a display list out, so that it can be reloaded with
+	fz_read_display_list without interpreting the document it was
+	made from again.
+
+	The file is a cache rather than an interchange format: the
+	commands are stored in their in-memory encoding, and only the
+	same build of the library on the same architecture can read
+	them back. Font files, image data and ICC profiles are stored
+	once per file, however many objects share them.
+
+	Tint transforms and transfer functions are stored sampled.
+
+	Throws FZ_ERROR_UNSUPPORTED if the list uses something that
+	cannot be saved, such as a Type 3 font.
+*/
+void fz_write_display_list(fz_context *ctx, fz_output *out, fz_display_list *list);
+
+/**
+	Save a display list to a file, as for fz_write_display_list.
+*/
+void fz_save_display_list(fz_context *ctx, fz_display_list *list, const char *filename);
+
+/**
+	Recreate a display list from data written by
+	fz_write_display_list.
+
+	The commands are copied back as they are, with their object
+	references fixed up; no parsing or interpretation takes place
+	beyond that. The list does not reference buf once loaded.
+
+	Throws FZ_ERROR_FORMAT if the data is damaged or was written by
+	a different build.
+*/
+fz_display_list *fz_read_display_list(fz_context *ctx, fz_buffer *buf);
+
+/**
+	Load a display list saved by fz_save_display_list.
+*/
+fz_display_list *fz_load_display_list(fz_context *ctx, const char *filename);
+
 #endif
@@ -705,6 +705,25 @@ float fz_font_descender(fz_context *ctx, fz_font *font);
 */
 void fz_font_digest(fz_context *ctx, fz_font *font, unsigned char digest[16]);
 
+/**
+	Enable or disable per-thread FreeType instances.
+
+	By default all contexts share one FreeType library, and glyph
+	loading is serialised on FZ_LOCK_FREETYPE. When enabled, each
+	context (and hence each thread) opens its own FreeType library
+	on first use, together with its own faces onto the shared font
+	data, and renders, outlines, bounds and measures glyphs with
+	those without taking the lock.
+
+	Each context keeps up to 32 faces open and holds a reference
+	to their fonts until the face is evicted, the font is no longer
+	used elsewhere, or the context is dropped.
+
+	This setting is shared by all clones of a context, and should
+	be made before any other threads are started.
+*/
+void fz_set_per_thread_freetype(fz_context *ctx, int enable);
+
 /* Implementation details: subject to change. */
 
 void fz_decouple_type3_font(fz_context *ctx, fz_font *font, void *t3doc);
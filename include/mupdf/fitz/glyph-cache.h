@@ -34,6 +34,28 @@
 */
 void fz_purge_glyph_cache(fz_context *ctx);
 
+/**
+	Share rendered glyphs with other processes (and other context
+	families) through a memory mapped file.
+
+	Glyphs rendered from font files are looked up in the file before
+	being rendered, and added to it after. Fonts are identified by
+	the digest of their data rather than by the fz_font, so a font
+	embedded in many documents is only rendered once. Nothing is
+	removed from the file; once full, it is simply not added to. To
+	start afresh, delete the file while no process is using it.
+
+	filename: The file to use. It is created if required.
+
+	size: The size of the file to create. If the file exists, its
+	size is used instead. All processes sharing a file should give
+	the same size.
+
+	Not supported on all platforms. This should be called before the
+	glyph cache is in use by other threads.
+*/
+void fz_use_shared_glyph_cache(fz_context *ctx, const char *filename, size_t size);
+
 /**
 	Create a pixmap containing a rendered glyph.
 
@@ -69,6 +91,42 @@ void fz_render_t3_glyph_direct(fz_context *ctx, fz_device *dev, fz_font *font, i
 */
 void fz_prepare_t3_glyph(fz_context *ctx, fz_font *font, int gid);
 
+/**
+	Set the maximum size of the glyph cache (1MB by default). Glyph
+	heavy documents (such as CJK text) may benefit from a larger
+	cache. The cache is emptied.
+
+	This should be called before the glyph cache is in use by other
+	threads.
+*/
+void fz_set_glyph_cache_size(fz_context *ctx, size_t max);
+
+/**
+	Statistics for the glyph cache.
+
+	size, max: The current and maximum size of the cache.
+
+	hits, misses: The number of lookups that did and did not find
+	a glyph.
+
+	evictions, evicted_bytes: The number (and total size) of glyphs
+	evicted to keep the cache within its maximum size.
+*/
+typedef struct
+{
+	size_t size;
+	size_t max;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t evicted_bytes;
+} fz_glyph_cache_stats;
+
+/**
+	Read the statistics for the glyph cache.
+*/
+void fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats);
+
 /**
 	Dump debug statistics for the glyph cache.
 */
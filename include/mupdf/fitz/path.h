@@ -26,6 +26,8 @@
 #include "mupdf/fitz/system.h"
 #include "mupdf/fitz/context.h"
 #include "mupdf/fitz/geometry.h"
+#include "mupdf/fitz/buffer.h"
+#include "mupdf/fitz/crypt.h"
 
 /**
  * Vector path buffer.
@@ -176,6 +178,51 @@ int fz_packed_path_size(const fz_path *path);
 */
 size_t fz_pack_path(fz_context *ctx, uint8_t *pack, const fz_path *path);
 
+/**
+	Internal functions used to save and reload packed paths.
+
+	A copy of a flat packed block is self contained. An 'open'
+	packed block holds pointers to its coordinates and commands, so
+	those have to be stored alongside it.
+
+	fz_save_packed_path_data: Append the out of line data of a
+	packed path to buf, and clear the pointers to it. pack must be
+	a copy of the packed block, not the original.
+
+	fz_packed_path_data_size: Check that pack is a block saved by
+	fz_save_packed_path_data that fits in avail bytes, and return the
+	number of bytes of out of line data it needs. Throws if it is not.
+
+	fz_load_packed_path_data: Reattach the out of line data for a
+	block checked by fz_packed_path_data_size, taking it from the
+	start of data. Returns the number of bytes used.
+*/
+void fz_save_packed_path_data(fz_context *ctx, fz_buffer *buf, fz_path *pack);
+size_t fz_packed_path_data_size(fz_context *ctx, const fz_path *pack, size_t avail);
+size_t fz_load_packed_path_data(fz_context *ctx, fz_path *pack, const unsigned char *data, size_t len);
+
+/**
+	Compare the commands and coordinates of two paths, whether
+	packed or not.
+
+	Returns 0 if they are identical, non-zero otherwise.
+*/
+int fz_compare_paths(fz_context *ctx, const fz_path *a, const fz_path *b);
+
+/**
+	Return a hash of the commands and coordinates of a path, whether
+	packed or not. Paths that fz_compare_paths finds identical hash
+	to the same value.
+*/
+unsigned int fz_hash_path(fz_context *ctx, const fz_path *path);
+
+/**
+	Feed the commands and coordinates of a path, whether packed or
+	not, into an md5 digest. Paths that fz_compare_paths finds
+	identical feed in the same data.
+*/
+void fz_digest_path(fz_context *ctx, const fz_path *path, fz_md5 *md5);
+
 /**
 	Clone the data for a path.
 
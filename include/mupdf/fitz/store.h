@@ -251,6 +251,10 @@ typedef struct
 			unsigned int copy_spots:1;
 			unsigned int bgr:1;
 		} link; /* 36 bytes */
+		struct
+		{
+			unsigned char md5[16];
+		} md5; /* 16 bytes */
 	} u;
 } fz_store_hash; /* 40 or 44 bytes */
 
@@ -278,6 +282,196 @@ typedef struct
 */
 void fz_new_store_context(fz_context *ctx, size_t max);
 
+/**
+	Partition the store into a number of shards.
+
+	By default the store keeps all its items in a single hash table
+	and LRU list, protected by FZ_LOCK_ALLOC. This can become a
+	point of contention when many threads are rendering at once.
+
+	A sharded store divides its items between several hash tables
+	and LRU lists, chosen by the hash of their keys, each protected
+	by its own lock (FZ_LOCK_STORE + n). FZ_LOCK_ALLOC is then only
+	held briefly to update reference counts and the store size.
+	Evictions (both to keep the store below its maximum size, and
+	to scavenge memory) visit the shards in turn, so eviction order
+	is only approximately LRU across the store as a whole.
+
+	shards: The number of shards to use (clamped to the range 1 to
+	FZ_STORE_MAX_SHARDS). 1 gives the default, unsharded, store.
+
+	Any items already in the store are evicted. This should be
+	called before the store is in use by other threads, typically
+	directly after creating the context.
+*/
+void fz_set_store_shards(fz_context *ctx, int shards);
+
+/**
+	Eviction policies for the store.
+
+	FZ_STORE_POLICY_LRU: Evict the least recently used items first.
+	This is the default.
+
+	FZ_STORE_POLICY_2Q: New items are placed on probation, and only
+	join the main LRU list when they are used again. Items on
+	probation are evicted first, so a burst of items that are used
+	only once (such as when scrolling through a document) cannot
+	flush out the items that are reused. The main list is limited
+	to 3/4 of the store.
+
+	FZ_STORE_POLICY_COST: As LRU, but items that were expensive to
+	create for their size (see fz_store_item_with_cost) survive a
+	number of eviction passes before they are evicted.
+*/
+typedef enum
+{
+	FZ_STORE_POLICY_LRU,
+	FZ_STORE_POLICY_2Q,
+	FZ_STORE_POLICY_COST
+} fz_store_policy;
+
+/**
+	Set the eviction policy of the store. This may be called at any
+	time; items currently in the store are kept.
+*/
+void fz_set_store_policy(fz_context *ctx, fz_store_policy policy);
+
+/**
+	Map from (case sensitive) policy name ("lru", "2q" or "cost") to
+	an eviction policy. Unknown names map to FZ_STORE_POLICY_LRU.
+*/
+fz_store_policy fz_store_policy_from_string(const char *policy);
+
+/**
+	Map from an eviction policy to its name.
+*/
+const char *fz_store_policy_to_string(fz_store_policy policy);
+
+/**
+	Counters describing how effective the store is.
+
+	hits, misses: The number of lookups that did and did not find
+	an item.
+
+	stores: The number of items inserted.
+
+	evictions, evicted_bytes: The number (and total size) of items
+	evicted to make space in the store, or to free memory.
+*/
+typedef struct
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t stores;
+	uint64_t evictions;
+	uint64_t evicted_bytes;
+} fz_store_counters;
+
+/**
+	Read the counters of the store.
+*/
+void fz_get_store_counters(fz_context *ctx, fz_store_counters *counters);
+
+/**
+	Reset the counters of the store to zero.
+*/
+void fz_reset_store_counters(fz_context *ctx);
+
+/**
+	Statistics for the items of one type (as given by the name in
+	their fz_store_type) in the store.
+
+	items, bytes: The number (and total size) of items currently in
+	the store.
+
+	max: The limit on bytes set by fz_set_store_type_limit, or
+	FZ_STORE_UNLIMITED.
+
+	hits, misses: The number of lookups that did and did not find
+	an item.
+
+	evictions: The number of items evicted to make space in the
+	store (or to keep within max).
+
+	scavenges: The number of items evicted to free memory when an
+	allocation failed.
+*/
+typedef struct
+{
+	const char *name;
+	int items;
+	size_t bytes;
+	size_t max;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t scavenges;
+} fz_store_type_stats;
+
+enum
+{
+	FZ_STORE_MAX_TYPES = 32
+};
+
+/**
+	A snapshot of the state of the store, and of each type of item
+	that has been stored (or limited) so far.
+*/
+typedef struct
+{
+	size_t max;
+	size_t size;
+	int num_types;
+	fz_store_type_stats type[FZ_STORE_MAX_TYPES];
+} fz_store_stats;
+
+/**
+	Take a snapshot of the state of the store. The type names in
+	the snapshot remain valid for as long as the store does.
+*/
+void fz_get_store_stats(fz_context *ctx, fz_store_stats *stats);
+
+/**
+	Limit the total size of the items of one type in the store, so
+	that (for instance) large images cannot evict everything else.
+	Items of the given type are evicted (least recently used first)
+	to stay within the limit; other items are never evicted on its
+	account.
+
+	name: The name of the type, as given in its fz_store_type (for
+	instance "fz_image" for decoded images, or "pdf_obj" for fonts,
+	colorspaces and other resources loaded from PDF objects). This
+	need not have been seen by the store yet.
+
+	max: The maximum number of bytes, or FZ_STORE_UNLIMITED.
+*/
+void fz_set_store_type_limit(fz_context *ctx, const char *name, size_t max);
+
+/**
+	Set a directory in which to keep a persistent, second level,
+	cache of items that are expensive to recreate (currently, tiles
+	decoded from JPX, JBIG2 and CCITT fax images). Tiles are written
+	there when decoded, and read back in preference to decoding
+	again, by this or any later process using the same directory.
+	Files are named by a digest of the image data and decoding
+	parameters, so the cache may be shared between documents.
+
+	The directory must exist. Nothing is ever removed from it; its
+	size should be managed externally. There is no cache until this
+	is called; NULL (or "") does nothing.
+
+	The directory can be set only once; later calls are ignored,
+	with a warning. This should be called before the store is in use
+	by other threads, typically directly after creating the context.
+*/
+void fz_set_store_disk_cache(fz_context *ctx, const char *dir);
+
+/**
+	Return the directory set by fz_set_store_disk_cache, or NULL.
+	It stays valid for as long as the store does.
+*/
+const char *fz_store_disk_cache(fz_context *ctx);
+
 /**
 	Increment the reference count for the store context. Returns
 	the same pointer.
@@ -315,6 +509,18 @@ void fz_drop_store_context(fz_context *ctx);
 */
 void *fz_store_item(fz_context *ctx, void *key, void *val, size_t itemsize, const fz_store_type *type);
 
+/**
+	Add an item to the store, as for fz_store_item, also giving the
+	cost of recreating it should it be evicted.
+
+	cost: The cost of recreating the item, in arbitrary (but
+	consistent) units, such as the microseconds it took to decode.
+	Only the ratio of cost to itemsize, relative to that of the
+	other items in the store, is significant. 0 for unknown (treated
+	as average).
+*/
+void *fz_store_item_with_cost(fz_context *ctx, void *key, void *val, size_t itemsize, float cost, const fz_store_type *type);
+
 /**
 	Find an item within the store.
 
@@ -69,6 +69,33 @@ fz_stream *fz_open_file_autodelete(fz_context *ctx, const char *filename);
 */
 fz_stream *fz_try_open_file(fz_context *ctx, const char *name);
 
+/**
+	Map the named file into memory and wrap it in a stream.
+
+	Reads return pointers straight into the mapping, seeking costs
+	nothing, and null filters opened on the stream (such as those
+	for the contents of PDF objects) read straight out of the
+	mapping too, without copying.
+
+	The file must not be truncated while it is mapped; on most
+	systems, reading the missing part crashes the process.
+
+	Throws if the file cannot be opened or mapped (for instance, if
+	it is not a regular file, or the platform does not support
+	mapping files).
+*/
+fz_stream *fz_open_file_mmap(fz_context *ctx, const char *filename);
+
+/**
+	Set whether fz_open_file and fz_try_open_file map regular files
+	into memory (as fz_open_file_mmap does) rather than reading them.
+	Files that cannot be mapped are read as before.
+
+	This is off by default, as mapped files must not be truncated
+	while they are open.
+*/
+void fz_set_mmap_files(fz_context *ctx, int enable);
+
 #ifdef _WIN32
 /**
 	Open the named file and wrap it in a stream.
@@ -127,6 +154,86 @@ fz_stream *fz_open_buffer(fz_context *ctx, fz_buffer *buf);
 */
 fz_stream *fz_open_leecher(fz_context *ctx, fz_stream *chain, fz_buffer *buf);
 
+/**
+	A prefetcher reads blocks of a file ahead of time, on behalf of
+	one or more prefetch streams opened on the same file.
+
+	The library never creates threads itself; the caller runs
+	fz_prefetch_work on a thread of its own (with its own cloned
+	context), and reads from the prefetch stream on another.
+*/
+typedef struct fz_prefetch fz_prefetch;
+
+/**
+	Called (from whichever thread queued it) whenever new work is
+	queued for a prefetcher, or when it is closed. Typically this
+	triggers a semaphore that the worker thread waits on.
+*/
+typedef void (fz_prefetch_wake_fn)(void *arg);
+
+/**
+	Create a prefetcher that reads blocks from source.
+
+	source: The stream that fz_prefetch_work reads from. This must
+	be a separate stream on the same file as the prefetch streams,
+	as it is read from another thread. A reference is taken.
+
+	wake: Called whenever there is work to be done (may be NULL).
+*/
+fz_prefetch *fz_new_prefetch(fz_context *ctx, fz_stream *source, fz_prefetch_wake_fn *wake, void *arg);
+
+fz_prefetch *fz_keep_prefetch(fz_context *ctx, fz_prefetch *pf);
+void fz_drop_prefetch(fz_context *ctx, fz_prefetch *pf);
+
+/**
+	Do one piece of prefetching work, reading a single block from
+	the source stream.
+
+	Returns 1 if a block was read (or failed to be read), 0 if there
+	is nothing to do (the caller should wait to be woken), or -1 once
+	the prefetcher has been closed (the caller should stop).
+*/
+int fz_prefetch_work(fz_context *ctx, fz_prefetch *pf);
+
+/**
+	Stop prefetching. Any queued work is discarded, and the wake
+	function is called so that the worker can notice. Prefetch
+	streams keep working, reading synchronously from their chain.
+*/
+void fz_close_prefetch(fz_context *ctx, fz_prefetch *pf);
+
+/**
+	Return the number of reads from prefetch streams that were
+	satisfied from prefetched blocks (hits), and that had to be
+	read synchronously (misses).
+*/
+void fz_prefetch_stats(fz_context *ctx, fz_prefetch *pf, int *hits, int *misses);
+
+/**
+	Open a stream that reads the same data as chain, but takes it
+	from blocks read ahead by the prefetcher where it can. Reading
+	straight through a file prefetches the next block automatically;
+	other accesses can be hinted with fz_prefetch_stream_range.
+
+	chain: The stream to read from on a prefetch miss. A reference
+	is taken.
+*/
+fz_stream *fz_open_prefetch(fz_context *ctx, fz_prefetch *pf, fz_stream *chain);
+
+/**
+	Returns non-zero if stm was opened by fz_open_prefetch.
+*/
+int fz_is_prefetch_stream(fz_context *ctx, fz_stream *stm);
+
+/**
+	Hint that the given range of a stream will be read soon. This
+	does nothing unless stm was opened by fz_open_prefetch, so
+	callers may give hints regardless of where their data lives.
+
+	Never throws exceptions.
+*/
+void fz_prefetch_stream_range(fz_context *ctx, fz_stream *stm, int64_t offset, int64_t len);
+
 /**
 	Increments the reference count for a stream. Returns the same
 	pointer.
@@ -643,4 +750,15 @@ static inline int fz_is_eof_bits(fz_context *ctx, fz_stream *stm)
 */
 fz_stream *fz_open_file_ptr_no_close(fz_context *ctx, FILE *file);
 
+/**
+	If stm holds all of its data in memory (as streams from
+	fz_open_memory, fz_open_buffer and fz_open_file_mmap do), return
+	a stream that reads len bytes (or as many as there are) from
+	offset within that data, straight out of the same memory, and
+	which keeps stm alive. Otherwise, return NULL.
+
+	The position of stm is unaffected.
+*/
+fz_stream *fz_open_memory_slice(fz_context *ctx, fz_stream *stm, int64_t offset, uint64_t len);
+
 #endif
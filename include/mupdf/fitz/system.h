@@ -102,9 +102,10 @@ typedef unsigned __int64 uint64_t;
 #endif
 
 
-/* We assume that pretty much any X86 or X64 machine has SSE these days. */
+/* We assume that pretty much any X86 or X64 machine has SSE these days.
+ * Elsewhere, use it if the compiler has been told SSE4.1 is available. */
 #ifndef ARCH_HAS_SSE
-#if defined(_M_IX86) || defined(_M_AMD64) || defined(_M_X64)
+#if defined(_M_IX86) || defined(_M_AMD64) || defined(_M_X64) || defined(__SSE4_1__)
 #define ARCH_HAS_SSE 1
 #endif
 #endif
@@ -219,6 +220,13 @@ int64_t fz_stat_ctime(const char *path);
 int64_t fz_stat_mtime(const char *path);
 int fz_mkdir(char *path);
 
+/**
+	Return the current time in microseconds, for timing
+	operations. Only the difference between two values is
+	meaningful.
+*/
+int64_t fz_time_us(void);
+
 
 /* inline is standard in C++. For some compilers we can enable it within
  * C too. Some compilers think they know better than we do about when
@@ -53,6 +53,14 @@ typedef struct
 	 * Future values reserved.
 	 */
 	pdf_clean_options_structure structure;
+
+	/* If set, called with the document as soon as it has been
+	 * opened (and authenticated), before anything is done to it.
+	 * mutool clean uses this to decode object streams on several
+	 * threads (see pdf_new_obj_stm_batch).
+	 */
+	void (*preload)(fz_context *ctx, pdf_document *doc, void *arg);
+	void *preload_arg;
 } pdf_clean_options;
 
 /*
@@ -179,6 +179,53 @@ pdf_document *pdf_open_document(fz_context *ctx, const char *filename);
 */
 pdf_document *pdf_open_document_with_stream(fz_context *ctx, fz_stream *file);
 
+/*
+	Options for opening a PDF document; all are off when zeroed.
+
+	lazy_xref: Read the cross reference tables lazily. Large xref
+	subsections (and the subsections of xref streams) are then only
+	located when the document is opened; their entries are read a
+	few hundred at a time, as objects around them are looked up.
+	Until then they cost no more than their packed form (nothing for
+	an xref table, which stays in the file, and a few bytes each for
+	an xref stream). This makes opening huge files much faster, and
+	keeps memory use in line with the objects actually used, at the
+	cost of finding some damage later than usual (objects whose xref
+	entries are broken are repaired when they are loaded, rather than
+	at open). The saving lasts only while few pages are used: the
+	second page lookup maps the whole page tree, which loads every
+	page object (and so, in most files, every object stream).
+
+	obj_arena: Allocate the objects read from the file (other than
+	names) out of large blocks owned by the document, instead of one
+	at a time. They are not reference counted: keeping and dropping
+	them does nothing, and they are all freed at once when the
+	document is dropped, which makes dropping a large document much
+	quicker. Arrays and dictionaries that are edited are quietly
+	given items of their own first, so editing works as usual.
+	Objects decoded by pdf_decode_obj_stm_batch are the exception;
+	they are allocated on the heap as usual.
+
+	The price is that no object loaded from such a document may be
+	used after the document has been dropped, not even a number or a
+	string (which, unlike arrays and dictionaries, do not say which
+	document they came from, so are not caught when they are put
+	into another document; pdf_graft_object copies them).
+*/
+typedef struct
+{
+	int lazy_xref;
+	int obj_arena;
+} pdf_open_options;
+
+/*
+	Open a PDF document as pdf_open_document and
+	pdf_open_document_with_stream do, but with the given options.
+	opts may be NULL for the defaults.
+*/
+pdf_document *pdf_open_document_with_options(fz_context *ctx, const char *filename, const pdf_open_options *opts);
+pdf_document *pdf_open_document_with_stream_and_options(fz_context *ctx, fz_stream *file, const pdf_open_options *opts);
+
 /*
 	Closes and frees an opened PDF document.
 
@@ -447,12 +494,16 @@ struct pdf_document
 	int *xref_index;
 	int save_in_progress;
 	int last_xref_was_old_style;
+	int lazy_xref;
+	int lazy_xref_damaged;
+	pdf_obj_arena *obj_arena;
 	int has_linearization_object;
 
 	int map_page_count;
 	pdf_rev_page_map *rev_page_map;
 	pdf_obj **fwd_page_map;
 	int page_tree_broken;
+	int page_tree_walked;
 
 	int repair_attempted;
 	int repair_in_progress;
@@ -79,7 +79,8 @@ typedef struct pdf_xref_subsec
 	struct pdf_xref_subsec *next;
 	int len;
 	int start;
-	pdf_xref_entry *table;
+	pdf_xref_entry *table;	/* NULL if lazy */
+	struct pdf_xref_lazy *lazy;	/* packed rows and expanded pages (lazy xref loading only) */
 } pdf_xref_subsec;
 
 struct pdf_xref
@@ -124,6 +125,35 @@ pdf_obj *pdf_resolve_indirect_chain(fz_context *ctx, pdf_obj *ref);
 pdf_obj *pdf_load_object(fz_context *ctx, pdf_document *doc, int num);
 pdf_obj *pdf_load_unencrypted_object(fz_context *ctx, pdf_document *doc, int num);
 
+/**
+	Decode the object streams of a document on several threads.
+
+	pdf_new_obj_stm_batch finds the object streams holding objects
+	that have not been loaded yet, and reads their data from the file.
+
+	pdf_decode_obj_stm_batch decompresses and parses the next object
+	stream in the batch. It can be called from any number of threads
+	at once, each with its own cloned context, and returns 0 once
+	there are none left. The document must not otherwise be used
+	while this is going on.
+
+	pdf_merge_obj_stm_batch, called once all the decoding is done,
+	puts the objects into the document, so that loading them later
+	costs nothing. Object streams that could not be decoded are left
+	to be loaded in the usual way. The objects decoded here are
+	ordinary heap objects, even in a document opened with an object
+	arena (see pdf_open_options), as arenas are not thread safe.
+
+	The library never creates threads itself; see mutool clean -j
+	for an example.
+*/
+typedef struct pdf_obj_stm_batch pdf_obj_stm_batch;
+
+pdf_obj_stm_batch *pdf_new_obj_stm_batch(fz_context *ctx, pdf_document *doc);
+int pdf_decode_obj_stm_batch(fz_context *ctx, pdf_obj_stm_batch *batch);
+void pdf_merge_obj_stm_batch(fz_context *ctx, pdf_obj_stm_batch *batch);
+void pdf_drop_obj_stm_batch(fz_context *ctx, pdf_obj_stm_batch *batch);
+
 /*
 	Load raw (compressed but decrypted) contents of a stream into buf.
 */
@@ -0,0 +1,236 @@
+/* affinecheck.c -- check and time the SIMD cores of the image painters
+
+	The bilinear and constant alpha nearest image painters for 1, 3
+	and 4 colourants, with and without alpha, hand each span to the
+	SSE (or NEON) cores in draw-affine_sse.h and draw-affine_neon.h.
+	affineref.c builds the painters again with no SIMD cores; given
+	the same image, transform, alpha, shape and group alpha, the two
+	must leave exactly the same bytes.
+
+	Build against a release build of the library with the SIMD
+	cores in it (on x86, say XCFLAGS=-msse4.1; on ARM, say
+	XCFLAGS=-DFZ_ENABLE_DRAW_NEON=1), using the same flags:
+
+	cc -O2 -msse4.1 -Iinclude -o affinecheck scripts/affinecheck.c \
+		scripts/affineref.c build/release/libmupdf.a \
+		build/release/libmupdf-third.a -lm
+
+	affinecheck
+		Paint random images with random scales, rotations and
+		offsets, nearest and bilinear, then time the two painting
+		a large rotated image.
+*/
+
+#include "mupdf/fitz.h"
+#include "../source/fitz/draw-imp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define IMAGES 20000
+#define DST_W 96
+#define DST_H 64
+#define BENCH_SIZE 512
+#define BENCH_RUNS 50
+
+void ref_fz_paint_image(fz_context *ctx, fz_pixmap *dst, const fz_irect *scissor, fz_pixmap *shape, fz_pixmap *group_alpha, fz_pixmap *img, fz_matrix ctm, int alpha, int lerp_allowed, const fz_overprint *eop);
+
+static unsigned int
+next_rand(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static float
+rand_float(unsigned int *seed, float lo, float hi)
+{
+	return lo + (hi - lo) * (next_rand(seed) & 0xffff) / 65535.0f;
+}
+
+static fz_colorspace *
+colorspace_for(fz_context *ctx, int n)
+{
+	switch (n)
+	{
+	case 1: return fz_device_gray(ctx);
+	case 3: return fz_device_rgb(ctx);
+	default: return fz_device_cmyk(ctx);
+	}
+}
+
+static void
+fill_random(fz_pixmap *pix, unsigned int *seed)
+{
+	unsigned char *p = pix->samples;
+	size_t len = (size_t)pix->stride * pix->h;
+	while (len--)
+		*p++ = next_rand(seed);
+}
+
+static fz_pixmap *
+copy_pixmap(fz_context *ctx, fz_pixmap *pix)
+{
+	fz_pixmap *copy;
+	if (!pix)
+		return NULL;
+	copy = fz_new_pixmap_with_bbox(ctx, pix->colorspace, fz_pixmap_bbox(ctx, pix), NULL, pix->alpha);
+	memcpy(copy->samples, pix->samples, (size_t)pix->stride * pix->h);
+	return copy;
+}
+
+static int
+same_pixmap(fz_pixmap *a, fz_pixmap *b)
+{
+	if (!a)
+		return 1;
+	return !memcmp(a->samples, b->samples, (size_t)a->stride * a->h);
+}
+
+/* Map the unit square onto a w by h rectangle, turned by angle degrees
+ * and placed at (x,y). */
+static fz_matrix
+place(float w, float h, float angle, float x, float y)
+{
+	fz_matrix ctm = fz_scale(w, h);
+	ctm = fz_concat(ctm, fz_translate(-w/2, -h/2));
+	ctm = fz_concat(ctm, fz_rotate(angle));
+	return fz_concat(ctm, fz_translate(x, y));
+}
+
+static int
+check_images(fz_context *ctx)
+{
+	static const int ns[] = { 1, 3, 4 };
+	unsigned int seed = 1;
+	int i, painted = 0;
+
+	for (i = 0; i < IMAGES; i++)
+	{
+		int n = ns[next_rand(&seed) % 3];
+		int sa = next_rand(&seed) & 1;
+		int da = next_rand(&seed) & 1;
+		int lerp = next_rand(&seed) % 3 != 0;
+		int alpha = next_rand(&seed) % 3 == 0 ? 255 : (int)(next_rand(&seed) % 256);
+		int sw = 1 + next_rand(&seed) % 40;
+		int sh = 1 + next_rand(&seed) % 40;
+		float scale = rand_float(&seed, 0.2f, 6);
+		float angle = next_rand(&seed) % 3 == 0 ? 0 : rand_float(&seed, 0, 360);
+		fz_irect scissor = { 0, 0, DST_W, DST_H };
+		fz_pixmap *img, *dst, *shape = NULL, *group_alpha = NULL;
+		fz_pixmap *ref, *ref_shape, *ref_group_alpha;
+		fz_matrix ctm;
+		int same;
+
+		img = fz_new_pixmap(ctx, colorspace_for(ctx, n), sw, sh, NULL, sa);
+		fill_random(img, &seed);
+		if (next_rand(&seed) & 1)
+			img->flags |= FZ_PIXMAP_FLAG_INTERPOLATE;
+		dst = fz_new_pixmap(ctx, colorspace_for(ctx, n), DST_W, DST_H, NULL, da);
+		fill_random(dst, &seed);
+		if (next_rand(&seed) % 4 == 0)
+		{
+			shape = fz_new_pixmap(ctx, NULL, DST_W, DST_H, NULL, 1);
+			fill_random(shape, &seed);
+		}
+		if (next_rand(&seed) % 4 == 0)
+		{
+			group_alpha = fz_new_pixmap(ctx, NULL, DST_W, DST_H, NULL, 1);
+			fill_random(group_alpha, &seed);
+		}
+		if (next_rand(&seed) & 1)
+		{
+			scissor.x0 = next_rand(&seed) % DST_W;
+			scissor.x1 = scissor.x0 + 1 + next_rand(&seed) % (DST_W - scissor.x0);
+		}
+		ctm = place(sw * scale, sh * scale, angle,
+			rand_float(&seed, -20, DST_W + 20), rand_float(&seed, -20, DST_H + 20));
+
+		ref = copy_pixmap(ctx, dst);
+		ref_shape = copy_pixmap(ctx, shape);
+		ref_group_alpha = copy_pixmap(ctx, group_alpha);
+
+		fz_paint_image(ctx, dst, &scissor, shape, group_alpha, img, ctm, alpha, lerp, NULL);
+		ref_fz_paint_image(ctx, ref, &scissor, ref_shape, ref_group_alpha, img, ctm, alpha, lerp, NULL);
+		same = same_pixmap(dst, ref) && same_pixmap(shape, ref_shape) && same_pixmap(group_alpha, ref_group_alpha);
+		if (!same)
+			fprintf(stderr, "image %d differs: n=%d sa=%d da=%d lerp=%d alpha=%d %dx%d scale=%g angle=%g shape=%d group_alpha=%d\n",
+				i, n, sa, da, lerp, alpha, sw, sh, scale, angle, !!shape, !!group_alpha);
+
+		fz_drop_pixmap(ctx, img);
+		fz_drop_pixmap(ctx, dst);
+		fz_drop_pixmap(ctx, shape);
+		fz_drop_pixmap(ctx, group_alpha);
+		fz_drop_pixmap(ctx, ref);
+		fz_drop_pixmap(ctx, ref_shape);
+		fz_drop_pixmap(ctx, ref_group_alpha);
+		if (!same)
+			return 1;
+		painted++;
+	}
+
+	printf("%d images: same\n", painted);
+	return 0;
+}
+
+static void
+bench_images(fz_context *ctx)
+{
+	static const int ns[] = { 1, 3, 4 };
+	fz_irect scissor = { 0, 0, BENCH_SIZE, BENCH_SIZE };
+	unsigned int seed = 1;
+	int i, sa, lerp, alpha, ref, k;
+
+	printf("ms to paint a %d pixel square image turned by 30 degrees: SIMD vs C\n", BENCH_SIZE / 2);
+	for (i = 0; i < (int)nelem(ns); i++)
+	for (sa = 0; sa <= 1; sa++)
+	for (lerp = 1; lerp >= 0; lerp--)
+	for (alpha = 255; alpha > 1; alpha -= 127)
+	{
+		fz_pixmap *img = fz_new_pixmap(ctx, colorspace_for(ctx, ns[i]), BENCH_SIZE / 4, BENCH_SIZE / 4, NULL, sa);
+		fz_pixmap *dst = fz_new_pixmap(ctx, colorspace_for(ctx, ns[i]), BENCH_SIZE, BENCH_SIZE, NULL, sa);
+		fz_matrix ctm = place(BENCH_SIZE / 2, BENCH_SIZE / 2, 30, BENCH_SIZE / 2, BENCH_SIZE / 2);
+		double ms[2];
+
+		fill_random(img, &seed);
+		fill_random(dst, &seed);
+		for (ref = 0; ref < 2; ref++)
+		{
+			clock_t start = clock();
+			for (k = 0; k < BENCH_RUNS; k++)
+				if (ref)
+					ref_fz_paint_image(ctx, dst, &scissor, NULL, NULL, img, ctm, alpha, lerp, NULL);
+				else
+					fz_paint_image(ctx, dst, &scissor, NULL, NULL, img, ctm, alpha, lerp, NULL);
+			ms[ref] = (double)(clock() - start) / CLOCKS_PER_SEC * 1000 / BENCH_RUNS;
+		}
+		printf("\tn=%d sa=%d %s alpha=%d: %6.2f %6.2f\n",
+			ns[i], sa, lerp ? "bilinear" : "nearest ", alpha, ms[0], ms[1]);
+
+		fz_drop_pixmap(ctx, img);
+		fz_drop_pixmap(ctx, dst);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	fz_context *ctx;
+	int failed;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		return 1;
+	}
+
+	failed = check_images(ctx);
+	if (!failed)
+		bench_images(ctx);
+
+	fz_drop_context(ctx);
+	return failed;
+}
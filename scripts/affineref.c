@@ -0,0 +1,10 @@
+/* affineref.c -- the image painters without their SIMD cores, for affinecheck.c */
+
+#define ARCH_HAS_SSE 0
+#define ARCH_HAS_NEON 0
+
+#define fz_gridfit_matrix ref_fz_gridfit_matrix
+#define fz_paint_image ref_fz_paint_image
+#define fz_paint_image_with_color ref_fz_paint_image_with_color
+
+#include "../source/fitz/draw-affine.c"
@@ -0,0 +1,239 @@
+/* blendcheck.c -- check and time the SIMD cores of the blenders
+
+	Separable blending, isolated and not, and knockout groups for 1,
+	3 and 4 colourants hand each row to the SSE (or NEON) cores in
+	draw-blend_sse.h and draw-blend_neon.h. blendref.c builds the
+	blenders again with no SIMD cores; given the same premultiplied
+	pixmaps, shape and alpha, the two must leave exactly the same
+	bytes.
+
+	Build against a release build of the library with the SIMD
+	cores in it (on x86, say XCFLAGS=-msse4.1; on ARM, say
+	XCFLAGS=-DFZ_ENABLE_DRAW_NEON=1), using the same flags:
+
+	cc -O2 -msse4.1 -Iinclude -o blendcheck scripts/blendcheck.c \
+		scripts/blendref.c build/release/libmupdf.a \
+		build/release/libmupdf-third.a -lm
+
+	blendcheck
+		Blend random groups in every mode, isolated, non-isolated
+		and knockout, then time the two on a large group.
+*/
+
+#include "mupdf/fitz.h"
+#include "../source/fitz/draw-imp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define GROUPS 20000
+#define BENCH_SIZE 512
+#define BENCH_RUNS 20
+
+void ref_fz_blend_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, int alpha, int blendmode, int isolated, const fz_pixmap *shape);
+void ref_fz_blend_pixmap_knockout(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, const fz_pixmap *shape);
+
+static unsigned int
+next_rand(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static fz_colorspace *
+colorspace_for(fz_context *ctx, int n)
+{
+	switch (n)
+	{
+	case 1: return fz_device_gray(ctx);
+	case 3: return fz_device_rgb(ctx);
+	default: return fz_device_cmyk(ctx);
+	}
+}
+
+/* Fill a pixmap with premultiplied pixels, as the draw device leaves
+ * them: many are clear or opaque, the rest anything. */
+static void
+fill_premultiplied(fz_pixmap *pix, unsigned int *seed)
+{
+	int x, y, k, n1 = pix->n - pix->alpha;
+
+	for (y = 0; y < pix->h; y++)
+	{
+		unsigned char *p = pix->samples + y * (size_t)pix->stride;
+		for (x = 0; x < pix->w; x++)
+		{
+			int kind = next_rand(seed) % 4;
+			int a = kind == 0 ? 0 : kind == 1 ? 255 : (int)(next_rand(seed) & 255);
+			if (!pix->alpha)
+				a = 255;
+			for (k = 0; k < n1; k++)
+				*p++ = fz_mul255(next_rand(seed) & 255, a);
+			if (pix->alpha)
+				*p++ = a;
+		}
+	}
+}
+
+static fz_pixmap *
+copy_pixmap(fz_context *ctx, fz_pixmap *pix)
+{
+	fz_pixmap *copy = fz_new_pixmap_with_bbox(ctx, pix->colorspace, fz_pixmap_bbox(ctx, pix), NULL, pix->alpha);
+	memcpy(copy->samples, pix->samples, (size_t)pix->stride * pix->h);
+	return copy;
+}
+
+static int
+same_pixmap(fz_pixmap *a, fz_pixmap *b)
+{
+	return !memcmp(a->samples, b->samples, (size_t)a->stride * a->h);
+}
+
+static int
+check_groups(fz_context *ctx)
+{
+	static const int ns[] = { 1, 3, 4 };
+	unsigned int seed = 1;
+	int i, blended = 0;
+
+	for (i = 0; i < GROUPS; i++)
+	{
+		int n = ns[next_rand(&seed) % 3];
+		int sa = next_rand(&seed) % 4 != 0;
+		int da = next_rand(&seed) & 1;
+		int mode = next_rand(&seed) % (FZ_BLEND_LUMINOSITY + 1);
+		int kind = next_rand(&seed) % 3;
+		int alpha = next_rand(&seed) & 1 ? 255 : (int)(next_rand(&seed) & 255);
+		fz_irect sbox, dbox, hbox = { 0, 0, 80, 16 };
+		fz_pixmap *src, *dst, *shape, *ref_src, *ref;
+		int same;
+
+		/* Groups without alpha are only ever blended onto pixmaps
+		 * without alpha; the C code does not handle anything else. */
+		if (!sa)
+			da = 0;
+
+		dbox.x0 = next_rand(&seed) % 8;
+		dbox.y0 = next_rand(&seed) % 8;
+		dbox.x1 = dbox.x0 + 1 + next_rand(&seed) % 70;
+		dbox.y1 = dbox.y0 + 1 + next_rand(&seed) % 6;
+		sbox.x0 = next_rand(&seed) % 8;
+		sbox.y0 = next_rand(&seed) % 8;
+		sbox.x1 = sbox.x0 + 1 + next_rand(&seed) % 70;
+		sbox.y1 = sbox.y0 + 1 + next_rand(&seed) % 6;
+
+		src = fz_new_pixmap_with_bbox(ctx, colorspace_for(ctx, n), sbox, NULL, sa);
+		dst = fz_new_pixmap_with_bbox(ctx, colorspace_for(ctx, n), dbox, NULL, da);
+		shape = fz_new_pixmap_with_bbox(ctx, NULL, hbox, NULL, 1);
+		fill_premultiplied(src, &seed);
+		fill_premultiplied(dst, &seed);
+		fill_premultiplied(shape, &seed);
+		ref_src = copy_pixmap(ctx, src);
+		ref = copy_pixmap(ctx, dst);
+
+		if (kind == 2)
+		{
+			fz_blend_pixmap_knockout(ctx, dst, src, shape);
+			ref_fz_blend_pixmap_knockout(ctx, ref, ref_src, shape);
+		}
+		else
+		{
+			fz_blend_pixmap(ctx, dst, src, alpha, mode, kind, shape);
+			ref_fz_blend_pixmap(ctx, ref, ref_src, alpha, mode, kind, shape);
+		}
+		same = same_pixmap(dst, ref) && same_pixmap(src, ref_src);
+		if (!same)
+			fprintf(stderr, "group %d differs: n=%d sa=%d da=%d %s %s alpha=%d %dx%d\n",
+				i, n, sa, da, fz_blendmode_name(mode),
+				kind == 2 ? "knockout" : kind ? "isolated" : "non-isolated",
+				alpha, sbox.x1 - sbox.x0, sbox.y1 - sbox.y0);
+
+		fz_drop_pixmap(ctx, src);
+		fz_drop_pixmap(ctx, dst);
+		fz_drop_pixmap(ctx, shape);
+		fz_drop_pixmap(ctx, ref_src);
+		fz_drop_pixmap(ctx, ref);
+		if (!same)
+			return 1;
+		blended++;
+	}
+
+	printf("%d groups: same\n", blended);
+	return 0;
+}
+
+static void
+bench_groups(fz_context *ctx)
+{
+	static const int ns[] = { 1, 3, 4 };
+	static const int modes[] = { FZ_BLEND_MULTIPLY, FZ_BLEND_SCREEN, FZ_BLEND_DARKEN, FZ_BLEND_HARD_LIGHT };
+	unsigned int seed = 1;
+	int i, m, kind, ref, k;
+
+	printf("ms to blend a %d pixel square group: SIMD vs C\n", BENCH_SIZE);
+	for (i = 0; i < (int)nelem(ns); i++)
+	for (kind = 0; kind < 3; kind++)
+	for (m = 0; m < (kind == 2 ? 1 : (int)nelem(modes)); m++)
+	{
+		fz_pixmap *src = fz_new_pixmap(ctx, colorspace_for(ctx, ns[i]), BENCH_SIZE, BENCH_SIZE, NULL, 1);
+		fz_pixmap *dst = fz_new_pixmap(ctx, colorspace_for(ctx, ns[i]), BENCH_SIZE, BENCH_SIZE, NULL, 1);
+		fz_pixmap *shape = fz_new_pixmap(ctx, NULL, BENCH_SIZE, BENCH_SIZE, NULL, 1);
+		double ms[2];
+
+		fill_premultiplied(src, &seed);
+		fill_premultiplied(dst, &seed);
+		fill_premultiplied(shape, &seed);
+		for (ref = 0; ref < 2; ref++)
+		{
+			clock_t start = clock();
+			for (k = 0; k < BENCH_RUNS; k++)
+			{
+				if (kind == 2)
+				{
+					if (ref)
+						ref_fz_blend_pixmap_knockout(ctx, dst, src, shape);
+					else
+						fz_blend_pixmap_knockout(ctx, dst, src, shape);
+				}
+				else
+				{
+					if (ref)
+						ref_fz_blend_pixmap(ctx, dst, src, 255, modes[m], kind, shape);
+					else
+						fz_blend_pixmap(ctx, dst, src, 255, modes[m], kind, shape);
+				}
+			}
+			ms[ref] = (double)(clock() - start) / CLOCKS_PER_SEC * 1000 / BENCH_RUNS;
+		}
+		printf("\tn=%d %-12s %-10s: %6.2f %6.2f\n", ns[i],
+			kind == 2 ? "knockout" : kind ? "isolated" : "non-isolated",
+			kind == 2 ? "" : fz_blendmode_name(modes[m]), ms[0], ms[1]);
+
+		fz_drop_pixmap(ctx, src);
+		fz_drop_pixmap(ctx, dst);
+		fz_drop_pixmap(ctx, shape);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	fz_context *ctx;
+	int failed;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		return 1;
+	}
+
+	failed = check_groups(ctx);
+	if (!failed)
+		bench_groups(ctx);
+
+	fz_drop_context(ctx);
+	return failed;
+}
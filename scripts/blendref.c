@@ -0,0 +1,11 @@
+/* blendref.c -- the blenders without their SIMD cores, for blendcheck.c */
+
+#define ARCH_HAS_SSE 0
+#define ARCH_HAS_NEON 0
+
+#define fz_blend_pixmap ref_fz_blend_pixmap
+#define fz_blend_pixmap_knockout ref_fz_blend_pixmap_knockout
+#define fz_blendmode_name ref_fz_blendmode_name
+#define fz_lookup_blendmode ref_fz_lookup_blendmode
+
+#include "../source/fitz/draw-blend.c"
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+
+# Check and time the edgebuffer scan converter on dense vector art.
+#
+# The edgebuffer (mutool draw -A9 for centre of pixel, -A10 for any part
+# of pixel) sorts the intersections of long rows with a radix sort, and
+# only walks the rows a path can touch. Both should leave every pixel as
+# it was; this renders pages of generated vector art that exercise them
+# (thousands of overlapping curves, fine hatching, hairlines in long
+# rows) with a reference mutool and the one under test, and compares
+# the output.
+#
+# usage: edgecheck.py [-k dir] reference-mutool [test-mutool]
+#
+# Prints the time each mutool took, and whether the outputs match. With
+# one mutool, only time it. The generated files are written to a
+# temporary directory, or kept in dir if given.
+
+import hashlib
+import math
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+import zlib
+
+RESOLUTIONS = [ 72, 300 ]
+RASTERIZERS = [ 9, 10 ]
+
+def write_pdf(filename, ops):
+	content = zlib.compress("\n".join(ops).encode())
+	objs = [
+		b"<</Type/Catalog/Pages 2 0 R>>",
+		b"<</Type/Pages/Kids[3 0 R]/Count 1>>",
+		b"<</Type/Page/Parent 2 0 R/MediaBox[0 0 612 792]/Contents 4 0 R>>",
+		b"<</Length %d/Filter/FlateDecode>>stream\n" % len(content) + content + b"\nendstream",
+	]
+	out = b"%PDF-1.4\n"
+	offsets = []
+	for i, obj in enumerate(objs):
+		offsets.append(len(out))
+		out += b"%d 0 obj\n" % (i+1) + obj + b"\nendobj\n"
+	startxref = len(out)
+	out += b"xref\n0 %d\n0000000000 65535 f \n" % (len(objs)+1)
+	out += b"".join(b"%010d 00000 n \n" % ofs for ofs in offsets)
+	out += b"trailer\n<</Size %d/Root 1 0 R>>\nstartxref\n%d\n%%%%EOF\n" % (len(objs)+1, startxref)
+	with open(filename, "wb") as f:
+		f.write(out)
+
+def curve(rnd, x, y, spread):
+	return "%.1f %.1f %.1f %.1f %.1f %.1f c" % tuple(rnd.uniform(-spread, spread) + (x if j % 2 == 0 else y) for j in range(6))
+
+# Large overlapping curves, stroked and filled with both fill rules,
+# giving long rows of intersections.
+def make_tangle(rnd):
+	ops = []
+	for i in range(20000):
+		x, y = rnd.uniform(0, 600), rnd.uniform(0, 800)
+		ops.append("%.2f w %.3f %.3f %.3f RG %.1f %.1f m" % (rnd.uniform(0.2, 3), rnd.random(), rnd.random(), rnd.random(), x, y))
+		for k in range(6):
+			ops.append(curve(rnd, x, y, 80))
+		ops.append([ "S", "%.3f g h f" % rnd.random(), "%.3f g h f*" % rnd.random() ][i % 3])
+	return ops
+
+# Many small strokes in colour, each touching a few rows.
+def make_scribble(rnd):
+	ops = []
+	for i in range(50000):
+		x, y = rnd.uniform(0, 600), rnd.uniform(0, 800)
+		ops.append("%.2f w %.3f %.3f %.3f RG %.1f %.1f m" % (rnd.uniform(0.1, 0.5), rnd.random(), rnd.random(), rnd.random(), x, y))
+		for k in range(6):
+			ops.append(curve(rnd, x, y, 15))
+		ops.append("S")
+	return ops
+
+# Hatching across the whole page and hairlines, in paths of many
+# subpaths.
+def make_hatching(rnd):
+	ops = [ "0 w" ]
+	for i in range(200):
+		angle = rnd.uniform(0, 3.14159)
+		ops.append("%.3f G" % rnd.random())
+		for k in range(100):
+			x, y = rnd.uniform(-100, 700), rnd.uniform(-100, 900)
+			ops.append("%.1f %.1f m %.1f %.1f l" % (x, y, x + 900 * math.cos(angle), y + 900 * math.sin(angle)))
+		ops.append("S")
+	return ops
+
+ARTS = [
+	( "tangle", make_tangle ),
+	( "scribble", make_scribble ),
+	( "hatching", make_hatching ),
+]
+
+def render(mutool, filename, aa, res, outfile):
+	start = time.time()
+	subprocess.run([ mutool, "draw", "-q", "-A", str(aa), "-r", str(res), "-o", outfile, filename ], check=True)
+	secs = time.time() - start
+	with open(outfile, "rb") as f:
+		digest = hashlib.md5(f.read()).hexdigest()
+	os.remove(outfile)
+	return digest, secs
+
+def main(args):
+	keep = None
+	if len(args) > 1 and args[0] == "-k":
+		keep = args[1]
+		args = args[2:]
+	if len(args) < 1 or len(args) > 2:
+		print("usage: edgecheck.py [-k dir] reference-mutool [test-mutool]", file=sys.stderr)
+		return 1
+
+	tmpdir = None
+	if keep:
+		os.makedirs(keep, exist_ok=True)
+		dir = keep
+	else:
+		tmpdir = tempfile.TemporaryDirectory()
+		dir = tmpdir.name
+
+	failed = 0
+	for name, make in ARTS:
+		filename = os.path.join(dir, name + ".pdf")
+		write_pdf(filename, make(random.Random(1)))
+		for aa in RASTERIZERS:
+			for res in RESOLUTIONS:
+				outfile = os.path.join(dir, "out.pam")
+				results = [ render(mutool, filename, aa, res, outfile) for mutool in args ]
+				line = "%-8s -A%-2d -r%-3d" % (name, aa, res)
+				for digest, secs in results:
+					line += " %7.3fs" % secs
+				if len(results) == 2:
+					if results[0][0] == results[1][0]:
+						line += " same"
+					else:
+						line += " DIFFERENT"
+						failed = 1
+				print(line)
+
+	if tmpdir:
+		tmpdir.cleanup()
+	return failed
+
+if __name__ == "__main__":
+	sys.exit(main(sys.argv[1:]))
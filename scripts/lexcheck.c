@@ -0,0 +1,342 @@
+/* lexcheck.c -- check and time the PDF lexer's fast paths
+
+	The lexer takes tokens that lie wholly within the buffered data
+	straight from the buffer, and leaves anything else to the code
+	that reads a byte at a time. lexref.c builds the lexer again
+	without the fast paths; fed the same data in the same chunks
+	(whole, one byte at a time, and in random sizes), the two must
+	give the same tokens, values, scratch text and stream positions.
+
+	Build against a release build of the library:
+
+	cc -O2 -Iinclude -o lexcheck scripts/lexcheck.c scripts/lexref.c \
+		build/release/libmupdf.a build/release/libmupdf-third.a -lm
+
+	lexcheck
+		Check random token soups and short reals.
+	lexcheck file ...
+		Check the bytes of each file, then time lexing them with
+		and without the fast paths.
+*/
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SOUPS 3000
+#define REALS 2000000
+#define BENCH_RUNS 5
+
+pdf_token ref_pdf_lex(fz_context *ctx, fz_stream *f, pdf_lexbuf *lexbuf);
+void ref_pdf_lexbuf_init(fz_context *ctx, pdf_lexbuf *lexbuf, int size);
+void ref_pdf_lexbuf_fin(fz_context *ctx, pdf_lexbuf *lexbuf);
+
+/* A stream that serves data in chunks of a fixed size (or, when the
+ * size is 0, of random sizes from 1 to 40 bytes). */
+typedef struct
+{
+	const unsigned char *data;
+	size_t len, pos;
+	size_t chunk;
+	unsigned int seed;
+	unsigned char buf[4096];
+} chunk_state;
+
+static unsigned int
+next_rand(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static int
+next_chunk(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	chunk_state *state = stm->state;
+	size_t n = state->len - state->pos;
+	size_t chunk = state->chunk;
+
+	if (chunk == 0)
+		chunk = 1 + next_rand(&state->seed) % 40;
+	if (n > chunk)
+		n = chunk;
+	if (n > sizeof state->buf)
+		n = sizeof state->buf;
+	if (n == 0)
+		return EOF;
+	memcpy(state->buf, state->data + state->pos, n);
+	state->pos += n;
+	stm->rp = state->buf;
+	stm->wp = state->buf + n;
+	stm->pos += n;
+	return *stm->rp++;
+}
+
+static void
+drop_chunk(fz_context *ctx, void *state)
+{
+	fz_free(ctx, state);
+}
+
+static fz_stream *
+open_chunks(fz_context *ctx, const unsigned char *data, size_t len, size_t chunk, unsigned int seed)
+{
+	chunk_state *state = fz_malloc_struct(ctx, chunk_state);
+	state->data = data;
+	state->len = len;
+	state->chunk = chunk;
+	state->seed = seed;
+	return fz_new_stream(ctx, state, next_chunk, drop_chunk);
+}
+
+static int
+lex(fz_context *ctx, fz_stream *stm, pdf_lexbuf *lb, int ref)
+{
+	int tok = PDF_TOK_ERROR;
+	fz_try(ctx)
+		tok = ref ? ref_pdf_lex(ctx, stm, lb) : pdf_lex(ctx, stm, lb);
+	fz_catch(ctx)
+		tok = -1;
+	return tok;
+}
+
+static int
+same_token(fz_context *ctx, int tok, fz_stream *a, pdf_lexbuf *la, fz_stream *b, pdf_lexbuf *lb)
+{
+	if (fz_tell(ctx, a) != fz_tell(ctx, b))
+		return 0;
+	switch (tok)
+	{
+	case PDF_TOK_INT:
+		return la->i == lb->i && !strcmp(la->scratch, lb->scratch);
+	case PDF_TOK_REAL:
+		return !memcmp(&la->f, &lb->f, sizeof la->f) && !strcmp(la->scratch, lb->scratch);
+	case PDF_TOK_NAME:
+	case PDF_TOK_KEYWORD:
+		return la->len == lb->len && !strcmp(la->scratch, lb->scratch);
+	case PDF_TOK_STRING:
+		return la->len == lb->len && !memcmp(la->scratch, lb->scratch, la->len);
+	}
+	return 1;
+}
+
+/* Lex the data in chunks of the given size with both lexers, in step;
+ * return the number of tokens, or -1 if they differ. */
+static int
+check(fz_context *ctx, const unsigned char *data, size_t len, size_t chunk, unsigned int seed)
+{
+	fz_stream *a = NULL, *b = NULL;
+	pdf_lexbuf la, lb;
+	int ta, tb, n = 0;
+
+	pdf_lexbuf_init(ctx, &la, PDF_LEXBUF_SMALL);
+	ref_pdf_lexbuf_init(ctx, &lb, PDF_LEXBUF_SMALL);
+	a = open_chunks(ctx, data, len, chunk, seed);
+	b = open_chunks(ctx, data, len, chunk, seed);
+
+	do
+	{
+		ta = lex(ctx, a, &la, 0);
+		tb = lex(ctx, b, &lb, 1);
+		if (ta != tb || !same_token(ctx, ta, a, &la, b, &lb))
+		{
+			fprintf(stderr, "token %d differs at offset %d: %d '%s', expected %d '%s'\n",
+				n, (int)fz_tell(ctx, b), ta, la.scratch, tb, lb.scratch);
+			n = -1;
+			break;
+		}
+		n++;
+	}
+	while (ta != PDF_TOK_EOF && ta != -1);
+
+	fz_drop_stream(ctx, a);
+	fz_drop_stream(ctx, b);
+	pdf_lexbuf_fin(ctx, &la);
+	ref_pdf_lexbuf_fin(ctx, &lb);
+	return n;
+}
+
+static int
+check_all_chunks(fz_context *ctx, const unsigned char *data, size_t len, unsigned int seed)
+{
+	if (check(ctx, data, len, sizeof ((chunk_state *)0)->buf, seed) < 0)
+		return 1;
+	if (check(ctx, data, len, 1, seed) < 0)
+		return 1;
+	if (check(ctx, data, len, 0, seed) < 0)
+		return 1;
+	return 0;
+}
+
+static const char *soup_words[] = {
+	" ", "\n", "\r\n", "\t", "\f", "\0", "0", "1", "9", ".", "-", "+",
+	"/", "#", "#20", "#4", "#0", "(", ")", "<", ">", "<<", ">>", "[",
+	"]", "{", "}", "%", "obj", "R", "endobj", "true", "null", "stream",
+	"a", "Z", "\x80", "\xff", "123456789", "0.000000000000001",
+	"1234567890123", "3.14159", "-0.0", "--5", "1e5", "12.5.6", "/Name",
+	"% comment\n",
+};
+
+static size_t
+make_soup(unsigned char *out, size_t max, unsigned int seed)
+{
+	int nwords = nelem(soup_words);
+	size_t n = 0;
+
+	while (n + 256 < max)
+	{
+		int k = next_rand(&seed) % nwords;
+		size_t len = soup_words[k][0] ? strlen(soup_words[k]) : 1;
+		/* Now and then, a long run of digits, points and letters. */
+		if (next_rand(&seed) % 8 == 0)
+		{
+			int i, run = next_rand(&seed) % 200;
+			for (i = 0; i < run; i++)
+				out[n++] = "0123456789.a "[next_rand(&seed) % 13];
+		}
+		memcpy(out + n, soup_words[k], len);
+		n += len;
+	}
+	return n;
+}
+
+/* Signed reals of up to 8 digits, which the fast path converts. */
+static size_t
+make_real(char *out, unsigned int *seed)
+{
+	int digits = 1 + next_rand(seed) % 8;
+	int point = next_rand(seed) % (digits + 1);
+	int sign = next_rand(seed) % 3;
+	size_t n = 0;
+	int i;
+
+	if (sign == 1)
+		out[n++] = '-';
+	else if (sign == 2)
+		out[n++] = '+';
+	for (i = 0; i < digits; i++)
+	{
+		if (i == point)
+			out[n++] = '.';
+		out[n++] = '0' + next_rand(seed) % 10;
+	}
+	if (point == digits)
+		out[n++] = '.';
+	out[n++] = ' ';
+	return n;
+}
+
+static int
+check_random(fz_context *ctx)
+{
+	static unsigned char soup[1 << 20];
+	unsigned int seed = 1;
+	char real[32];
+	size_t len;
+	int i;
+
+	for (i = 0; i < SOUPS; i++)
+	{
+		len = make_soup(soup, (i % 10 == 0) ? sizeof soup : 4096, i * 7919 + 1);
+		if (check_all_chunks(ctx, soup, len, i))
+		{
+			fprintf(stderr, "soup %d differs\n", i);
+			return 1;
+		}
+	}
+	printf("%d token soups: same\n", SOUPS);
+
+	for (i = 0; i < REALS; i++)
+	{
+		len = make_real(real, &seed);
+		if (check(ctx, (unsigned char *)real, len, sizeof real, 0) < 0)
+		{
+			fprintf(stderr, "real '%.*s' differs\n", (int)len - 1, real);
+			return 1;
+		}
+	}
+	printf("%d short reals: same\n", REALS);
+	return 0;
+}
+
+static int
+check_file(fz_context *ctx, const char *filename)
+{
+	fz_buffer *buf;
+	unsigned char *data;
+	size_t len;
+	clock_t start;
+	double secs;
+	int i, n, ref, tokens;
+	pdf_lexbuf lb;
+	fz_stream *stm;
+
+	buf = fz_read_file(ctx, filename);
+	len = fz_buffer_storage(ctx, buf, &data);
+
+	if (check_all_chunks(ctx, data, len, 1))
+	{
+		fprintf(stderr, "%s differs\n", filename);
+		fz_drop_buffer(ctx, buf);
+		return 1;
+	}
+
+	printf("%s: same\n", filename);
+	for (ref = 0; ref < 2; ref++)
+	{
+		if (ref)
+			ref_pdf_lexbuf_init(ctx, &lb, PDF_LEXBUF_SMALL);
+		else
+			pdf_lexbuf_init(ctx, &lb, PDF_LEXBUF_SMALL);
+		tokens = 0;
+		start = clock();
+		for (i = 0; i < BENCH_RUNS; i++)
+		{
+			stm = fz_open_buffer(ctx, buf);
+			while ((n = lex(ctx, stm, &lb, ref)) != PDF_TOK_EOF && n != -1)
+				tokens++;
+			fz_drop_stream(ctx, stm);
+		}
+		secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+		if (ref)
+			ref_pdf_lexbuf_fin(ctx, &lb);
+		else
+			pdf_lexbuf_fin(ctx, &lb);
+
+		printf("\t%s: %d tokens in %.3fs (%.1f MB/s)\n",
+			ref ? "without fast paths" : "with fast paths",
+			tokens / BENCH_RUNS, secs / BENCH_RUNS,
+			secs > 0 ? len * (double)BENCH_RUNS / secs / (1 << 20) : 0);
+	}
+
+	fz_drop_buffer(ctx, buf);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	fz_context *ctx;
+	int i, failed = 0;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		return 1;
+	}
+	fz_set_warning_callback(ctx, NULL, NULL);
+	fz_set_error_callback(ctx, NULL, NULL);
+
+	if (argc < 2)
+		failed = check_random(ctx);
+	for (i = 1; i < argc; i++)
+		failed |= check_file(ctx, argv[i]);
+
+	fz_drop_context(ctx);
+	return failed;
+}
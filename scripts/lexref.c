@@ -0,0 +1,12 @@
+/* lexref.c -- the PDF lexer without its fast paths, for lexcheck.c */
+
+#define PDF_LEX_NO_FAST_PATHS
+
+#define pdf_lex ref_pdf_lex
+#define pdf_lex_no_string ref_pdf_lex_no_string
+#define pdf_lexbuf_init ref_pdf_lexbuf_init
+#define pdf_lexbuf_fin ref_pdf_lexbuf_fin
+#define pdf_lexbuf_grow ref_pdf_lexbuf_grow
+#define pdf_append_token ref_pdf_append_token
+
+#include "../source/pdf/pdf-lex.c"
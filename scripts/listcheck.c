@@ -0,0 +1,186 @@
+/* listcheck.c -- check and time saving and loading display lists
+
+	fz_save_display_list writes the commands of a display list out
+	as they are, with the fonts, images and other objects they use;
+	fz_load_display_list reads them back without interpreting the
+	document again. Drawn at the same resolution, a page's list and
+	the list loaded back from its file must give exactly the same
+	pixels.
+
+	Build against a release build of the library:
+
+	cc -O2 -Iinclude -o listcheck scripts/listcheck.c \
+		build/release/libmupdf.a build/release/libmupdf-third.a -lm
+
+	listcheck [-r dpi] [-o file] document ...
+		Save the list of each page of each document to file
+		(listcheck.list by default), load it back, and check
+		that both draw the same; then report the time taken to
+		make the lists by interpreting the pages, and to load
+		them. Pages whose lists cannot be saved (such as those
+		using Type 3 fonts) are counted, but not checked.
+*/
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static float resolution = 72;
+static const char *scratch = "listcheck.list";
+
+static double
+elapsed(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC * 1000;
+}
+
+static int
+same_pixmap(fz_pixmap *a, fz_pixmap *b)
+{
+	if (a->x != b->x || a->y != b->y || a->w != b->w || a->h != b->h || a->n != b->n || a->stride != b->stride)
+		return 0;
+	return !memcmp(a->samples, b->samples, (size_t)a->stride * a->h);
+}
+
+static int
+check_document(fz_context *ctx, const char *filename)
+{
+	fz_document *doc = NULL;
+	fz_page *page = NULL;
+	fz_display_list *list = NULL, *loaded = NULL;
+	fz_pixmap *pix = NULL, *loaded_pix = NULL;
+	fz_matrix ctm = fz_scale(resolution / 72, resolution / 72);
+	double interp_ms = 0, load_ms = 0;
+	int i, count = 0, checked = 0, unsaved = 0, failed = 0;
+	FILE *file;
+	long bytes = 0;
+	clock_t start;
+
+	fz_var(doc);
+	fz_var(page);
+	fz_var(list);
+	fz_var(loaded);
+	fz_var(pix);
+	fz_var(loaded_pix);
+	fz_var(checked);
+	fz_var(unsaved);
+	fz_var(failed);
+	fz_var(bytes);
+	fz_var(interp_ms);
+	fz_var(load_ms);
+
+	fz_try(ctx)
+	{
+		doc = fz_open_document(ctx, filename);
+		count = fz_count_pages(ctx, doc);
+		for (i = 0; i < count && !failed; i++)
+		{
+			fz_try(ctx)
+			{
+				start = clock();
+				page = fz_load_page(ctx, doc, i);
+				list = fz_new_display_list_from_page(ctx, page);
+				interp_ms += elapsed(start);
+
+				fz_save_display_list(ctx, list, scratch);
+				file = fopen(scratch, "rb");
+				if (file)
+				{
+					fseek(file, 0, SEEK_END);
+					bytes += ftell(file);
+					fclose(file);
+				}
+
+				start = clock();
+				loaded = fz_load_display_list(ctx, scratch);
+				load_ms += elapsed(start);
+
+				pix = fz_new_pixmap_from_display_list(ctx, list, ctm, fz_device_rgb(ctx), 0);
+				loaded_pix = fz_new_pixmap_from_display_list(ctx, loaded, ctm, fz_device_rgb(ctx), 0);
+				if (!same_pixmap(pix, loaded_pix))
+				{
+					fprintf(stderr, "%s: page %d differs when loaded\n", filename, i + 1);
+					failed = 1;
+				}
+				checked++;
+			}
+			fz_always(ctx)
+			{
+				fz_drop_pixmap(ctx, loaded_pix);
+				fz_drop_pixmap(ctx, pix);
+				fz_drop_display_list(ctx, loaded);
+				fz_drop_display_list(ctx, list);
+				fz_drop_page(ctx, page);
+				loaded_pix = pix = NULL;
+				loaded = list = NULL;
+				page = NULL;
+			}
+			fz_catch(ctx)
+			{
+				if (fz_caught(ctx) != FZ_ERROR_UNSUPPORTED)
+					fz_rethrow(ctx);
+				unsaved++;
+			}
+		}
+	}
+	fz_always(ctx)
+		fz_drop_document(ctx, doc);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "%s: %s\n", filename, fz_caught_message(ctx));
+		return 1;
+	}
+
+	if (failed)
+		return 1;
+
+	printf("%s: %d of %d pages same", filename, checked, count);
+	if (unsaved)
+		printf(" (%d could not be saved)", unsaved);
+	printf("\n");
+	if (checked)
+		printf("\t%ld bytes of lists; ms to make the lists: %.1f by interpreting, %.1f by loading\n",
+			bytes, interp_ms, load_ms);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	fz_context *ctx;
+	int i, failed = 0;
+
+	for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2)
+	{
+		if (!strcmp(argv[i], "-r"))
+			resolution = atof(argv[i+1]);
+		else if (!strcmp(argv[i], "-o"))
+			scratch = argv[i+1];
+		else
+			break;
+	}
+	if (i >= argc || argv[i][0] == '-')
+	{
+		fprintf(stderr, "usage: listcheck [-r dpi] [-o file] document ...\n");
+		return 1;
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		return 1;
+	}
+	fz_register_document_handlers(ctx);
+	fz_set_warning_callback(ctx, NULL, NULL);
+
+	for (; i < argc; i++)
+		failed |= check_document(ctx, argv[i]);
+
+	remove(scratch);
+	fz_drop_context(ctx);
+	return failed;
+}
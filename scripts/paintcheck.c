@@ -0,0 +1,227 @@
+/* paintcheck.c -- check and time the SIMD cores of the span painters
+
+	The solid and masked colour painters for 1, 3 and 4 colourants
+	hand whole blocks of 16 pixels to the SSE (or NEON) cores in
+	draw-paint_sse.h and draw-paint_neon.h, and do the rest in C.
+	paintref.c builds the painters again with no SIMD cores; given
+	the same spans, the two must leave exactly the same bytes.
+
+	Build against a release build of the library with the SIMD
+	cores in it (on x86, say XCFLAGS=-msse4.1; on ARM, say
+	XCFLAGS=-DFZ_ENABLE_DRAW_NEON=1), using the same flags:
+
+	cc -O2 -msse4.1 -Iinclude -o paintcheck scripts/paintcheck.c \
+		scripts/paintref.c build/release/libmupdf.a \
+		build/release/libmupdf-third.a -lm
+
+	paintcheck
+		Check random spans of every width up to 100 pixels, at
+		every alignment, for 1 to 5 components with and without
+		destination alpha, then time the two on long spans.
+*/
+
+#include "mupdf/fitz.h"
+#include "../source/fitz/draw-imp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_W 100
+#define GUARD 32
+#define BENCH_W 1024
+#define BENCH_PIXELS 200000000
+
+fz_solid_color_painter_t *ref_fz_get_solid_color_painter(int n, const unsigned char *color, int da, const fz_overprint *eop);
+fz_span_color_painter_t *ref_fz_get_span_color_painter(int n, int da, const unsigned char *color, const fz_overprint *eop);
+
+static const int alphas[] = { 255, 0, 1, 128, 254 };
+
+static unsigned int
+next_rand(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static void
+fill_random(unsigned char *p, size_t len, unsigned int *seed)
+{
+	while (len--)
+		*p++ = next_rand(seed);
+}
+
+/* Masks are mostly runs of 0 and 255 with edges between, as the
+ * rasterizers make them; now and then they are just noise. */
+static void
+make_mask(unsigned char *mp, int w, unsigned int *seed)
+{
+	int i, kind = next_rand(seed) % 4;
+	int v = 0;
+
+	for (i = 0; i < w; i++)
+	{
+		switch (kind)
+		{
+		case 0: mp[i] = next_rand(seed); break;
+		case 1: mp[i] = 255; break;
+		case 2: mp[i] = 0; break;
+		default:
+			if (next_rand(seed) % 12 == 0)
+				v = next_rand(seed) % 3 ? (next_rand(seed) & 1) * 255 : next_rand(seed) & 255;
+			mp[i] = v;
+			break;
+		}
+	}
+}
+
+static void
+report(const char *what, int n, int da, int alpha, int w, int off, const unsigned char *a, const unsigned char *b, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len && a[i] == b[i]; i++)
+		;
+	fprintf(stderr, "%s n=%d da=%d alpha=%d w=%d offset=%d: byte %d is %d, expected %d\n",
+		what, n, da, alpha, w, off, (int)i - GUARD - off, a[i], b[i]);
+}
+
+static int
+check_painters(void)
+{
+	static unsigned char dst[GUARD + 16 + MAX_W * FZ_MAX_COLORS + GUARD];
+	static unsigned char ref[sizeof dst];
+	unsigned char mask[16 + MAX_W];
+	unsigned char color[FZ_MAX_COLORS + 1];
+	unsigned int seed = 1;
+	int n, da, a, w, off, spans = 0;
+
+	for (n = 1; n <= 5; n++)
+	for (da = 0; da <= 1; da++)
+	for (a = 0; a < (int)nelem(alphas); a++)
+	for (w = 1; w <= MAX_W; w++)
+	for (off = 0; off < 16; off++)
+	{
+		fz_solid_color_painter_t *solid, *ref_solid;
+		fz_span_color_painter_t *span, *ref_span;
+		unsigned char *dp = dst + GUARD + off;
+
+		fill_random(color, sizeof color, &seed);
+		color[n-da] = alphas[a];
+
+		solid = fz_get_solid_color_painter(n, color, da, NULL);
+		ref_solid = ref_fz_get_solid_color_painter(n, color, da, NULL);
+		if (!solid != !ref_solid)
+		{
+			fprintf(stderr, "solid n=%d da=%d alpha=%d: painters differ\n", n, da, alphas[a]);
+			return 1;
+		}
+		if (solid)
+		{
+			fill_random(dst, sizeof dst, &seed);
+			memcpy(ref, dst, sizeof dst);
+			solid(dp, n, w, color, da, NULL);
+			ref_solid(ref + (dp - dst), n, w, color, da, NULL);
+			if (memcmp(dst, ref, sizeof dst))
+			{
+				report("solid", n, da, alphas[a], w, off, dst, ref, sizeof dst);
+				return 1;
+			}
+			spans++;
+		}
+
+		span = fz_get_span_color_painter(n, da, color, NULL);
+		ref_span = ref_fz_get_span_color_painter(n, da, color, NULL);
+		if (!span != !ref_span)
+		{
+			fprintf(stderr, "span n=%d da=%d alpha=%d: painters differ\n", n, da, alphas[a]);
+			return 1;
+		}
+		if (span)
+		{
+			make_mask(mask + off, w, &seed);
+			fill_random(dst, sizeof dst, &seed);
+			memcpy(ref, dst, sizeof dst);
+			span(dp, mask + off, n, w, color, da, NULL);
+			ref_span(ref + (dp - dst), mask + off, n, w, color, da, NULL);
+			if (memcmp(dst, ref, sizeof dst))
+			{
+				report("span", n, da, alphas[a], w, off, dst, ref, sizeof dst);
+				return 1;
+			}
+			spans++;
+		}
+	}
+
+	printf("%d spans: same\n", spans);
+	return 0;
+}
+
+static double
+time_painter(fz_solid_color_painter_t *solid, fz_span_color_painter_t *span,
+	unsigned char *dp, const unsigned char *mp, int n, const unsigned char *color, int da)
+{
+	clock_t start = clock();
+	int i, runs = BENCH_PIXELS / BENCH_W / n;
+
+	for (i = 0; i < runs; i++)
+	{
+		if (solid)
+			solid(dp, n, BENCH_W, color, da, NULL);
+		else
+			span(dp, mp, n, BENCH_W, color, da, NULL);
+	}
+	return (double)runs * BENCH_W / ((double)(clock() - start) / CLOCKS_PER_SEC) / 1e6;
+}
+
+static void
+bench_painters(void)
+{
+	static unsigned char dst[BENCH_W * FZ_MAX_COLORS];
+	unsigned char mask[BENCH_W];
+	unsigned char color[FZ_MAX_COLORS + 1];
+	static const int ns[] = { 1, 3, 4 };
+	unsigned int seed = 1;
+	int i, da, a, solid;
+
+	fill_random(color, sizeof color, &seed);
+	for (i = 0; i < BENCH_W; i++)
+		if (i % 64 < 8)
+			mask[i] = next_rand(&seed);
+		else
+			mask[i] = i % 64 < 40 ? 255 : 0;
+
+	printf("Mpixels/s on %d pixel spans: SIMD vs C\n", BENCH_W);
+	for (solid = 1; solid >= 0; solid--)
+	for (i = 0; i < (int)nelem(ns); i++)
+	for (da = 0; da <= 1; da++)
+	for (a = 0; a < 2; a++)
+	{
+		int n = ns[i] + da;
+		double simd, c;
+
+		color[n-da] = a ? 128 : 255;
+		fill_random(dst, sizeof dst, &seed);
+		if (solid)
+		{
+			simd = time_painter(fz_get_solid_color_painter(n, color, da, NULL), NULL, dst, NULL, n, color, da);
+			c = time_painter(ref_fz_get_solid_color_painter(n, color, da, NULL), NULL, dst, NULL, n, color, da);
+		}
+		else
+		{
+			simd = time_painter(NULL, fz_get_span_color_painter(n, da, color, NULL), dst, mask, n, color, da);
+			c = time_painter(NULL, ref_fz_get_span_color_painter(n, da, color, NULL), dst, mask, n, color, da);
+		}
+		printf("\t%s n=%d da=%d alpha=%d: %8.1f %8.1f\n",
+			solid ? "solid" : "span ", n, da, color[n-da], simd, c);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	if (check_painters())
+		return 1;
+	bench_painters();
+	return 0;
+}
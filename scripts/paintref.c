@@ -0,0 +1,17 @@
+/* paintref.c -- the span painters without their SIMD cores, for paintcheck.c */
+
+#define ARCH_HAS_SSE 0
+#define ARCH_HAS_NEON 0
+
+#define fz_get_solid_color_painter ref_fz_get_solid_color_painter
+#define fz_get_span_color_painter ref_fz_get_span_color_painter
+#define fz_get_span_painter ref_fz_get_span_painter
+#define fz_paint_glyph ref_fz_paint_glyph
+#define fz_paint_over_pixmap_with_mask ref_fz_paint_over_pixmap_with_mask
+#define fz_paint_pixmap ref_fz_paint_pixmap
+#define fz_paint_pixmap_alpha ref_fz_paint_pixmap_alpha
+#define fz_paint_pixmap_with_bbox ref_fz_paint_pixmap_with_bbox
+#define fz_paint_pixmap_with_mask ref_fz_paint_pixmap_with_mask
+#define fz_paint_pixmap_with_overprint ref_fz_paint_pixmap_with_overprint
+
+#include "../source/fitz/draw-paint.c"
@@ -47,6 +47,7 @@ void fz_new_font_context(fz_context *ctx);
 
 fz_font_context *fz_keep_font_context(fz_context *ctx);
 void fz_drop_font_context(fz_context *ctx);
+void fz_drop_ft_thread_context(fz_context *ctx);
 
 struct fz_tuning_context
 {
@@ -204,6 +204,7 @@ fz_drop_context(fz_context *ctx)
 		ctx->alloc.free(ctx->alloc.user, ctx->master);
 
 	/* Other finalisation calls go here (in reverse order) */
+	fz_drop_ft_thread_context(ctx);
 	fz_drop_document_handler_context(ctx);
 	fz_drop_archive_handler_context(ctx);
 	fz_drop_glyph_cache_context(ctx);
@@ -329,6 +330,9 @@ fz_clone_context(fz_context *ctx)
 	/* Reset error context to initial state. */
 	fz_init_error_context(new_ctx);
 
+	/* Per-thread FreeType instances are created on demand. */
+	new_ctx->ft_thread = NULL;
+
 	/* Then keep lock checking happy by keeping shared contexts with new context */
 	fz_keep_document_handler_context(new_ctx);
 	fz_keep_archive_handler_context(new_ctx);
@@ -59,6 +59,24 @@ static fz_forceinline const byte *sample_nearest(const byte *s, affint w, affint
 	return s + v * str + u * n;
 }
 
+/* Optional SIMD cores for the bilinear and constant alpha nearest
+ * templates, for 1, 3 and 4 components with or without alpha. Each
+ * returns 0 if it does not handle the given pixel layout, leaving it to
+ * the C code. They give identical results (which scripts/affinecheck.c
+ * checks). The NEON cores are only used when FZ_ENABLE_DRAW_NEON is set. */
+
+#if ARCH_HAS_SSE
+#include "draw-affine_sse.h"
+#define template_affine_N_lerp_simd template_affine_N_lerp_sse
+#define template_affine_alpha_N_lerp_simd template_affine_alpha_N_lerp_sse
+#define template_affine_alpha_N_near_simd template_affine_alpha_N_near_sse
+#elif ARCH_HAS_NEON && FZ_ENABLE_DRAW_NEON
+#include "draw-affine_neon.h"
+#define template_affine_N_lerp_simd template_affine_N_lerp_neon
+#define template_affine_alpha_N_lerp_simd template_affine_alpha_N_lerp_neon
+#define template_affine_alpha_N_near_simd template_affine_alpha_N_near_neon
+#endif
+
 /* Blend premultiplied source image in constant alpha over destination */
 
 static fz_forceinline void
@@ -66,6 +84,11 @@ template_affine_alpha_N_lerp(byte * FZ_RESTRICT dp, int da, const byte * FZ_REST
 {
 	int k;
 
+#ifdef template_affine_N_lerp_simd
+	if (dn1 == sn1 && template_affine_alpha_N_lerp_simd(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, sn1, alpha, hp, gp))
+		return;
+#endif
+
 	do
 	{
 		if (u + HALF >= 0 && u + ONE < sw && v + HALF >= 0 && v + ONE < sh)
@@ -294,6 +317,11 @@ template_affine_alpha_N_near(byte * FZ_RESTRICT dp, int da, const byte * FZ_REST
 {
 	int k;
 
+#ifdef template_affine_N_lerp_simd
+	if (dn1 == sn1 && template_affine_alpha_N_near_simd(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, sn1, alpha, hp, gp))
+		return;
+#endif
+
 	do
 	{
 		affint ui = u >> PREC;
@@ -495,6 +523,11 @@ template_affine_N_lerp(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT s
 {
 	int k;
 
+#ifdef template_affine_N_lerp_simd
+	if (dn1 == sn1 && template_affine_N_lerp_simd(dp, da, sp, sw, sh, ss, sa, u, v, fa, fb, w, sn1, hp, gp))
+		return;
+#endif
+
 	do
 	{
 		if (u + HALF >= 0 && u + ONE < sw && v + HALF >= 0 && v + ONE < sh)
@@ -0,0 +1,248 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+/* This file is included from draw-affine.c if NEON cores are allowed.
+ * Each pixel is held in the 16-bit lanes of one register, so the
+ * per-component sums of the C templates are done in one go. Sampling
+ * is still done per pixel, exactly as in the C code. */
+
+#include <arm_neon.h>
+
+/* Load a pixel of n <= 5 bytes into 16-bit lanes, without reading past it. */
+static simd_forceinline uint16x8_t
+load_pixel_neon(const byte * FZ_RESTRICT p, int n)
+{
+	uint64_t q = 0;
+	memcpy(&q, p, n);
+	return vmovl_u8(vcreate_u8(q));
+}
+
+/* Store n bytes of a pixel, truncating each lane to 8 bits as a byte
+ * assignment would. */
+static simd_forceinline void
+store_pixel_neon(byte * FZ_RESTRICT p, uint16x8_t x, int n)
+{
+	uint64_t q = vget_lane_u64(vreinterpret_u64_u8(vmovn_u16(x)), 0);
+	memcpy(p, &q, n);
+}
+
+/* lerp() on 16-bit lanes. vqdmulh gives the high half of twice the
+ * product, so with (b-a)<<(15-PREC) this is exactly ((b-a)*f)>>PREC,
+ * rounded down as the C version is. */
+static simd_forceinline uint16x8_t
+lerp_neon(uint16x8_t a, uint16x8_t b, int16x8_t f)
+{
+	int16x8_t d = vshlq_n_s16(vreinterpretq_s16_u16(vsubq_u16(b, a)), 15-PREC);
+	return vaddq_u16(a, vreinterpretq_u16_s16(vqdmulhq_s16(d, f)));
+}
+
+/* fz_mul255() on 16-bit lanes. */
+static simd_forceinline uint16x8_t
+mul255_neon(uint16x8_t a, uint16x8_t b)
+{
+	uint16x8_t x = vaddq_u16(vmulq_u16(a, b), vdupq_n_u16(128));
+	return vshrq_n_u16(vsraq_n_u16(x, x, 8), 8);
+}
+
+/* A register with 255 in the alpha lane, for sources without alpha. */
+static simd_forceinline uint16x8_t
+opaque_lane_neon(int n1)
+{
+	uint16_t o[8] = { 0 };
+	o[n1] = 255;
+	return vld1q_u16(o);
+}
+
+static simd_forceinline uint16x8_t
+sample_bilinear_neon(const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sn, affint u, affint v)
+{
+	affint ui = u >> PREC;
+	affint vi = v >> PREC;
+	int16x8_t uf = vdupq_n_s16(u & MASK);
+	int16x8_t vf = vdupq_n_s16(v & MASK);
+	uint16x8_t a = load_pixel_neon(sample_nearest(sp, sw, sh, ss, sn, ui, vi), sn);
+	uint16x8_t b = load_pixel_neon(sample_nearest(sp, sw, sh, ss, sn, ui+1, vi), sn);
+	uint16x8_t c = load_pixel_neon(sample_nearest(sp, sw, sh, ss, sn, ui, vi+1), sn);
+	uint16x8_t d = load_pixel_neon(sample_nearest(sp, sw, sh, ss, sn, ui+1, vi+1), sn);
+	return lerp_neon(lerp_neon(a, b, uf), lerp_neon(c, d, uf), vf);
+}
+
+/* As template_affine_N_lerp, for dn1 == sn1 == n1. */
+static simd_forceinline void
+affine_N_lerp_neon(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+	uint16x8_t opaque = opaque_lane_neon(n1);
+	uint16_t xs[8];
+
+	do
+	{
+		if (u + HALF >= 0 && u + ONE < sw && v + HALF >= 0 && v + ONE < sh)
+		{
+			uint16x8_t x = sample_bilinear_neon(sp, sw, sh, ss, n1+sa, u, v);
+			int y = 255;
+			if (sa)
+			{
+				vst1q_u16(xs, x);
+				y = xs[n1];
+			}
+			else
+				x = vorrq_u16(x, opaque);
+			if (y != 0)
+			{
+				int t = 255 - y;
+				uint16x8_t d = load_pixel_neon(dp, n1+da);
+				x = vaddq_u16(x, mul255_neon(d, vdupq_n_u16(t)));
+				store_pixel_neon(dp, x, n1+da);
+				if (hp)
+					hp[0] = y + fz_mul255(hp[0], t);
+				if (gp)
+					gp[0] = y + fz_mul255(gp[0], t);
+			}
+		}
+		dp += n1 + da;
+		if (hp)
+			hp++;
+		if (gp)
+			gp++;
+		u += fa;
+		v += fb;
+	}
+	while (--w);
+}
+
+/* As template_affine_alpha_N_lerp, for dn1 == sn1 == n1. */
+static simd_forceinline void
+affine_alpha_N_lerp_neon(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+	uint16x8_t opaque = opaque_lane_neon(n1);
+	uint16x8_t va = vdupq_n_u16(alpha);
+	uint16_t xs[8];
+
+	do
+	{
+		if (u + HALF >= 0 && u + ONE < sw && v + HALF >= 0 && v + ONE < sh)
+		{
+			uint16x8_t x = sample_bilinear_neon(sp, sw, sh, ss, n1+sa, u, v);
+			int y = 255;
+			int ya;
+			if (sa)
+			{
+				vst1q_u16(xs, x);
+				y = xs[n1];
+				ya = fz_mul255(y, alpha);
+			}
+			else
+			{
+				x = vorrq_u16(x, opaque);
+				ya = alpha;
+			}
+			if (ya != 0)
+			{
+				int t = 255 - ya;
+				uint16x8_t d = load_pixel_neon(dp, n1+da);
+				/* The alpha lane comes out as ya, as fz_mul255(255, alpha) == alpha. */
+				x = vaddq_u16(mul255_neon(x, va), mul255_neon(d, vdupq_n_u16(t)));
+				store_pixel_neon(dp, x, n1+da);
+				if (hp)
+					hp[0] = y + fz_mul255(hp[0], 255 - y);
+				if (gp)
+					gp[0] = ya + fz_mul255(gp[0], t);
+			}
+		}
+		dp += n1 + da;
+		if (hp)
+			hp++;
+		if (gp)
+			gp++;
+		u += fa;
+		v += fb;
+	}
+	while (--w);
+}
+
+/* As template_affine_alpha_N_near, for dn1 == sn1 == n1. */
+static simd_forceinline void
+affine_alpha_N_near_neon(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+	uint16x8_t opaque = opaque_lane_neon(n1);
+	uint16x8_t va = vdupq_n_u16(alpha);
+
+	do
+	{
+		affint ui = u >> PREC;
+		affint vi = v >> PREC;
+		if (ui >= 0 && ui < sw && vi >= 0 && vi < sh)
+		{
+			const byte *sample = sp + (vi * ss) + (ui * (n1+sa));
+			int a = sa ? sample[n1] : 255;
+			int aa = (sa ? fz_mul255(a, alpha) : alpha);
+			if (aa != 0)
+			{
+				int t = 255 - aa;
+				uint16x8_t x = load_pixel_neon(sample, n1+sa);
+				uint16x8_t d = load_pixel_neon(dp, n1+da);
+				if (!sa)
+					x = vorrq_u16(x, opaque);
+				x = vaddq_u16(mul255_neon(x, va), mul255_neon(d, vdupq_n_u16(t)));
+				store_pixel_neon(dp, x, n1+da);
+				if (hp)
+					hp[0] = a + fz_mul255(hp[0], 255 - a);
+				if (gp)
+					gp[0] = aa + fz_mul255(gp[0], t);
+			}
+		}
+		dp += n1 + da;
+		if (hp)
+			hp++;
+		if (gp)
+			gp++;
+		u += fa;
+		v += fb;
+	}
+	while (--w);
+}
+
+/* Entry points from the C templates. */
+
+static int
+template_affine_N_lerp_neon(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+#define CALL(N, SA, DA) affine_N_lerp_neon(dp, DA, sp, sw, sh, ss, SA, u, v, fa, fb, w, N, hp, gp)
+	SIMD_LAYOUT_SWITCH(n1, sa, da, CALL);
+#undef CALL
+}
+
+static int
+template_affine_alpha_N_lerp_neon(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+#define CALL(N, SA, DA) affine_alpha_N_lerp_neon(dp, DA, sp, sw, sh, ss, SA, u, v, fa, fb, w, N, alpha, hp, gp)
+	SIMD_LAYOUT_SWITCH(n1, sa, da, CALL);
+#undef CALL
+}
+
+static int
+template_affine_alpha_N_near_neon(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+#define CALL(N, SA, DA) affine_alpha_N_near_neon(dp, DA, sp, sw, sh, ss, SA, u, v, fa, fb, w, N, alpha, hp, gp)
+	SIMD_LAYOUT_SWITCH(n1, sa, da, CALL);
+#undef CALL
+}
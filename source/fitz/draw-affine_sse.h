@@ -0,0 +1,269 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+/* This file is included from draw-affine.c if SSE cores are allowed.
+ * Each pixel is held in the 16-bit lanes of one register, so the
+ * per-component sums of the C templates are done in one go. Sampling
+ * is still done per pixel, exactly as in the C code. */
+
+#include <emmintrin.h>
+#include <smmintrin.h>
+
+/* Load a pixel of n <= 5 bytes into 16-bit lanes, without reading past
+ * it. The bytes are gathered in general registers, as a wide load from
+ * a narrower store on the stack would stall on every pixel. */
+static simd_forceinline __m128i
+load_pixel_sse(const byte * FZ_RESTRICT p, int n)
+{
+	uint32_t lo = 0, hi = 0;
+	uint16_t s;
+	switch (n)
+	{
+	case 1: lo = p[0]; break;
+	case 2: memcpy(&s, p, 2); lo = s; break;
+	case 3: memcpy(&s, p, 2); lo = s | (p[2]<<16); break;
+	case 4: memcpy(&lo, p, 4); break;
+	default: memcpy(&lo, p, 4); hi = p[4]; break;
+	}
+	return _mm_unpacklo_epi8(_mm_insert_epi32(_mm_cvtsi32_si128(lo), hi, 1), _mm_setzero_si128());
+}
+
+/* Store n bytes of a pixel, truncating each lane to 8 bits as a byte
+ * assignment would. */
+static simd_forceinline void
+store_pixel_sse(byte * FZ_RESTRICT p, __m128i x, int n)
+{
+	uint32_t lo, hi;
+	x = _mm_and_si128(x, _mm_set1_epi16(0xFF));
+	x = _mm_packus_epi16(x, x);
+	lo = _mm_cvtsi128_si32(x);
+	hi = _mm_extract_epi32(x, 1);
+	switch (n)
+	{
+	case 1: p[0] = lo; break;
+	case 2: memcpy(p, &lo, 2); break;
+	case 3: memcpy(p, &lo, 2); p[2] = lo>>16; break;
+	case 4: memcpy(p, &lo, 4); break;
+	default: memcpy(p, &lo, 4); p[4] = hi; break;
+	}
+}
+
+/* lerp() on 16-bit lanes. (b-a)*f does not fit in 16 bits, but as f is
+ * less than 1<<PREC, the high half of ((b-a)<<(16-PREC))*f is exactly
+ * ((b-a)*f)>>PREC, rounded down as the C version is. */
+static simd_forceinline __m128i
+lerp_sse(__m128i a, __m128i b, __m128i f)
+{
+	return _mm_add_epi16(a, _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(b, a), 16-PREC), f));
+}
+
+/* fz_mul255() on 16-bit lanes. */
+static simd_forceinline __m128i
+mul255_sse(__m128i a, __m128i b)
+{
+	__m128i x = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* A register with 255 in the alpha lane, for sources without alpha. */
+static simd_forceinline __m128i
+opaque_lane_sse(int n1)
+{
+	int16_t o[8] = { 0 };
+	o[n1] = 255;
+	return _mm_loadu_si128((const __m128i *)o);
+}
+
+static simd_forceinline __m128i
+sample_bilinear_sse(const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sn, affint u, affint v)
+{
+	affint ui = u >> PREC;
+	affint vi = v >> PREC;
+	__m128i uf = _mm_set1_epi16(u & MASK);
+	__m128i vf = _mm_set1_epi16(v & MASK);
+	__m128i a = load_pixel_sse(sample_nearest(sp, sw, sh, ss, sn, ui, vi), sn);
+	__m128i b = load_pixel_sse(sample_nearest(sp, sw, sh, ss, sn, ui+1, vi), sn);
+	__m128i c = load_pixel_sse(sample_nearest(sp, sw, sh, ss, sn, ui, vi+1), sn);
+	__m128i d = load_pixel_sse(sample_nearest(sp, sw, sh, ss, sn, ui+1, vi+1), sn);
+	return lerp_sse(lerp_sse(a, b, uf), lerp_sse(c, d, uf), vf);
+}
+
+/* As template_affine_N_lerp, for dn1 == sn1 == n1. */
+static simd_forceinline void
+affine_N_lerp_sse(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+	__m128i opaque = opaque_lane_sse(n1);
+	uint16_t xs[8];
+
+	do
+	{
+		if (u + HALF >= 0 && u + ONE < sw && v + HALF >= 0 && v + ONE < sh)
+		{
+			__m128i x = sample_bilinear_sse(sp, sw, sh, ss, n1+sa, u, v);
+			int y = 255;
+			if (sa)
+			{
+				_mm_storeu_si128((__m128i *)xs, x);
+				y = xs[n1];
+			}
+			else
+				x = _mm_or_si128(x, opaque);
+			if (y != 0)
+			{
+				int t = 255 - y;
+				__m128i d = load_pixel_sse(dp, n1+da);
+				x = _mm_add_epi16(x, mul255_sse(d, _mm_set1_epi16(t)));
+				store_pixel_sse(dp, x, n1+da);
+				if (hp)
+					hp[0] = y + fz_mul255(hp[0], t);
+				if (gp)
+					gp[0] = y + fz_mul255(gp[0], t);
+			}
+		}
+		dp += n1 + da;
+		if (hp)
+			hp++;
+		if (gp)
+			gp++;
+		u += fa;
+		v += fb;
+	}
+	while (--w);
+}
+
+/* As template_affine_alpha_N_lerp, for dn1 == sn1 == n1. */
+static simd_forceinline void
+affine_alpha_N_lerp_sse(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+	__m128i opaque = opaque_lane_sse(n1);
+	__m128i va = _mm_set1_epi16(alpha);
+	uint16_t xs[8];
+
+	do
+	{
+		if (u + HALF >= 0 && u + ONE < sw && v + HALF >= 0 && v + ONE < sh)
+		{
+			__m128i x = sample_bilinear_sse(sp, sw, sh, ss, n1+sa, u, v);
+			int y = 255;
+			int ya;
+			if (sa)
+			{
+				_mm_storeu_si128((__m128i *)xs, x);
+				y = xs[n1];
+				ya = fz_mul255(y, alpha);
+			}
+			else
+			{
+				x = _mm_or_si128(x, opaque);
+				ya = alpha;
+			}
+			if (ya != 0)
+			{
+				int t = 255 - ya;
+				__m128i d = load_pixel_sse(dp, n1+da);
+				/* The alpha lane comes out as ya, as fz_mul255(255, alpha) == alpha. */
+				x = _mm_add_epi16(mul255_sse(x, va), mul255_sse(d, _mm_set1_epi16(t)));
+				store_pixel_sse(dp, x, n1+da);
+				if (hp)
+					hp[0] = y + fz_mul255(hp[0], 255 - y);
+				if (gp)
+					gp[0] = ya + fz_mul255(gp[0], t);
+			}
+		}
+		dp += n1 + da;
+		if (hp)
+			hp++;
+		if (gp)
+			gp++;
+		u += fa;
+		v += fb;
+	}
+	while (--w);
+}
+
+/* As template_affine_alpha_N_near, for dn1 == sn1 == n1. */
+static simd_forceinline void
+affine_alpha_N_near_sse(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+	__m128i opaque = opaque_lane_sse(n1);
+	__m128i va = _mm_set1_epi16(alpha);
+
+	do
+	{
+		affint ui = u >> PREC;
+		affint vi = v >> PREC;
+		if (ui >= 0 && ui < sw && vi >= 0 && vi < sh)
+		{
+			const byte *sample = sp + (vi * ss) + (ui * (n1+sa));
+			int a = sa ? sample[n1] : 255;
+			int aa = (sa ? fz_mul255(a, alpha) : alpha);
+			if (aa != 0)
+			{
+				int t = 255 - aa;
+				__m128i x = load_pixel_sse(sample, n1+sa);
+				__m128i d = load_pixel_sse(dp, n1+da);
+				if (!sa)
+					x = _mm_or_si128(x, opaque);
+				x = _mm_add_epi16(mul255_sse(x, va), mul255_sse(d, _mm_set1_epi16(t)));
+				store_pixel_sse(dp, x, n1+da);
+				if (hp)
+					hp[0] = a + fz_mul255(hp[0], 255 - a);
+				if (gp)
+					gp[0] = aa + fz_mul255(gp[0], t);
+			}
+		}
+		dp += n1 + da;
+		if (hp)
+			hp++;
+		if (gp)
+			gp++;
+		u += fa;
+		v += fb;
+	}
+	while (--w);
+}
+
+/* Entry points from the C templates. */
+
+static int
+template_affine_N_lerp_sse(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+#define CALL(N, SA, DA) affine_N_lerp_sse(dp, DA, sp, sw, sh, ss, SA, u, v, fa, fb, w, N, hp, gp)
+	SIMD_LAYOUT_SWITCH(n1, sa, da, CALL);
+#undef CALL
+}
+
+static int
+template_affine_alpha_N_lerp_sse(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+#define CALL(N, SA, DA) affine_alpha_N_lerp_sse(dp, DA, sp, sw, sh, ss, SA, u, v, fa, fb, w, N, alpha, hp, gp)
+	SIMD_LAYOUT_SWITCH(n1, sa, da, CALL);
+#undef CALL
+}
+
+static int
+template_affine_alpha_N_near_sse(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, affint sw, affint sh, ptrdiff_t ss, int sa, affint u, affint v, affint fa, affint fb, int w, int n1, int alpha, byte * FZ_RESTRICT hp, byte * FZ_RESTRICT gp)
+{
+#define CALL(N, SA, DA) affine_alpha_N_near_sse(dp, DA, sp, sw, sh, ss, SA, u, v, fa, fb, w, N, alpha, hp, gp)
+	SIMD_LAYOUT_SWITCH(n1, sa, da, CALL);
+#undef CALL
+}
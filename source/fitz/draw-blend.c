@@ -222,6 +222,24 @@ static inline int fz_exclusion_byte(int b, int s)
 	return b + s - (fz_mul255(b, s)<<1);
 }
 
+/* Optional SIMD cores for the separable modes and for knockout groups,
+ * for 1, 3 and 4 colour components without spots. Each returns 0 if it
+ * does not handle the given mode or pixel layout, leaving it to the C
+ * code below (scripts/blendcheck.c checks they agree). The NEON cores
+ * are only used when FZ_ENABLE_DRAW_NEON is set. */
+
+#if ARCH_HAS_SSE
+#include "draw-blend_sse.h"
+#define fz_blend_separable_simd fz_blend_separable_sse
+#define fz_blend_separable_nonisolated_simd fz_blend_separable_nonisolated_sse
+#define fz_blend_knockout_simd fz_blend_knockout_sse
+#elif ARCH_HAS_NEON && FZ_ENABLE_DRAW_NEON
+#include "draw-blend_neon.h"
+#define fz_blend_separable_simd fz_blend_separable_neon
+#define fz_blend_separable_nonisolated_simd fz_blend_separable_nonisolated_neon
+#define fz_blend_knockout_simd fz_blend_knockout_neon
+#endif
+
 /* Non-separable blend modes */
 
 static void
@@ -340,6 +358,12 @@ static inline void
 fz_blend_separable(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int blendmode, int complement, int first_spot)
 {
 	int k;
+
+#ifdef fz_blend_separable_simd
+	if (first_spot == n1 && fz_blend_separable_simd(bp, bal, sp, sal, n1, w, blendmode, complement))
+		return;
+#endif
+
 	do
 	{
 		int sa = (sal ? sp[n1] : 255);
@@ -637,6 +661,12 @@ fz_blend_separable_nonisolated(byte * FZ_RESTRICT bp, int bal, const byte * FZ_R
 		while (--w);
 		return;
 	}
+
+#ifdef fz_blend_separable_nonisolated_simd
+	if (first_spot == n1 && fz_blend_separable_nonisolated_simd(bp, bal, sp, sal, n1, w, blendmode, complement, hp, alpha))
+		return;
+#endif
+
 	do
 	{
 		int ha = *hp++;
@@ -1276,6 +1306,12 @@ static inline void
 fz_blend_knockout(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, const byte * FZ_RESTRICT hp)
 {
 	int k;
+
+#ifdef fz_blend_knockout_simd
+	if (fz_blend_knockout_simd(bp, bal, sp, sal, n1, w, hp))
+		return;
+#endif
+
 	do
 	{
 		int ha = *hp++;
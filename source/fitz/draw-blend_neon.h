@@ -0,0 +1,320 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+
+/* This file is included from draw-blend.c if NEON cores are allowed.
+ * Each pixel is held in the 16-bit lanes of one register, and the
+ * separable blend modes that need neither division nor square roots
+ * are done lane-wise. Results match the C code for premultiplied
+ * input. */
+
+#include <arm_neon.h>
+
+/* Load the n1 <= 4 colour bytes of a pixel into 16-bit lanes. */
+static simd_forceinline int16x4_t
+load_color_neon(const byte * FZ_RESTRICT p, int n1)
+{
+	uint32_t v;
+	uint16_t s;
+	switch (n1)
+	{
+	case 1: v = p[0]; break;
+	case 3: memcpy(&s, p, 2); v = s | (p[2]<<16); break;
+	default: memcpy(&v, p, 4); break;
+	}
+	return vreinterpret_s16_u16(vget_low_u16(vmovl_u8(vcreate_u8(v))));
+}
+
+/* Store n1 colour bytes, truncating each lane as a byte assignment would. */
+static simd_forceinline void
+store_color_neon(byte * FZ_RESTRICT p, int16x4_t x, int n1)
+{
+	uint32_t v = vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(vreinterpret_u16_s16(x), vdup_n_u16(0)))), 0);
+	switch (n1)
+	{
+	case 1: p[0] = v; break;
+	case 3: memcpy(p, &v, 2); p[2] = v>>16; break;
+	default: memcpy(p, &v, 4); break;
+	}
+}
+
+/* fz_mul255() on 16-bit lanes. */
+static simd_forceinline int16x4_t
+mul255_neon(int16x4_t a, int16x4_t b)
+{
+	uint16x4_t x = vadd_u16(vmul_u16(vreinterpret_u16_s16(a), vreinterpret_u16_s16(b)), vdup_n_u16(128));
+	return vreinterpret_s16_u16(vshr_n_u16(vsra_n_u16(x, x, 8), 8));
+}
+
+/* (c * inv) >> 8, the conversion to non-premultiplied form. */
+static simd_forceinline int16x4_t
+unpremultiply_neon(int16x4_t c, int inv)
+{
+	uint32x4_t x = vmull_n_u16(vreinterpret_u16_s16(c), inv);
+	return vreinterpret_s16_u16(vshrn_n_u32(x, 8));
+}
+
+static simd_forceinline int16x4_t
+screen_neon(int16x4_t b, int16x4_t s)
+{
+	return vsub_s16(vadd_s16(b, s), mul255_neon(b, s));
+}
+
+static simd_forceinline int16x4_t
+hard_light_neon(int16x4_t b, int16x4_t s)
+{
+	int16x4_t s2 = vshl_n_s16(s, 1);
+	int16x4_t lo = mul255_neon(b, s2);
+	int16x4_t hi = screen_neon(b, vsub_s16(s2, vdup_n_s16(255)));
+	return vbsl_s16(vcgt_s16(s, vdup_n_s16(127)), hi, lo);
+}
+
+static inline int
+blendmode_has_neon(int blendmode)
+{
+	return blendmode != FZ_BLEND_COLOR_DODGE && blendmode != FZ_BLEND_COLOR_BURN && blendmode != FZ_BLEND_SOFT_LIGHT;
+}
+
+/* B(bc, sc) for the modes accepted by blendmode_has_neon. */
+static simd_forceinline int16x4_t
+blend_byte_neon(int16x4_t b, int16x4_t s, int blendmode)
+{
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_NORMAL: return s;
+	case FZ_BLEND_MULTIPLY: return mul255_neon(b, s);
+	case FZ_BLEND_SCREEN: return screen_neon(b, s);
+	case FZ_BLEND_OVERLAY: return hard_light_neon(s, b);
+	case FZ_BLEND_DARKEN: return vmin_s16(b, s);
+	case FZ_BLEND_LIGHTEN: return vmax_s16(b, s);
+	case FZ_BLEND_HARD_LIGHT: return hard_light_neon(b, s);
+	case FZ_BLEND_DIFFERENCE: return vabd_s16(b, s);
+	case FZ_BLEND_EXCLUSION: return vsub_s16(vadd_s16(b, s), vshl_n_s16(mul255_neon(b, s), 1));
+	}
+}
+
+/* As fz_blend_separable, with no spots and not (bal && !sal). */
+static simd_forceinline void
+blend_separable_neon(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int blendmode, int complement)
+{
+	const int16x4_t c255 = vdup_n_s16(255);
+
+	do
+	{
+		int sa = (sal ? sp[n1] : 255);
+
+		if (sa != 0)
+		{
+			int ba = (bal ? bp[n1] : 255);
+			if (ba == 0)
+			{
+				memcpy(bp, sp, n1 + sal);
+			}
+			else
+			{
+				int saba = fz_mul255(sa, ba);
+				int invsa = 255 * 256 / sa;
+				int invba = 255 * 256 / ba;
+				int16x4_t s = load_color_neon(sp, n1);
+				int16x4_t b = load_color_neon(bp, n1);
+				int16x4_t sc = unpremultiply_neon(s, invsa);
+				int16x4_t bc = unpremultiply_neon(b, invba);
+				int16x4_t rc;
+
+				if (complement)
+				{
+					sc = vsub_s16(c255, sc);
+					bc = vsub_s16(c255, bc);
+				}
+				rc = blend_byte_neon(bc, sc, blendmode);
+				if (complement)
+					rc = vsub_s16(c255, rc);
+
+				rc = vadd_s16(vadd_s16(
+					mul255_neon(vdup_n_s16(255 - sa), b),
+					mul255_neon(vdup_n_s16(255 - ba), s)),
+					mul255_neon(vdup_n_s16(saba), rc));
+				store_color_neon(bp, rc, n1);
+
+				if (bal)
+					bp[n1] = ba + sa - saba;
+			}
+		}
+		sp += n1 + sal;
+		bp += n1 + bal;
+	}
+	while (--w);
+}
+
+/* As fz_blend_separable_nonisolated, with no spots. */
+static simd_forceinline void
+blend_separable_nonisolated_neon(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int blendmode, int complement, const byte * FZ_RESTRICT hp, int alpha)
+{
+	const int16x4_t c255 = vdup_n_s16(255);
+	int k;
+
+	do
+	{
+		int ha = *hp++;
+		int haa = fz_mul255(ha, alpha);
+		while (haa != 0)
+		{
+			int sa, ba, bahaa, ra, ra0, invsa, invba, scale;
+			int16x4_t s, b, sc, bc, rc;
+			int32x4_t d;
+
+			sa = (sal ? sp[n1] : 255);
+			if (sa == 0)
+				break;
+			invsa = 255 * 256 / sa;
+			ba = (bal ? bp[n1] : 255);
+			if (ba == 0)
+			{
+				for (k = 0; k < n1; k++)
+					bp[k] = fz_mul255((sp[k] * invsa) >> 8, haa);
+				if (bal)
+					bp[n1] = haa;
+				break;
+			}
+			invba = 255 * 256 / ba;
+
+			scale = (512 * ba + ha) / (ha*2) - FZ_EXPAND(ba);
+
+			bahaa = fz_mul255(ba, haa);
+			ra0 = ba - bahaa;
+			ra = ra0 + haa;
+			if (bal)
+				bp[n1] = ra;
+
+			if (ra == 0)
+				break;
+
+			s = load_color_neon(sp, n1);
+			b = load_color_neon(bp, n1);
+			sc = unpremultiply_neon(s, invsa);
+			bc = unpremultiply_neon(b, invba);
+
+			if (complement)
+			{
+				sc = vsub_s16(c255, sc);
+				bc = vsub_s16(c255, bc);
+			}
+
+			/* Uncomposite. The product needs 32 bits, but saturating
+			 * back to 16 bits cannot change the clamped result. */
+			d = vmulq_n_s32(vmovl_s16(vsub_s16(sc, bc)), scale);
+			sc = vqadd_s16(sc, vqmovn_s32(vshrq_n_s32(d, 8)));
+			sc = vmin_s16(vmax_s16(sc, vdup_n_s16(0)), c255);
+
+			rc = blend_byte_neon(bc, sc, blendmode);
+
+			/* Each of the conditional terms in the C version is an
+			 * identity when its condition fails. */
+			rc = mul255_neon(vdup_n_s16(bahaa), rc);
+			rc = vadd_s16(rc, mul255_neon(vdup_n_s16(fz_mul255(255 - ba, haa)), sc));
+			rc = vadd_s16(rc, mul255_neon(vdup_n_s16(ra0), bc));
+
+			if (complement)
+				rc = vsub_s16(vdup_n_s16(ra), rc);
+
+			rc = vmin_s16(vmax_s16(rc, vdup_n_s16(0)), vdup_n_s16(ra));
+			store_color_neon(bp, rc, n1);
+			break;
+		}
+
+		sp += n1 + sal;
+		bp += n1 + bal;
+	}
+	while (--w);
+}
+
+/* As fz_blend_knockout. */
+static simd_forceinline void
+blend_knockout_neon(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, const byte * FZ_RESTRICT hp)
+{
+	do
+	{
+		int ha = *hp++;
+
+		if (ha != 0)
+		{
+			int sa = (sal ? sp[n1] : 255);
+			int ba = (bal ? bp[n1] : 255);
+			if (ba == 0 && ha == 0xFF)
+			{
+				memcpy(bp, sp, n1);
+				if (bal)
+					bp[n1] = sa;
+			}
+			else
+			{
+				int hasa = fz_mul255(ha, sa);
+				int invsa = sa ? 255 * 256 / sa : 0;
+				int invba = ba ? 255 * 256 / ba : 0;
+				int ra = hasa + fz_mul255(255-ha, ba);
+				int16x4_t sc = unpremultiply_neon(load_color_neon(sp, n1), invsa);
+				int16x4_t bc = unpremultiply_neon(load_color_neon(bp, n1), invba);
+				int16x4_t rc = vadd_s16(
+					mul255_neon(vdup_n_s16(255 - ha), bc),
+					mul255_neon(vdup_n_s16(ha), sc));
+
+				store_color_neon(bp, mul255_neon(vdup_n_s16(ra), rc), n1);
+				if (bal)
+					bp[n1] = ra;
+			}
+		}
+		sp += n1 + sal;
+		bp += n1 + bal;
+	}
+	while (--w);
+}
+
+/* Entry points from the C code. */
+
+static int
+fz_blend_separable_neon(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int blendmode, int complement)
+{
+	if (!blendmode_has_neon(blendmode) || (bal && !sal))
+		return 0;
+#define CALL(N, SA, DA) blend_separable_neon(bp, DA, sp, SA, N, w, blendmode, complement)
+	SIMD_LAYOUT_SWITCH(n1, sal, bal, CALL);
+#undef CALL
+}
+
+static int
+fz_blend_separable_nonisolated_neon(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int blendmode, int complement, const byte * FZ_RESTRICT hp, int alpha)
+{
+	if (!blendmode_has_neon(blendmode))
+		return 0;
+#define CALL(N, SA, DA) blend_separable_nonisolated_neon(bp, DA, sp, SA, N, w, blendmode, complement, hp, alpha)
+	SIMD_LAYOUT_SWITCH(n1, sal, bal, CALL);
+#undef CALL
+}
+
+static int
+fz_blend_knockout_neon(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, const byte * FZ_RESTRICT hp)
+{
+#define CALL(N, SA, DA) blend_knockout_neon(bp, DA, sp, SA, N, w, hp)
+	SIMD_LAYOUT_SWITCH(n1, sal, bal, CALL);
+#undef CALL
+}
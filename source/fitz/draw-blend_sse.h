@@ -0,0 +1,323 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+
+/* This file is included from draw-blend.c if SSE cores are allowed.
+ * Each pixel is held in the 16-bit lanes of one register, and the
+ * separable blend modes that need neither division nor square roots
+ * are done lane-wise. Results match the C code for premultiplied
+ * input. */
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <smmintrin.h>
+
+/* Load the n1 <= 4 colour bytes of a pixel into 16-bit lanes. */
+static simd_forceinline __m128i
+load_color_sse(const byte * FZ_RESTRICT p, int n1)
+{
+	uint32_t v;
+	uint16_t s;
+	switch (n1)
+	{
+	case 1: v = p[0]; break;
+	case 3: memcpy(&s, p, 2); v = s | (p[2]<<16); break;
+	default: memcpy(&v, p, 4); break;
+	}
+	return _mm_cvtepu8_epi16(_mm_cvtsi32_si128(v));
+}
+
+/* Store n1 colour bytes, truncating each lane as a byte assignment would. */
+static simd_forceinline void
+store_color_sse(byte * FZ_RESTRICT p, __m128i x, int n1)
+{
+	uint32_t v;
+	x = _mm_and_si128(x, _mm_set1_epi16(0xFF));
+	v = _mm_cvtsi128_si32(_mm_packus_epi16(x, x));
+	switch (n1)
+	{
+	case 1: p[0] = v; break;
+	case 3: memcpy(p, &v, 2); p[2] = v>>16; break;
+	default: memcpy(p, &v, 4); break;
+	}
+}
+
+/* fz_mul255() on 16-bit lanes. */
+static simd_forceinline __m128i
+mul255_sse(__m128i a, __m128i b)
+{
+	__m128i x = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* (c * inv) >> 8, the conversion to non-premultiplied form. */
+static simd_forceinline __m128i
+unpremultiply_sse(__m128i c, int inv)
+{
+	return _mm_mulhi_epu16(_mm_slli_epi16(c, 8), _mm_set1_epi16(inv));
+}
+
+static simd_forceinline __m128i
+screen_sse(__m128i b, __m128i s)
+{
+	return _mm_sub_epi16(_mm_add_epi16(b, s), mul255_sse(b, s));
+}
+
+static simd_forceinline __m128i
+hard_light_sse(__m128i b, __m128i s)
+{
+	__m128i s2 = _mm_slli_epi16(s, 1);
+	__m128i lo = mul255_sse(b, s2);
+	__m128i hi = screen_sse(b, _mm_sub_epi16(s2, _mm_set1_epi16(255)));
+	return _mm_blendv_epi8(lo, hi, _mm_cmpgt_epi16(s, _mm_set1_epi16(127)));
+}
+
+static inline int
+blendmode_has_sse(int blendmode)
+{
+	return blendmode != FZ_BLEND_COLOR_DODGE && blendmode != FZ_BLEND_COLOR_BURN && blendmode != FZ_BLEND_SOFT_LIGHT;
+}
+
+/* B(bc, sc) for the modes accepted by blendmode_has_sse. */
+static simd_forceinline __m128i
+blend_byte_sse(__m128i b, __m128i s, int blendmode)
+{
+	switch (blendmode)
+	{
+	default:
+	case FZ_BLEND_NORMAL: return s;
+	case FZ_BLEND_MULTIPLY: return mul255_sse(b, s);
+	case FZ_BLEND_SCREEN: return screen_sse(b, s);
+	case FZ_BLEND_OVERLAY: return hard_light_sse(s, b);
+	case FZ_BLEND_DARKEN: return _mm_min_epi16(b, s);
+	case FZ_BLEND_LIGHTEN: return _mm_max_epi16(b, s);
+	case FZ_BLEND_HARD_LIGHT: return hard_light_sse(b, s);
+	case FZ_BLEND_DIFFERENCE: return _mm_abs_epi16(_mm_sub_epi16(b, s));
+	case FZ_BLEND_EXCLUSION: return _mm_sub_epi16(_mm_add_epi16(b, s), _mm_slli_epi16(mul255_sse(b, s), 1));
+	}
+}
+
+/* As fz_blend_separable, with no spots and not (bal && !sal). */
+static simd_forceinline void
+blend_separable_sse(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int blendmode, int complement)
+{
+	const __m128i c255 = _mm_set1_epi16(255);
+
+	do
+	{
+		int sa = (sal ? sp[n1] : 255);
+
+		if (sa != 0)
+		{
+			int ba = (bal ? bp[n1] : 255);
+			if (ba == 0)
+			{
+				memcpy(bp, sp, n1 + sal);
+			}
+			else
+			{
+				int saba = fz_mul255(sa, ba);
+				int invsa = 255 * 256 / sa;
+				int invba = 255 * 256 / ba;
+				__m128i s = load_color_sse(sp, n1);
+				__m128i b = load_color_sse(bp, n1);
+				__m128i sc = unpremultiply_sse(s, invsa);
+				__m128i bc = unpremultiply_sse(b, invba);
+				__m128i rc;
+
+				if (complement)
+				{
+					sc = _mm_sub_epi16(c255, sc);
+					bc = _mm_sub_epi16(c255, bc);
+				}
+				rc = blend_byte_sse(bc, sc, blendmode);
+				if (complement)
+					rc = _mm_sub_epi16(c255, rc);
+
+				rc = _mm_add_epi16(_mm_add_epi16(
+					mul255_sse(_mm_set1_epi16(255 - sa), b),
+					mul255_sse(_mm_set1_epi16(255 - ba), s)),
+					mul255_sse(_mm_set1_epi16(saba), rc));
+				store_color_sse(bp, rc, n1);
+
+				if (bal)
+					bp[n1] = ba + sa - saba;
+			}
+		}
+		sp += n1 + sal;
+		bp += n1 + bal;
+	}
+	while (--w);
+}
+
+/* As fz_blend_separable_nonisolated, with no spots. */
+static simd_forceinline void
+blend_separable_nonisolated_sse(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int blendmode, int complement, const byte * FZ_RESTRICT hp, int alpha)
+{
+	const __m128i c255 = _mm_set1_epi16(255);
+	int k;
+
+	do
+	{
+		int ha = *hp++;
+		int haa = fz_mul255(ha, alpha);
+		while (haa != 0)
+		{
+			int sa, ba, bahaa, ra, ra0, invsa, invba, scale;
+			__m128i s, b, sc, bc, rc, d;
+
+			sa = (sal ? sp[n1] : 255);
+			if (sa == 0)
+				break;
+			invsa = 255 * 256 / sa;
+			ba = (bal ? bp[n1] : 255);
+			if (ba == 0)
+			{
+				for (k = 0; k < n1; k++)
+					bp[k] = fz_mul255((sp[k] * invsa) >> 8, haa);
+				if (bal)
+					bp[n1] = haa;
+				break;
+			}
+			invba = 255 * 256 / ba;
+
+			scale = (512 * ba + ha) / (ha*2) - FZ_EXPAND(ba);
+
+			bahaa = fz_mul255(ba, haa);
+			ra0 = ba - bahaa;
+			ra = ra0 + haa;
+			if (bal)
+				bp[n1] = ra;
+
+			if (ra == 0)
+				break;
+
+			s = load_color_sse(sp, n1);
+			b = load_color_sse(bp, n1);
+			sc = unpremultiply_sse(s, invsa);
+			bc = unpremultiply_sse(b, invba);
+
+			if (complement)
+			{
+				sc = _mm_sub_epi16(c255, sc);
+				bc = _mm_sub_epi16(c255, bc);
+			}
+
+			/* Uncomposite. The product needs 32 bits, but saturating
+			 * back to 16 bits cannot change the clamped result. */
+			d = _mm_mullo_epi32(_mm_cvtepi16_epi32(_mm_sub_epi16(sc, bc)), _mm_set1_epi32(scale));
+			d = _mm_srai_epi32(d, 8);
+			sc = _mm_adds_epi16(sc, _mm_packs_epi32(d, d));
+			sc = _mm_min_epi16(_mm_max_epi16(sc, _mm_setzero_si128()), c255);
+
+			rc = blend_byte_sse(bc, sc, blendmode);
+
+			/* Each of the conditional terms in the C version is an
+			 * identity when its condition fails. */
+			rc = mul255_sse(_mm_set1_epi16(bahaa), rc);
+			rc = _mm_add_epi16(rc, mul255_sse(_mm_set1_epi16(fz_mul255(255 - ba, haa)), sc));
+			rc = _mm_add_epi16(rc, mul255_sse(_mm_set1_epi16(ra0), bc));
+
+			if (complement)
+				rc = _mm_sub_epi16(_mm_set1_epi16(ra), rc);
+
+			rc = _mm_min_epi16(_mm_max_epi16(rc, _mm_setzero_si128()), _mm_set1_epi16(ra));
+			store_color_sse(bp, rc, n1);
+			break;
+		}
+
+		sp += n1 + sal;
+		bp += n1 + bal;
+	}
+	while (--w);
+}
+
+/* As fz_blend_knockout. */
+static simd_forceinline void
+blend_knockout_sse(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, const byte * FZ_RESTRICT hp)
+{
+	do
+	{
+		int ha = *hp++;
+
+		if (ha != 0)
+		{
+			int sa = (sal ? sp[n1] : 255);
+			int ba = (bal ? bp[n1] : 255);
+			if (ba == 0 && ha == 0xFF)
+			{
+				memcpy(bp, sp, n1);
+				if (bal)
+					bp[n1] = sa;
+			}
+			else
+			{
+				int hasa = fz_mul255(ha, sa);
+				int invsa = sa ? 255 * 256 / sa : 0;
+				int invba = ba ? 255 * 256 / ba : 0;
+				int ra = hasa + fz_mul255(255-ha, ba);
+				__m128i sc = unpremultiply_sse(load_color_sse(sp, n1), invsa);
+				__m128i bc = unpremultiply_sse(load_color_sse(bp, n1), invba);
+				__m128i rc = _mm_add_epi16(
+					mul255_sse(_mm_set1_epi16(255 - ha), bc),
+					mul255_sse(_mm_set1_epi16(ha), sc));
+
+				store_color_sse(bp, mul255_sse(_mm_set1_epi16(ra), rc), n1);
+				if (bal)
+					bp[n1] = ra;
+			}
+		}
+		sp += n1 + sal;
+		bp += n1 + bal;
+	}
+	while (--w);
+}
+
+/* Entry points from the C code. */
+
+static int
+fz_blend_separable_sse(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int blendmode, int complement)
+{
+	if (!blendmode_has_sse(blendmode) || (bal && !sal))
+		return 0;
+#define CALL(N, SA, DA) blend_separable_sse(bp, DA, sp, SA, N, w, blendmode, complement)
+	SIMD_LAYOUT_SWITCH(n1, sal, bal, CALL);
+#undef CALL
+}
+
+static int
+fz_blend_separable_nonisolated_sse(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, int blendmode, int complement, const byte * FZ_RESTRICT hp, int alpha)
+{
+	if (!blendmode_has_sse(blendmode))
+		return 0;
+#define CALL(N, SA, DA) blend_separable_nonisolated_sse(bp, DA, sp, SA, N, w, blendmode, complement, hp, alpha)
+	SIMD_LAYOUT_SWITCH(n1, sal, bal, CALL);
+#undef CALL
+}
+
+static int
+fz_blend_knockout_sse(byte * FZ_RESTRICT bp, int bal, const byte * FZ_RESTRICT sp, int sal, int n1, int w, const byte * FZ_RESTRICT hp)
+{
+#define CALL(N, SA, DA) blend_knockout_sse(bp, DA, sp, SA, N, w, hp)
+	SIMD_LAYOUT_SWITCH(n1, sal, bal, CALL);
+#undef CALL
+}
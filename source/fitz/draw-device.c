@@ -69,6 +69,7 @@ typedef struct fz_draw_device
 	fz_device super;
 	fz_matrix transform;
 	fz_rasterizer *rast;
+	fz_rasterizer *batch;
 	fz_default_colorspaces *default_cs;
 	fz_colorspace *proof_cs;
 	int flags;
@@ -669,6 +670,47 @@ push_group_for_separations(fz_context *ctx, fz_draw_device *dev, fz_color_params
 	return &dev->stack[1];
 }
 
+/*
+	With FZ_BATCH_PATHS, opaque paths are converted by a sparse
+	rasterizer, that only paints them once the colour changes or it
+	is flushed. Everything else that touches the pixmaps must flush
+	it first.
+*/
+static fz_rasterizer *
+batch_rasterizer(fz_context *ctx, fz_draw_device *dev, fz_draw_state *state, float alpha)
+{
+	if (!(dev->super.hints & FZ_BATCH_PATHS) || alpha != 1 || state->shape || state->group_alpha)
+		return NULL;
+	if (fz_rasterizer_graphics_aa_level(dev->rast) > 8)
+		return NULL;
+	if (dev->batch == NULL)
+		dev->batch = fz_new_sparse_rasterizer(ctx, &dev->rast->aa);
+	return dev->batch;
+}
+
+static void
+flush_batch(fz_context *ctx, fz_draw_device *dev)
+{
+	if (dev->batch)
+		fz_flush_rasterizer(ctx, dev->batch);
+}
+
+static int
+flatten_fill_path(fz_context *ctx, fz_draw_device *dev, fz_rasterizer *rast, const fz_path *path, fz_matrix ctm, float flatness, fz_irect scissor, fz_irect *bbox)
+{
+	if (dev->super.hints & FZ_CACHE_FLATTENED_PATHS)
+		return fz_flatten_fill_path_cached(ctx, rast, path, ctm, flatness, scissor, bbox);
+	return fz_flatten_fill_path(ctx, rast, path, ctm, flatness, scissor, bbox);
+}
+
+static int
+flatten_stroke_path(fz_context *ctx, fz_draw_device *dev, fz_rasterizer *rast, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth, fz_irect scissor, fz_irect *bbox)
+{
+	if (dev->super.hints & FZ_CACHE_FLATTENED_PATHS)
+		return fz_flatten_stroke_path_cached(ctx, rast, path, stroke, ctm, flatness, linewidth, scissor, bbox);
+	return fz_flatten_stroke_path(ctx, rast, path, stroke, ctm, flatness, linewidth, scissor, bbox);
+}
+
 static void
 fz_draw_fill_path(fz_context *ctx, fz_device *devp, const fz_path *path, int even_odd, fz_matrix in_ctm,
 	fz_colorspace *colorspace_in, const float *color, float alpha, fz_color_params color_params)
@@ -684,10 +726,17 @@ fz_draw_fill_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_overprint op = { { 0 } };
 	fz_overprint *eop;
+	fz_rasterizer *batch;
 
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, color_params, dev->default_cs);
 
+	batch = batch_rasterizer(ctx, dev, state, alpha);
+	if (batch)
+		rast = batch;
+	else
+		flush_batch(ctx, dev);
+
 	if (expansion < FLT_EPSILON)
 		expansion = 1;
 	flatness = 0.3f / expansion;
@@ -695,7 +744,7 @@ fz_draw_fill_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 		flatness = 0.001f;
 
 	bbox = fz_intersect_irect(fz_pixmap_bbox(ctx, state->dest), state->scissor);
-	if (fz_flatten_fill_path(ctx, rast, path, ctm, flatness, bbox, &bbox))
+	if (flatten_fill_path(ctx, dev, rast, path, ctm, flatness, bbox, &bbox))
 		return;
 
 	if (alpha == 0)
@@ -710,7 +759,7 @@ fz_draw_fill_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 	if (state->shape)
 	{
 		if (!rast->fns.reusable)
-			fz_flatten_fill_path(ctx, rast, path, ctm, flatness, bbox, NULL);
+			flatten_fill_path(ctx, dev, rast, path, ctm, flatness, bbox, NULL);
 
 		colorbv[0] = 255;
 		fz_convert_rasterizer(ctx, rast, even_odd, state->shape, colorbv, 0);
@@ -718,7 +767,7 @@ fz_draw_fill_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 	if (state->group_alpha)
 	{
 		if (!rast->fns.reusable)
-			fz_flatten_fill_path(ctx, rast, path, ctm, flatness, bbox, NULL);
+			flatten_fill_path(ctx, dev, rast, path, ctm, flatness, bbox, NULL);
 
 		colorbv[0] = alpha * 255;
 		fz_convert_rasterizer(ctx, rast, even_odd, state->group_alpha, colorbv, 0);
@@ -746,10 +795,17 @@ fz_draw_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path, const
 	float mlw = fz_rasterizer_graphics_min_line_width(rast);
 	fz_overprint op = { { 0 } };
 	fz_overprint *eop;
+	fz_rasterizer *batch;
 
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, color_params, dev->default_cs);
 
+	batch = batch_rasterizer(ctx, dev, state, alpha);
+	if (batch)
+		rast = batch;
+	else
+		flush_batch(ctx, dev);
+
 	if (mlw > aa_level)
 		aa_level = mlw;
 	if (expansion < FLT_EPSILON)
@@ -761,7 +817,7 @@ fz_draw_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path, const
 		flatness = 0.001f;
 
 	bbox = fz_intersect_irect(fz_pixmap_bbox_no_ctx(state->dest), state->scissor);
-	if (fz_flatten_stroke_path(ctx, rast, path, stroke, ctm, flatness, linewidth, bbox, &bbox))
+	if (flatten_stroke_path(ctx, dev, rast, path, stroke, ctm, flatness, linewidth, bbox, &bbox))
 		return;
 
 	if (alpha == 0)
@@ -785,7 +841,7 @@ fz_draw_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path, const
 	if (state->shape)
 	{
 		if (!rast->fns.reusable)
-			(void)fz_flatten_stroke_path(ctx, rast, path, stroke, ctm, flatness, linewidth, bbox, NULL);
+			(void)flatten_stroke_path(ctx, dev, rast, path, stroke, ctm, flatness, linewidth, bbox, NULL);
 
 		colorbv[0] = 255;
 		fz_convert_rasterizer(ctx, rast, 0, state->shape, colorbv, 0);
@@ -793,7 +849,7 @@ fz_draw_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path, const
 	if (state->group_alpha)
 	{
 		if (!rast->fns.reusable)
-			(void)fz_flatten_stroke_path(ctx, rast, path, stroke, ctm, flatness, linewidth, bbox, NULL);
+			(void)flatten_stroke_path(ctx, dev, rast, path, stroke, ctm, flatness, linewidth, bbox, NULL);
 
 		colorbv[0] = 255 * alpha;
 		fz_convert_rasterizer(ctx, rast, 0, state->group_alpha, colorbv, 0);
@@ -826,6 +882,8 @@ fz_draw_clip_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 	fz_draw_state *state = &dev->stack[dev->top];
 	fz_colorspace *model;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, fz_default_color_params /* FIXME */, dev->default_cs);
 
@@ -843,7 +901,7 @@ fz_draw_clip_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 	if (!fz_is_infinite_rect(scissor))
 		bbox = fz_intersect_irect(bbox, fz_irect_from_rect(fz_transform_rect(scissor, dev->transform)));
 
-	if (fz_flatten_fill_path(ctx, rast, path, ctm, flatness, bbox, &bbox) || fz_is_rect_rasterizer(ctx, rast))
+	if (flatten_fill_path(ctx, dev, rast, path, ctm, flatness, bbox, &bbox) || fz_is_rect_rasterizer(ctx, rast))
 	{
 		state[1].scissor = bbox;
 		state[1].mask = NULL;
@@ -893,6 +951,8 @@ fz_draw_clip_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path,
 	float aa_level = 2.0f/(fz_rasterizer_graphics_aa_level(rast)+2);
 	float mlw = fz_rasterizer_graphics_min_line_width(rast);
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, fz_default_color_params /* FIXME */, dev->default_cs);
 
@@ -914,7 +974,7 @@ fz_draw_clip_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path,
 	if (!fz_is_infinite_rect(scissor))
 		bbox = fz_intersect_irect(bbox, fz_irect_from_rect(fz_transform_rect(scissor, dev->transform)));
 
-	if (fz_flatten_stroke_path(ctx, rast, path, stroke, ctm, flatness, linewidth, bbox, &bbox))
+	if (flatten_stroke_path(ctx, dev, rast, path, stroke, ctm, flatness, linewidth, bbox, &bbox))
 	{
 		state[1].scissor = bbox;
 		state[1].mask = NULL;
@@ -1035,6 +1095,8 @@ fz_draw_fill_text(fz_context *ctx, fz_device *devp, const fz_text *text, fz_matr
 	fz_overprint op = { { 0 } };
 	fz_overprint *eop;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, color_params, dev->default_cs);
 
@@ -1138,6 +1200,8 @@ fz_draw_stroke_text(fz_context *ctx, fz_device *devp, const fz_text *text, const
 	fz_overprint op = { { 0 } };
 	fz_overprint *eop;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, color_params, dev->default_cs);
 
@@ -1230,6 +1294,8 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, const fz_text *text, fz_matr
 	fz_text_span *span;
 	fz_rasterizer *rast = dev->rast;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, fz_default_color_params /* FIXME */, dev->default_cs);
 
@@ -1358,6 +1424,8 @@ fz_draw_clip_stroke_text(fz_context *ctx, fz_device *devp, const fz_text *text,
 	fz_text_span *span;
 	int aa = fz_rasterizer_text_aa_level(dev->rast);
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, fz_default_color_params /* FIXME */, dev->default_cs);
 
@@ -1487,6 +1555,8 @@ fz_draw_fill_shade(fz_context *ctx, fz_device *devp, fz_shade *shade, fz_matrix
 	fz_overprint *eop;
 	fz_colorspace *colorspace = fz_default_colorspace(ctx, dev->default_cs, shade->colorspace);
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, color_params, dev->default_cs);
 
@@ -1811,6 +1881,8 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, fz_matrix
 	fz_overprint op = { { 0 } };
 	fz_overprint *eop = &op;
 
+	flush_batch(ctx, dev);
+
 	if (alpha == 0)
 		return;
 
@@ -1929,6 +2001,8 @@ fz_draw_fill_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, fz_ma
 	fz_overprint op = { { 0 } };
 	fz_overprint *eop;
 
+	flush_batch(ctx, dev);
+
 	if (alpha == 0)
 		return;
 
@@ -2006,6 +2080,8 @@ fz_draw_clip_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, fz_ma
 	fz_irect clip;
 	fz_irect src_area;
 
+	flush_batch(ctx, dev);
+
 	fz_var(pixmap);
 
 	if (dev->top == 0 && dev->resolve_spots)
@@ -2134,6 +2210,8 @@ fz_draw_pop_clip(fz_context *ctx, fz_device *devp)
 	fz_draw_device *dev = (fz_draw_device*)devp;
 	fz_draw_state *state;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "unexpected pop clip");
 
@@ -2205,6 +2283,8 @@ fz_draw_begin_mask(fz_context *ctx, fz_device *devp, fz_rect area, int luminosit
 	fz_rect trect;
 	fz_colorspace *colorspace = NULL;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, color_params, dev->default_cs);
 
@@ -2325,6 +2405,8 @@ fz_draw_end_mask(fz_context *ctx, fz_device *devp, fz_function *tr)
 	fz_irect bbox;
 	fz_draw_state *state;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "unexpected end mask");
 
@@ -2398,6 +2480,8 @@ fz_draw_begin_group(fz_context *ctx, fz_device *devp, fz_rect area, fz_colorspac
 	fz_colorspace *model = state->dest->colorspace;
 	fz_rect trect;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, fz_default_color_params /* FIXME */, dev->default_cs);
 
@@ -2471,6 +2555,8 @@ fz_draw_end_group(fz_context *ctx, fz_device *devp)
 	float alpha;
 	fz_draw_state *state;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "unexpected end group");
 
@@ -2695,6 +2781,8 @@ fz_draw_begin_tile(fz_context *ctx, fz_device *devp, fz_rect area, fz_rect view,
 	fz_colorspace *model = state->dest->colorspace;
 	fz_rect local_view;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0 && dev->resolve_spots)
 		state = push_group_for_separations(ctx, dev, fz_default_color_params /* FIXME */, dev->default_cs);
 
@@ -2813,6 +2901,8 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 	fz_pixmap *shape = NULL;
 	fz_pixmap *group_alpha = NULL;
 
+	flush_batch(ctx, dev);
+
 	if (dev->top == 0)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "unexpected end tile");
 
@@ -3014,6 +3104,8 @@ fz_draw_close_device(fz_context *ctx, fz_device *devp)
 {
 	fz_draw_device *dev = (fz_draw_device*)devp;
 
+	flush_batch(ctx, dev);
+
 	/* pop and free the stacks */
 	if (dev->top > dev->resolve_spots)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "items left on stack in draw device: %d", dev->top);
@@ -3071,6 +3163,7 @@ fz_draw_drop_device(fz_context *ctx, fz_device *devp)
 	fz_drop_scale_cache(ctx, dev->cache_x);
 	fz_drop_scale_cache(ctx, dev->cache_y);
 	fz_drop_rasterizer(ctx, rast);
+	fz_drop_rasterizer(ctx, dev->batch);
 	fz_drop_shade_color_cache(ctx, dev->shade_cache);
 }
 
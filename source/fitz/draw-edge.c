@@ -888,6 +888,7 @@ static const fz_rasterizer_fns gel_rasterizer =
 	NULL, /* gap */
 	fz_convert_gel,
 	fz_is_rect_gel,
+	NULL, /* flush */
 	0 /* Not reusable */
 };
 
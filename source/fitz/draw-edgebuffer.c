@@ -79,6 +79,8 @@ typedef struct fz_edgebuffer_s
 	int *index;
 	int table_cap;
 	int *table;
+	int sort_cap;
+	int *sort;
 
 	/* cursor section, for use with any part of pixel mode */
 	cursor_t cursor[3];
@@ -149,6 +151,7 @@ static void fz_drop_edgebuffer(fz_context *ctx, fz_rasterizer *r)
 	{
 		fz_free(ctx, eb->index);
 		fz_free(ctx, eb->table);
+		fz_free(ctx, eb->sort);
 	}
 	fz_free(ctx, eb);
 }
@@ -218,22 +221,45 @@ static void index_edgebuffer_insert(fz_context *ctx, fz_rasterizer *ras, float f
 	eb->index[imaxy+1] -= eb->n;
 }
 
+/* Rows longer than this are radix sorted rather than insertion sorted. */
+#define EDGEBUFFER_INSERTION_SORT_MAX 32
+
+/*
+	Only rows within a scanline of the measured bbox can ever hold
+	intersections. Find that range [*y0, *y1) of table rows, so that
+	we need not walk the whole clip height for every path. All rows
+	outside it share the permanently empty row at table[0].
+*/
+static void edgebuffer_rows(fz_edgebuffer *eb, int *y0, int *y1)
+{
+	int height = eb->super.clip.y1 - eb->super.clip.y0;
+
+	*y0 = fz_clampi(eb->super.bbox.y0 - 1 - eb->super.clip.y0, 0, height);
+	*y1 = fz_clampi(eb->super.bbox.y1 + 2 - eb->super.clip.y0, *y0, height);
+}
+
 static void fz_postindex_edgebuffer(fz_context *ctx, fz_rasterizer *r)
 {
 	fz_edgebuffer *eb = (fz_edgebuffer *)r;
-	int height = eb->super.clip.y1 - eb->super.clip.y0 + 1;
 	int n = eb->n;
-	int total = 0;
+	int total = 1;
 	int delta = 0;
-	int i;
+	int widest = 0;
+	int i, y0, y1;
 
 	eb->super.fns.insert = (eb->app ? fz_insert_edgebuffer_app : fz_insert_edgebuffer);
 
-	for (i = 0; i < height; i++)
+	/* The row after the last one holds the closing deltas, and
+	 * gets an (empty) entry of its own so that the capacity of
+	 * every row is the difference of consecutive indexes. */
+	edgebuffer_rows(eb, &y0, &y1);
+	for (i = y0; i <= y1; i++)
 	{
 		delta += eb->index[i];
 		eb->index[i] = total;
 		total += 1 + delta*n;
+		if (widest < delta*n)
+			widest = delta*n;
 	}
 	assert(delta == 0);
 
@@ -242,8 +268,14 @@ static void fz_postindex_edgebuffer(fz_context *ctx, fz_rasterizer *r)
 		eb->table = fz_realloc_array(ctx, eb->table, total, int);
 		eb->table_cap = total;
 	}
+	if (widest > EDGEBUFFER_INSERTION_SORT_MAX && eb->sort_cap < widest)
+	{
+		eb->sort = fz_realloc_array(ctx, eb->sort, widest, int);
+		eb->sort_cap = widest;
+	}
 
-	for (i = 0; i < height; i++)
+	eb->table[0] = 0;
+	for (i = y0; i <= y1; i++)
 	{
 		eb->table[eb->index[i]] = 0;
 	}
@@ -1507,16 +1539,146 @@ static void fz_insert_edgebuffer_app(fz_context *ctx, fz_rasterizer *ras, float
 	mark_line_app(ctx, eb, sx, sy, ex, ey, rev);
 }
 
-static int intcmp(const void *a, const void *b)
+/*
+	Per scanline sorting of intersections.
+
+	Most rows hold a handful of entries, for which an insertion sort
+	beats anything cleverer. Long rows (big self-intersecting paths,
+	dense hatching) use an LSD radix sort on 8 bit digits, skipping
+	any digit that is the same for the whole row; as the entries of a
+	row lie within the width of the clip, at most three passes are
+	normally needed. Keys are biased so that signed values sort
+	correctly. scripts/edgecheck.py renders dense vector art to check
+	this against an older build.
+*/
+#define RADIX_KEY(v) ((unsigned int)(v) ^ 0x80000000U)
+
+static void sort_row(int * FZ_RESTRICT row, int len, int * FZ_RESTRICT tmp)
+{
+	unsigned int count[4][256];
+	int *src, *dst, *swap;
+	int i, j, p;
+
+	if (len <= EDGEBUFFER_INSERTION_SORT_MAX)
+	{
+		for (i = 1; i < len; i++)
+		{
+			int v = row[i];
+			for (j = i; j > 0 && row[j-1] > v; j--)
+				row[j] = row[j-1];
+			row[j] = v;
+		}
+		return;
+	}
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < len; i++)
+	{
+		unsigned int k = RADIX_KEY(row[i]);
+		count[0][k & 255]++;
+		count[1][(k >> 8) & 255]++;
+		count[2][(k >> 16) & 255]++;
+		count[3][k >> 24]++;
+	}
+
+	src = row;
+	dst = tmp;
+	for (p = 0; p < 4; p++)
+	{
+		unsigned int *c = count[p];
+		int shift = p * 8;
+		unsigned int sum = 0;
+
+		if (c[(RADIX_KEY(src[0]) >> shift) & 255] == (unsigned int)len)
+			continue;
+		for (i = 0; i < 256; i++)
+		{
+			unsigned int k = c[i];
+			c[i] = sum;
+			sum += k;
+		}
+		for (i = 0; i < len; i++)
+			dst[c[(RADIX_KEY(src[i]) >> shift) & 255]++] = src[i];
+		swap = src; src = dst; dst = swap;
+	}
+	if (src != row)
+		memcpy(row, src, len * sizeof(int));
+}
+
+/*
+	As above, but for the (left, right) pairs of any part of pixel
+	mode, ordered on left alone. The order of pairs with equal left
+	does not matter: the filter below extends each span to the
+	furthest right it has seen, and merges a span with the previous
+	one when they touch, so any order of such pairs gives the same
+	spans.
+*/
+static void sort_row_app(int * FZ_RESTRICT row, int len, int * FZ_RESTRICT tmp)
 {
-	return *((int*)a) - *((int *)b);
+	unsigned int count[4][256];
+	int *src, *dst, *swap;
+	int i, j, p;
+
+	if (len <= EDGEBUFFER_INSERTION_SORT_MAX/2)
+	{
+		for (i = 1; i < len; i++)
+		{
+			int l = row[2*i];
+			int r = row[2*i+1];
+			for (j = i; j > 0 && row[2*j-2] > l; j--)
+			{
+				row[2*j] = row[2*j-2];
+				row[2*j+1] = row[2*j-1];
+			}
+			row[2*j] = l;
+			row[2*j+1] = r;
+		}
+		return;
+	}
+
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < len; i++)
+	{
+		unsigned int k = RADIX_KEY(row[2*i]);
+		count[0][k & 255]++;
+		count[1][(k >> 8) & 255]++;
+		count[2][(k >> 16) & 255]++;
+		count[3][k >> 24]++;
+	}
+
+	src = row;
+	dst = tmp;
+	for (p = 0; p < 4; p++)
+	{
+		unsigned int *c = count[p];
+		int shift = p * 8;
+		unsigned int sum = 0;
+
+		if (c[(RADIX_KEY(src[0]) >> shift) & 255] == (unsigned int)len)
+			continue;
+		for (i = 0; i < 256; i++)
+		{
+			unsigned int k = c[i];
+			c[i] = sum;
+			sum += k;
+		}
+		for (i = 0; i < len; i++)
+		{
+			unsigned int o = c[(RADIX_KEY(src[2*i]) >> shift) & 255]++;
+			dst[2*o] = src[2*i];
+			dst[2*o+1] = src[2*i+1];
+		}
+		swap = src; src = dst; dst = swap;
+	}
+	if (src != row)
+		memcpy(row, src, 2 * len * sizeof(int));
 }
 
 static void fz_convert_edgebuffer(fz_context *ctx, fz_rasterizer *ras, int eofill, const fz_irect *clip, fz_pixmap *pix, unsigned char *color, fz_overprint *eop)
 {
 	fz_edgebuffer *eb = (fz_edgebuffer *)ras;
 	int scanlines = ras->clip.y1 - ras->clip.y0;
-	int i, n, a, pl, pr;
+	int i, n, a, pl, pr, y0, y1;
 	int *table = eb->table;
 	int *index = eb->index;
 	uint8_t *out;
@@ -1527,6 +1689,8 @@ static void fz_convert_edgebuffer(fz_context *ctx, fz_rasterizer *ras, int eofil
 	if (fn == NULL)
 		return;
 
+	edgebuffer_rows(eb, &y0, &y1);
+
 #ifdef DEBUG_SCAN_CONVERTER
 	if (debugging_scan_converter)
 	{
@@ -1539,27 +1703,12 @@ static void fz_convert_edgebuffer(fz_context *ctx, fz_rasterizer *ras, int eofil
 	if (!eb->sorted)
 	{
 		eb->sorted = 1;
-		for (i = 0; i < scanlines; i++)
+		for (i = y0; i < y1; i++)
 		{
 			int *row = &table[index[i]];
 			int rowlen = *row++;
 
-			/* Bubblesort short runs, qsort longer ones. */
-			/* FIXME: Check "6" below */
-			if (rowlen <= 6) {
-				int j, k;
-				for (j = 0; j < rowlen-1; j++)
-				{
-					int t = row[j];
-					for (k = j+1; k < rowlen; k++)
-					{
-						int s = row[k];
-						if (t > s)
-							row[k] = t, t = row[j] = s;
-					}
-				}
-			} else
-				qsort(row, rowlen, sizeof(int), intcmp);
+			sort_row(row, rowlen, eb->sort);
 		}
 
 #ifdef DEBUG_SCAN_CONVERTER
@@ -1571,7 +1720,7 @@ static void fz_convert_edgebuffer(fz_context *ctx, fz_rasterizer *ras, int eofil
 		}
 #endif
 
-		for (i=0; i < scanlines; i++) {
+		for (i = y0; i < y1; i++) {
 			int *row = &table[index[i]];
 			int *rowstart = row;
 			int rowlen = *row++;
@@ -1628,7 +1777,15 @@ static void fz_convert_edgebuffer(fz_context *ctx, fz_rasterizer *ras, int eofil
 	out = pix->samples + pix->stride * fz_maxi(ras->clip.y0 - pix->y, 0) + fz_maxi(ras->clip.x0 - pix->x, 0) * n;
 	if (scanlines > pix->y + pix->h - ras->clip.y0)
 		scanlines = pix->y + pix->h - ras->clip.y0;
-	for (i = fz_maxi(pix->y - ras->clip.y0, 0); i < scanlines; i++) {
+	if (scanlines > y1)
+		scanlines = y1;
+	i = fz_maxi(pix->y - ras->clip.y0, 0);
+	if (i < y0)
+	{
+		out += pix->stride * (y0 - i);
+		i = y0;
+	}
+	for (; i < scanlines; i++) {
 		int *row = &table[index[i]];
 		int  rowlen = *row++;
 
@@ -1658,21 +1815,11 @@ static void fz_convert_edgebuffer(fz_context *ctx, fz_rasterizer *ras, int eofil
 	}
 }
 
-static int edgecmp(const void *a, const void *b)
-{
-	int left  = ((int*)a)[0];
-	int right = ((int*)b)[0];
-	left -= right;
-	if (left)
-		return left;
-	return ((int*)a)[1] - ((int*)b)[1];
-}
-
 static void fz_convert_edgebuffer_app(fz_context *ctx, fz_rasterizer *ras, int eofill, const fz_irect *clip, fz_pixmap *pix, unsigned char *color, fz_overprint *eop)
 {
 	fz_edgebuffer *eb = (fz_edgebuffer *)ras;
 	int scanlines = ras->clip.y1 - ras->clip.y0;
-	int i, n, a, pl, pr;
+	int i, n, a, pl, pr, y0, y1;
 	int *table = eb->table;
 	int *index = eb->index;
 	uint8_t *out;
@@ -1683,6 +1830,8 @@ static void fz_convert_edgebuffer_app(fz_context *ctx, fz_rasterizer *ras, int e
 	if (fn == NULL)
 		return;
 
+	edgebuffer_rows(eb, &y0, &y1);
+
 #ifdef DEBUG_SCAN_CONVERTER
 	if (debugging_scan_converter)
 	{
@@ -1695,31 +1844,12 @@ static void fz_convert_edgebuffer_app(fz_context *ctx, fz_rasterizer *ras, int e
 	if (!eb->sorted)
 	{
 		eb->sorted = 1;
-		for (i = 0; i < scanlines; i++)
+		for (i = y0; i < y1; i++)
 		{
 			int *row = &table[index[i]];
 			int rowlen = *row++;
 
-			/* Bubblesort short runs, qsort longer ones. */
-			/* FIXME: Check "6" below */
-			if (rowlen <= 6) {
-				int j, k;
-				for (j = 0; j < rowlen-1; j++) {
-					int * FZ_RESTRICT t = &row[j<<1];
-					for (k = j+1; k < rowlen; k++) {
-						int * FZ_RESTRICT s = &row[k<<1];
-						int tmp;
-						if (t[0] < s[0])
-							continue;
-						if (t[0] > s[0])
-							tmp = t[0], t[0] = s[0], s[0] = tmp;
-						else if (t[0] <= s[1])
-							continue;
-						tmp = t[1]; t[1] = s[1]; s[1] = tmp;
-					}
-				}
-			} else
-				qsort(row, rowlen, 2*sizeof(int), edgecmp);
+			sort_row_app(row, rowlen, eb->sort);
 		}
 
 #ifdef DEBUG_SCAN_CONVERTER
@@ -1731,7 +1861,7 @@ static void fz_convert_edgebuffer_app(fz_context *ctx, fz_rasterizer *ras, int e
 		}
 #endif
 
-		for (i=0; i < scanlines; i++) {
+		for (i = y0; i < y1; i++) {
 			int *row = &table[index[i]];
 			int rowlen = *row++;
 			int *rowstart = row;
@@ -1816,10 +1946,17 @@ static void fz_convert_edgebuffer_app(fz_context *ctx, fz_rasterizer *ras, int e
 	out = pix->samples + pix->stride * (clip->y0 - pix->y) + (clip->x0 - pix->x) * n;
 	if (scanlines > clip->y1 - ras->clip.y0)
 		scanlines = clip->y1 - ras->clip.y0;
+	if (scanlines > y1)
+		scanlines = y1;
 
 	i = (clip->y0 - ras->clip.y0);
 	if (i < 0)
 		return;
+	if (i < y0)
+	{
+		out += pix->stride * (y0 - i);
+		i = y0;
+	}
 	for (; i < scanlines; i++) {
 		int *row = &table[index[i]];
 		int  rowlen = *row++;
@@ -1896,6 +2033,7 @@ static const fz_rasterizer_fns edgebuffer_app =
 	fz_gap_edgebuffer,
 	fz_convert_edgebuffer_app,
 	fz_is_rect_edgebuffer,
+	NULL, /* flush */
 	1 /* Reusable */
 };
 
@@ -1909,6 +2047,7 @@ static const fz_rasterizer_fns edgebuffer_cop =
 	NULL, /* gap */
 	fz_convert_edgebuffer,
 	fz_is_rect_edgebuffer,
+	NULL, /* flush */
 	1 /* Reusable */
 };
 
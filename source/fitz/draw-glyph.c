@@ -28,11 +28,24 @@
 #include <string.h>
 #include <math.h>
 
+#if !defined(_WIN32) && (defined(__GNUC__) || defined(__clang__))
+#define FZ_SHARED_GLYPH_CACHE 1
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define FZ_SHARED_GLYPH_CACHE 0
+#endif
+
 #define MAX_GLYPH_SIZE 256
 #define MAX_CACHE_SIZE (1024*1024)
 
 #define GLYPH_HASH_LEN 509
 
+#define SHARED_GLYPH_HASH_LEN 65521
+
 typedef struct
 {
 	fz_font *font;
@@ -54,17 +67,86 @@ typedef struct fz_glyph_cache_entry
 	fz_glyph *val;
 } fz_glyph_cache_entry;
 
-struct fz_glyph_cache
+/*
+	The shared glyph cache lives in a memory mapped file, so that it
+	can be used by many processes at once. Entries are only ever
+	added (until the file is full), never removed, so readers need no
+	locks. Space is claimed by atomically advancing 'used' (never past
+	the end of the file), the entry is filled in, and it is then
+	published by atomically pushing it onto the head of its bucket's
+	chain. All links are offsets from the start of the file, as each
+	process maps it at a different address.
+*/
+
+enum
 {
-	int refs;
+	SHARED_GLYPH_UNINITIALISED,
+	SHARED_GLYPH_INITIALISING,
+	SHARED_GLYPH_READY
+};
+
+typedef struct
+{
+	char magic[8];
+	uint32_t state;
+	uint32_t size;
+	uint32_t used;
+	uint32_t bucket[SHARED_GLYPH_HASH_LEN];
+} fz_shared_glyph_header;
+
+/* Fonts are identified by their contents, and the other details that
+ * affect how their glyphs are rendered. */
+typedef struct
+{
+	unsigned char digest[16];
+	int subfont;
+	int width;
+	int a, b;
+	int c, d;
+	unsigned short gid;
+	unsigned char e, f;
+	unsigned char fake_bold, fake_italic;
+	unsigned char aa;
+	unsigned char pad;
+} fz_shared_glyph_key;
+
+typedef struct
+{
+	uint32_t next;
+	uint32_t size;
+	fz_shared_glyph_key key;
+	int x, y, w, h;
+	int is_pixmap;
+	unsigned char data[FZ_FLEXIBLE_ARRAY];
+} fz_shared_glyph_entry;
+
+static const char shared_glyph_magic[8] = "MuGlyph";
+
+/* The glyph cache is divided into shards, chosen by the hash of the
+ * glyph key, each with its own lock, hash table and LRU list, so that
+ * threads rendering text at once rarely contend. Each shard is kept
+ * to its share of the maximum size. */
+typedef struct
+{
+	int lock;
+	int hash_len;
 	size_t total;
-#ifndef NDEBUG
-	int num_evictions;
-	ptrdiff_t evicted;
-#endif
-	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
+	size_t max;
+	fz_glyph_cache_entry **entry;
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t evicted;
+} fz_glyph_cache_shard;
+
+struct fz_glyph_cache
+{
+	int refs;
+	fz_glyph_cache_shard shard[FZ_GLYPH_CACHE_SHARDS];
+	fz_shared_glyph_header *shared;
+	size_t shared_size;
 };
 
 static size_t
@@ -75,70 +157,146 @@ fz_glyph_size(fz_context *ctx, fz_glyph *glyph)
 	return sizeof(fz_glyph) + glyph->size + fz_pixmap_size(ctx, glyph->pixmap);
 }
 
+/* Scale the hash tables with the cache size, assuming glyphs of a
+ * few hundred bytes on average. */
+static int
+glyph_hash_len(size_t max)
+{
+	size_t len = max / FZ_GLYPH_CACHE_SHARDS / 512;
+	if (len < GLYPH_HASH_LEN)
+		return GLYPH_HASH_LEN;
+	if (len > 1 << 20)
+		return 1 << 20;
+	return (int)len | 1;
+}
+
 void
 fz_new_glyph_cache_context(fz_context *ctx)
 {
 	fz_glyph_cache *cache;
+	int i;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
-	cache->total = 0;
+	fz_try(ctx)
+	{
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+		{
+			cache->shard[i].lock = FZ_LOCK_GLYPHCACHE + i;
+			cache->shard[i].max = MAX_CACHE_SIZE / FZ_GLYPH_CACHE_SHARDS;
+			cache->shard[i].hash_len = GLYPH_HASH_LEN;
+			cache->shard[i].entry = fz_malloc_array(ctx, GLYPH_HASH_LEN, fz_glyph_cache_entry *);
+			memset(cache->shard[i].entry, 0, GLYPH_HASH_LEN * sizeof(fz_glyph_cache_entry *));
+		}
+	}
+	fz_catch(ctx)
+	{
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+			fz_free(ctx, cache->shard[i].entry);
+		fz_free(ctx, cache);
+		fz_rethrow(ctx);
+	}
 	cache->refs = 1;
 
 	ctx->glyph_cache = cache;
 }
 
 static void
-drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
+drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	if (entry->lru_prev)
 		entry->lru_prev->lru_next = entry->lru_next;
 	else
-		cache->lru_head = entry->lru_next;
-	cache->total -= fz_glyph_size(ctx, entry->val);
+		shard->lru_head = entry->lru_next;
+	shard->total -= fz_glyph_size(ctx, entry->val);
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		shard->entry[entry->hash] = entry->bucket_next;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
 }
 
-/* The glyph cache lock is always held when this function is called. */
+/* The shard lock is always held when this function is called. */
 static void
-do_purge(fz_context *ctx)
+do_purge(fz_context *ctx, fz_glyph_cache_shard *shard)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
-	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	for (i = 0; i < shard->hash_len; i++)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		while (shard->entry[i])
+			drop_glyph_cache_entry(ctx, shard, shard->entry[i]);
 	}
 
-	cache->total = 0;
+	shard->total = 0;
 }
 
 void
 fz_purge_glyph_cache(fz_context *ctx)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	do_purge(ctx);
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	int i;
+
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_lock(ctx, cache->shard[i].lock);
+		do_purge(ctx, &cache->shard[i]);
+		fz_unlock(ctx, cache->shard[i].lock);
+	}
+}
+
+void
+fz_set_glyph_cache_size(fz_context *ctx, size_t max)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	fz_glyph_cache_entry **entry[FZ_GLYPH_CACHE_SHARDS] = { NULL };
+	int hash_len = glyph_hash_len(max);
+	int i;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+		{
+			entry[i] = fz_malloc_array(ctx, hash_len, fz_glyph_cache_entry *);
+			memset(entry[i], 0, hash_len * sizeof(fz_glyph_cache_entry *));
+		}
+	}
+	fz_catch(ctx)
+	{
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+			fz_free(ctx, entry[i]);
+		fz_rethrow(ctx);
+	}
+
+	/* Empty each shard, and swap in its new hash table. */
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_glyph_cache_shard *shard = &cache->shard[i];
+		fz_glyph_cache_entry **old;
+
+		fz_lock(ctx, shard->lock);
+		do_purge(ctx, shard);
+		old = shard->entry;
+		shard->entry = entry[i];
+		shard->hash_len = hash_len;
+		shard->max = max / FZ_GLYPH_CACHE_SHARDS;
+		fz_unlock(ctx, shard->lock);
+		fz_free(ctx, old);
+	}
 }
 
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
+	int i;
+
 	if (!ctx || !ctx->glyph_cache)
 		return;
 
@@ -146,7 +304,15 @@ fz_drop_glyph_cache_context(fz_context *ctx)
 	ctx->glyph_cache->refs--;
 	if (ctx->glyph_cache->refs == 0)
 	{
-		do_purge(ctx);
+		for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+		{
+			do_purge(ctx, &ctx->glyph_cache->shard[i]);
+			fz_free(ctx, ctx->glyph_cache->shard[i].entry);
+		}
+#if FZ_SHARED_GLYPH_CACHE
+		if (ctx->glyph_cache->shared)
+			munmap(ctx->glyph_cache->shared, ctx->glyph_cache->shared_size);
+#endif
 		fz_free(ctx, ctx->glyph_cache);
 		ctx->glyph_cache = NULL;
 	}
@@ -256,7 +422,7 @@ static unsigned do_hash(unsigned char *s, int len)
 }
 
 static inline void
-move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
+move_to_front(fz_glyph_cache_shard *cache, fz_glyph_cache_entry *entry)
 {
 	if (entry->lru_prev == NULL)
 		return; /* At front already */
@@ -275,10 +441,222 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 	entry->lru_prev = NULL;
 }
 
+#if FZ_SHARED_GLYPH_CACHE
+
+void
+fz_use_shared_glyph_cache(fz_context *ctx, const char *filename, size_t size)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	fz_shared_glyph_header *hdr;
+	struct stat info;
+	uint32_t expected = SHARED_GLYPH_UNINITIALISED;
+	int fd;
+
+	if (size < sizeof(fz_shared_glyph_header) || size > UINT32_MAX)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "bad shared glyph cache size");
+
+	fd = open(filename, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot open shared glyph cache '%s': %s", filename, strerror(errno));
+
+	/* If another process has created the file already, use its size.
+	 * Otherwise, size it ourselves; it is filled with zeros, which is
+	 * how an uninitialised cache looks. */
+	if (fstat(fd, &info) < 0 || (info.st_size == 0 && ftruncate(fd, size) < 0))
+	{
+		close(fd);
+		fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot size shared glyph cache '%s': %s", filename, strerror(errno));
+	}
+	if (info.st_size != 0)
+	{
+		if (info.st_size < (off_t)sizeof(fz_shared_glyph_header) || info.st_size > UINT32_MAX)
+		{
+			close(fd);
+			fz_throw(ctx, FZ_ERROR_FORMAT, "incompatible shared glyph cache '%s'", filename);
+		}
+		size = info.st_size;
+	}
+
+	hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot map shared glyph cache '%s': %s", filename, strerror(errno));
+
+	/* The first process to get here initialises the header. Anyone
+	 * else who arrives in the meantime will find the cache not ready,
+	 * and will just not use it until it is. */
+	if (__atomic_compare_exchange_n(&hdr->state, &expected, SHARED_GLYPH_INITIALISING, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		memcpy(hdr->magic, shared_glyph_magic, sizeof hdr->magic);
+		hdr->size = size;
+		hdr->used = sizeof(fz_shared_glyph_header);
+		__atomic_store_n(&hdr->state, SHARED_GLYPH_READY, __ATOMIC_RELEASE);
+	}
+	else if (expected == SHARED_GLYPH_READY && (memcmp(hdr->magic, shared_glyph_magic, sizeof hdr->magic) || hdr->size != size))
+	{
+		munmap(hdr, size);
+		fz_throw(ctx, FZ_ERROR_FORMAT, "incompatible shared glyph cache '%s'", filename);
+	}
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	if (cache->shared)
+		munmap(cache->shared, cache->shared_size);
+	cache->shared = hdr;
+	cache->shared_size = size;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
+/* Returns 0 if glyphs from this font cannot be shared. */
+static int
+make_shared_glyph_key(fz_context *ctx, fz_shared_glyph_key *skey, const fz_glyph_key *key)
+{
+	fz_font *font = key->font;
+
+	if (font->buffer == NULL)
+		return 0;
+
+	memset(skey, 0, sizeof *skey);
+	/* The digest is calculated once, and kept in the font. */
+	fz_lock(ctx, FZ_LOCK_FREETYPE);
+	fz_try(ctx)
+		fz_font_digest(ctx, font, skey->digest);
+	fz_always(ctx)
+		fz_unlock(ctx, FZ_LOCK_FREETYPE);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	skey->subfont = font->subfont;
+	skey->width = -1;
+	if (font->flags.ft_stretch && font->width_table)
+		skey->width = key->gid < font->width_count ? font->width_table[key->gid] : font->width_default;
+	skey->a = key->a;
+	skey->b = key->b;
+	skey->c = key->c;
+	skey->d = key->d;
+	skey->gid = key->gid;
+	skey->e = key->e;
+	skey->f = key->f;
+	skey->fake_bold = font->flags.fake_bold;
+	skey->fake_italic = font->flags.fake_italic;
+	skey->aa = key->aa;
+	return 1;
+}
+
+/* The size of the cache, trusting the header only as far as our mapping. */
+static uint32_t
+shared_glyph_size(fz_glyph_cache *cache)
+{
+	uint32_t size = cache->shared->size;
+	return size < cache->shared_size ? size : (uint32_t)cache->shared_size;
+}
+
+static fz_glyph *
+find_shared_glyph(fz_context *ctx, fz_glyph_cache *cache, const fz_shared_glyph_key *skey, unsigned hash)
+{
+	fz_shared_glyph_header *hdr = cache->shared;
+	unsigned char *base = (unsigned char *)hdr;
+	uint32_t size = shared_glyph_size(cache);
+	/* No chain can be longer than this, unless the file is corrupt. */
+	uint32_t steps = size / sizeof(fz_shared_glyph_entry);
+	uint32_t off;
+
+	if (__atomic_load_n(&hdr->state, __ATOMIC_ACQUIRE) != SHARED_GLYPH_READY)
+		return NULL;
+
+	off = __atomic_load_n(&hdr->bucket[hash % SHARED_GLYPH_HASH_LEN], __ATOMIC_ACQUIRE);
+	while (off != 0 && off <= size - sizeof(fz_shared_glyph_entry) && steps-- > 0)
+	{
+		fz_shared_glyph_entry *entry = (fz_shared_glyph_entry *)(base + off);
+
+		if (!memcmp(&entry->key, skey, sizeof *skey))
+		{
+			if (entry->size > size - off - sizeof(fz_shared_glyph_entry))
+				return NULL;
+			if (entry->is_pixmap)
+			{
+				fz_pixmap *pix;
+				if ((size_t)entry->w * entry->h != entry->size)
+					return NULL;
+				pix = fz_new_pixmap(ctx, NULL, entry->w, entry->h, NULL, 1);
+				pix->x = entry->x;
+				pix->y = entry->y;
+				memcpy(pix->samples, entry->data, entry->size);
+				return fz_new_glyph_from_pixmap(ctx, pix);
+			}
+			return fz_new_glyph_from_rle_data(ctx, entry->x, entry->y, entry->w, entry->h, entry->data, entry->size);
+		}
+		off = entry->next;
+	}
+
+	return NULL;
+}
+
+static void
+insert_shared_glyph(fz_context *ctx, fz_glyph_cache *cache, const fz_shared_glyph_key *skey, unsigned hash, fz_glyph *glyph)
+{
+	fz_shared_glyph_header *hdr = cache->shared;
+	unsigned char *base = (unsigned char *)hdr;
+	uint32_t max = shared_glyph_size(cache);
+	fz_shared_glyph_entry *entry;
+	fz_pixmap *pix = glyph->pixmap;
+	uint32_t *bucket = &hdr->bucket[hash % SHARED_GLYPH_HASH_LEN];
+	uint32_t off, head, size, need;
+
+	if (__atomic_load_n(&hdr->state, __ATOMIC_ACQUIRE) != SHARED_GLYPH_READY)
+		return;
+
+	if (pix)
+	{
+		/* Only plain alpha only pixmaps (as rendered by freetype). */
+		if (pix->n != 1 || pix->colorspace || pix->stride != pix->w)
+			return;
+		size = pix->w * pix->h;
+	}
+	else
+		size = glyph->size;
+
+	/* Claim space, keeping entries aligned. Never advance 'used' past
+	 * the end, or repeated failures could wrap it back to the start. */
+	need = (sizeof(fz_shared_glyph_entry) + size + 7) & ~7;
+	off = __atomic_load_n(&hdr->used, __ATOMIC_RELAXED);
+	do
+	{
+		if (off > max || need > max - off)
+			return; /* Full */
+	}
+	while (!__atomic_compare_exchange_n(&hdr->used, &off, off + need, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	entry = (fz_shared_glyph_entry *)(base + off);
+	entry->key = *skey;
+	entry->size = size;
+	entry->x = glyph->x;
+	entry->y = glyph->y;
+	entry->w = glyph->w;
+	entry->h = glyph->h;
+	entry->is_pixmap = (pix != NULL);
+	memcpy(entry->data, pix ? pix->samples : glyph->data, size);
+
+	/* Publish it. */
+	head = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+	do
+		entry->next = head;
+	while (!__atomic_compare_exchange_n(bucket, &head, off, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+#else
+
+void
+fz_use_shared_glyph_cache(fz_context *ctx, const char *filename, size_t size)
+{
+	fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "shared glyph cache not supported on this platform");
+}
+
+#endif
+
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor, int alpha, int aa)
 {
 	fz_glyph_cache *cache;
+	fz_glyph_cache_shard *shard;
 	fz_glyph_key key;
 	fz_matrix subpix_ctm;
 	fz_irect subpix_scissor;
@@ -322,22 +700,34 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = aa;
 
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	entry = cache->entry[hash];
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+	shard = &cache->shard[hash % FZ_GLYPH_CACHE_SHARDS];
+	fz_lock(ctx, shard->lock);
+	hash = (hash / FZ_GLYPH_CACHE_SHARDS) % shard->hash_len;
+	entry = shard->entry[hash];
 	while (entry)
 	{
 		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 		{
-			move_to_front(cache, entry);
+			move_to_front(shard, entry);
 			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			shard->hits++;
+			fz_unlock(ctx, shard->lock);
 			return val;
 		}
 		entry = entry->bucket_next;
 	}
-
-	locked = 1;
+	shard->misses++;
+
+	/* We drop the shard lock while we render, so that other threads
+	 * can use the cache meanwhile. The danger here is that some other
+	 * thread will come along, and want the same glyph too. If it does,
+	 * we may both end up rendering it. We cope with this later on, by
+	 * ensuring that only one gets inserted into the cache. If we insert
+	 * ours to find one already there, we abandon ours, and use the one
+	 * there already. */
+	fz_unlock(ctx, shard->lock);
+	locked = 0;
 	caching = 0;
 	val = NULL;
 
@@ -345,24 +735,30 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	{
 		if (is_ft_font)
 		{
+#if FZ_SHARED_GLYPH_CACHE
+			/* Another process may have rendered it already. */
+			fz_shared_glyph_key skey;
+			int shared = do_cache && cache->shared && make_shared_glyph_key(ctx, &skey, &key);
+			unsigned shared_hash = 0;
+
+			if (shared)
+			{
+				shared_hash = do_hash((unsigned char *)&skey, sizeof skey);
+				val = find_shared_glyph(ctx, cache, &skey, shared_hash);
+			}
+			if (val == NULL)
+			{
+				val = fz_render_ft_glyph(ctx, font, gid, subpix_ctm, aa);
+				if (val && shared && val->w < MAX_GLYPH_SIZE && val->h < MAX_GLYPH_SIZE)
+					insert_shared_glyph(ctx, cache, &skey, shared_hash, val);
+			}
+#else
 			val = fz_render_ft_glyph(ctx, font, gid, subpix_ctm, aa);
+#endif
 		}
 		else if (fz_font_t3_procs(ctx, font))
 		{
-			/* We drop the glyphcache here, and execute the t3
-			 * glyph code. The danger here is that some other
-			 * thread will come along, and want the same glyph
-			 * too. If it does, we may both end up rendering
-			 * pixmaps. We cope with this later on, by ensuring
-			 * that only one gets inserted into the cache. If
-			 * we insert ours to find one already there, we
-			 * abandon ours, and use the one there already.
-			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 0;
 			val = fz_render_t3_glyph(ctx, font, gid, subpix_ctm, model, scissor, aa);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-			locked = 1;
 		}
 		else
 		{
@@ -375,49 +771,47 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				/* If we throw an exception whilst caching,
 				 * just ignore the exception and carry on. */
 				caching = 1;
-				if (!is_ft_font)
+				fz_lock(ctx, shard->lock);
+				locked = 1;
+
+				/* Someone else might have rendered it in the
+				 * meantime. */
+				entry = shard->entry[hash];
+				while (entry)
 				{
-					/* We had to unlock. Someone else might
-					 * have rendered in the meantime */
-					entry = cache->entry[hash];
-					while (entry)
+					if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 					{
-						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
-						{
-							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
-							val = fz_keep_glyph(ctx, entry->val);
-							goto unlock_and_return_val;
-						}
-						entry = entry->bucket_next;
+						fz_drop_glyph(ctx, val);
+						move_to_front(shard, entry);
+						val = fz_keep_glyph(ctx, entry->val);
+						goto unlock_and_return_val;
 					}
+					entry = entry->bucket_next;
 				}
 
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
 				entry->key = key;
 				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
+				entry->bucket_next = shard->entry[hash];
 				if (entry->bucket_next)
 					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
+				shard->entry[hash] = entry;
 				entry->val = fz_keep_glyph(ctx, val);
 				fz_keep_font(ctx, key.font);
 
-				entry->lru_next = cache->lru_head;
+				entry->lru_next = shard->lru_head;
 				if (entry->lru_next)
 					entry->lru_next->lru_prev = entry;
 				else
-					cache->lru_tail = entry;
-				cache->lru_head = entry;
+					shard->lru_tail = entry;
+				shard->lru_head = entry;
 
-				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
+				shard->total += fz_glyph_size(ctx, val);
+				while (shard->total > shard->max)
 				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
+					shard->evictions++;
+					shard->evicted += fz_glyph_size(ctx, shard->lru_tail->val);
+					drop_glyph_cache_entry(ctx, shard, shard->lru_tail);
 				}
 			}
 		}
@@ -428,7 +822,7 @@ unlock_and_return_val:
 	fz_always(ctx)
 	{
 		if (locked)
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, shard->lock);
 	}
 	fz_catch(ctx)
 	{
@@ -478,11 +872,34 @@ fz_render_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm,
 }
 
 void
-fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
+fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
-	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", cache->total);
-#ifndef NDEBUG
-	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_glyph_cache_shard *shard = &cache->shard[i];
+
+		fz_lock(ctx, shard->lock);
+		stats->size += shard->total;
+		stats->max += shard->max;
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+		stats->evicted_bytes += shard->evicted;
+		fz_unlock(ctx, shard->lock);
+	}
+}
+
+void
+fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
+{
+	fz_glyph_cache_stats stats;
+
+	fz_get_glyph_cache_stats(ctx, &stats);
+	fz_write_printf(ctx, out, "Glyph Cache Size: %zu (max %zu)\n", stats.size, stats.max);
+	fz_write_printf(ctx, out, "Glyph Cache Hits: %lu, Misses: %lu\n", stats.hits, stats.misses);
+	fz_write_printf(ctx, out, "Glyph Cache Evictions: %lu (%lu bytes)\n", stats.evictions, stats.evicted_bytes);
 }
@@ -38,6 +38,41 @@ static inline int fz_idiv_up(int a, int b)
 	return a < 0 ? a / b : (a + b - 1) / b;
 }
 
+#if ARCH_HAS_SSE || ARCH_HAS_NEON
+
+/* The SIMD cores in the draw code are only worthwhile once specialised
+ * for each pixel layout, so their entry points switch once per span to
+ * copies that must really be inlined. fz_forceinline is only a hint to
+ * gcc and clang. */
+#if defined(__GNUC__)
+#define simd_forceinline inline __attribute__((always_inline))
+#else
+#define simd_forceinline fz_forceinline
+#endif
+
+/* Call CALL(n1, sa, da) with constant arguments for 1, 3 or 4 colour
+ * components with or without source and destination alpha, and return
+ * 1; or return 0 for any other layout. */
+#define SIMD_LAYOUT_SWITCH(n1, sa, da, CALL) \
+	switch (((n1)<<2) | ((sa)<<1) | (da)) \
+	{ \
+	case (1<<2): CALL(1, 0, 0); return 1; \
+	case (1<<2)|1: CALL(1, 0, 1); return 1; \
+	case (1<<2)|2: CALL(1, 1, 0); return 1; \
+	case (1<<2)|3: CALL(1, 1, 1); return 1; \
+	case (3<<2): CALL(3, 0, 0); return 1; \
+	case (3<<2)|1: CALL(3, 0, 1); return 1; \
+	case (3<<2)|2: CALL(3, 1, 0); return 1; \
+	case (3<<2)|3: CALL(3, 1, 1); return 1; \
+	case (4<<2): CALL(4, 0, 0); return 1; \
+	case (4<<2)|1: CALL(4, 0, 1); return 1; \
+	case (4<<2)|2: CALL(4, 1, 0); return 1; \
+	case (4<<2)|3: CALL(4, 1, 1); return 1; \
+	} \
+	return 0
+
+#endif
+
 #ifdef AA_BITS
 
 #define fz_aa_scale 0
@@ -163,6 +198,7 @@ typedef void (fz_rasterizer_gap_fn)(fz_context *ctx, fz_rasterizer *r);
 typedef fz_irect *(fz_rasterizer_bound_fn)(fz_context *ctx, const fz_rasterizer *r, fz_irect *bbox);
 typedef void (fz_rasterizer_fn)(fz_context *ctx, fz_rasterizer *r, int eofill, const fz_irect *clip, fz_pixmap *pix, unsigned char *colorbv, fz_overprint *eop);
 typedef int (fz_rasterizer_is_rect_fn)(fz_context *ctx, fz_rasterizer *r);
+typedef void (fz_rasterizer_flush_fn)(fz_context *ctx, fz_rasterizer *r);
 
 typedef struct
 {
@@ -174,6 +210,7 @@ typedef struct
 	fz_rasterizer_gap_fn *gap;
 	fz_rasterizer_fn *convert;
 	fz_rasterizer_is_rect_fn *is_rect;
+	fz_rasterizer_flush_fn *flush;
 	int reusable;
 } fz_rasterizer_fns;
 
@@ -379,6 +416,20 @@ static inline int fz_is_rect_rasterizer(fz_context *ctx, fz_rasterizer *r)
 	return r->fns.is_rect(ctx, r);
 }
 
+/*
+	fz_flush_rasterizer: Rasterizers that batch up paths (see
+	fz_new_sparse_rasterizer) may not have painted everything
+	converted so far. Paint anything pending.
+
+	This must be called before anything else touches a pixmap that
+	has been converted into, and before it is freed.
+*/
+static inline void fz_flush_rasterizer(fz_context *ctx, fz_rasterizer *r)
+{
+	if (r->fns.flush)
+		r->fns.flush(ctx, r);
+}
+
 void *fz_new_rasterizer_of_size(fz_context *ctx, int size, const fz_rasterizer_fns *fns);
 
 #define fz_new_derived_rasterizer(C,M,F) \
@@ -443,9 +494,29 @@ typedef enum
 
 fz_rasterizer *fz_new_edgebuffer(fz_context *ctx, fz_edgebuffer_rule rule);
 
+/*
+	fz_new_sparse_rasterizer: Create a rasterizer that accumulates
+	the coverage of successive paths converted to the same pixmap
+	in the same color, and only paints it when flushed (or when
+	something else is converted). Each path must be one that would
+	be painted opaquely.
+
+	aa: The antialiasing settings to use (or NULL).
+*/
+fz_rasterizer *fz_new_sparse_rasterizer(fz_context *ctx, const fz_aa_context *aa);
+
 int fz_flatten_fill_path(fz_context *ctx, fz_rasterizer *rast, const fz_path *path, fz_matrix ctm, float flatness, fz_irect scissor, fz_irect *bbox);
 int fz_flatten_stroke_path(fz_context *ctx, fz_rasterizer *rast, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth, fz_irect scissor, fz_irect *bbox);
 
+/*
+	As fz_flatten_fill_path and fz_flatten_stroke_path, but keep the
+	edges in the store, so that flattening the same path again at
+	the same scale and rotation (at any translation) just replays
+	them. The edges given to the rasterizer are identical.
+*/
+int fz_flatten_fill_path_cached(fz_context *ctx, fz_rasterizer *rast, const fz_path *path, fz_matrix ctm, float flatness, fz_irect scissor, fz_irect *bbox);
+int fz_flatten_stroke_path_cached(fz_context *ctx, fz_rasterizer *rast, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth, fz_irect scissor, fz_irect *bbox);
+
 fz_irect *fz_bound_path_accurate(fz_context *ctx, fz_irect *bbox, fz_irect scissor, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth);
 
 typedef void (fz_solid_color_painter_t)(unsigned char * FZ_RESTRICT dp, int n, int w, const unsigned char * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop);
@@ -101,6 +101,47 @@ and stick to using the premultiplied form.
 
 typedef unsigned char byte;
 
+/* Optional SIMD cores for the common 1, 3 and 4 component painters.
+ * These do whole blocks of 16 pixels, and leave the remainder of each
+ * span to the C code below, giving identical results (which
+ * scripts/paintcheck.c checks). The NEON cores are only used when
+ * FZ_ENABLE_DRAW_NEON is set. */
+
+#if ARCH_HAS_SSE
+#include "draw-paint_sse.h"
+#define template_span_with_color_simd template_span_with_color_sse
+#define template_solid_color_simd template_solid_color_sse
+#elif ARCH_HAS_NEON && FZ_ENABLE_DRAW_NEON
+#include "draw-paint_neon.h"
+#define template_span_with_color_simd template_span_with_color_neon
+#define template_solid_color_simd template_solid_color_neon
+#endif
+
+#ifdef template_span_with_color_simd
+#define SPAN_WITH_COLOR_SIMD(dp, mp, n, w, color, da, sa) \
+	do { \
+		int done = template_span_with_color_simd(dp, mp, n, w, color, da, sa); \
+		if (done == w) \
+			return; \
+		dp += done * n; \
+		mp += done; \
+		w -= done; \
+	} while (0)
+#define SOLID_COLOR_SIMD(dp, n, w, color, da, sa) \
+	do { \
+		int done = (sa) == 256 ? \
+			template_solid_color_simd(dp, n, w, color, da) : \
+			template_span_with_color_simd(dp, NULL, n, w, color, da, sa); \
+		if (done == w) \
+			return; \
+		dp += done * n; \
+		w -= done; \
+	} while (0)
+#else
+#define SPAN_WITH_COLOR_SIMD(dp, mp, n, w, color, da, sa) do { } while (0)
+#define SOLID_COLOR_SIMD(dp, n, w, color, da, sa) do { } while (0)
+#endif
+
 /* These are used by the non-aa scan converter */
 
 static fz_forceinline void
@@ -491,6 +532,7 @@ template_solid_color_0_da(byte * FZ_RESTRICT dp, int w, int sa)
 static void paint_solid_color_1_alpha(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SOLID_COLOR_SIMD(dp, 1, w, color, 0, FZ_EXPAND(color[1]));
 	template_solid_color_N_sa(dp, 1, w, color, 0, FZ_EXPAND(color[1]));
 }
 
@@ -503,6 +545,7 @@ static void paint_solid_color_1(byte * FZ_RESTRICT dp, int n, int w, const byte
 static void paint_solid_color_1_da(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SOLID_COLOR_SIMD(dp, 2, w, color, 1, FZ_EXPAND(color[1]));
 	template_solid_color_1_da(dp, 2, w, color, 1);
 }
 #endif /* FZ_PLOTTERS_G */
@@ -517,18 +560,21 @@ static void paint_solid_color_0_da(byte * FZ_RESTRICT dp, int n, int w, const by
 static void paint_solid_color_3_alpha(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SOLID_COLOR_SIMD(dp, 3, w, color, 0, FZ_EXPAND(color[3]));
 	template_solid_color_N_sa(dp, 3, w, color, 0, FZ_EXPAND(color[3]));
 }
 
 static void paint_solid_color_3(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SOLID_COLOR_SIMD(dp, 3, w, color, 0, 256);
 	template_solid_color_N_256(dp, 3, w, color, 0);
 }
 
 static void paint_solid_color_3_da(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SOLID_COLOR_SIMD(dp, 4, w, color, 1, FZ_EXPAND(color[3]));
 	template_solid_color_3_da(dp, 4, w, color, 1);
 }
 #endif /* FZ_PLOTTERS_RGB */
@@ -537,12 +583,14 @@ static void paint_solid_color_3_da(byte * FZ_RESTRICT dp, int n, int w, const by
 static void paint_solid_color_4_alpha(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SOLID_COLOR_SIMD(dp, 4, w, color, 0, FZ_EXPAND(color[4]));
 	template_solid_color_N_sa(dp, 4, w, color, 0, FZ_EXPAND(color[4]));
 }
 
 static void paint_solid_color_4(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SOLID_COLOR_SIMD(dp, 4, w, color, 0, 256);
 	template_solid_color_N_256(dp, 4, w, color, 0);
 }
 
@@ -954,6 +1002,7 @@ static void
 paint_span_with_color_0_da_solid(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 1, w, color, 1, 256);
 	template_span_with_color_N_general_solid(dp, mp, 1, w, color, 1);
 }
 
@@ -961,6 +1010,7 @@ static void
 paint_span_with_color_0_da_alpha(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 1, w, color, 1, FZ_EXPAND(color[0]));
 	template_span_with_color_N_general_alpha(dp, mp, 1, w, color, 1);
 }
 
@@ -968,6 +1018,7 @@ static void
 paint_span_with_color_1_solid(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 1, w, color, 0, 256);
 	template_span_with_color_N_general_solid(dp, mp, 1, w, color, 0);
 }
 
@@ -975,6 +1026,7 @@ static void
 paint_span_with_color_1_alpha(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 1, w, color, 0, FZ_EXPAND(color[1]));
 	template_span_with_color_N_general_alpha(dp, mp, 1, w, color, 0);
 }
 
@@ -982,6 +1034,7 @@ static void
 paint_span_with_color_1_da_solid(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 2, w, color, 1, 256);
 	template_span_with_color_1_da_solid(dp, mp, 2, w, color, 1);
 }
 
@@ -989,6 +1042,7 @@ static void
 paint_span_with_color_1_da_alpha(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 2, w, color, 1, FZ_EXPAND(color[1]));
 	template_span_with_color_1_da_alpha(dp, mp, 2, w, color, 1);
 }
 
@@ -997,6 +1051,7 @@ static void
 paint_span_with_color_3_solid(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 3, w, color, 0, 256);
 	template_span_with_color_N_general_solid(dp, mp, 3, w, color, 0);
 }
 
@@ -1004,6 +1059,7 @@ static void
 paint_span_with_color_3_da_solid(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 4, w, color, 1, 256);
 	template_span_with_color_3_da_solid(dp, mp, 4, w, color, 1);
 }
 
@@ -1011,6 +1067,7 @@ static void
 paint_span_with_color_3_alpha(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 3, w, color, 0, FZ_EXPAND(color[3]));
 	template_span_with_color_N_general_alpha(dp, mp, 3, w, color, 0);
 }
 
@@ -1018,6 +1075,7 @@ static void
 paint_span_with_color_3_da_alpha(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 4, w, color, 1, FZ_EXPAND(color[3]));
 	template_span_with_color_3_da_alpha(dp, mp, 4, w, color, 1);
 }
 #endif /* FZ_PLOTTERS_RGB */
@@ -1027,6 +1085,7 @@ static void
 paint_span_with_color_4_solid(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 4, w, color, 0, 256);
 	template_span_with_color_N_general_solid(dp, mp, 4, w, color, 0);
 }
 
@@ -1034,6 +1093,7 @@ static void
 paint_span_with_color_4_alpha(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 4, w, color, 0, FZ_EXPAND(color[4]));
 	template_span_with_color_N_general_alpha(dp, mp, 4, w, color, 0);
 }
 
@@ -1041,6 +1101,7 @@ static void
 paint_span_with_color_4_da_solid(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 5, w, color, 1, 256);
 	template_span_with_color_4_da_solid(dp, mp, 5, w, color, 1);
 }
 
@@ -1048,6 +1109,7 @@ static void
 paint_span_with_color_4_da_alpha(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
 {
 	TRACK_FN();
+	SPAN_WITH_COLOR_SIMD(dp, mp, 5, w, color, 1, FZ_EXPAND(color[4]));
 	template_span_with_color_4_da_alpha(dp, mp, 5, w, color, 1);
 }
 #endif /* FZ_PLOTTERS_CMYK */
@@ -0,0 +1,179 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+/* This file is included from draw-paint.c if NEON cores are allowed. */
+
+#include "arm_neon.h"
+
+/* FZ_BLEND of a constant source into 16 bytes. As (DST<<8) +
+ * (SRC-DST)*AMOUNT == DST*(256-AMOUNT) + SRC*AMOUNT, and the latter
+ * never exceeds 255*256, this can be done with unsigned 16-bit
+ * arithmetic and gives results identical to the C code. */
+static fz_forceinline uint8x16_t
+blend_neon(uint16_t src, uint8x16_t dst, uint16x8_t mlo, uint16x8_t mhi)
+{
+	uint16x8_t k256 = vdupq_n_u16(256);
+	uint16x8_t lo = vmulq_u16(vmovl_u8(vget_low_u8(dst)), vsubq_u16(k256, mlo));
+	uint16x8_t hi = vmulq_u16(vmovl_u8(vget_high_u8(dst)), vsubq_u16(k256, mhi));
+	lo = vmlaq_n_u16(lo, mlo, src);
+	hi = vmlaq_n_u16(hi, mhi, src);
+	return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+/* FZ_EXPAND, and FZ_COMBINE with sa where sa < 256. */
+static fz_forceinline uint16x8_t
+expand_mask_neon(uint8x8_t m8, uint16_t sa, int solid)
+{
+	uint16x8_t m = vmovl_u8(m8);
+	m = vsraq_n_u16(m, m, 7);
+	if (!solid)
+		m = vshrq_n_u16(vmulq_n_u16(m, sa), 8);
+	return m;
+}
+
+/*
+	Plot color through mask over n byte pixels, 16 pixels at a time,
+	using the de-interleaving loads for n <= 4. If da, the last
+	component of each pixel is alpha and is blended towards 255. sa is
+	the expanded alpha of color (256 for solid). A NULL mp is taken
+	to be a fully opaque mask.
+
+	Returns the number of pixels done; the caller finishes the span
+	using the C code.
+*/
+static fz_forceinline int
+template_span_with_color_neon(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, int sa)
+{
+	uint16_t c[4];
+	int solid = (sa == 256);
+	int k, done = w & ~15;
+
+	if (n > 4 || done == 0)
+		return 0;
+
+	for (k = 0; k < n; k++)
+		c[k] = (da && k == n - 1) ? 255 : color[k];
+
+	for (w = done; w > 0; w -= 16)
+	{
+		uint8x16_t m = vdupq_n_u8(255);
+		uint16x8_t mlo, mhi;
+
+		if (mp)
+		{
+			m = vld1q_u8(mp);
+			mp += 16;
+		}
+		mlo = expand_mask_neon(vget_low_u8(m), sa, solid);
+		mhi = expand_mask_neon(vget_high_u8(m), sa, solid);
+
+		switch (n)
+		{
+		case 1:
+			vst1q_u8(dp, blend_neon(c[0], vld1q_u8(dp), mlo, mhi));
+			break;
+		case 2:
+		{
+			uint8x16x2_t d = vld2q_u8(dp);
+			d.val[0] = blend_neon(c[0], d.val[0], mlo, mhi);
+			d.val[1] = blend_neon(c[1], d.val[1], mlo, mhi);
+			vst2q_u8(dp, d);
+			break;
+		}
+		case 3:
+		{
+			uint8x16x3_t d = vld3q_u8(dp);
+			d.val[0] = blend_neon(c[0], d.val[0], mlo, mhi);
+			d.val[1] = blend_neon(c[1], d.val[1], mlo, mhi);
+			d.val[2] = blend_neon(c[2], d.val[2], mlo, mhi);
+			vst3q_u8(dp, d);
+			break;
+		}
+		case 4:
+		{
+			uint8x16x4_t d = vld4q_u8(dp);
+			d.val[0] = blend_neon(c[0], d.val[0], mlo, mhi);
+			d.val[1] = blend_neon(c[1], d.val[1], mlo, mhi);
+			d.val[2] = blend_neon(c[2], d.val[2], mlo, mhi);
+			d.val[3] = blend_neon(c[3], d.val[3], mlo, mhi);
+			vst4q_u8(dp, d);
+			break;
+		}
+		}
+		dp += 16 * n;
+	}
+
+	return done;
+}
+
+/*
+	Fill w pixels of n bytes with opaque color. If da, the last
+	component of each pixel is set to 255.
+
+	The C code does this a pixel at a time, which matters for the
+	aliased rasterizers that plot every run of a scanline as a solid
+	span. Here 16 pixels are stored at a time with the interleaving
+	stores, and the end of the span is done by a final store
+	overlapping the previous one, so no C tail is left.
+
+	Returns the number of pixels done (0 for spans shorter than 16
+	pixels).
+*/
+static fz_forceinline int
+template_solid_color_neon(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da)
+{
+	uint8x16x4_t col;
+	int k;
+
+	if (n > 4 || w < 16)
+		return 0;
+
+	for (k = 0; k < n; k++)
+		col.val[k] = vdupq_n_u8((da && k == n - 1) ? 255 : color[k]);
+
+	for (k = 0; k < w; k += 16)
+	{
+		byte *d = dp + (k < w - 16 ? k : w - 16) * n;
+		switch (n)
+		{
+		case 1:
+			vst1q_u8(d, col.val[0]);
+			break;
+		case 2:
+		{
+			uint8x16x2_t c2 = { { col.val[0], col.val[1] } };
+			vst2q_u8(d, c2);
+			break;
+		}
+		case 3:
+		{
+			uint8x16x3_t c3 = { { col.val[0], col.val[1], col.val[2] } };
+			vst3q_u8(d, c3);
+			break;
+		}
+		case 4:
+			vst4q_u8(d, col);
+			break;
+		}
+	}
+	return w;
+}
@@ -0,0 +1,235 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+/* This file is included from draw-paint.c if SSE cores are allowed. */
+
+#include <emmintrin.h>
+#include <smmintrin.h>
+
+/* For each pixel size n, the n rows starting at row n*(n-1)/2 map the
+ * bytes of 16 consecutive pixels onto the index of their mask byte. */
+static const uint8_t span_shuffle_sse[15][16] =
+{
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+
+	{ 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7 },
+	{ 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, 15, 15 },
+
+	{ 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5 },
+	{ 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10 },
+	{ 10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15 },
+
+	{ 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 },
+	{ 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7 },
+	{ 8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11 },
+	{ 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15 },
+
+	{ 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 3 },
+	{ 3, 3, 3, 3, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 6, 6 },
+	{ 6, 6, 6, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 9, 9, 9 },
+	{ 9, 9, 10, 10, 10, 10, 10, 11, 11, 11, 11, 11, 12, 12, 12, 12 },
+	{ 12, 13, 13, 13, 13, 13, 14, 14, 14, 14, 14, 15, 15, 15, 15, 15 },
+};
+
+/* The component index of each byte of 16 consecutive 3 and 5 byte
+ * pixels. */
+static const uint8_t solid_shuffle_sse[8][16] =
+{
+	{ 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0 },
+	{ 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1 },
+	{ 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2, 0, 1, 2 },
+
+	{ 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0 },
+	{ 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1 },
+	{ 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2 },
+	{ 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3 },
+	{ 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4, 0, 1, 2, 3, 4 },
+};
+
+/* FZ_BLEND on 8 16-bit lanes. As (DST<<8) + (SRC-DST)*AMOUNT ==
+ * DST*(256-AMOUNT) + SRC*AMOUNT, and the latter never exceeds 255*256,
+ * this can be done with unsigned 16-bit arithmetic and gives results
+ * identical to the C code. */
+static fz_forceinline __m128i
+blend_sse(__m128i src, __m128i dst, __m128i amount)
+{
+	__m128i inv = _mm_sub_epi16(_mm_set1_epi16(256), amount);
+	return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(dst, inv), _mm_mullo_epi16(src, amount)), 8);
+}
+
+/* FZ_EXPAND, and FZ_COMBINE with sa where sa < 256, on 8 16-bit lanes. */
+static fz_forceinline __m128i
+expand_mask_sse(__m128i m, __m128i sa, int solid)
+{
+	m = _mm_add_epi16(m, _mm_srli_epi16(m, 7));
+	if (!solid)
+		m = _mm_srli_epi16(_mm_mullo_epi16(m, sa), 8);
+	return m;
+}
+
+/*
+	Plot color through mask over n byte pixels, 16 pixels at a time.
+	If da, the last component of each pixel is alpha and is blended
+	towards 255. sa is the expanded alpha of color (256 for solid).
+	A NULL mp is taken to be a fully opaque mask.
+
+	Returns the number of pixels done; the caller finishes the span
+	using the C code.
+*/
+static fz_forceinline int
+template_span_with_color_sse(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, int sa)
+{
+	const uint8_t (*shuffle)[16] = &span_shuffle_sse[n * (n - 1) / 2];
+	__m128i col[5], clo[5], chi[5];
+	__m128i zero = _mm_setzero_si128();
+	__m128i ones = _mm_set1_epi8(-1);
+	__m128i vsa = _mm_set1_epi16(sa);
+	int solid = (sa == 256);
+	int v, c, done = w & ~15;
+	byte px[8] = { 0 };
+
+	if (done == 0)
+		return 0;
+
+	/* Spans are often short, so keep the setup cheap: pixels of 1, 2
+	 * or 4 bytes are a single broadcast. */
+	for (c = 0; c < n; c++)
+		px[c] = (da && c == n - 1) ? 255 : color[c];
+	if (n == 1)
+		col[0] = _mm_set1_epi8(px[0]);
+	else if (n == 2)
+		col[0] = col[1] = _mm_set1_epi16(px[0] | (px[1] << 8));
+	else if (n == 4)
+		col[0] = col[1] = col[2] = col[3] = _mm_set1_epi32(px[0] | (px[1] << 8) | (px[2] << 16) | ((unsigned int)px[3] << 24));
+	else
+	{
+		const uint8_t (*pattern)[16] = &solid_shuffle_sse[n == 3 ? 0 : 3];
+		__m128i p = _mm_loadl_epi64((const __m128i *)px);
+		for (v = 0; v < n; v++)
+			col[v] = _mm_shuffle_epi8(p, _mm_loadu_si128((const __m128i *)pattern[v]));
+	}
+
+	for (v = 0; v < n; v++)
+	{
+		clo[v] = _mm_unpacklo_epi8(col[v], zero);
+		chi[v] = _mm_unpackhi_epi8(col[v], zero);
+	}
+
+	for (w = done; w > 0; w -= 16)
+	{
+		__m128i m;
+
+		if (mp)
+		{
+			m = _mm_loadu_si128((const __m128i *)mp);
+			mp += 16;
+			if (_mm_testz_si128(m, m))
+			{
+				dp += 16 * n;
+				continue;
+			}
+		}
+		else
+			m = ones;
+
+		if (solid && _mm_testc_si128(m, ones))
+		{
+			for (v = 0; v < n; v++)
+				_mm_storeu_si128((__m128i *)(dp + 16 * v), col[v]);
+		}
+		else
+		{
+			for (v = 0; v < n; v++)
+			{
+				__m128i mv = n == 1 ? m : _mm_shuffle_epi8(m, _mm_loadu_si128((const __m128i *)shuffle[v]));
+				__m128i d = _mm_loadu_si128((const __m128i *)(dp + 16 * v));
+				__m128i mlo = expand_mask_sse(_mm_unpacklo_epi8(mv, zero), vsa, solid);
+				__m128i mhi = expand_mask_sse(_mm_unpackhi_epi8(mv, zero), vsa, solid);
+				__m128i lo = blend_sse(clo[v], _mm_unpacklo_epi8(d, zero), mlo);
+				__m128i hi = blend_sse(chi[v], _mm_unpackhi_epi8(d, zero), mhi);
+				_mm_storeu_si128((__m128i *)(dp + 16 * v), _mm_packus_epi16(lo, hi));
+			}
+		}
+		dp += 16 * n;
+	}
+
+	return done;
+}
+
+/*
+	Fill w pixels of n bytes with opaque color. If da, the last
+	component of each pixel is set to 255.
+
+	The C code does this a pixel at a time, which matters for the
+	aliased rasterizers that plot every run of a scanline as a solid
+	span. Here whole vectors are stored, and the end of the span is
+	done by a final store overlapping the previous one, so no C tail
+	is left.
+
+	Returns the number of pixels done (0 for spans shorter than one
+	vector).
+*/
+static fz_forceinline int
+template_solid_color_sse(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da)
+{
+	__m128i col[5];
+	byte px[8] = { 0 };
+	int c, k, v, bytes;
+
+	/* The C code for single bytes is a memset already. */
+	if (n == 1)
+		return 0;
+
+	for (c = 0; c < n; c++)
+		px[c] = (da && c == n - 1) ? 255 : color[c];
+
+	if (n == 2 || n == 4)
+	{
+		bytes = w * n;
+		if (bytes < 16)
+			return 0;
+		if (n == 2)
+			col[0] = _mm_set1_epi16(px[0] | (px[1] << 8));
+		else
+			col[0] = _mm_set1_epi32(px[0] | (px[1] << 8) | (px[2] << 16) | ((unsigned int)px[3] << 24));
+		for (k = 0; k < bytes - 16; k += 16)
+			_mm_storeu_si128((__m128i *)(dp + k), col[0]);
+		_mm_storeu_si128((__m128i *)(dp + bytes - 16), col[0]);
+		return w;
+	}
+
+	/* Other sizes repeat every 16 pixels. */
+	if (w < 16)
+		return 0;
+	{
+		const uint8_t (*shuffle)[16] = &solid_shuffle_sse[n == 3 ? 0 : 3];
+		__m128i p = _mm_loadl_epi64((const __m128i *)px);
+		for (v = 0; v < n; v++)
+			col[v] = _mm_shuffle_epi8(p, _mm_loadu_si128((const __m128i *)shuffle[v]));
+	}
+	for (k = 0; k < w - 16; k += 16)
+		for (v = 0; v < n; v++)
+			_mm_storeu_si128((__m128i *)(dp + k * n + 16 * v), col[v]);
+	for (v = 0; v < n; v++)
+		_mm_storeu_si128((__m128i *)(dp + (w - 16) * n + 16 * v), col[v]);
+	return w;
+}
@@ -26,6 +26,7 @@
 #include <math.h>
 #include <float.h>
 #include <assert.h>
+#include <string.h>
 
 #define MAX_DEPTH 8
 
@@ -1617,3 +1618,352 @@ fz_flatten_stroke_path(fz_context *ctx, fz_rasterizer *rast, const fz_path *path
 	*bbox = fz_intersect_irect(scissor, fz_bound_rasterizer(ctx, rast));
 	return fz_is_empty_irect(*bbox);
 }
+
+/*
+	Cached flattening.
+
+	Flattening (and, even more so, stroking) a path happens wholly in
+	user space, with each point transformed into device space only as
+	its edge is fed to the rasterizer. So we can flatten a path with
+	the translation taken out of the ctm, record the calls made to
+	the rasterizer, and play them back under any translation to get
+	the very same edges. This lets viewers redrawing a page, and
+	banded or tiled renderers, skip flattening paths they have seen
+	at the same scale and rotation before.
+
+	Recordings are kept in the store, keyed on an md5 digest of the
+	path contents and everything else that shapes the edges. Dashed
+	strokes are never cached, as the dashes that get emitted depend
+	on the scissor.
+*/
+
+enum
+{
+	FLATTEN_OP_INSERT, /* + rev */
+	FLATTEN_OP_RECT = 3,
+	FLATTEN_OP_GAP
+};
+
+typedef struct
+{
+	float x0, y0, x1, y1;
+	int op;
+} fz_flatten_op;
+
+typedef struct
+{
+	fz_storable storable;
+	int len, cap;
+	fz_flatten_op *ops;
+} fz_flattened_path;
+
+typedef struct
+{
+	int refs;
+	unsigned char digest[16];
+} fz_flattened_path_key;
+
+typedef struct
+{
+	fz_rasterizer super;
+	fz_flattened_path *fp;
+} flatten_recorder;
+
+static void
+fz_drop_flattened_path_imp(fz_context *ctx, fz_storable *storable)
+{
+	fz_flattened_path *fp = (fz_flattened_path *)storable;
+	fz_free(ctx, fp->ops);
+	fz_free(ctx, fp);
+}
+
+static int
+fz_make_hash_flattened_path_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_flattened_path_key *key = (fz_flattened_path_key *)key_;
+	memcpy(hash->u.md5.md5, key->digest, 16);
+	return 1;
+}
+
+static void *
+fz_keep_flattened_path_key(fz_context *ctx, void *key_)
+{
+	fz_flattened_path_key *key = (fz_flattened_path_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_flattened_path_key(fz_context *ctx, void *key_)
+{
+	fz_flattened_path_key *key = (fz_flattened_path_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+		fz_free(ctx, key);
+}
+
+static int
+fz_cmp_flattened_path_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_flattened_path_key *k0 = (fz_flattened_path_key *)k0_;
+	fz_flattened_path_key *k1 = (fz_flattened_path_key *)k1_;
+	return memcmp(k0->digest, k1->digest, 16);
+}
+
+static void
+fz_format_flattened_path_key(fz_context *ctx, char *s, size_t n, void *key_)
+{
+	static const char *hex = "0123456789abcdef";
+	fz_flattened_path_key *key = (fz_flattened_path_key *)key_;
+	char md5[33];
+	int i;
+	for (i = 0; i < 16; ++i)
+	{
+		md5[i*2+0] = hex[key->digest[i]>>4];
+		md5[i*2+1] = hex[key->digest[i]&15];
+	}
+	md5[32] = 0;
+	fz_snprintf(s, n, "(flattened path md5=%s)", md5);
+}
+
+static const fz_store_type fz_flattened_path_store_type =
+{
+	"fz_flattened_path",
+	fz_make_hash_flattened_path_key,
+	fz_keep_flattened_path_key,
+	fz_drop_flattened_path_key,
+	fz_cmp_flattened_path_key,
+	fz_format_flattened_path_key,
+	NULL
+};
+
+static void
+record_op(fz_context *ctx, fz_rasterizer *rast, int op, float x0, float y0, float x1, float y1)
+{
+	fz_flattened_path *fp = ((flatten_recorder *)rast)->fp;
+	fz_flatten_op *o;
+
+	if (fp->len == fp->cap)
+	{
+		int new_cap = fp->cap ? fp->cap * 2 : 16;
+		fp->ops = fz_realloc_array(ctx, fp->ops, new_cap, fz_flatten_op);
+		fp->cap = new_cap;
+	}
+	o = &fp->ops[fp->len++];
+	o->x0 = x0;
+	o->y0 = y0;
+	o->x1 = x1;
+	o->y1 = y1;
+	o->op = op;
+}
+
+static void
+record_insert(fz_context *ctx, fz_rasterizer *rast, float x0, float y0, float x1, float y1, int rev)
+{
+	record_op(ctx, rast, FLATTEN_OP_INSERT + rev, x0, y0, x1, y1);
+}
+
+static void
+record_rect(fz_context *ctx, fz_rasterizer *rast, float x0, float y0, float x1, float y1)
+{
+	record_op(ctx, rast, FLATTEN_OP_RECT, x0, y0, x1, y1);
+}
+
+static void
+record_gap(fz_context *ctx, fz_rasterizer *rast)
+{
+	record_op(ctx, rast, FLATTEN_OP_GAP, 0, 0, 0, 0);
+}
+
+static const fz_rasterizer_fns recorder_fns =
+{
+	NULL, /* drop */
+	NULL, /* reset */
+	NULL, /* postindex */
+	record_insert,
+	record_rect,
+	record_gap,
+	NULL, /* convert */
+	NULL, /* is_rect */
+	NULL, /* flush */
+	0 /* Not reusable */
+};
+
+static fz_flattened_path *
+new_flattened_path(fz_context *ctx, fz_rasterizer *rast, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth)
+{
+	flatten_recorder rec;
+	fz_flattened_path *fp;
+
+	fp = fz_malloc_struct(ctx, fz_flattened_path);
+	FZ_INIT_STORABLE(fp, 1, fz_drop_flattened_path_imp);
+
+	/* The flattening code never looks at anything but the functions
+	 * of the rasterizer it is given, and at whether it wants
+	 * anti-dropout rectangles (and at the bound, which we leave
+	 * empty). */
+	memset(&rec, 0, sizeof rec);
+	rec.super.fns = recorder_fns;
+	rec.super.bbox.x0 = rec.super.bbox.y0 = BBOX_MAX;
+	rec.super.bbox.x1 = rec.super.bbox.y1 = BBOX_MIN;
+	if (!fz_antidropout_rasterizer(ctx, rast))
+		rec.super.fns.rect = NULL;
+	rec.fp = fp;
+
+	ctm.e = 0;
+	ctm.f = 0;
+
+	fz_try(ctx)
+	{
+		if (stroke)
+			(void)do_flatten_stroke(ctx, &rec.super, path, stroke, ctm, flatness, linewidth);
+		else
+			(void)do_flatten_fill(ctx, &rec.super, path, ctm, flatness);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_flattened_path_imp(ctx, &fp->storable);
+		fz_rethrow(ctx);
+	}
+
+	return fp;
+}
+
+static int
+replay_flattened_path(fz_context *ctx, fz_rasterizer *rast, const fz_flattened_path *fp, float e, float f)
+{
+	const fz_flatten_op *o = fp->ops;
+	int i;
+
+	for (i = 0; i < fp->len; i++, o++)
+	{
+		switch (o->op)
+		{
+		case FLATTEN_OP_RECT:
+			fz_insert_rasterizer_rect(ctx, rast, o->x0 + e, o->y0 + f, o->x1 + e, o->y1 + f);
+			break;
+		case FLATTEN_OP_GAP:
+			fz_gap_rasterizer(ctx, rast);
+			break;
+		default:
+			fz_insert_rasterizer(ctx, rast, o->x0 + e, o->y0 + f, o->x1 + e, o->y1 + f, o->op - FLATTEN_OP_INSERT);
+			break;
+		}
+	}
+
+	return fz_is_empty_irect(fz_bound_rasterizer(ctx, rast));
+}
+
+static fz_flattened_path *
+find_flattened_path(fz_context *ctx, fz_rasterizer *rast, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth)
+{
+	fz_flattened_path_key key;
+	fz_flattened_path_key *new_key;
+	fz_flattened_path *fp, *old_fp;
+	fz_md5 md5;
+	float m[5];
+
+	fz_md5_init(&md5);
+	fz_md5_update_int64(&md5, stroke != NULL);
+	fz_md5_update_int64(&md5, fz_antidropout_rasterizer(ctx, rast));
+	m[0] = ctm.a;
+	m[1] = ctm.b;
+	m[2] = ctm.c;
+	m[3] = ctm.d;
+	m[4] = flatness;
+	fz_md5_update(&md5, (const unsigned char *)m, sizeof m);
+	if (stroke)
+	{
+		fz_md5_update_int64(&md5, stroke->start_cap);
+		fz_md5_update_int64(&md5, stroke->dash_cap);
+		fz_md5_update_int64(&md5, stroke->end_cap);
+		fz_md5_update_int64(&md5, stroke->linejoin);
+		m[0] = linewidth;
+		m[1] = stroke->miterlimit;
+		fz_md5_update(&md5, (const unsigned char *)m, 2 * sizeof(float));
+	}
+	fz_digest_path(ctx, path, &md5);
+	fz_md5_final(&md5, key.digest);
+	key.refs = 1;
+
+	fp = fz_find_item(ctx, fz_drop_flattened_path_imp, &key, &fz_flattened_path_store_type);
+	if (fp)
+		return fp;
+
+	fz_var(fp);
+
+	new_key = fz_malloc_struct(ctx, fz_flattened_path_key);
+	*new_key = key;
+	fz_try(ctx)
+	{
+		fp = new_flattened_path(ctx, rast, path, stroke, ctm, flatness, linewidth);
+		old_fp = fz_store_item(ctx, new_key, fp, sizeof(*fp) + (size_t)fp->cap * sizeof(fz_flatten_op), &fz_flattened_path_store_type);
+		if (old_fp)
+		{
+			/* Found one while adding! Perhaps from another thread? */
+			fz_drop_storable(ctx, &fp->storable);
+			fp = old_fp;
+		}
+	}
+	fz_always(ctx)
+		fz_drop_flattened_path_key(ctx, new_key);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return fp;
+}
+
+static int
+flatten_cached(fz_context *ctx, fz_rasterizer *rast, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth, fz_irect scissor, fz_irect *bbox)
+{
+	fz_flattened_path *fp;
+	int empty = 1;
+
+	fp = find_flattened_path(ctx, rast, path, stroke, ctm, flatness, linewidth);
+
+	fz_try(ctx)
+	{
+		if (!fz_reset_rasterizer(ctx, rast, scissor))
+			empty = replay_flattened_path(ctx, rast, fp, ctm.e, ctm.f);
+		else if (!replay_flattened_path(ctx, rast, fp, ctm.e, ctm.f))
+		{
+			fz_postindex_rasterizer(ctx, rast);
+			empty = replay_flattened_path(ctx, rast, fp, ctm.e, ctm.f);
+		}
+	}
+	fz_always(ctx)
+		fz_drop_storable(ctx, &fp->storable);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	if (empty)
+		return *bbox = fz_empty_irect, 1;
+
+	*bbox = fz_intersect_irect(scissor, fz_bound_rasterizer(ctx, rast));
+	return fz_is_empty_irect(*bbox);
+}
+
+int
+fz_flatten_fill_path_cached(fz_context *ctx, fz_rasterizer *rast, const fz_path *path, fz_matrix ctm, float flatness, fz_irect scissor, fz_irect *bbox)
+{
+	fz_irect local_bbox;
+	if (!bbox)
+		bbox = &local_bbox;
+
+	if (fz_is_empty_irect(scissor))
+		scissor.x1 = scissor.x0, scissor.y1 = scissor.y0;
+
+	return flatten_cached(ctx, rast, path, NULL, ctm, flatness, 0, scissor, bbox);
+}
+
+int
+fz_flatten_stroke_path_cached(fz_context *ctx, fz_rasterizer *rast, const fz_path *path, const fz_stroke_state *stroke, fz_matrix ctm, float flatness, float linewidth, fz_irect scissor, fz_irect *bbox)
+{
+	fz_irect local_bbox;
+
+	if (stroke->dash_len > 0)
+		return fz_flatten_stroke_path(ctx, rast, path, stroke, ctm, flatness, linewidth, scissor, bbox);
+
+	if (!bbox)
+		bbox = &local_bbox;
+
+	return flatten_cached(ctx, rast, path, stroke, ctm, flatness, linewidth, scissor, bbox);
+}
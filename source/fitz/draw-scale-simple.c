@@ -50,6 +50,12 @@ intermediate results rather than ints.
  */
 #define SINGLE_PIXEL_SPECIALS
 
+/* The NEON cores for 64-bit ARM have not yet been built, so they are
+ * only used when FZ_ENABLE_DRAW_NEON is set. */
+#if ARCH_HAS_NEON && FZ_ENABLE_DRAW_NEON && !defined(ARCH_ARM)
+#define SCALE_NEON
+#endif
+
 /*
 Consider a row of source samples, src, of width src_w, positioned at x,
 scaled to width dst_w.
@@ -1058,6 +1064,7 @@ scale_row_from_temp_alpha(unsigned char * FZ_RESTRICT dst, const unsigned char *
 }
 #else
 
+#if !ARCH_HAS_SSE
 static void
 scale_row_to_temp1(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
 {
@@ -1096,6 +1103,7 @@ scale_row_to_temp1(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RES
 		}
 	}
 }
+#endif
 
 static void
 scale_row_to_temp2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
@@ -1142,6 +1150,7 @@ scale_row_to_temp2(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RES
 	}
 }
 
+#if !ARCH_HAS_SSE
 static void
 scale_row_to_temp3(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
 {
@@ -1251,7 +1260,9 @@ scale_row_to_temp4(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RES
 		}
 	}
 }
+#endif
 
+#if !ARCH_HAS_SSE && !defined(SCALE_NEON)
 static void
 scale_row_from_temp(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
 {
@@ -1310,6 +1321,16 @@ scale_row_from_temp_alpha(unsigned char * FZ_RESTRICT dst, const unsigned char *
 }
 #endif
 
+#endif
+
+/* Optional SIMD cores. On 32-bit ARM the assembler versions above are
+ * used instead. */
+#if ARCH_HAS_SSE
+#include "draw-scale-simple_sse.h"
+#elif defined(SCALE_NEON)
+#include "draw-scale-simple_neon.h"
+#endif
+
 #ifdef SINGLE_PIXEL_SPECIALS
 static void
 duplicate_single_pixel(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, int n, int forcealpha, int w, int h, int stride)
@@ -1830,19 +1851,37 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 			row_scale_in = scale_row_to_temp;
 			break;
 		case 1: /* Image mask case or Greyscale case */
+#if ARCH_HAS_SSE
+			row_scale_in = scale_row_to_temp1_sse;
+#else
 			row_scale_in = scale_row_to_temp1;
+#endif
 			break;
 		case 2: /* Greyscale with alpha case */
 			row_scale_in = scale_row_to_temp2;
 			break;
 		case 3: /* RGB case */
+#if ARCH_HAS_SSE
+			row_scale_in = scale_row_to_temp3_sse;
+#else
 			row_scale_in = scale_row_to_temp3;
+#endif
 			break;
 		case 4: /* RGBA or CMYK case */
+#if ARCH_HAS_SSE
+			row_scale_in = scale_row_to_temp4_sse;
+#else
 			row_scale_in = scale_row_to_temp4;
+#endif
 			break;
 		}
+#if ARCH_HAS_SSE
+		row_scale_out = forcealpha ? scale_row_from_temp_alpha_sse : scale_row_from_temp_sse;
+#elif defined(SCALE_NEON)
+		row_scale_out = forcealpha ? scale_row_from_temp_alpha_neon : scale_row_from_temp_neon;
+#else
 		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
+#endif
 		max_row = contrib_rows->index[contrib_rows->index[0]];
 		for (row = 0; row < contrib_rows->count; row++)
 		{
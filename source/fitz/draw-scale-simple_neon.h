@@ -0,0 +1,132 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+/* This file is included from draw-scale-simple.c if NEON cores are
+ * allowed (and the ARM assembler versions are not in use). */
+
+#include "arm_neon.h"
+
+/* Apply the weights of a row to 16 consecutive bytes of the temporary
+ * buffer. The narrowing moves truncate, matching (unsigned char)(val>>8)
+ * in the C code. */
+static fz_forceinline uint8x16_t
+scale_col16_neon(const unsigned char * FZ_RESTRICT min, const int * FZ_RESTRICT contrib, int len, int width)
+{
+	int32x4_t a0 = vdupq_n_s32(128);
+	int32x4_t a1 = a0, a2 = a0, a3 = a0;
+	int16x8_t lo, hi;
+
+	while (len-- > 0)
+	{
+		uint8x16_t r = vld1q_u8(min);
+		int16_t w = (int16_t)*contrib++;
+		lo = vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(r)));
+		hi = vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(r)));
+		a0 = vmlal_n_s16(a0, vget_low_s16(lo), w);
+		a1 = vmlal_n_s16(a1, vget_high_s16(lo), w);
+		a2 = vmlal_n_s16(a2, vget_low_s16(hi), w);
+		a3 = vmlal_n_s16(a3, vget_high_s16(hi), w);
+		min += width;
+	}
+
+	lo = vcombine_s16(vmovn_s32(vshrq_n_s32(a0, 8)), vmovn_s32(vshrq_n_s32(a1, 8)));
+	hi = vcombine_s16(vmovn_s32(vshrq_n_s32(a2, 8)), vmovn_s32(vshrq_n_s32(a3, 8)));
+	return vreinterpretq_u8_s8(vcombine_s8(vmovn_s16(lo), vmovn_s16(hi)));
+}
+
+static void
+scale_row_from_temp_neon(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	int len, x;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = width; x >= 16; x -= 16)
+	{
+		vst1q_u8(dst, scale_col16_neon(src, contrib, len, width));
+		dst += 16;
+		src += 16;
+	}
+	for (; x > 0; x--)
+	{
+		const unsigned char *min = src;
+		int val = 128;
+		int len2 = len;
+		const int *contrib2 = contrib;
+
+		while (len2-- > 0)
+		{
+			val += *min * *contrib2++;
+			min += width;
+		}
+		*dst++ = (unsigned char)(val>>8);
+		src++;
+	}
+}
+
+static void
+scale_row_from_temp_alpha_neon(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	unsigned char tmp[16];
+	int len, x, i, k = 0;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = width; x >= 16; x -= 16)
+	{
+		vst1q_u8(tmp, scale_col16_neon(src, contrib, len, width));
+		for (i = 0; i < 16; i++)
+		{
+			*dst++ = tmp[i];
+			if (++k == n)
+			{
+				*dst++ = 255;
+				k = 0;
+			}
+		}
+		src += 16;
+	}
+	for (; x > 0; x--)
+	{
+		const unsigned char *min = src;
+		int val = 128;
+		int len2 = len;
+		const int *contrib2 = contrib;
+
+		while (len2-- > 0)
+		{
+			val += *min * *contrib2++;
+			min += width;
+		}
+		*dst++ = (unsigned char)(val>>8);
+		src++;
+		if (++k == n)
+		{
+			*dst++ = 255;
+			k = 0;
+		}
+	}
+}
@@ -0,0 +1,281 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+/* This file is included from draw-scale-simple.c if SSE cores are
+ * allowed. The weights never exceed 16 bits, so pairs of source samples
+ * are multiplied by pairs of weights using _mm_madd_epi16, giving exactly
+ * the same sums as the C code. */
+
+#include <emmintrin.h>
+#include <smmintrin.h>
+
+/* Two weights as a pair of 16-bit lanes, for _mm_madd_epi16. */
+static fz_forceinline __m128i
+weight_pair_sse(int w0, int w1)
+{
+	return _mm_set1_epi32((int)(((unsigned int)w1 << 16) | ((unsigned int)w0 & 0xFFFF)));
+}
+
+/* (unsigned char)(val>>8) on 16 32-bit lanes. */
+static fz_forceinline __m128i
+pack_result_sse(__m128i a0, __m128i a1, __m128i a2, __m128i a3)
+{
+	__m128i mask = _mm_set1_epi32(0xFF);
+	a0 = _mm_and_si128(_mm_srai_epi32(a0, 8), mask);
+	a1 = _mm_and_si128(_mm_srai_epi32(a1, 8), mask);
+	a2 = _mm_and_si128(_mm_srai_epi32(a2, 8), mask);
+	a3 = _mm_and_si128(_mm_srai_epi32(a3, 8), mask);
+	return _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+}
+
+static void
+scale_row_to_temp1_sse(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	const int *contrib = &weights->index[weights->index[0]];
+	int len, i, step = 1;
+	const unsigned char *min;
+
+	assert(weights->n == 1);
+	if (weights->flip)
+	{
+		dst += weights->count-1;
+		step = -1;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = _mm_setzero_si128();
+		int val;
+		min = &src[*contrib++];
+		len = *contrib++;
+		for (; len >= 8; len -= 8)
+		{
+			__m128i s = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)min));
+			__m128i w = _mm_packs_epi32(_mm_loadu_si128((const __m128i *)contrib), _mm_loadu_si128((const __m128i *)(contrib+4)));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, w));
+			min += 8;
+			contrib += 8;
+		}
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+		acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+		val = 128 + _mm_cvtsi128_si32(acc);
+		while (len-- > 0)
+		{
+			val += *min++ * *contrib++;
+		}
+		*dst = (unsigned char)(val>>8);
+		dst += step;
+	}
+}
+
+static void
+scale_row_to_temp3_sse(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	/* r0 r1 g0 g1 b0 b1 as 16-bit values. */
+	const __m128i shuffle = _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1);
+	const int *contrib = &weights->index[weights->index[0]];
+	int len, i, step = 3;
+	const unsigned char *min;
+
+	assert(weights->n == 3);
+	if (weights->flip)
+	{
+		dst += 3*(weights->count-1);
+		step = -3;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = _mm_set1_epi32(128);
+		int c[4];
+		min = &src[3 * *contrib++];
+		len = *contrib++;
+		/* Each load reads 2 bytes of the following pixel. */
+		for (; len >= 3; len -= 2)
+		{
+			__m128i s = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *)min), shuffle);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, weight_pair_sse(contrib[0], contrib[1])));
+			min += 6;
+			contrib += 2;
+		}
+		_mm_storeu_si128((__m128i *)c, acc);
+		while (len-- > 0)
+		{
+			int w = *contrib++;
+			c[0] += *min++ * w;
+			c[1] += *min++ * w;
+			c[2] += *min++ * w;
+		}
+		dst[0] = (unsigned char)(c[0]>>8);
+		dst[1] = (unsigned char)(c[1]>>8);
+		dst[2] = (unsigned char)(c[2]>>8);
+		dst += step;
+	}
+}
+
+static void
+scale_row_to_temp4_sse(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights)
+{
+	/* r0 r1 g0 g1 b0 b1 a0 a1 as 16-bit values. */
+	const __m128i shuffle = _mm_setr_epi8(0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1);
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const int *contrib = &weights->index[weights->index[0]];
+	int len, i, step = 4;
+	const unsigned char *min;
+
+	assert(weights->n == 4);
+	if (weights->flip)
+	{
+		dst += 4*(weights->count-1);
+		step = -4;
+	}
+	for (i=weights->count; i > 0; i--)
+	{
+		__m128i acc = _mm_set1_epi32(128);
+		int v;
+		min = &src[4 * *contrib++];
+		len = *contrib++;
+		for (; len >= 2; len -= 2)
+		{
+			__m128i s = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *)min), shuffle);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, weight_pair_sse(contrib[0], contrib[1])));
+			min += 8;
+			contrib += 2;
+		}
+		if (len)
+		{
+			__m128i s;
+			memcpy(&v, min, 4);
+			s = _mm_shuffle_epi8(_mm_cvtsi32_si128(v), shuffle);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(s, weight_pair_sse(contrib[0], 0)));
+			contrib++;
+		}
+		acc = _mm_and_si128(_mm_srai_epi32(acc, 8), mask);
+		acc = _mm_packus_epi16(_mm_packs_epi32(acc, acc), acc);
+		v = _mm_cvtsi128_si32(acc);
+		memcpy(dst, &v, 4);
+		dst += step;
+	}
+}
+
+/* Apply the weights of a row to 16 consecutive bytes of the temporary
+ * buffer. */
+static fz_forceinline __m128i
+scale_col16_sse(const unsigned char * FZ_RESTRICT min, const int * FZ_RESTRICT contrib, int len, int width)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i a0 = _mm_set1_epi32(128);
+	__m128i a1 = a0, a2 = a0, a3 = a0;
+
+	for (; len > 0; len -= 2)
+	{
+		__m128i r0 = _mm_loadu_si128((const __m128i *)min);
+		__m128i r1 = len > 1 ? _mm_loadu_si128((const __m128i *)(min + width)) : zero;
+		__m128i w = weight_pair_sse(contrib[0], len > 1 ? contrib[1] : 0);
+		__m128i lo = _mm_unpacklo_epi8(r0, r1);
+		__m128i hi = _mm_unpackhi_epi8(r0, r1);
+		a0 = _mm_add_epi32(a0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+		a1 = _mm_add_epi32(a1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+		a2 = _mm_add_epi32(a2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+		a3 = _mm_add_epi32(a3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+		min += 2 * width;
+		contrib += 2;
+	}
+
+	return pack_result_sse(a0, a1, a2, a3);
+}
+
+static void
+scale_row_from_temp_sse(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	int len, x;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = width; x >= 16; x -= 16)
+	{
+		_mm_storeu_si128((__m128i *)dst, scale_col16_sse(src, contrib, len, width));
+		dst += 16;
+		src += 16;
+	}
+	for (; x > 0; x--)
+	{
+		const unsigned char *min = src;
+		int val = 128;
+		int len2 = len;
+		const int *contrib2 = contrib;
+
+		while (len2-- > 0)
+		{
+			val += *min * *contrib2++;
+			min += width;
+		}
+		*dst++ = (unsigned char)(val>>8);
+		src++;
+	}
+}
+
+static void
+scale_row_from_temp_alpha_sse(unsigned char * FZ_RESTRICT dst, const unsigned char * FZ_RESTRICT src, const fz_weights * FZ_RESTRICT weights, int w, int n, int row)
+{
+	const int *contrib = &weights->index[weights->index[row]];
+	unsigned char tmp[16];
+	int len, x, i, k = 0;
+	int width = w * n;
+
+	contrib++; /* Skip min */
+	len = *contrib++;
+	for (x = width; x >= 16; x -= 16)
+	{
+		_mm_storeu_si128((__m128i *)tmp, scale_col16_sse(src, contrib, len, width));
+		for (i = 0; i < 16; i++)
+		{
+			*dst++ = tmp[i];
+			if (++k == n)
+			{
+				*dst++ = 255;
+				k = 0;
+			}
+		}
+		src += 16;
+	}
+	for (; x > 0; x--)
+	{
+		const unsigned char *min = src;
+		int val = 128;
+		int len2 = len;
+		const int *contrib2 = contrib;
+
+		while (len2-- > 0)
+		{
+			val += *min * *contrib2++;
+			min += width;
+		}
+		*dst++ = (unsigned char)(val>>8);
+		src++;
+		if (++k == n)
+		{
+			*dst++ = 255;
+			k = 0;
+		}
+	}
+}
@@ -0,0 +1,743 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#include "mupdf/fitz.h"
+#include "draw-imp.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Sparse coverage rasterizer -- for batches of small paths
+ *
+ * Drawings such as CAD plans and maps are made of huge numbers of
+ * small strokes in a handful of colours. Scan converting each of
+ * those with the gel costs a painter call for every scanline across
+ * the whole width of the stroke's bounding box, even though a thin
+ * diagonal line only touches a couple of pixels on each of them.
+ *
+ * This rasterizer turns each path into coverage values for just the
+ * pixels it touches, and merges those into a sparse coverage store,
+ * made of tiles of SPARSE_TILE_W x SPARSE_TILE_H values that are only
+ * allocated once something lands in them. As long as paths go to
+ * the same pixmap in the same colour, they are merged into the same
+ * store; the pixmap is only painted (run by run) when the rasterizer
+ * is flushed, or when a path in a different colour comes along.
+ *
+ * Coverage from separate paths is combined as a + b - a.b, which is
+ * what painting them opaquely one after the other would give (up to
+ * rounding). The winding of each path is kept to itself, so stroke
+ * outlines with opposite orientations cannot cancel out.
+ */
+
+#define SPARSE_TILE_W 64
+#define SPARSE_TILE_H 16
+#define SPARSE_TILE_SIZE (SPARSE_TILE_W * SPARSE_TILE_H)
+
+#define SPARSE_INSERTION_SORT_MAX 32
+
+typedef struct
+{
+	int x0, y0, x1, y1; /* y0 < y1 */
+	int up;
+} fz_sparse_edge;
+
+typedef struct
+{
+	int slot; /* Index into the grid */
+	int x0, y0, x1, y1; /* Area touched, relative to the tile */
+} fz_sparse_tile;
+
+typedef struct
+{
+	fz_rasterizer super;
+
+	/* Edges of the current path, in subsamples. */
+	int cap, len;
+	fz_sparse_edge *edges;
+
+	/* Scratch space for scan converting the current path. */
+	int xcap;
+	int *xings;
+	int rcap;
+	int *rows;
+	int bcap;
+	int *deltas;
+	unsigned char *alphas;
+
+	/* What the pending batch will be painted with. */
+	fz_pixmap *dest;
+	unsigned char *color;
+	unsigned char colorbv[FZ_MAX_COLORS + 1];
+	fz_overprint op;
+	fz_overprint *eop;
+
+	/* Grid of tile numbers (plus one, zero for none) over dest. */
+	int gw, gh;
+	size_t gcap;
+	int *grid;
+
+	/* Tiles with coverage, and the coverage itself. */
+	int tcap, tlen;
+	fz_sparse_tile *tiles;
+	unsigned char *cov;
+} fz_sparse;
+
+static int
+fz_reset_sparse(fz_context *ctx, fz_rasterizer *rast)
+{
+	fz_sparse *sp = (fz_sparse *)rast;
+
+	sp->len = 0;
+
+	return 0;
+}
+
+static void
+fz_drop_sparse(fz_context *ctx, fz_rasterizer *rast)
+{
+	fz_sparse *sp = (fz_sparse *)rast;
+	if (sp == NULL)
+		return;
+	fz_free(ctx, sp->edges);
+	fz_free(ctx, sp->xings);
+	fz_free(ctx, sp->rows);
+	fz_free(ctx, sp->deltas);
+	fz_free(ctx, sp->alphas);
+	fz_free(ctx, sp->grid);
+	fz_free(ctx, sp->tiles);
+	fz_free(ctx, sp->cov);
+	fz_free(ctx, sp);
+}
+
+static void
+fz_insert_sparse_raw(fz_context *ctx, fz_sparse *sp, int x0, int y0, int x1, int y1)
+{
+	fz_irect *clip = &sp->super.clip;
+	fz_irect *bbox = &sp->super.bbox;
+	fz_sparse_edge *edge;
+	int up, tmp;
+
+	if (y0 == y1)
+		return;
+
+	if (y0 > y1) {
+		up = 0;
+		tmp = x0; x0 = x1; x1 = tmp;
+		tmp = y0; y0 = y1; y1 = tmp;
+	}
+	else
+		up = 1;
+
+	/* Edges wholly above or below the clip cannot contribute. Those
+	 * to either side are clamped onto the clip edge as they are scan
+	 * converted, just as the gel would. */
+	if (y1 <= clip->y0 || y0 >= clip->y1)
+		return;
+
+	tmp = fz_clampi(fz_mini(x0, x1), clip->x0, clip->x1);
+	if (tmp < bbox->x0) bbox->x0 = tmp;
+	tmp = fz_clampi(fz_maxi(x0, x1), clip->x0, clip->x1);
+	if (tmp > bbox->x1) bbox->x1 = tmp;
+	tmp = fz_maxi(y0, clip->y0);
+	if (tmp < bbox->y0) bbox->y0 = tmp;
+	tmp = fz_mini(y1, clip->y1);
+	if (tmp > bbox->y1) bbox->y1 = tmp;
+
+	if (sp->len == sp->cap) {
+		int new_cap = sp->cap * 2;
+		sp->edges = fz_realloc_array(ctx, sp->edges, new_cap, fz_sparse_edge);
+		sp->cap = new_cap;
+	}
+
+	edge = &sp->edges[sp->len++];
+	edge->x0 = x0;
+	edge->y0 = y0;
+	edge->x1 = x1;
+	edge->y1 = y1;
+	edge->up = up;
+}
+
+static void
+fz_insert_sparse(fz_context *ctx, fz_rasterizer *ras, float fx0, float fy0, float fx1, float fy1, int rev)
+{
+	int x0, y0, x1, y1;
+	const int hscale = fz_rasterizer_aa_hscale(ras);
+	const int vscale = fz_rasterizer_aa_vscale(ras);
+
+	fx0 = floorf(fx0 * hscale);
+	fx1 = floorf(fx1 * hscale);
+	fy0 = floorf(fy0 * vscale);
+	fy1 = floorf(fy1 * vscale);
+
+	/* Clamp in the float domain before casting down; see the gel. */
+	x0 = (int)fz_clamp(fx0, BBOX_MIN * hscale, BBOX_MAX * hscale);
+	y0 = (int)fz_clamp(fy0, BBOX_MIN * vscale, BBOX_MAX * vscale);
+	x1 = (int)fz_clamp(fx1, BBOX_MIN * hscale, BBOX_MAX * hscale);
+	y1 = (int)fz_clamp(fy1, BBOX_MIN * vscale, BBOX_MAX * vscale);
+
+	fz_insert_sparse_raw(ctx, (fz_sparse *)ras, x0, y0, x1, y1);
+}
+
+static void
+fz_insert_sparse_rect(fz_context *ctx, fz_rasterizer *ras, float fx0, float fy0, float fx1, float fy1)
+{
+	int x0, y0, x1, y1;
+	const int hscale = fz_rasterizer_aa_hscale(ras);
+	const int vscale = fz_rasterizer_aa_vscale(ras);
+
+	fx0 = floorf(fx0 * hscale);
+	fx1 = floorf(fx1 * hscale);
+	if (fx1 == fx0)
+		fx1++;
+	fy0 = floorf(fy0 * vscale);
+	fy1 = floorf(fy1 * vscale);
+	if (fy1 == fy0)
+		fy1++;
+
+	fx0 = fz_clamp(fx0, ras->clip.x0, ras->clip.x1);
+	fx1 = fz_clamp(fx1, ras->clip.x0, ras->clip.x1);
+	fy0 = fz_clamp(fy0, ras->clip.y0, ras->clip.y1);
+	fy1 = fz_clamp(fy1, ras->clip.y0, ras->clip.y1);
+
+	x0 = (int)fz_clamp(fx0, BBOX_MIN * hscale, BBOX_MAX * hscale);
+	y0 = (int)fz_clamp(fy0, BBOX_MIN * vscale, BBOX_MAX * vscale);
+	x1 = (int)fz_clamp(fx1, BBOX_MIN * hscale, BBOX_MAX * hscale);
+	y1 = (int)fz_clamp(fy1, BBOX_MIN * vscale, BBOX_MAX * vscale);
+
+	fz_insert_sparse_raw(ctx, (fz_sparse *)ras, x1, y0, x1, y1);
+	fz_insert_sparse_raw(ctx, (fz_sparse *)ras, x0, y1, x0, y0);
+}
+
+static int
+fz_is_rect_sparse(fz_context *ctx, fz_rasterizer *ras)
+{
+	return 0;
+}
+
+/*
+ * The sparse coverage store.
+ */
+
+static void
+start_batch(fz_context *ctx, fz_sparse *sp, fz_pixmap *dst, unsigned char *color, fz_overprint *eop)
+{
+	int gw = (dst->w + SPARSE_TILE_W - 1) / SPARSE_TILE_W;
+	int gh = (dst->h + SPARSE_TILE_H - 1) / SPARSE_TILE_H;
+
+	/* The grid is left clear after every flush, so only a new one
+	 * needs clearing. */
+	if ((size_t)gw * gh > sp->gcap)
+	{
+		fz_free(ctx, sp->grid);
+		sp->grid = NULL;
+		sp->gcap = 0;
+		sp->grid = Memento_label(fz_calloc(ctx, (size_t)gw * gh, sizeof(int)), "sparse_grid");
+		sp->gcap = (size_t)gw * gh;
+	}
+	sp->gw = gw;
+	sp->gh = gh;
+
+	sp->dest = dst;
+	sp->color = NULL;
+	if (color)
+	{
+		memcpy(sp->colorbv, color, dst->n - dst->alpha + 1);
+		sp->color = sp->colorbv;
+	}
+	sp->eop = NULL;
+	if (fz_overprint_required(eop))
+	{
+		sp->op = *eop;
+		sp->eop = &sp->op;
+	}
+}
+
+static int
+same_batch(fz_sparse *sp, fz_pixmap *dst, unsigned char *color, fz_overprint *eop)
+{
+	if (sp->dest != dst)
+		return 0;
+	if ((sp->color == NULL) != (color == NULL))
+		return 0;
+	if (color && memcmp(sp->colorbv, color, dst->n - dst->alpha + 1))
+		return 0;
+	if (fz_overprint_required(eop))
+		return sp->eop && !memcmp(&sp->op, eop, sizeof sp->op);
+	return sp->eop == NULL;
+}
+
+static int
+find_tile(fz_context *ctx, fz_sparse *sp, int tx, int ty)
+{
+	int slot = ty * sp->gw + tx;
+	fz_sparse_tile *tile;
+
+	if (sp->grid[slot])
+		return sp->grid[slot] - 1;
+
+	if (sp->tlen == sp->tcap)
+	{
+		int new_cap = sp->tcap ? sp->tcap * 2 : 64;
+		sp->tiles = fz_realloc_array(ctx, sp->tiles, new_cap, fz_sparse_tile);
+		sp->cov = fz_realloc(ctx, sp->cov, (size_t)new_cap * SPARSE_TILE_SIZE);
+		memset(sp->cov + (size_t)sp->tcap * SPARSE_TILE_SIZE, 0, (size_t)(new_cap - sp->tcap) * SPARSE_TILE_SIZE);
+		sp->tcap = new_cap;
+	}
+
+	tile = &sp->tiles[sp->tlen];
+	tile->slot = slot;
+	tile->x0 = SPARSE_TILE_W;
+	tile->y0 = SPARSE_TILE_H;
+	tile->x1 = 0;
+	tile->y1 = 0;
+	sp->grid[slot] = ++sp->tlen;
+
+	return sp->tlen - 1;
+}
+
+/* Merge a row of coverage for one path into the store. x and y are
+ * relative to the destination pixmap. */
+static void
+merge_row(fz_context *ctx, fz_sparse *sp, int x, int y, const unsigned char *mp, int w)
+{
+	int ty = y / SPARSE_TILE_H;
+	int ry = y % SPARSE_TILE_H;
+
+	while (w > 0)
+	{
+		fz_sparse_tile *tile;
+		unsigned char *cp;
+		int rx, n, i, t;
+
+		while (w > 0 && *mp == 0)
+			mp++, x++, w--;
+		if (w == 0)
+			break;
+
+		rx = x % SPARSE_TILE_W;
+		n = fz_mini(w, SPARSE_TILE_W - rx);
+		t = find_tile(ctx, sp, x / SPARSE_TILE_W, ty);
+		tile = &sp->tiles[t];
+		cp = sp->cov + (size_t)t * SPARSE_TILE_SIZE + ry * SPARSE_TILE_W + rx;
+		for (i = 0; i < n; i++)
+		{
+			int a = cp[i];
+			cp[i] = a + fz_mul255(mp[i], 255 - a);
+		}
+
+		if (rx < tile->x0) tile->x0 = rx;
+		if (rx + n > tile->x1) tile->x1 = rx + n;
+		if (ry < tile->y0) tile->y0 = ry;
+		if (ry + 1 > tile->y1) tile->y1 = ry + 1;
+
+		mp += n;
+		x += n;
+		w -= n;
+	}
+}
+
+static void
+fz_flush_sparse(fz_context *ctx, fz_rasterizer *rast)
+{
+	fz_sparse *sp = (fz_sparse *)rast;
+	fz_pixmap *dst = sp->dest;
+	void *fn = NULL;
+	int i;
+
+	if (sp->tlen == 0)
+	{
+		sp->dest = NULL;
+		return;
+	}
+
+	if (sp->color)
+		fn = (void *)fz_get_span_color_painter(dst->n, dst->alpha, sp->color, sp->eop);
+	else
+		fn = (void *)fz_get_span_painter(dst->alpha, 1, 0, 255, sp->eop);
+
+	for (i = 0; i < sp->tlen; i++)
+	{
+		fz_sparse_tile *tile = &sp->tiles[i];
+		unsigned char *cp = sp->cov + (size_t)i * SPARSE_TILE_SIZE;
+		int ox = (tile->slot % sp->gw) * SPARSE_TILE_W;
+		int oy = (tile->slot / sp->gw) * SPARSE_TILE_H;
+		int x, y;
+
+		for (y = tile->y0; y < tile->y1; y++)
+		{
+			unsigned char *mp = cp + y * SPARSE_TILE_W;
+
+			/* Paint each run of non zero coverage. */
+			x = tile->x0;
+			while (fn && x < tile->x1)
+			{
+				unsigned char *dp;
+				int x1;
+
+				while (x < tile->x1 && mp[x] == 0)
+					x++;
+				if (x == tile->x1)
+					break;
+				x1 = x + 1;
+				while (x1 < tile->x1 && mp[x1] != 0)
+					x1++;
+
+				dp = dst->samples + (oy + y) * (size_t)dst->stride + (ox + x) * (size_t)dst->n;
+				if (sp->color)
+					(*(fz_span_color_painter_t *)fn)(dp, mp + x, dst->n, x1 - x, sp->color, dst->alpha, sp->eop);
+				else
+					(*(fz_span_painter_t *)fn)(dp, dst->alpha, mp + x, 1, 0, x1 - x, 255, sp->eop);
+				x = x1;
+			}
+
+			memset(mp + tile->x0, 0, tile->x1 - tile->x0);
+		}
+
+		sp->grid[tile->slot] = 0;
+	}
+
+	sp->tlen = 0;
+	sp->dest = NULL;
+}
+
+/*
+ * Scan conversion of one path into the store.
+ */
+
+static int
+intcmp(const void *va, const void *vb)
+{
+	int a = *(const int *)va;
+	int b = *(const int *)vb;
+	return a < b ? -1 : a > b;
+}
+
+static void
+sort_xings(int *a, int n)
+{
+	int i, j, t;
+
+	if (n > SPARSE_INSERTION_SORT_MAX)
+	{
+		qsort(a, n, sizeof *a, intcmp);
+		return;
+	}
+
+	for (i = 1; i < n; i++)
+	{
+		t = a[i];
+		for (j = i; j > 0 && a[j - 1] > t; j--)
+			a[j] = a[j - 1];
+		a[j] = t;
+	}
+}
+
+static inline void
+add_span(int *list, int x0, int x1, int hscale, int *lo, int *hi)
+{
+	int x0pix, x0sub;
+	int x1pix, x1sub;
+
+	if (x0 == x1)
+		return;
+
+	x0pix = ((unsigned int)x0) / hscale;
+	x0sub = ((unsigned int)x0) % hscale;
+	x1pix = ((unsigned int)x1) / hscale;
+	x1sub = ((unsigned int)x1) % hscale;
+
+	if (x0pix == x1pix)
+	{
+		list[x0pix] += x1sub - x0sub;
+		list[x0pix+1] += x0sub - x1sub;
+	}
+	else
+	{
+		list[x0pix] += hscale - x0sub;
+		list[x0pix+1] += x0sub;
+		list[x1pix] += x1sub - hscale;
+		list[x1pix+1] += -x1sub;
+	}
+
+	if (x0pix < *lo)
+		*lo = x0pix;
+	if (x1pix + 1 > *hi)
+		*hi = x1pix + 1;
+}
+
+static void
+fz_convert_sparse(fz_context *ctx, fz_rasterizer *rast, int eofill, const fz_irect *clip, fz_pixmap *dst, unsigned char *color, fz_overprint *eop)
+{
+	fz_sparse *sp = (fz_sparse *)rast;
+	const int hscale = fz_rasterizer_aa_hscale(rast);
+	const int vscale = fz_rasterizer_aa_vscale(rast);
+	const int scale = fz_rasterizer_aa_scale(rast);
+	int sy0 = clip->y0 * vscale;
+	int nsub = (clip->y1 - clip->y0) * vscale;
+	int cx0 = clip->x0 * hscale;
+	int cx1 = clip->x1 * hscale;
+	int w = clip->x1 - clip->x0;
+	int *rows, *xings, *deltas;
+	unsigned char *alphas;
+	int i, k, total, count, start, y, sub, lo, hi;
+
+	(void)scale; /* Avoid warnings in some builds */
+
+	if (sp->len == 0)
+		return;
+
+	if (!same_batch(sp, dst, color, eop))
+	{
+		fz_flush_sparse(ctx, rast);
+		start_batch(ctx, sp, dst, color, eop);
+	}
+
+	if (nsub + 1 > sp->rcap)
+	{
+		fz_free(ctx, sp->rows);
+		sp->rows = NULL;
+		sp->rcap = 0;
+		sp->rows = Memento_label(fz_malloc_array(ctx, nsub + 1, int), "sparse_rows");
+		sp->rcap = nsub + 1;
+	}
+	if (w + 2 > sp->bcap)
+	{
+		fz_free(ctx, sp->deltas);
+		fz_free(ctx, sp->alphas);
+		sp->deltas = NULL;
+		sp->alphas = NULL;
+		sp->bcap = 0;
+		sp->deltas = Memento_label(fz_malloc_array(ctx, w + 2, int), "sparse_deltas");
+		sp->alphas = Memento_label(fz_malloc_array(ctx, w + 2, unsigned char), "sparse_alphas");
+		sp->bcap = w + 2;
+	}
+	rows = sp->rows;
+	deltas = sp->deltas;
+	alphas = sp->alphas;
+
+	/* Count the crossings on each subscanline (as differences), and
+	 * turn that into the start of each subscanline's crossings. */
+	memset(rows, 0, (nsub + 1) * sizeof(int));
+	for (i = 0; i < sp->len; i++)
+	{
+		fz_sparse_edge *edge = &sp->edges[i];
+		int a = fz_maxi(edge->y0 - sy0, 0);
+		int b = fz_mini(edge->y1 - sy0, nsub);
+		if (a < b)
+		{
+			rows[a]++;
+			rows[b]--;
+		}
+	}
+	total = 0;
+	count = 0;
+	for (k = 0; k < nsub; k++)
+	{
+		count += rows[k];
+		rows[k] = total;
+		total += count;
+	}
+	if (total == 0)
+		return;
+
+	if (total > sp->xcap)
+	{
+		fz_free(ctx, sp->xings);
+		sp->xings = NULL;
+		sp->xcap = 0;
+		sp->xings = Memento_label(fz_malloc_array(ctx, total, int), "sparse_xings");
+		sp->xcap = total;
+	}
+	xings = sp->xings;
+
+	/* Step along each edge, recording where it crosses each
+	 * subscanline (relative to the clip, and clamped onto it) with
+	 * its direction in the bottom bit. Afterwards rows[k] is the end
+	 * of subscanline k's crossings. */
+	for (i = 0; i < sp->len; i++)
+	{
+		fz_sparse_edge *edge = &sp->edges[i];
+		int a = fz_maxi(edge->y0 - sy0, 0);
+		int b = fz_mini(edge->y1 - sy0, nsub);
+		int dy = edge->y1 - edge->y0;
+		int dx = edge->x1 - edge->x0;
+		int64_t num;
+		int x, q, r, e;
+
+		if (a >= b)
+			continue;
+
+		/* Sample x where the gel's Bresenham stepping would put it,
+		 * x0 + ceil((y - y0) * dx / dy), without dividing each time. */
+		q = -dx / dy;
+		r = -dx % dy;
+		if (r < 0)
+		{
+			r += dy;
+			q--;
+		}
+		num = (int64_t)(sy0 + a - edge->y0) * -dx;
+		x = (int)(num / dy);
+		e = (int)(num % dy);
+		if (e < 0)
+		{
+			e += dy;
+			x--;
+		}
+		x = edge->x0 - x;
+
+		for (k = a; k < b; k++)
+		{
+			int v = fz_clampi(x, cx0, cx1);
+			xings[rows[k]++] = ((v - cx0) << 1) | edge->up;
+			x -= q;
+			e += r;
+			if (e >= dy)
+			{
+				x--;
+				e -= dy;
+			}
+		}
+	}
+
+	/* Accumulate the spans on each subscanline as deltas, and merge
+	 * each finished scanline into the store. */
+	memset(deltas, 0, (w + 2) * sizeof(int));
+	lo = INT_MAX;
+	hi = -1;
+	start = 0;
+	sub = 0;
+	y = clip->y0 - dst->y;
+	for (k = 0; k < nsub; k++)
+	{
+		int end = rows[k];
+		int x0 = 0;
+
+		if (end - start == 2)
+		{
+			/* Thin strokes mostly cross a subscanline just twice. */
+			int a = xings[start];
+			int b = xings[start + 1];
+			if (a > b)
+			{
+				x0 = a;
+				a = b;
+				b = x0;
+			}
+			if (eofill || ((a ^ b) & 1))
+				add_span(deltas, a >> 1, b >> 1, hscale, &lo, &hi);
+		}
+		else if (eofill)
+		{
+			int even = 0;
+			sort_xings(xings + start, end - start);
+			for (i = start; i < end; i++)
+			{
+				int x = xings[i] >> 1;
+				if (!even)
+					x0 = x;
+				else
+					add_span(deltas, x0, x, hscale, &lo, &hi);
+				even = !even;
+			}
+		}
+		else
+		{
+			int winding = 0;
+			sort_xings(xings + start, end - start);
+			for (i = start; i < end; i++)
+			{
+				int x = xings[i] >> 1;
+				int d = (xings[i] & 1) ? 1 : -1;
+				if (!winding)
+					x0 = x;
+				winding += d;
+				if (!winding)
+					add_span(deltas, x0, x, hscale, &lo, &hi);
+			}
+		}
+		start = end;
+
+		if (++sub == vscale)
+		{
+			if (lo <= hi)
+			{
+				int d = 0;
+				int n = fz_mini(hi, w - 1) + 1 - lo;
+				for (i = 0; i < n; i++)
+				{
+					d += deltas[lo + i];
+					alphas[i] = AA_SCALE(scale, d);
+				}
+				merge_row(ctx, sp, clip->x0 - dst->x + lo, y, alphas, n);
+				memset(deltas + lo, 0, (hi + 1 - lo) * sizeof(int));
+				lo = INT_MAX;
+				hi = -1;
+			}
+			sub = 0;
+			y++;
+		}
+	}
+}
+
+static const fz_rasterizer_fns sparse_rasterizer =
+{
+	fz_drop_sparse,
+	fz_reset_sparse,
+	NULL, /* postindex */
+	fz_insert_sparse,
+	fz_insert_sparse_rect,
+	NULL, /* gap */
+	fz_convert_sparse,
+	fz_is_rect_sparse,
+	fz_flush_sparse,
+	1 /* Reusable */
+};
+
+fz_rasterizer *
+fz_new_sparse_rasterizer(fz_context *ctx, const fz_aa_context *aa)
+{
+	fz_sparse *sp;
+
+	sp = fz_new_derived_rasterizer(ctx, fz_sparse, &sparse_rasterizer);
+	fz_try(ctx)
+	{
+		sp->cap = 512;
+		sp->len = 0;
+		sp->edges = Memento_label(fz_malloc_array(ctx, sp->cap, fz_sparse_edge), "sparse_edges");
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, sp);
+		fz_rethrow(ctx);
+	}
+#ifndef AA_BITS
+	if (aa == NULL)
+		aa = &ctx->aa;
+	sp->super.aa = *aa;
+#endif
+
+	return &sp->super;
+}
@@ -296,6 +296,33 @@ fz_stream *
 fz_open_endstream_filter(fz_context *ctx, fz_stream *chain, uint64_t len, int64_t offset)
 {
 	struct endstream_filter *state;
+	fz_stream *slice;
+
+	/* If the data is all in memory (or mapped), and the length is
+	 * right, read it in place. */
+	slice = fz_open_memory_slice(ctx, chain, offset, UINT64_MAX);
+	if (slice)
+	{
+		unsigned char *end;
+		size_t after;
+
+		if (len <= (uint64_t)(slice->wp - slice->rp))
+		{
+			end = slice->rp + len;
+			after = slice->wp - end;
+			if (after > 0 && end[0] == '\r')
+				end++, after--;
+			if (after > 0 && end[0] == '\n')
+				end++, after--;
+			if (after >= 9 && !memcmp(end, "endstream", 9))
+			{
+				slice->wp = slice->rp + len;
+				slice->pos = (int64_t)len;
+				return slice;
+			}
+		}
+		fz_drop_stream(ctx, slice);
+	}
 
 	state = fz_malloc_struct(ctx, struct endstream_filter);
 	state->chain = fz_keep_stream(ctx, chain);
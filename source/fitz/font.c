@@ -292,6 +292,7 @@ struct fz_font_context
 	FT_Library ftlib;
 	struct FT_MemoryRec_ ftmemory;
 	int ftlib_refs;
+	int per_thread_ft;
 	fz_load_system_font_fn *load_font;
 	fz_load_system_cjk_font_fn *load_cjk_font;
 	fz_load_system_fallback_font_fn *load_fallback_font;
@@ -706,6 +707,170 @@ fz_drop_freetype(fz_context *ctx)
 	fz_ft_unlock(ctx);
 }
 
+/*
+ * Per-thread FreeType instances.
+ *
+ * FreeType faces carry the size, transform and glyph slot of the last
+ * glyph loaded, so the shared face in each fz_font can only be used with
+ * FZ_LOCK_FREETYPE held. When enabled, each context instead opens its own
+ * library and its own faces onto the (immutable) font data, and uses them
+ * for glyph loading without taking the lock. Faces are kept in a small
+ * move-to-front list, each holding a reference to its font.
+ */
+
+enum { FZ_FT_THREAD_FACES = 32 };
+
+struct fz_ft_thread_context
+{
+	FT_Library ftlib;
+	struct FT_MemoryRec_ ftmemory;
+	int len;
+	struct
+	{
+		fz_font *font;
+		FT_Face face;
+	} entry[FZ_FT_THREAD_FACES];
+};
+
+void
+fz_set_per_thread_freetype(fz_context *ctx, int enable)
+{
+	ctx->font->per_thread_ft = !!enable;
+}
+
+static void
+drop_thread_ft_face(fz_context *ctx, fz_ft_thread_context *ft, int i)
+{
+	fz_font *font = ft->entry[i].font;
+	int fterr = FT_Done_Face(ft->entry[i].face);
+	if (fterr)
+		fz_warn(ctx, "FT_Done_Face(%s): %s", font->name, ft_error_string(fterr));
+	fz_drop_font(ctx, font);
+	ft->len--;
+	memmove(&ft->entry[i], &ft->entry[i+1], (ft->len - i) * sizeof(ft->entry[0]));
+}
+
+/* Close the faces of fonts that nobody but us holds any more. */
+static void
+drop_unused_thread_ft_faces(fz_context *ctx, fz_ft_thread_context *ft)
+{
+	int i, unused;
+
+	for (i = ft->len - 1; i >= 0; i--)
+	{
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		unused = (ft->entry[i].font->refs == 1);
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		if (unused)
+			drop_thread_ft_face(ctx, ft, i);
+	}
+}
+
+/* Returns this context's own face for font, or NULL if the shared
+ * face must be used instead. */
+static FT_Face
+thread_ft_face(fz_context *ctx, fz_font *font)
+{
+	fz_ft_thread_context *ft = ctx->ft_thread;
+	FT_Face face;
+	int i, fterr;
+
+	if (!ctx->font->per_thread_ft || !font->buffer)
+		return NULL;
+
+	if (ft)
+	{
+		for (i = 0; i < ft->len; i++)
+		{
+			if (ft->entry[i].font == font)
+			{
+				face = ft->entry[i].face;
+				if (i > 0)
+				{
+					memmove(&ft->entry[1], &ft->entry[0], i * sizeof(ft->entry[0]));
+					ft->entry[0].font = font;
+					ft->entry[0].face = face;
+				}
+				return face;
+			}
+		}
+	}
+	else
+	{
+		ft = fz_malloc_no_throw(ctx, sizeof(*ft));
+		if (!ft)
+			return NULL;
+		memset(ft, 0, sizeof(*ft));
+		ft->ftmemory = ctx->font->ftmemory;
+		ft->ftmemory.user = ctx;
+		fterr = FT_New_Library(&ft->ftmemory, &ft->ftlib);
+		if (fterr)
+		{
+			fz_warn(ctx, "cannot init per-thread freetype: %s", ft_error_string(fterr));
+			fz_free(ctx, ft);
+			return NULL;
+		}
+		FT_Add_Default_Modules(ft->ftlib);
+		ctx->ft_thread = ft;
+	}
+
+	drop_unused_thread_ft_faces(ctx, ft);
+	if (ft->len == FZ_FT_THREAD_FACES)
+		drop_thread_ft_face(ctx, ft, ft->len - 1);
+
+	fterr = FT_New_Memory_Face(ft->ftlib, font->buffer->data, (FT_Long)font->buffer->len, font->subfont, &face);
+	if (fterr)
+		return NULL;
+
+	/* Carry over the hinting fixups made to the shared face after loading. */
+	face->face_flags |= ((FT_Face)font->ft_face)->face_flags & FT_FACE_FLAG_TRICKY;
+
+	memmove(&ft->entry[1], &ft->entry[0], ft->len * sizeof(ft->entry[0]));
+	ft->entry[0].font = fz_keep_font(ctx, font);
+	ft->entry[0].face = face;
+	ft->len++;
+
+	return face;
+}
+
+void
+fz_drop_ft_thread_context(fz_context *ctx)
+{
+	fz_ft_thread_context *ft = ctx->ft_thread;
+	int fterr;
+
+	if (!ft)
+		return;
+
+	while (ft->len > 0)
+		drop_thread_ft_face(ctx, ft, ft->len - 1);
+	fterr = FT_Done_Library(ft->ftlib);
+	if (fterr)
+		fz_warn(ctx, "FT_Done_Library(): %s", ft_error_string(fterr));
+	fz_free(ctx, ft);
+	ctx->ft_thread = NULL;
+}
+
+/* Returns the face to load glyphs of font with. This is either the
+ * context's own face, or the shared face with the freetype lock taken.
+ * Release with fz_unlock_ft_face. */
+static FT_Face
+fz_lock_ft_face(fz_context *ctx, fz_font *font)
+{
+	FT_Face face = thread_ft_face(ctx, font);
+	if (face)
+		return face;
+	fz_ft_lock(ctx);
+	return font->ft_face;
+}
+
+static void
+fz_unlock_ft_face(fz_context *ctx, fz_font *font, FT_Face face)
+{
+	if (face == font->ft_face)
+		fz_ft_unlock(ctx);
+}
+
 fz_font *
 fz_new_font_from_buffer(fz_context *ctx, const char *name, fz_buffer *buffer, int index, int use_glyph_bbox)
 {
@@ -969,7 +1134,7 @@ fz_new_builtin_font(fz_context *ctx, const char *name, int is_bold, int is_itali
 }
 
 static fz_matrix *
-fz_adjust_ft_glyph_width(fz_context *ctx, fz_font *font, int gid, fz_matrix *trm)
+fz_adjust_ft_glyph_width(fz_context *ctx, fz_font *font, FT_Face face, int gid, fz_matrix *trm)
 {
 	/* Fudge the font matrix to stretch the glyph if we've substituted the font. */
 	if (font->flags.ft_stretch && font->width_table /* && font->wmode == 0 */)
@@ -979,13 +1144,11 @@ fz_adjust_ft_glyph_width(fz_context *ctx, fz_font *font, int gid, fz_matrix *trm
 		float subw;
 		float realw;
 
-		fz_ft_lock(ctx);
-		fterr = FT_Get_Advance(font->ft_face, gid, FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM, &adv);
-		fz_ft_unlock(ctx);
+		fterr = FT_Get_Advance(face, gid, FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM, &adv);
 		if (fterr && fterr != FT_Err_Invalid_Argument)
 			fz_warn(ctx, "FT_Get_Advance(%s,%d): %s", font->name, gid, ft_error_string(fterr));
 
-		realw = adv * 1000.0f / ((FT_Face)font->ft_face)->units_per_EM;
+		realw = adv * 1000.0f / face->units_per_EM;
 		if (gid < font->width_count)
 			subw = font->width_table[gid];
 		else
@@ -1019,24 +1182,22 @@ pixmap_from_ft_bitmap(fz_context *ctx, int left, int top, FT_Bitmap *bitmap)
 		return fz_new_pixmap_from_8bpp_data(ctx, left, top - bitmap->rows, bitmap->width, bitmap->rows, bitmap->buffer + (bitmap->rows-1)*bitmap->pitch, -bitmap->pitch);
 }
 
-/* Takes the freetype lock, and returns with it held */
+/* Locks the face (see fz_lock_ft_face), and returns with it held */
 static FT_GlyphSlot
-do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int aa)
+do_ft_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int aa, FT_Face *facep)
 {
-	FT_Face face = font->ft_face;
+	FT_Face face = *facep = fz_lock_ft_face(ctx, font);
 	FT_Matrix m;
 	FT_Vector v;
 	FT_Error fterr;
 
 	float strength = fz_matrix_expansion(trm) * 0.02f;
 
-	fz_adjust_ft_glyph_width(ctx, font, gid, &trm);
+	fz_adjust_ft_glyph_width(ctx, font, face, gid, &trm);
 
 	if (font->flags.fake_italic)
 		trm = fz_pre_shear(trm, SHEAR, 0);
 
-	fz_ft_lock(ctx);
-
 	if (aa == 0)
 	{
 		/* enable grid fitting for non-antialiased rendering */
@@ -1115,12 +1276,13 @@ retry_unhinted:
 fz_pixmap *
 fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int aa)
 {
-	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa);
+	FT_Face face;
+	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa, &face);
 	fz_pixmap *pixmap = NULL;
 
 	if (slot == NULL)
 	{
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 		return NULL;
 	}
 
@@ -1130,7 +1292,7 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix trm
 	}
 	fz_always(ctx)
 	{
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 	}
 	fz_catch(ctx)
 	{
@@ -1140,16 +1302,16 @@ fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix trm
 	return pixmap;
 }
 
-/* The glyph cache lock is always taken when this is called. */
 fz_glyph *
 fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int aa)
 {
-	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa);
+	FT_Face face;
+	FT_GlyphSlot slot = do_ft_render_glyph(ctx, font, gid, trm, aa, &face);
 	fz_glyph *glyph = NULL;
 
 	if (slot == NULL)
 	{
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 		return NULL;
 	}
 
@@ -1159,7 +1321,7 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int a
 	}
 	fz_always(ctx)
 	{
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 	}
 	fz_catch(ctx)
 	{
@@ -1169,11 +1331,11 @@ fz_render_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, int a
 	return glyph;
 }
 
-/* Takes the freetype lock, and returns with it held */
+/* Locks the face (see fz_lock_ft_face), and returns with it held */
 static FT_Glyph
-do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, fz_matrix ctm, const fz_stroke_state *state, int aa)
+do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, fz_matrix ctm, const fz_stroke_state *state, int aa, FT_Face *facep)
 {
-	FT_Face face = font->ft_face;
+	FT_Face face = *facep = fz_lock_ft_face(ctx, font);
 	float expansion = fz_matrix_expansion(ctm);
 	int linewidth = state->linewidth * expansion * 64 / 2;
 	FT_Matrix m;
@@ -1184,7 +1346,7 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 	FT_Stroker_LineJoin line_join;
 	FT_Stroker_LineCap line_cap;
 
-	fz_adjust_ft_glyph_width(ctx, font, gid, &trm);
+	fz_adjust_ft_glyph_width(ctx, font, face, gid, &trm);
 
 	if (font->flags.fake_italic)
 		trm = fz_pre_shear(trm, SHEAR, 0);
@@ -1196,7 +1358,6 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 	v.x = trm.e * 64;
 	v.y = trm.f * 64;
 
-	fz_ft_lock(ctx);
 	fterr = FT_Set_Char_Size(face, 65536, 65536, 72, 72); /* should be 64, 64 */
 	if (fterr)
 	{
@@ -1213,7 +1374,7 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 		return NULL;
 	}
 
-	fterr = FT_Stroker_New(ctx->font->ftlib, &stroker);
+	fterr = FT_Stroker_New(face->glyph->library, &stroker);
 	if (fterr)
 	{
 		fz_warn(ctx, "FT_Stroker_New(): %s", ft_error_string(fterr));
@@ -1266,13 +1427,14 @@ do_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 fz_glyph *
 fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm, fz_matrix ctm, const fz_stroke_state *state, int aa)
 {
-	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, gid, trm, ctm, state, aa);
+	FT_Face face;
+	FT_Glyph glyph = do_render_ft_stroked_glyph(ctx, font, gid, trm, ctm, state, aa, &face);
 	FT_BitmapGlyph bitmap = (FT_BitmapGlyph)glyph;
 	fz_glyph *result = NULL;
 
 	if (bitmap == NULL)
 	{
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 		return NULL;
 	}
 
@@ -1283,7 +1445,7 @@ fz_render_ft_stroked_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix tr
 	fz_always(ctx)
 	{
 		FT_Done_Glyph(glyph);
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 	}
 	fz_catch(ctx)
 	{
@@ -1320,12 +1482,12 @@ get_gid_bbox(fz_context *ctx, fz_font *font, int gid)
 static fz_rect *
 fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 {
-	FT_Face face = font->ft_face;
+	fz_rect *bounds = get_gid_bbox(ctx, font, gid);
+	FT_Face face = fz_lock_ft_face(ctx, font);
 	FT_Error fterr;
 	FT_BBox cbox;
 	FT_Matrix m;
 	FT_Vector v;
-	fz_rect *bounds = get_gid_bbox(ctx, font, gid);
 
 	// TODO: refactor loading into fz_load_ft_glyph
 	// TODO: cache results
@@ -1335,7 +1497,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	const float strength = 0.02f;
 	fz_matrix trm = fz_identity;
 
-	fz_adjust_ft_glyph_width(ctx, font, gid, &trm);
+	fz_adjust_ft_glyph_width(ctx, font, face, gid, &trm);
 
 	if (font->flags.fake_italic)
 		trm = fz_pre_shear(trm, SHEAR, 0);
@@ -1347,7 +1509,6 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	v.x = trm.e * 65536;
 	v.y = trm.f * 65536;
 
-	fz_ft_lock(ctx);
 	/* Set the char size to scale=face->units_per_EM to effectively give
 	 * us unscaled results. This avoids quantisation. We then apply the
 	 * scale ourselves below. */
@@ -1360,7 +1521,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	if (fterr)
 	{
 		fz_warn(ctx, "FT_Load_Glyph(%s,%d,FT_LOAD_NO_HINTING): %s", font->name, gid, ft_error_string(fterr));
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 		bounds->x0 = bounds->x1 = trm.e;
 		bounds->y0 = bounds->y1 = trm.f;
 		return bounds;
@@ -1373,7 +1534,7 @@ fz_bound_ft_glyph(fz_context *ctx, fz_font *font, int gid)
 	}
 
 	FT_Outline_Get_CBox(&face->glyph->outline, &cbox);
-	fz_ft_unlock(ctx);
+	fz_unlock_ft_face(ctx, font, face);
 	bounds->x0 = cbox.xMin * recip;
 	bounds->y0 = cbox.yMin * recip;
 	bounds->x1 = cbox.xMax * recip;
@@ -1457,20 +1618,18 @@ fz_path *
 fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 {
 	struct closure cc;
-	FT_Face face = font->ft_face;
+	FT_Face face = fz_lock_ft_face(ctx, font);
 	int fterr;
 
 	const int scale = 65536;
 	const float recip = 1.0f / scale;
 	const float strength = 0.02f;
 
-	fz_adjust_ft_glyph_width(ctx, font, gid, &trm);
+	fz_adjust_ft_glyph_width(ctx, font, face, gid, &trm);
 
 	if (font->flags.fake_italic)
 		trm = fz_pre_shear(trm, SHEAR, 0);
 
-	fz_ft_lock(ctx);
-
 	fterr = FT_Set_Char_Size(face, scale, scale, 72, 72);
 	if (fterr)
 		fz_warn(ctx, "FT_Set_Char_Size(%s,%d,72): %s", font->name, scale, ft_error_string(fterr));
@@ -1484,7 +1643,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 	if (fterr)
 	{
 		fz_warn(ctx, "FT_Load_Glyph(%s,%d,FT_LOAD_IGNORE_TRANSFORM | FT_LOAD_NO_HINTING): %s", font->name, gid, ft_error_string(fterr));
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 		return NULL;
 	}
 
@@ -1506,7 +1665,7 @@ fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm)
 	}
 	fz_always(ctx)
 	{
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 	}
 	fz_catch(ctx)
 	{
@@ -1826,6 +1985,7 @@ int fz_glyph_cacheable(fz_context *ctx, fz_font *font, int gid)
 static float
 fz_advance_ft_glyph_aux(fz_context *ctx, fz_font *font, int gid, int wmode, int locked)
 {
+	FT_Face face;
 	FT_Error fterr;
 	FT_Fixed adv = 0;
 	int mask;
@@ -1844,11 +2004,10 @@ fz_advance_ft_glyph_aux(fz_context *ctx, fz_font *font, int gid, int wmode, int
 	mask = FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING | FT_LOAD_IGNORE_TRANSFORM;
 	if (wmode)
 		mask |= FT_LOAD_VERTICAL_LAYOUT;
+	face = locked ? font->ft_face : fz_lock_ft_face(ctx, font);
+	fterr = FT_Get_Advance(face, gid, mask, &adv);
 	if (!locked)
-		fz_ft_lock(ctx);
-	fterr = FT_Get_Advance(font->ft_face, gid, mask, &adv);
-	if (!locked)
-		fz_ft_unlock(ctx);
+		fz_unlock_ft_face(ctx, font, face);
 	if (fterr && fterr != FT_Err_Invalid_Argument)
 	{
 		fz_warn(ctx, "FT_Get_Advance(%s,%d): %s", font->name, gid, ft_error_string(fterr));
@@ -1859,7 +2018,7 @@ fz_advance_ft_glyph_aux(fz_context *ctx, fz_font *font, int gid, int wmode, int
 			return font->width_default / 1000.0f;
 		}
 	}
-	return (float) adv / ((FT_Face)font->ft_face)->units_per_EM;
+	return (float) adv / face->units_per_EM;
 }
 
 static float
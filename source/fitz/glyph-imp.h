@@ -101,6 +101,15 @@ fz_glyph *fz_new_glyph_from_8bpp_data(fz_context *ctx, int x, int y, int w, int
 */
 fz_glyph *fz_new_glyph_from_1bpp_data(fz_context *ctx, int x, int y, int w, int h, unsigned char *sp, int span);
 
+/*
+	Create a new glyph from run length encoded data, as found in
+	the data of another glyph.
+
+	Returns a pointer to the new glyph. Throws exception on failure
+	to allocate.
+*/
+fz_glyph *fz_new_glyph_from_rle_data(fz_context *ctx, int x, int y, int w, int h, const unsigned char *data, size_t size);
+
 fz_path *fz_outline_ft_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix trm);
 fz_glyph *fz_render_ft_glyph(fz_context *ctx, fz_font *font, int cid, fz_matrix trm, int aa);
 fz_pixmap *fz_render_ft_glyph_pixmap(fz_context *ctx, fz_font *font, int cid, fz_matrix trm, int aa);
@@ -187,6 +187,21 @@ fz_new_glyph_from_pixmap(fz_context *ctx, fz_pixmap *pix)
 	return glyph;
 }
 
+fz_glyph *
+fz_new_glyph_from_rle_data(fz_context *ctx, int x, int y, int w, int h, const unsigned char *data, size_t size)
+{
+	fz_glyph *glyph = Memento_label(fz_malloc(ctx, sizeof(fz_glyph) + size), "fz_glyph(rle)");
+	FZ_INIT_STORABLE(glyph, 1, fz_drop_glyph_imp);
+	glyph->x = x;
+	glyph->y = y;
+	glyph->w = w;
+	glyph->h = h;
+	glyph->pixmap = NULL;
+	glyph->size = size;
+	memcpy(glyph->data, data, size);
+	return glyph;
+}
+
 fz_glyph *
 fz_new_glyph_from_8bpp_data(fz_context *ctx, int x, int y, int w, int h, unsigned char *sp, int span)
 {
@@ -932,6 +932,274 @@ fz_find_image_tile(fz_context *ctx, fz_image *image, fz_image_key *key, fz_matri
 	return NULL;
 }
 
+/*
+	The on-disk second level cache for decoded tiles (see
+	fz_set_store_disk_cache). Each tile is kept in a file, named by
+	a digest of everything that went into decoding it, holding a
+	header followed by the samples.
+*/
+
+enum
+{
+	DISK_CACHE_CS_NONE,
+	DISK_CACHE_CS_IMAGE,
+	DISK_CACHE_CS_BASE,
+	DISK_CACHE_CS_GRAY,
+	DISK_CACHE_CS_RGB,
+	DISK_CACHE_CS_CMYK
+};
+
+typedef struct
+{
+	char magic[8];
+	int w, h, n, alpha;
+	int xres, yres, flags, cs;
+	fz_irect rect;
+} disk_cache_header;
+
+static const char disk_cache_magic[8] = "MuTile1";
+
+static int
+disk_cache_digest(fz_context *ctx, fz_image *image, const fz_irect *rect, int l2factor, unsigned char digest[16])
+{
+	fz_compressed_buffer *cbuf;
+	fz_compression_params *params;
+	fz_colorspace *cs = image->colorspace;
+	fz_md5 md5;
+	int i;
+
+	/* Only cache those images that are expensive to decode. */
+	if (image->get_pixmap != compressed_image_get_pixmap)
+		return 0;
+	cbuf = ((fz_compressed_image *)image)->buffer;
+	if (cbuf == NULL || cbuf->buffer == NULL)
+		return 0;
+	params = &cbuf->params;
+	if (params->type != FZ_IMAGE_JPX && params->type != FZ_IMAGE_JBIG2 && params->type != FZ_IMAGE_FAX)
+		return 0;
+
+	/* Unblending a matte depends on the mask too. */
+	if (image->use_colorkey && image->mask)
+		return 0;
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, cbuf->buffer->data, cbuf->buffer->len);
+	fz_md5_update_int64(&md5, params->type);
+	if (params->type == FZ_IMAGE_JPX)
+	{
+		fz_md5_update_int64(&md5, params->u.jpx.smask_in_data);
+	}
+	else if (params->type == FZ_IMAGE_JBIG2)
+	{
+		fz_buffer *globals = fz_jbig2_globals_data(ctx, params->u.jbig2.globals);
+		if (globals)
+			fz_md5_update(&md5, globals->data, globals->len);
+		fz_md5_update_int64(&md5, params->u.jbig2.embedded);
+	}
+	else
+	{
+		fz_md5_update_int64(&md5, params->u.fax.columns);
+		fz_md5_update_int64(&md5, params->u.fax.rows);
+		fz_md5_update_int64(&md5, params->u.fax.k);
+		fz_md5_update_int64(&md5, params->u.fax.end_of_line);
+		fz_md5_update_int64(&md5, params->u.fax.encoded_byte_align);
+		fz_md5_update_int64(&md5, params->u.fax.end_of_block);
+		fz_md5_update_int64(&md5, params->u.fax.black_is_1);
+		fz_md5_update_int64(&md5, params->u.fax.damaged_rows_before_error);
+	}
+
+	fz_md5_update_int64(&md5, image->w);
+	fz_md5_update_int64(&md5, image->h);
+	fz_md5_update_int64(&md5, image->n);
+	fz_md5_update_int64(&md5, image->bpc);
+	fz_md5_update_int64(&md5, image->imagemask);
+	fz_md5_update_int64(&md5, image->interpolate);
+	fz_md5_update_int64(&md5, image->use_colorkey);
+	fz_md5_update_int64(&md5, image->use_decode);
+	if (image->use_colorkey)
+		for (i = 0; i < image->n * 2; i++)
+			fz_md5_update_int64(&md5, image->colorkey[i]);
+	if (image->use_decode)
+		for (i = 0; i < image->n * 2; i++)
+			fz_md5_update_int64(&md5, (int64_t)(image->decode[i] * 65536));
+
+	if (cs)
+	{
+		fz_md5_update_int64(&md5, cs->type);
+		fz_md5_update_int64(&md5, cs->n);
+		if (fz_colorspace_is_indexed(ctx, cs))
+		{
+			fz_md5_update_int64(&md5, cs->u.indexed.high);
+			fz_md5_update(&md5, cs->u.indexed.lookup, (size_t)(cs->u.indexed.high + 1) * cs->u.indexed.base->n);
+		}
+	}
+
+	fz_md5_update_int64(&md5, rect->x0);
+	fz_md5_update_int64(&md5, rect->y0);
+	fz_md5_update_int64(&md5, rect->x1);
+	fz_md5_update_int64(&md5, rect->y1);
+	fz_md5_update_int64(&md5, l2factor);
+	fz_md5_final(&md5, digest);
+
+	return 1;
+}
+
+static char *
+disk_cache_path(fz_context *ctx, const char *dir, const unsigned char digest[16], const char *suffix)
+{
+	static const char hex[] = "0123456789abcdef";
+	char name[33];
+	int i;
+
+	for (i = 0; i < 16; i++)
+	{
+		name[i*2] = hex[digest[i] >> 4];
+		name[i*2+1] = hex[digest[i] & 15];
+	}
+	name[32] = 0;
+
+	return fz_asprintf(ctx, "%s/%s%s", dir, name, suffix);
+}
+
+static fz_pixmap *
+load_disk_cached_tile(fz_context *ctx, fz_image *image, const char *dir, const unsigned char digest[16], fz_irect *rect)
+{
+	char *path;
+	fz_stream *stm = NULL;
+	fz_pixmap *tile = NULL;
+	fz_colorspace *cs = NULL;
+	disk_cache_header hdr;
+	size_t len;
+
+	path = disk_cache_path(ctx, dir, digest, "");
+
+	fz_var(stm);
+	fz_var(tile);
+
+	fz_try(ctx)
+	{
+		stm = fz_try_open_file(ctx, path);
+		if (stm == NULL)
+			break;
+
+		if (fz_read(ctx, stm, (unsigned char *)&hdr, sizeof hdr) != sizeof hdr || memcmp(hdr.magic, disk_cache_magic, sizeof hdr.magic))
+			fz_throw(ctx, FZ_ERROR_FORMAT, "bad header in cached tile '%s'", path);
+
+		switch (hdr.cs)
+		{
+		case DISK_CACHE_CS_NONE: cs = NULL; break;
+		case DISK_CACHE_CS_IMAGE: cs = image->colorspace; break;
+		case DISK_CACHE_CS_BASE: cs = image->colorspace ? fz_base_colorspace(ctx, image->colorspace) : NULL; break;
+		case DISK_CACHE_CS_GRAY: cs = fz_device_gray(ctx); break;
+		case DISK_CACHE_CS_RGB: cs = fz_device_rgb(ctx); break;
+		case DISK_CACHE_CS_CMYK: cs = fz_device_cmyk(ctx); break;
+		default: fz_throw(ctx, FZ_ERROR_FORMAT, "bad colorspace in cached tile '%s'", path);
+		}
+
+		tile = fz_new_pixmap(ctx, cs, hdr.w, hdr.h, NULL, hdr.alpha);
+		if (tile->n != hdr.n)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "bad components in cached tile '%s'", path);
+		len = (size_t)tile->stride * tile->h;
+		if (fz_read(ctx, stm, tile->samples, len) != len)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "truncated cached tile '%s'", path);
+		tile->xres = hdr.xres;
+		tile->yres = hdr.yres;
+		tile->flags = hdr.flags;
+		*rect = hdr.rect;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_free(ctx, path);
+	}
+	fz_catch(ctx)
+	{
+		/* Fall back to decoding. */
+		fz_drop_pixmap(ctx, tile);
+		tile = NULL;
+		fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+		fz_report_error(ctx);
+	}
+
+	return tile;
+}
+
+static void
+save_disk_cached_tile(fz_context *ctx, fz_image *image, const char *dir, const unsigned char digest[16], fz_pixmap *tile, const fz_irect *rect)
+{
+	char *path = NULL;
+	char *tmp = NULL;
+	fz_output *out = NULL;
+	disk_cache_header hdr;
+
+	memset(&hdr, 0, sizeof hdr);
+	if (tile->colorspace == NULL)
+		hdr.cs = DISK_CACHE_CS_NONE;
+	else if (tile->colorspace == image->colorspace)
+		hdr.cs = DISK_CACHE_CS_IMAGE;
+	else if (image->colorspace && tile->colorspace == fz_base_colorspace(ctx, image->colorspace))
+		hdr.cs = DISK_CACHE_CS_BASE;
+	else if (tile->colorspace == fz_device_gray(ctx))
+		hdr.cs = DISK_CACHE_CS_GRAY;
+	else if (tile->colorspace == fz_device_rgb(ctx))
+		hdr.cs = DISK_CACHE_CS_RGB;
+	else if (tile->colorspace == fz_device_cmyk(ctx))
+		hdr.cs = DISK_CACHE_CS_CMYK;
+	else
+		return; /* We can't recreate other colorspaces (such as embedded ICC profiles). */
+
+	/* We only recreate plain tiles. */
+	if (tile->s != 0 || tile->x != 0 || tile->y != 0 || tile->stride != tile->w * tile->n)
+		return;
+
+	memcpy(hdr.magic, disk_cache_magic, sizeof hdr.magic);
+	hdr.w = tile->w;
+	hdr.h = tile->h;
+	hdr.n = tile->n;
+	hdr.alpha = tile->alpha;
+	hdr.xres = tile->xres;
+	hdr.yres = tile->yres;
+	hdr.flags = tile->flags;
+	hdr.rect = *rect;
+
+	fz_var(path);
+	fz_var(tmp);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		/* Write to a temporary file, then rename it into place, so
+		 * that readers never see a partially written tile. */
+		path = disk_cache_path(ctx, dir, digest, "");
+		tmp = fz_asprintf(ctx, "%s.%p-%x.tmp", path, (void *)tile, (unsigned int)fz_time_us());
+		out = fz_new_output_with_path(ctx, tmp, 0);
+		fz_write_data(ctx, out, &hdr, sizeof hdr);
+		fz_write_data(ctx, out, tile->samples, (size_t)tile->stride * tile->h);
+		fz_close_output(ctx, out);
+		fz_drop_output(ctx, out);
+		out = NULL;
+		if (rename(tmp, path) < 0)
+		{
+#ifdef _WIN32
+			fz_remove_utf8(tmp);
+#else
+			remove(tmp);
+#endif
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_free(ctx, tmp);
+		fz_free(ctx, path);
+	}
+	fz_catch(ctx)
+	{
+		/* Failing to cache is not fatal. */
+		fz_report_error(ctx);
+	}
+}
+
 fz_pixmap *
 fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *ctm, int *dw, int *dh)
 {
@@ -941,6 +1209,10 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 	fz_image_key *keyp = NULL;
 	int w;
 	int h;
+	int64_t start;
+	const char *disk_cache;
+	unsigned char digest[16];
+	int use_disk_cache = 0;
 
 	fz_var(keyp);
 
@@ -1017,26 +1289,45 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 	if (subarea)
 		fz_compute_image_key(ctx, image, ctm, &key, subarea, l2factor, &w, &h, dw, dh);
 
-	/* We'll have to decode the image; request the correct amount of downscaling. */
-	l2factor_remaining = l2factor;
-	tile = image->get_pixmap(ctx, image, &key.rect, w, h, &l2factor_remaining);
+	/* We'll have to decode the image; request the correct amount of downscaling.
+	 * Time it, so the store knows how costly the tile is to recreate. */
+	start = fz_time_us();
+	tile = NULL;
 
-	/* Update the ctm to allow for subareas. */
-	update_ctm_for_subarea(ctm, &key.rect, image->w, image->h);
+	/* Look in the on-disk cache first, if we have one. */
+	disk_cache = fz_store_disk_cache(ctx);
+	if (disk_cache)
+	{
+		use_disk_cache = disk_cache_digest(ctx, image, &key.rect, l2factor, digest);
+		if (use_disk_cache)
+			tile = load_disk_cached_tile(ctx, image, disk_cache, digest, &key.rect);
+	}
 
-	/* l2factor_remaining is updated to the amount of subscaling left to do */
-	assert(l2factor_remaining >= 0 && l2factor_remaining <= 6);
-	if (l2factor_remaining)
+	if (tile == NULL)
 	{
-		fz_try(ctx)
-			fz_subsample_pixmap(ctx, tile, l2factor_remaining);
-		fz_catch(ctx)
+		l2factor_remaining = l2factor;
+		tile = image->get_pixmap(ctx, image, &key.rect, w, h, &l2factor_remaining);
+
+		/* l2factor_remaining is updated to the amount of subscaling left to do */
+		assert(l2factor_remaining >= 0 && l2factor_remaining <= 6);
+		if (l2factor_remaining)
 		{
-			fz_drop_pixmap(ctx, tile);
-			fz_rethrow(ctx);
+			fz_try(ctx)
+				fz_subsample_pixmap(ctx, tile, l2factor_remaining);
+			fz_catch(ctx)
+			{
+				fz_drop_pixmap(ctx, tile);
+				fz_rethrow(ctx);
+			}
 		}
+
+		if (use_disk_cache)
+			save_disk_cached_tile(ctx, image, disk_cache, digest, tile, &key.rect);
 	}
 
+	/* Update the ctm to allow for subareas. */
+	update_ctm_for_subarea(ctm, &key.rect, image->w, image->h);
+
 	fz_try(ctx)
 	{
 		fz_pixmap *existing_tile;
@@ -1049,7 +1340,7 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 		keyp->l2factor = l2factor;
 		keyp->rect = key.rect;
 
-		existing_tile = fz_store_item(ctx, keyp, tile, fz_pixmap_size(ctx, tile), &fz_image_store_type);
+		existing_tile = fz_store_item_with_cost(ctx, keyp, tile, fz_pixmap_size(ctx, tile), fz_time_us() - start, &fz_image_store_type);
 		if (existing_tile)
 		{
 			/* We already have a tile. This must have been produced by a
@@ -23,6 +23,8 @@
 #include "mupdf/fitz.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
 #include <string.h>
 
 #define STACK_SIZE 96
@@ -71,15 +73,17 @@ typedef enum
  *		data occupies. (i.e. &node[size] = the next node in the
  *		chain; 0 for end of list).
  *
- *		At 9 bits for this field, and 4 bytes for a node, this means
- *		the largest node can span 511*4 bytes. We therefore reserve
- *		511 as a special value to mean that the actual size for the
+ *		At 8 bits for this field, and 4 bytes for a node, this means
+ *		the largest node can span 255*4 bytes. We therefore reserve
+ *		255 as a special value to mean that the actual size for the
  *		node is given in an (unaligned!) size_t following the node
  *		before the rest of the data.
  *
  *	rect:	0 for unchanged, 1 for present.
  *
- *	path:	0 for unchanged, 1 for present.
+ *	path:	0 for unchanged, 1 for present. A path identical to one
+ *		already packed in the list is stored as a fz_list_path_ref
+ *		to that copy instead.
  *
  *	cs:	0 for unchanged
  *		1 for devicegray (color defaults to 0)
@@ -90,7 +94,8 @@ typedef enum
  *		6 for devicecmyk (color defaults to 0,0,0,1)
  *		7 for present (color defaults to 0)
  *
- *	color:	0 for unchanged color, 1 for present.
+ *	color:	0 for unchanged color, 1 for present, 2 for a 32 bit node
+ *		offset of identical color values earlier in the list.
  *
  *	alpha:	0 for unchanged, 1 for solid, 2 for transparent, 3
  *		for alpha value present.
@@ -100,7 +105,9 @@ typedef enum
  *		2 for change bc
  *		4 for change ef.
  *
- *	stroke:	0 for unchanged, 1 for present.
+ *	stroke:	0 for unchanged, 1 for present. Identical stroke states
+ *		(and texts) are shared by pointer, so that a state that is
+ *		recreated for every stroke is only stored once.
  *
  *	flags:	Flags (node specific meanings)
  *
@@ -110,11 +117,11 @@ typedef enum
 typedef struct
 {
 	unsigned int cmd    : 5;
-	unsigned int size   : 9;
+	unsigned int size   : 8;
 	unsigned int rect   : 1;
 	unsigned int path   : 1;
 	unsigned int cs     : 3;
-	unsigned int color  : 1;
+	unsigned int color  : 2;
 	unsigned int alpha  : 2;
 	unsigned int ctm    : 3;
 	unsigned int stroke : 1;
@@ -131,6 +138,10 @@ enum {
 	CS_CMYK_1    = 6,
 	CS_OTHER_0   = 7,
 
+	COLOR_UNCHANGED = 0,
+	COLOR_PRESENT   = 1,
+	COLOR_REPEAT    = 2,
+
 	ALPHA_UNCHANGED = 0,
 	ALPHA_1         = 1,
 	ALPHA_0         = 2,
@@ -141,9 +152,87 @@ enum {
 	CTM_CHANGE_BC = 2,
 	CTM_CHANGE_EF = 4,
 
-	INDIRECT_NODE_THRESHOLD = (1<<9)-1
+	INDIRECT_NODE_THRESHOLD = (1<<8)-1
 };
 
+/* Optional spatial index over a closed display list, so that runs
+ * through a small scissor (zoomed views, bands, tiles) can jump over
+ * nodes that the scissor test would cull anyway.
+ *
+ * Leaf drawing commands are bucketed by their bbox into a stack of
+ * uniform grids, each four times coarser than the one below; every
+ * entry goes in the finest grid where it spans only a few cells.
+ * Commands that the playback loop never culls, or that change the
+ * clip/group nesting, are kept in an "always" set. Nodes are delta
+ * encoded, so the graphics state is snapshotted every INDEX_CHUNK
+ * commands; a jump restores the nearest snapshot and decodes forward
+ * from there.
+ *
+ * A clip, mask or group whose opening node is culled takes its whole
+ * subtree with it. Small subtrees are therefore bucketed as a single
+ * entry by the bbox of their opening node, and larger ones are listed
+ * separately so that they can be dropped as a whole.
+ *
+ * The index only covers the nodes there were when it was built, so it
+ * is dropped as soon as anything else is appended to the list. */
+
+#define INDEX_CHUNK 16
+#define INDEX_SMALL_SUBTREE 64
+#define INDEX_MAX_CELLS_PER_NODE 16
+#define INDEX_MAX_GRID 1024
+#define INDEX_MAX_GRID_LEVELS 6
+#define INDEX_MIN_LIST_SIZE 4096 /* in nodes */
+
+typedef struct
+{
+	fz_rect rect;
+	fz_matrix ctm;
+	float alpha;
+	fz_colorspace *colorspace;
+	int color_default; /* CS_* code if color was reset by a colorspace change */
+	size_t color; /* else offset (in nodes) of the color values */
+	fz_stroke_state *stroke;
+	fz_path *path;
+} fz_list_state;
+
+typedef struct
+{
+	size_t start, end; /* in commands */
+	fz_rect rect;
+} fz_list_subtree;
+
+typedef struct
+{
+	unsigned int cmd, len;
+} fz_list_entry;
+
+typedef struct
+{
+	int gw, gh;
+	float sx, sy;
+	unsigned int *cell_start;
+	fz_list_entry *cells;
+} fz_list_grid;
+
+typedef struct
+{
+	size_t ncmds;
+
+	/* Node offset of, and state before, every INDEX_CHUNK'th command.
+	 * The pointers borrow the references held by the list. */
+	size_t *offset;
+	fz_list_state *state;
+
+	uint64_t *always;
+
+	fz_rect bounds;
+	int levels;
+	fz_list_grid grid[INDEX_MAX_GRID_LEVELS];
+
+	size_t nsubtrees;
+	fz_list_subtree *subtrees;
+} fz_list_index;
+
 struct fz_display_list
 {
 	fz_storable storable;
@@ -151,14 +240,50 @@ struct fz_display_list
 	fz_rect mediabox;
 	size_t max;
 	size_t len;
+	fz_list_index *index;
 };
 
+static void fz_drop_list_index(fz_context *ctx, fz_list_index *index);
+
+/* While a list is being written, the paths, colors, stroke states and
+ * texts most recently stored are remembered by content hash, so that
+ * repeats can point back at the stored copy. The cache is direct
+ * mapped, so its size is fixed however long the list gets. Each slot
+ * holds the node offset of the stored copy (0 for an empty slot); the
+ * caller checks that the contents really match. */
+#define LIST_INTERN_SIZE 4096
+
+typedef struct
+{
+	unsigned int hash;
+	unsigned int offset;
+} fz_list_intern_slot;
+
+typedef struct
+{
+	fz_list_intern_slot *slot;
+} fz_list_intern;
+
+/* A repeated path: the packed byte overlays that of the packed path
+ * (see path.c), which never takes this value. */
+typedef struct
+{
+	int8_t refs;
+	uint8_t packed;
+	uint16_t pad;
+	unsigned int offset; /* in nodes, of the earlier packed path */
+} fz_list_path_ref;
+
+#define LIST_PATH_REF 255
+
 typedef struct
 {
 	fz_device super;
 
 	fz_display_list *list;
 
+	fz_list_intern paths, colors, strokes, texts;
+
 	fz_path *path;
 	float alpha;
 	fz_matrix ctm;
@@ -233,6 +358,158 @@ cmd_needs_alignment(fz_display_command cmd)
 		cmd == FZ_CMD_DEFAULT_COLORSPACES);
 }
 
+/* Return the slot for hash. It holds a candidate for a repeat if its
+ * hash matches; otherwise it can be reused for the new copy. */
+static fz_list_intern_slot *
+lookup_list_intern(fz_context *ctx, fz_list_intern *t, unsigned int hash)
+{
+	/* The hashes are built by multiplication, which only carries
+	 * changes upwards, so fold the top bits down for the index. */
+	unsigned int k = (hash ^ (hash >> 16)) * 0x45d9f3bu;
+
+	if (t->slot == NULL)
+		t->slot = fz_calloc(ctx, LIST_INTERN_SIZE, sizeof(fz_list_intern_slot));
+	return &t->slot[(k ^ (k >> 16)) & (LIST_INTERN_SIZE - 1)];
+}
+
+static void
+insert_list_intern(fz_list_intern_slot *slot, unsigned int hash, size_t offset)
+{
+	if (slot == NULL || offset >= UINT_MAX)
+		return;
+	slot->hash = hash;
+	slot->offset = (unsigned int)offset;
+}
+
+static void
+drop_list_intern(fz_context *ctx, fz_list_intern *t)
+{
+	fz_free(ctx, t->slot);
+	t->slot = NULL;
+}
+
+static unsigned int
+hash_list_words(unsigned int h, const void *data, size_t n)
+{
+	const unsigned char *p = data;
+	unsigned int v;
+
+	while (n--)
+	{
+		memcpy(&v, p, sizeof(v));
+		h = (h ^ v) * 16777619u;
+		p += sizeof(v);
+	}
+	return h;
+}
+
+static unsigned int
+hash_list_color(const float *color, int n)
+{
+	/* Keep n in the top bits, so equal hashes mean equal lengths. */
+	return (hash_list_words(2166136261u, color, n) >> 6) | ((unsigned int)n << 26);
+}
+
+static unsigned int
+hash_stroke_state(const fz_stroke_state *stroke)
+{
+	unsigned int v[8];
+
+	v[0] = stroke->start_cap;
+	v[1] = stroke->dash_cap;
+	v[2] = stroke->end_cap;
+	v[3] = stroke->linejoin;
+	memcpy(&v[4], &stroke->linewidth, sizeof(float));
+	memcpy(&v[5], &stroke->miterlimit, sizeof(float));
+	memcpy(&v[6], &stroke->dash_phase, sizeof(float));
+	v[7] = stroke->dash_len;
+	return hash_list_words(hash_list_words(2166136261u, v, 8), stroke->dash_list, stroke->dash_len);
+}
+
+static int
+compare_stroke_states(const fz_stroke_state *a, const fz_stroke_state *b)
+{
+	return a->start_cap != b->start_cap ||
+		a->dash_cap != b->dash_cap ||
+		a->end_cap != b->end_cap ||
+		a->linejoin != b->linejoin ||
+		memcmp(&a->linewidth, &b->linewidth, sizeof(float)) ||
+		memcmp(&a->miterlimit, &b->miterlimit, sizeof(float)) ||
+		memcmp(&a->dash_phase, &b->dash_phase, sizeof(float)) ||
+		a->dash_len != b->dash_len ||
+		memcmp(a->dash_list, b->dash_list, a->dash_len * sizeof(float));
+}
+
+static unsigned int
+hash_text(const fz_text *text)
+{
+	unsigned int h = 2166136261u;
+	fz_text_span *span;
+
+	for (span = text->head; span; span = span->next)
+	{
+		uintptr_t font = (uintptr_t)span->font;
+		unsigned int v[6];
+
+		v[0] = (unsigned int)font;
+		v[1] = (unsigned int)(font >> 16 >> 16);
+		v[2] = span->wmode | (span->bidi_level << 1) | (span->markup_dir << 8);
+		v[3] = span->language;
+		v[4] = span->len;
+		v[5] = 0;
+		h = hash_list_words(h, v, 6);
+		h = hash_list_words(h, &span->trm, 6);
+		h = hash_list_words(h, span->items, span->len * (sizeof(fz_text_item) / sizeof(unsigned int)));
+	}
+	return h;
+}
+
+static int
+compare_texts(const fz_text *a, const fz_text *b)
+{
+	const fz_text_span *x = a->head, *y = b->head;
+
+	for (; x && y; x = x->next, y = y->next)
+	{
+		if (x->font != y->font ||
+			x->wmode != y->wmode ||
+			x->bidi_level != y->bidi_level ||
+			x->markup_dir != y->markup_dir ||
+			x->language != y->language ||
+			x->len != y->len ||
+			memcmp(&x->trm, &y->trm, sizeof(fz_matrix)) ||
+			(x->len > 0 && memcmp(x->items, y->items, x->len * sizeof(fz_text_item))))
+			return 1;
+	}
+	return x != y;
+}
+
+static int
+cmd_is_text(fz_display_command cmd)
+{
+	return (cmd == FZ_CMD_FILL_TEXT ||
+		cmd == FZ_CMD_STROKE_TEXT ||
+		cmd == FZ_CMD_CLIP_TEXT ||
+		cmd == FZ_CMD_CLIP_STROKE_TEXT ||
+		cmd == FZ_CMD_IGNORE_TEXT);
+}
+
+/* Return the path stored at node, following a reference to an earlier
+ * copy, and the number of nodes it takes up here. */
+static fz_path *
+list_node_path(fz_display_list *list, fz_display_node *node, size_t *size)
+{
+	fz_list_path_ref *ref = (fz_list_path_ref *)node;
+
+	if (ref->packed == LIST_PATH_REF)
+	{
+		*size = SIZE_IN_NODES(sizeof(fz_list_path_ref));
+		return (fz_path *)&list->list[ref->offset];
+	}
+	*size = SIZE_IN_NODES(fz_packed_path_size((fz_path *)node));
+	return (fz_path *)node;
+}
+
 static unsigned char *
 fz_append_display_node(
 	fz_context *ctx,
@@ -268,6 +545,21 @@ fz_append_display_node(
 	fz_rect local_rect;
 	size_t path_size = 0;
 	unsigned char *out_private = NULL;
+	fz_list_intern_slot *path_slot = NULL;
+	fz_list_intern_slot *color_slot = NULL;
+	fz_list_intern_slot *stroke_slot = NULL;
+	fz_list_intern_slot *text_slot = NULL;
+	unsigned int path_hash = 0, color_hash = 0, stroke_hash = 0, text_hash = 0;
+	size_t path_ref = 0;
+	size_t color_ref = 0;
+	fz_text *text_repeat = NULL;
+
+	/* The index would miss this node (and any after it). */
+	if (list->index)
+	{
+		fz_drop_list_index(ctx, list->index);
+		list->index = NULL;
+	}
 
 	switch (cmd)
 	{
@@ -500,9 +792,29 @@ fz_append_display_node(
 
 		if (i != n)
 		{
-			node.color = 1;
+			/* A reference only saves space for 2 or more values. */
+			if (n > 1)
+			{
+				color_hash = hash_list_color(color, n);
+				color_slot = lookup_list_intern(ctx, &writer->colors, color_hash);
+				if (color_slot->offset && color_slot->hash == color_hash)
+				{
+					if (!memcmp(color, &list->list[color_slot->offset], n * sizeof(float)))
+						color_ref = color_slot->offset;
+					color_slot = NULL;
+				}
+			}
 			color_off = size;
-			size += n * SIZE_IN_NODES(sizeof(float));
+			if (color_ref)
+			{
+				node.color = COLOR_REPEAT;
+				size += SIZE_IN_NODES(sizeof(unsigned int));
+			}
+			else
+			{
+				node.color = COLOR_PRESENT;
+				size += n * SIZE_IN_NODES(sizeof(float));
+			}
 		}
 	}
 	if (alpha && (*alpha != writer->alpha))
@@ -532,6 +844,18 @@ fz_append_display_node(
 			ctm_flags |= CTM_CHANGE_EF, size += SIZE_IN_NODES(2*sizeof(float));
 		node.ctm = ctm_flags;
 	}
+	if (stroke && stroke != writer->stroke)
+	{
+		stroke_hash = hash_stroke_state(stroke);
+		stroke_slot = lookup_list_intern(ctx, &writer->strokes, stroke_hash);
+		if (stroke_slot->offset && stroke_slot->hash == stroke_hash)
+		{
+			fz_stroke_state *prev = *(fz_stroke_state **)(void *)&list->list[stroke_slot->offset];
+			if (!compare_stroke_states(stroke, prev))
+				stroke = prev;
+			stroke_slot = NULL;
+		}
+	}
 	if (stroke && (writer->stroke == NULL || stroke != writer->stroke))
 	{
 		pad_size_for_pointer(list, &size);
@@ -539,15 +863,48 @@ fz_append_display_node(
 		size += SIZE_IN_NODES(sizeof(fz_stroke_state *));
 		node.stroke = 1;
 	}
+	if (path && path != writer->path)
+	{
+		path_hash = fz_hash_path(ctx, path);
+		path_slot = lookup_list_intern(ctx, &writer->paths, path_hash);
+		if (path_slot->offset && path_slot->hash == path_hash)
+		{
+			fz_path *prev = (fz_path *)(void *)&list->list[path_slot->offset];
+			if (!fz_compare_paths(ctx, path, prev))
+			{
+				if (prev == writer->path)
+					path = NULL;
+				else
+					path_ref = path_slot->offset;
+			}
+			path_slot = NULL;
+		}
+	}
 	if (path && (writer->path == NULL || path != writer->path))
 	{
 		pad_size_for_pointer(list, &size);
-		path_size = SIZE_IN_NODES(fz_pack_path(ctx, NULL, path));
+		if (path_ref)
+			path_size = SIZE_IN_NODES(sizeof(fz_list_path_ref));
+		else
+			path_size = SIZE_IN_NODES(fz_pack_path(ctx, NULL, path));
 		node.path = 1;
 		path_off = size;
 
 		size += path_size;
 	}
+	if (private_data_len && cmd_is_text(cmd))
+	{
+		fz_text *text = *(fz_text * const *)private_data;
+		text_hash = hash_text(text);
+		text_slot = lookup_list_intern(ctx, &writer->texts, text_hash);
+		if (text_slot->offset && text_slot->hash == text_hash)
+		{
+			fz_text *prev = *(fz_text **)(void *)&list->list[text_slot->offset];
+			if (!compare_texts(text, prev))
+				text_repeat = prev;
+			text_slot = NULL;
+		}
+	}
 	if (private_data_len)
 	{
 		if (cmd_needs_alignment(cmd))
@@ -556,8 +913,8 @@ fz_append_display_node(
 		size += SIZE_IN_NODES(private_data_len);
 	}
 
-	/* If the size is more than 511, then we can't signal that in 9 bits,
-	 * so we'll send it as 511, and then put an extra size_t with the
+	/* If the size is 255 or more, then we can't signal that in 8 bits,
+	 * so we'll send it as 255, and then put an extra size_t with the
 	 * size in. */
 	if (size >= INDIRECT_NODE_THRESHOLD)
 		size += SIZE_IN_NODES(sizeof(size_t));
@@ -602,7 +959,15 @@ fz_append_display_node(
 
 	/* Path is the most frequent one, so try to avoid the try/catch in
 	 * this case */
-	if (path_off)
+	if (path_ref)
+	{
+		fz_list_path_ref *ref = (fz_list_path_ref *)(void *)(&node_ptr[path_off]);
+		ref->refs = 1;
+		ref->packed = LIST_PATH_REF;
+		ref->pad = 0;
+		ref->offset = (unsigned int)path_ref;
+	}
+	else if (path_off)
 	{
 		my_path = (void *)(&node_ptr[path_off]);
 		(void)fz_pack_path(ctx, (void *)my_path, path);
@@ -632,7 +997,13 @@ fz_append_display_node(
 	if (path_off)
 	{
 		fz_drop_path(ctx, writer->path);
-		writer->path = fz_keep_path(ctx, my_path); /* Can never fail */
+		if (path_ref)
+			writer->path = fz_keep_path(ctx, (fz_path *)(void *)&list->list[path_ref]);
+		else
+		{
+			writer->path = fz_keep_path(ctx, my_path); /* Can never fail */
+			insert_list_intern(path_slot, path_hash, (fz_display_node *)my_path - list->list);
+		}
 	}
 	if (node.cs)
 	{
@@ -690,9 +1061,15 @@ fz_append_display_node(
 	if (color_off)
 	{
 		int n = fz_colorspace_n(ctx, colorspace);
-		float *out_color = (float *)(void *)(&node_ptr[color_off]);
 		memcpy(writer->color, color, n * sizeof(float));
-		memcpy(out_color, color, n * sizeof(float));
+		if (color_ref)
+			*(unsigned int *)(void *)(&node_ptr[color_off]) = (unsigned int)color_ref;
+		else
+		{
+			float *out_color = (float *)(void *)(&node_ptr[color_off]);
+			memcpy(out_color, color, n * sizeof(float));
+			insert_list_intern(color_slot, color_hash, &node_ptr[color_off] - list->list);
+		}
 	}
 	if (node.alpha)
 	{
@@ -729,12 +1106,23 @@ fz_append_display_node(
 		fz_drop_stroke_state(ctx, writer->stroke);
 		/* Can never fail as my_stroke was kept above */
 		writer->stroke = fz_keep_stroke_state(ctx, my_stroke);
+		insert_list_intern(stroke_slot, stroke_hash, &node_ptr[stroke_off] - list->list);
 	}
 	if (private_data_len)
 	{
 		out_private = (unsigned char *)(void *)(&node_ptr[private_off]);
 		if (private_data)
 			memcpy(out_private, private_data, private_data_len);
+		if (text_repeat)
+		{
+			/* Swap the caller's reference for one to the copy we
+			 * already hold. */
+			fz_text **out_text = (fz_text **)(void *)out_private;
+			fz_drop_text(ctx, *out_text);
+			*out_text = fz_keep_text(ctx, text_repeat);
+		}
+		else if (text_slot)
+			insert_list_intern(text_slot, text_hash, &node_ptr[private_off] - list->list);
 	}
 	list->len += size;
 
@@ -1474,651 +1862,3324 @@ fz_list_end_metatext(fz_context *ctx, fz_device *dev)
 		0); /* private_data_len */
 }
 
-static void
-fz_list_drop_device(fz_context *ctx, fz_device *dev)
+static int
+cmd_pushes(fz_display_command cmd)
 {
-	fz_list_device *writer = (fz_list_device *)dev;
-
-	fz_drop_colorspace(ctx, writer->colorspace);
-	fz_drop_stroke_state(ctx, writer->stroke);
-	fz_drop_path(ctx, writer->path);
-	fz_drop_display_list(ctx, writer->list);
+	return (cmd == FZ_CMD_CLIP_PATH ||
+		cmd == FZ_CMD_CLIP_STROKE_PATH ||
+		cmd == FZ_CMD_CLIP_TEXT ||
+		cmd == FZ_CMD_CLIP_STROKE_TEXT ||
+		cmd == FZ_CMD_CLIP_IMAGE_MASK ||
+		cmd == FZ_CMD_BEGIN_MASK ||
+		cmd == FZ_CMD_BEGIN_GROUP ||
+		cmd == FZ_CMD_BEGIN_TILE);
 }
 
-fz_device *
-fz_new_list_device(fz_context *ctx, fz_display_list *list)
+static int
+cmd_pops(fz_display_command cmd)
 {
-	fz_list_device *dev;
-
-	dev = fz_new_derived_device(ctx, fz_list_device);
-
-	dev->super.fill_path = fz_list_fill_path;
-	dev->super.stroke_path = fz_list_stroke_path;
-	dev->super.clip_path = fz_list_clip_path;
-	dev->super.clip_stroke_path = fz_list_clip_stroke_path;
-
-	dev->super.fill_text = fz_list_fill_text;
-	dev->super.stroke_text = fz_list_stroke_text;
-	dev->super.clip_text = fz_list_clip_text;
-	dev->super.clip_stroke_text = fz_list_clip_stroke_text;
-	dev->super.ignore_text = fz_list_ignore_text;
-
-	dev->super.fill_shade = fz_list_fill_shade;
-	dev->super.fill_image = fz_list_fill_image;
-	dev->super.fill_image_mask = fz_list_fill_image_mask;
-	dev->super.clip_image_mask = fz_list_clip_image_mask;
-
-	dev->super.pop_clip = fz_list_pop_clip;
-
-	dev->super.begin_mask = fz_list_begin_mask;
-	dev->super.end_mask = fz_list_end_mask;
-	dev->super.begin_group = fz_list_begin_group;
-	dev->super.end_group = fz_list_end_group;
-
-	dev->super.begin_tile = fz_list_begin_tile;
-	dev->super.end_tile = fz_list_end_tile;
-
-	dev->super.render_flags = fz_list_render_flags;
-	dev->super.set_default_colorspaces = fz_list_set_default_colorspaces;
-
-	dev->super.begin_layer = fz_list_begin_layer;
-	dev->super.end_layer = fz_list_end_layer;
-
-	dev->super.begin_structure = fz_list_begin_structure;
-	dev->super.end_structure = fz_list_end_structure;
-
-	dev->super.begin_metatext = fz_list_begin_metatext;
-	dev->super.end_metatext = fz_list_end_metatext;
-
-	dev->super.drop_device = fz_list_drop_device;
+	return (cmd == FZ_CMD_POP_CLIP ||
+		cmd == FZ_CMD_END_GROUP ||
+		cmd == FZ_CMD_END_TILE);
+}
 
-	dev->list = fz_keep_display_list(ctx, list);
-	dev->path = NULL;
-	dev->alpha = 1.0f;
-	dev->ctm = fz_identity;
-	dev->stroke = NULL;
-	dev->colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
-	memset(dev->color, 0, sizeof(float)*FZ_MAX_COLORS);
-	dev->top = 0;
-	dev->tiled = 0;
+/* Commands that fz_run_display_list only ever culls by their rect. */
+static int
+cmd_is_leaf(fz_display_command cmd)
+{
+	return (cmd == FZ_CMD_FILL_PATH ||
+		cmd == FZ_CMD_STROKE_PATH ||
+		cmd == FZ_CMD_FILL_TEXT ||
+		cmd == FZ_CMD_STROKE_TEXT ||
+		cmd == FZ_CMD_IGNORE_TEXT ||
+		cmd == FZ_CMD_FILL_SHADE ||
+		cmd == FZ_CMD_FILL_IMAGE ||
+		cmd == FZ_CMD_FILL_IMAGE_MASK);
+}
 
-	return &dev->super;
+/* Commands that are passed through even inside a culled clip. */
+static int
+cmd_is_structure(fz_display_command cmd)
+{
+	return (cmd == FZ_CMD_BEGIN_STRUCTURE ||
+		cmd == FZ_CMD_END_STRUCTURE ||
+		cmd == FZ_CMD_BEGIN_METATEXT ||
+		cmd == FZ_CMD_END_METATEXT);
 }
 
-static void
-fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
+/* Decode the graphics state carried by a node into st, without taking
+ * any references. Returns the next node. */
+static fz_display_node *
+decode_list_state(fz_context *ctx, fz_display_list *list, fz_display_node *node, fz_list_state *st, fz_display_command *cmd)
 {
-	fz_display_list *list = (fz_display_list *)list_;
-	fz_display_node *node = list->list;
-	fz_display_node *node_end = list->list + list->len;
-	int cs_n = 1;
-	fz_colorspace *cs;
+	fz_display_node n = *node;
+	size_t size = n.size;
+	fz_display_node *next;
 
-	while (node != node_end)
+	if (size == INDIRECT_NODE_THRESHOLD)
 	{
-		fz_display_node n = *node;
-		size_t size = n.size;
-		fz_display_node *next;
-
-		if (size == INDIRECT_NODE_THRESHOLD)
-		{
-			memcpy(&size, &node[1], sizeof(size));
-			node += SIZE_IN_NODES(sizeof(size_t));
-			size -= SIZE_IN_NODES(sizeof(size_t));
-		}
-
-		next = node + size;
+		memcpy(&size, &node[1], sizeof(size_t));
+		node += SIZE_IN_NODES(sizeof(size_t));
+		size -= SIZE_IN_NODES(sizeof(size_t));
+	}
+	next = node + size;
+	*cmd = n.cmd;
 
-		node++;
-		if (n.rect)
-		{
-			node += SIZE_IN_NODES(sizeof(fz_rect));
-		}
+	node++;
+	if (n.rect)
+	{
+		st->rect = *(fz_rect *)node;
+		node += SIZE_IN_NODES(sizeof(fz_rect));
+	}
+	if (n.cs)
+	{
+		st->color_default = n.cs;
+		st->color = 0;
 		switch (n.cs)
 		{
 		default:
-		case CS_UNCHANGED:
-			break;
 		case CS_GRAY_0:
 		case CS_GRAY_1:
-			cs_n = 1;
+			st->colorspace = fz_device_gray(ctx);
 			break;
 		case CS_RGB_0:
 		case CS_RGB_1:
-			cs_n = 3;
+			st->colorspace = fz_device_rgb(ctx);
 			break;
 		case CS_CMYK_0:
 		case CS_CMYK_1:
-			cs_n = 4;
+			st->colorspace = fz_device_cmyk(ctx);
 			break;
 		case CS_OTHER_0:
 			align_node_for_pointer(&node);
-			cs = *(fz_colorspace **)node;
-			cs_n = fz_colorspace_n(ctx, cs);
-			fz_drop_colorspace(ctx, cs);
+			st->colorspace = *(fz_colorspace **)node;
 			node += SIZE_IN_NODES(sizeof(fz_colorspace *));
 			break;
 		}
-		if (n.color)
-		{
-			node += SIZE_IN_NODES(cs_n * sizeof(float));
-		}
-		if (n.alpha == ALPHA_PRESENT)
+	}
+	if (n.color == COLOR_REPEAT)
+	{
+		st->color = *(unsigned int *)node;
+		node += SIZE_IN_NODES(sizeof(unsigned int));
+	}
+	else if (n.color)
+	{
+		st->color = node - list->list;
+		node += SIZE_IN_NODES(fz_colorspace_n(ctx, st->colorspace) * sizeof(float));
+	}
+	if (n.alpha)
+	{
+		switch (n.alpha)
 		{
+		default:
+		case ALPHA_0:
+			st->alpha = 0.0f;
+			break;
+		case ALPHA_1:
+			st->alpha = 1.0f;
+			break;
+		case ALPHA_PRESENT:
+			st->alpha = *(float *)node;
 			node += SIZE_IN_NODES(sizeof(float));
+			break;
 		}
+	}
+	if (n.ctm != 0)
+	{
+		float *packed_ctm = (float *)node;
 		if (n.ctm & CTM_CHANGE_AD)
-			node += SIZE_IN_NODES(2*sizeof(float));
-		if (n.ctm & CTM_CHANGE_BC)
-			node += SIZE_IN_NODES(2*sizeof(float));
-		if (n.ctm & CTM_CHANGE_EF)
-			node += SIZE_IN_NODES(2*sizeof(float));
-		if (n.stroke)
 		{
-			align_node_for_pointer(&node);
-			fz_drop_stroke_state(ctx, *(fz_stroke_state **)node);
-			node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+			st->ctm.a = *packed_ctm++;
+			st->ctm.d = *packed_ctm++;
+			node += SIZE_IN_NODES(2*sizeof(float));
 		}
-		if (n.path)
+		if (n.ctm & CTM_CHANGE_BC)
 		{
-			int path_size;
-			align_node_for_pointer(&node);
-			path_size = fz_packed_path_size((fz_path *)node);
-			fz_drop_path(ctx, (fz_path *)node);
-			node += SIZE_IN_NODES(path_size);
+			st->ctm.b = *packed_ctm++;
+			st->ctm.c = *packed_ctm++;
+			node += SIZE_IN_NODES(2*sizeof(float));
 		}
-		switch(n.cmd)
+		if (n.ctm & CTM_CHANGE_EF)
 		{
-		case FZ_CMD_FILL_TEXT:
-		case FZ_CMD_STROKE_TEXT:
-		case FZ_CMD_CLIP_TEXT:
-		case FZ_CMD_CLIP_STROKE_TEXT:
-		case FZ_CMD_IGNORE_TEXT:
-			align_node_for_pointer(&node);
-			fz_drop_text(ctx, *(fz_text **)node);
-			break;
-		case FZ_CMD_FILL_SHADE:
-			align_node_for_pointer(&node);
-			fz_drop_shade(ctx, *(fz_shade **)node);
-			break;
-		case FZ_CMD_FILL_IMAGE:
-		case FZ_CMD_FILL_IMAGE_MASK:
-		case FZ_CMD_CLIP_IMAGE_MASK:
-			align_node_for_pointer(&node);
-			fz_drop_image(ctx, *(fz_image **)node);
-			break;
-		case FZ_CMD_END_MASK:
-			align_node_for_pointer(&node);
-			fz_drop_function(ctx, *(fz_function **)node);
-			break;
-		case FZ_CMD_DEFAULT_COLORSPACES:
-			align_node_for_pointer(&node);
-			fz_drop_default_colorspaces(ctx, *(fz_default_colorspaces **)node);
-			break;
+			st->ctm.e = *packed_ctm++;
+			st->ctm.f = *packed_ctm;
+			node += SIZE_IN_NODES(2*sizeof(float));
 		}
-		node = next;
 	}
-	fz_free(ctx, list->list);
-	fz_free(ctx, list);
+	if (n.stroke)
+	{
+		align_node_for_pointer(&node);
+		st->stroke = *(fz_stroke_state **)node;
+		node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+	}
+	if (n.path)
+	{
+		size_t path_size;
+		align_node_for_pointer(&node);
+		st->path = list_node_path(list, node, &path_size);
+	}
+
+	return next;
 }
 
-fz_display_list *
-fz_new_display_list(fz_context *ctx, fz_rect mediabox)
+static void
+fz_drop_list_index(fz_context *ctx, fz_list_index *index)
 {
-	fz_display_list *list = fz_malloc_struct(ctx, fz_display_list);
-	FZ_INIT_STORABLE(list, 1, fz_drop_display_list_imp);
-	list->list = NULL;
-	list->mediabox = mediabox;
-	list->max = 0;
-	list->len = 0;
-	return list;
+	int i;
+
+	if (!index)
+		return;
+	for (i = 0; i < index->levels; i++)
+	{
+		fz_free(ctx, index->grid[i].cell_start);
+		fz_free(ctx, index->grid[i].cells);
+	}
+	fz_free(ctx, index->offset);
+	fz_free(ctx, index->state);
+	fz_free(ctx, index->always);
+	fz_free(ctx, index->subtrees);
+	fz_free(ctx, index);
 }
 
-fz_display_list *
-fz_keep_display_list(fz_context *ctx, fz_display_list *list)
+static void
+clear_index_bits(uint64_t *bits, size_t a, size_t b)
 {
-	return fz_keep_storable(ctx, &list->storable);
+	while (a < b && (a & 63))
+	{
+		bits[a >> 6] &= ~((uint64_t)1 << (a & 63));
+		a++;
+	}
+	while (a + 64 <= b)
+	{
+		bits[a >> 6] = 0;
+		a += 64;
+	}
+	while (a < b)
+	{
+		bits[a >> 6] &= ~((uint64_t)1 << (a & 63));
+		a++;
+	}
 }
 
-void
-fz_drop_display_list(fz_context *ctx, fz_display_list *list)
+static void
+set_index_bits(uint64_t *bits, size_t a, size_t b)
 {
-	fz_defer_reap_start(ctx);
-	fz_drop_storable(ctx, &list->storable);
-	fz_defer_reap_end(ctx);
+	for (; a < b; a++)
+		bits[a >> 6] |= (uint64_t)1 << (a & 63);
 }
 
-fz_rect
-fz_bound_display_list(fz_context *ctx, fz_display_list *list)
+static int
+index_cell(float v, float origin, float scale, int n)
 {
-	return list->mediabox;
+	float f = (v - origin) * scale;
+	if (!(f >= 0))
+		return 0;
+	if (f >= n)
+		return n - 1;
+	return (int)f;
 }
 
-int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
+/* Find the range of cells that a rect covers. */
+static int
+index_cells(const fz_list_grid *g, fz_rect bounds, fz_rect r, int *x0, int *y0, int *x1, int *y1)
 {
-	return !list || list->len == 0;
+	*x0 = index_cell(r.x0, bounds.x0, g->sx, g->gw);
+	*x1 = index_cell(r.x1, bounds.x0, g->sx, g->gw);
+	*y0 = index_cell(r.y0, bounds.y0, g->sy, g->gh);
+	*y1 = index_cell(r.y1, bounds.y0, g->sy, g->gh);
+	return (*x1 - *x0 + 1) * (*y1 - *y0 + 1);
 }
 
-void
-fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
+static int
+index_level(const fz_list_index *index, fz_rect r)
 {
-	fz_display_node *node;
-	fz_display_node *node_end;
-	fz_display_node *next_node;
-	int clipped = 0;
-	int tiled = 0;
-	int progress = 0;
+	int level, x0, y0, x1, y1;
 
-	/* Current graphics state as unpacked from list */
-	fz_path *path = NULL;
-	float alpha = 1.0f;
-	fz_matrix ctm = fz_identity;
-	fz_stroke_state *stroke = NULL;
-	float color[FZ_MAX_COLORS] = { 0 };
-	fz_colorspace *colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
-	fz_color_params color_params;
-	fz_rect rect = { 0 };
+	for (level = 0; level < index->levels - 1; level++)
+		if (index_cells(&index->grid[level], index->bounds, r, &x0, &y0, &x1, &y1) <= INDEX_MAX_CELLS_PER_NODE)
+			break;
+	return level;
+}
 
-	/* Transformed versions of graphic state entries */
-	fz_rect trans_rect;
-	fz_matrix trans_ctm;
-	int tile_skip_depth = 0;
+static void
+build_index_grid(fz_context *ctx, fz_list_index *index, fz_rect bounds, size_t nleaves, const fz_list_entry *leaf, const fz_rect *leaf_rect)
+{
+	float w = bounds.x1 - bounds.x0;
+	float h = bounds.y1 - bounds.y0;
+	float target = fz_maxi(1, (int)(nleaves / 4));
+	unsigned int *fill = NULL;
+	size_t i, ncells;
+	int level, gw, gh, x, y, x0, y0, x1, y1;
 
-	if (cookie)
+	/* Aim for a handful of leaves per cell at the finest level, with
+	 * roughly square cells. */
+	if (w > 0 && h > 0)
 	{
-		cookie->progress_max = list->len;
-		cookie->progress = 0;
+		gw = fz_clampi((int)sqrtf(target * w / h), 1, INDEX_MAX_GRID);
+		gh = fz_clampi((int)(target / gw), 1, INDEX_MAX_GRID);
+	}
+	else
+	{
+		gw = w > 0 ? fz_clampi((int)target, 1, INDEX_MAX_GRID) : 1;
+		gh = h > 0 ? fz_clampi((int)target, 1, INDEX_MAX_GRID) : 1;
+	}
+	index->bounds = bounds;
+	for (level = 0; level < INDEX_MAX_GRID_LEVELS; level++)
+	{
+		fz_list_grid *g = &index->grid[level];
+		g->gw = gw;
+		g->gh = gh;
+		g->sx = w > 0 ? gw / w : 0;
+		g->sy = h > 0 ? gh / h : 0;
+		index->levels = level + 1;
+		if (gw == 1 && gh == 1)
+			break;
+		gw = (gw + 3) >> 2;
+		gh = (gh + 3) >> 2;
 	}
 
-	color_params = fz_default_color_params;
+	for (level = 0; level < index->levels; level++)
+	{
+		fz_list_grid *g = &index->grid[level];
+		ncells = (size_t)g->gw * g->gh;
+		g->cell_start = fz_calloc(ctx, ncells + 1, sizeof(unsigned int));
+	}
 
-	node = list->list;
-	node_end = &list->list[list->len];
-	for (; node != node_end ; node = next_node)
+	for (i = 0; i < nleaves; i++)
 	{
-		int empty;
-		fz_display_node n = *node;
-		size_t size = n.size;
+		fz_list_grid *g = &index->grid[index_level(index, leaf_rect[i])];
+		index_cells(g, bounds, leaf_rect[i], &x0, &y0, &x1, &y1);
+		for (y = y0; y <= y1; y++)
+			for (x = x0; x <= x1; x++)
+				g->cell_start[y * g->gw + x + 1]++;
+	}
 
-		if (size == INDIRECT_NODE_THRESHOLD)
+	fz_var(fill);
+
+	fz_try(ctx)
+	{
+		for (level = 0; level < index->levels; level++)
 		{
-			memcpy(&size, &node[1], sizeof(size_t));
-			node += SIZE_IN_NODES(sizeof(size_t));
-			size -= SIZE_IN_NODES(sizeof(size_t));
+			fz_list_grid *g = &index->grid[level];
+			ncells = (size_t)g->gw * g->gh;
+			for (i = 0; i < ncells; i++)
+				g->cell_start[i + 1] += g->cell_start[i];
+			g->cells = fz_malloc_array(ctx, g->cell_start[ncells] ? g->cell_start[ncells] : 1, fz_list_entry);
 		}
 
-		next_node = node + size;
-
-		/* Check the cookie for aborting */
-		if (cookie)
+		ncells = (size_t)index->grid[0].gw * index->grid[0].gh;
+		fill = fz_malloc_array(ctx, ncells, unsigned int);
+		for (level = 0; level < index->levels; level++)
 		{
-			if (cookie->abort)
-				break;
-			cookie->progress = progress;
-			progress += (int)size;
+			fz_list_grid *g = &index->grid[level];
+			memcpy(fill, g->cell_start, (size_t)g->gw * g->gh * sizeof(unsigned int));
+			for (i = 0; i < nleaves; i++)
+			{
+				if (index_level(index, leaf_rect[i]) != level)
+					continue;
+				index_cells(g, bounds, leaf_rect[i], &x0, &y0, &x1, &y1);
+				for (y = y0; y <= y1; y++)
+					for (x = x0; x <= x1; x++)
+						g->cells[fill[y * g->gw + x]++] = leaf[i];
+			}
 		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, fill);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
 
-		node++;
-		if (n.rect)
+typedef struct
+{
+	size_t start;
+	fz_rect rect;
+	int eligible;
+} fz_list_open_subtree;
+
+static fz_list_index *
+fz_new_list_index(fz_context *ctx, fz_display_list *list)
+{
+	fz_display_node *node;
+	fz_display_node *node_end = list->list + list->len;
+	fz_list_index *index = NULL;
+	fz_list_entry *leaf = NULL;
+	fz_rect *leaf_rect = NULL;
+	fz_list_open_subtree *stack = NULL;
+	fz_rect bounds = fz_empty_rect;
+	fz_list_state st = { 0 };
+	size_t ncmds, cmd, nleaves = 0, top = 0, stack_cap = 0, subtree_cap = 0;
+	int tiled = 0;
+
+	fz_var(index);
+	fz_var(leaf);
+	fz_var(leaf_rect);
+	fz_var(stack);
+
+	fz_try(ctx)
+	{
+		index = fz_malloc_struct(ctx, fz_list_index);
+
+		for (ncmds = 0, node = list->list; node != node_end; ncmds++)
 		{
-			rect = *(fz_rect *)node;
-			node += SIZE_IN_NODES(sizeof(fz_rect));
+			size_t size = node->size;
+			if (size == INDIRECT_NODE_THRESHOLD)
+				memcpy(&size, &node[1], sizeof(size_t));
+			node += size;
 		}
-		if (n.cs)
+		if (ncmds >= UINT_MAX)
+			fz_throw(ctx, FZ_ERROR_LIMIT, "display list too long to index");
+
+		index->ncmds = ncmds;
+		index->offset = fz_malloc_array(ctx, ncmds / INDEX_CHUNK + 1, size_t);
+		index->state = fz_malloc_array(ctx, ncmds / INDEX_CHUNK + 1, fz_list_state);
+		index->always = fz_calloc(ctx, ncmds / 64 + 1, sizeof(uint64_t));
+		leaf = fz_malloc_array(ctx, ncmds + 1, fz_list_entry);
+		leaf_rect = fz_malloc_array(ctx, ncmds + 1, fz_rect);
+
+		st.ctm = fz_identity;
+		st.alpha = 1;
+		st.colorspace = fz_device_gray(ctx);
+		st.color_default = CS_GRAY_0;
+
+		for (cmd = 0, node = list->list; node != node_end; cmd++)
 		{
-			int i, en;
+			fz_display_command c;
 
-			fz_drop_colorspace(ctx, colorspace);
-			switch (n.cs)
+			if (cmd % INDEX_CHUNK == 0)
 			{
-			default:
-			case CS_GRAY_0:
-				colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
-				color[0] = 0.0f;
-				break;
-			case CS_GRAY_1:
-				colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
-				color[0] = 1.0f;
-				break;
-			case CS_RGB_0:
-				colorspace = fz_keep_colorspace(ctx, fz_device_rgb(ctx));
-				color[0] = 0.0f;
-				color[1] = 0.0f;
-				color[2] = 0.0f;
-				break;
-			case CS_RGB_1:
-				colorspace = fz_keep_colorspace(ctx, fz_device_rgb(ctx));
-				color[0] = 1.0f;
-				color[1] = 1.0f;
-				color[2] = 1.0f;
-				break;
-			case CS_CMYK_0:
-				colorspace = fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
-				color[0] = 0.0f;
-				color[1] = 0.0f;
-				color[2] = 0.0f;
-				color[3] = 0.0f;
-				break;
-			case CS_CMYK_1:
-				colorspace = fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
-				color[0] = 0.0f;
-				color[1] = 0.0f;
-				color[2] = 0.0f;
-				color[3] = 1.0f;
-				break;
-			case CS_OTHER_0:
-				align_node_for_pointer(&node);
-				colorspace = fz_keep_colorspace(ctx, *(fz_colorspace **)(node));
-				node += SIZE_IN_NODES(sizeof(fz_colorspace *));
-				en = fz_colorspace_n(ctx, colorspace);
-				for (i = 0; i < en; i++)
-					color[i] = 0.0f;
-				break;
+				index->offset[cmd / INDEX_CHUNK] = node - list->list;
+				index->state[cmd / INDEX_CHUNK] = st;
 			}
-		}
-		if (n.color)
-		{
-			int nc = fz_colorspace_n(ctx, colorspace);
-			memcpy(color, (float *)node, nc * sizeof(float));
-			node += SIZE_IN_NODES(nc * sizeof(float));
-		}
-		if (n.alpha)
-		{
-			switch(n.alpha)
+			node = decode_list_state(ctx, list, node, &st, &c);
+
+			if (tiled || !cmd_is_leaf(c) || fz_is_infinite_rect(st.rect))
 			{
-			default:
-			case ALPHA_0:
-				alpha = 0.0f;
-				break;
-			case ALPHA_1:
-				alpha = 1.0f;
-				break;
-			case ALPHA_PRESENT:
-				alpha = *(float *)node;
-				node += SIZE_IN_NODES(sizeof(float));
-				break;
+				index->always[cmd >> 6] |= (uint64_t)1 << (cmd & 63);
 			}
-		}
-		if (n.ctm != 0)
-		{
-			float *packed_ctm = (float *)node;
-			if (n.ctm & CTM_CHANGE_AD)
+			else if (fz_is_valid_rect(st.rect))
 			{
-				ctm.a = *packed_ctm++;
-				ctm.d = *packed_ctm++;
-				node += SIZE_IN_NODES(2*sizeof(float));
+				leaf[nleaves].cmd = (unsigned int)cmd;
+				leaf[nleaves].len = 1;
+				leaf_rect[nleaves++] = st.rect;
+				bounds = nleaves == 1 ? st.rect : fz_union_rect(bounds, st.rect);
 			}
-			if (n.ctm & CTM_CHANGE_BC)
+			/* else: an invalid rect is always culled. */
+
+			/* Track subtrees that could be dropped whole. Anything
+			 * inside a pattern tile is never culled, and structure
+			 * commands are passed through even inside culled clips. */
+			if (cmd_pushes(c))
 			{
-				ctm.b = *packed_ctm++;
-				ctm.c = *packed_ctm++;
-				node += SIZE_IN_NODES(2*sizeof(float));
+				if (top == stack_cap)
+				{
+					stack_cap = stack_cap ? stack_cap * 2 : 32;
+					stack = fz_realloc_array(ctx, stack, stack_cap, fz_list_open_subtree);
+				}
+				stack[top].start = cmd;
+				stack[top].rect = st.rect;
+				stack[top].eligible = (!tiled && c != FZ_CMD_BEGIN_TILE &&
+					fz_is_valid_rect(st.rect) && !fz_is_infinite_rect(st.rect));
+				top++;
 			}
-			if (n.ctm & CTM_CHANGE_EF)
+			else if (cmd_pops(c) && top > 0)
 			{
-				ctm.e = *packed_ctm++;
-				ctm.f = *packed_ctm;
-				node += SIZE_IN_NODES(2*sizeof(float));
+				fz_list_open_subtree *t = &stack[--top];
+				if (t->eligible && cmd + 1 - t->start <= INDEX_SMALL_SUBTREE)
+				{
+					/* Replace everything inside with a single entry. */
+					while (nleaves > 0 && leaf[nleaves-1].cmd > t->start)
+						nleaves--;
+					clear_index_bits(index->always, t->start, cmd + 1);
+					leaf[nleaves].cmd = (unsigned int)t->start;
+					leaf[nleaves].len = (unsigned int)(cmd + 1 - t->start);
+					leaf_rect[nleaves++] = t->rect;
+					bounds = nleaves == 1 ? t->rect : fz_union_rect(bounds, t->rect);
+				}
+				else if (t->eligible)
+				{
+					if (index->nsubtrees == subtree_cap)
+					{
+						subtree_cap = subtree_cap ? subtree_cap * 2 : 32;
+						index->subtrees = fz_realloc_array(ctx, index->subtrees, subtree_cap, fz_list_subtree);
+					}
+					index->subtrees[index->nsubtrees].start = t->start;
+					index->subtrees[index->nsubtrees].end = cmd + 1;
+					index->subtrees[index->nsubtrees].rect = t->rect;
+					index->nsubtrees++;
+				}
 			}
+			else if (cmd_is_structure(c))
+			{
+				size_t i;
+				for (i = 0; i < top; i++)
+					stack[i].eligible = 0;
+			}
+
+			if (c == FZ_CMD_BEGIN_TILE)
+				tiled++;
+			else if (c == FZ_CMD_END_TILE && tiled > 0)
+				tiled--;
 		}
-		if (n.stroke)
-		{
-			align_node_for_pointer(&node);
-			fz_drop_stroke_state(ctx, stroke);
-			stroke = fz_keep_stroke_state(ctx, *(fz_stroke_state **)node);
-			node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
-		}
-		if (n.path)
+
+		if (nleaves > 0)
+			build_index_grid(ctx, index, bounds, nleaves, leaf, leaf_rect);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, leaf);
+		fz_free(ctx, leaf_rect);
+		fz_free(ctx, stack);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_list_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	return index;
+}
+
+static void
+index_display_list(fz_context *ctx, fz_display_list *list)
+{
+	if (list->index || list->len < INDEX_MIN_LIST_SIZE)
+		return;
+
+	/* The index is only an accelerator; run without one on failure. */
+	fz_try(ctx)
+		list->index = fz_new_list_index(ctx, list);
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+		fz_report_error(ctx);
+	}
+}
+
+static void
+fz_list_close_device(fz_context *ctx, fz_device *dev)
+{
+	fz_list_device *writer = (fz_list_device *)dev;
+
+	fz_display_list *list = writer->list;
+
+	drop_list_intern(ctx, &writer->paths);
+	drop_list_intern(ctx, &writer->colors);
+	drop_list_intern(ctx, &writer->strokes);
+	drop_list_intern(ctx, &writer->texts);
+
+	/* Nothing more will be appended, so give back the slack left by
+	 * growing the list. writer->path points into it. */
+	fz_drop_path(ctx, writer->path);
+	writer->path = NULL;
+	if (list->len > 0 && list->len < list->max)
+	{
+		fz_display_node *trimmed = fz_realloc_no_throw(ctx, list->list, list->len * sizeof(fz_display_node));
+		if (trimmed)
 		{
-			align_node_for_pointer(&node);
-			fz_drop_path(ctx, path);
-			path = fz_keep_path(ctx, (fz_path *)node);
-			node += SIZE_IN_NODES(fz_packed_path_size(path));
+			list->list = trimmed;
+			list->max = list->len;
 		}
+	}
 
-		if (tile_skip_depth > 0)
+	index_display_list(ctx, list);
+}
+
+static void
+fz_list_drop_device(fz_context *ctx, fz_device *dev)
+{
+	fz_list_device *writer = (fz_list_device *)dev;
+
+	fz_drop_colorspace(ctx, writer->colorspace);
+	fz_drop_stroke_state(ctx, writer->stroke);
+	fz_drop_path(ctx, writer->path);
+	drop_list_intern(ctx, &writer->paths);
+	drop_list_intern(ctx, &writer->colors);
+	drop_list_intern(ctx, &writer->strokes);
+	drop_list_intern(ctx, &writer->texts);
+	fz_drop_display_list(ctx, writer->list);
+}
+
+fz_device *
+fz_new_list_device(fz_context *ctx, fz_display_list *list)
+{
+	fz_list_device *dev;
+
+	dev = fz_new_derived_device(ctx, fz_list_device);
+
+	dev->super.fill_path = fz_list_fill_path;
+	dev->super.stroke_path = fz_list_stroke_path;
+	dev->super.clip_path = fz_list_clip_path;
+	dev->super.clip_stroke_path = fz_list_clip_stroke_path;
+
+	dev->super.fill_text = fz_list_fill_text;
+	dev->super.stroke_text = fz_list_stroke_text;
+	dev->super.clip_text = fz_list_clip_text;
+	dev->super.clip_stroke_text = fz_list_clip_stroke_text;
+	dev->super.ignore_text = fz_list_ignore_text;
+
+	dev->super.fill_shade = fz_list_fill_shade;
+	dev->super.fill_image = fz_list_fill_image;
+	dev->super.fill_image_mask = fz_list_fill_image_mask;
+	dev->super.clip_image_mask = fz_list_clip_image_mask;
+
+	dev->super.pop_clip = fz_list_pop_clip;
+
+	dev->super.begin_mask = fz_list_begin_mask;
+	dev->super.end_mask = fz_list_end_mask;
+	dev->super.begin_group = fz_list_begin_group;
+	dev->super.end_group = fz_list_end_group;
+
+	dev->super.begin_tile = fz_list_begin_tile;
+	dev->super.end_tile = fz_list_end_tile;
+
+	dev->super.render_flags = fz_list_render_flags;
+	dev->super.set_default_colorspaces = fz_list_set_default_colorspaces;
+
+	dev->super.begin_layer = fz_list_begin_layer;
+	dev->super.end_layer = fz_list_end_layer;
+
+	dev->super.begin_structure = fz_list_begin_structure;
+	dev->super.end_structure = fz_list_end_structure;
+
+	dev->super.begin_metatext = fz_list_begin_metatext;
+	dev->super.end_metatext = fz_list_end_metatext;
+
+	dev->super.close_device = fz_list_close_device;
+	dev->super.drop_device = fz_list_drop_device;
+
+	dev->list = fz_keep_display_list(ctx, list);
+	dev->path = NULL;
+	dev->alpha = 1.0f;
+	dev->ctm = fz_identity;
+	dev->stroke = NULL;
+	dev->colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
+	memset(dev->color, 0, sizeof(float)*FZ_MAX_COLORS);
+	dev->top = 0;
+	dev->tiled = 0;
+
+	return &dev->super;
+}
+
+static void
+fz_drop_display_list_imp(fz_context *ctx, fz_storable *list_)
+{
+	fz_display_list *list = (fz_display_list *)list_;
+	fz_display_node *node = list->list;
+	fz_display_node *node_end = list->list + list->len;
+	int cs_n = 1;
+	fz_colorspace *cs;
+
+	while (node != node_end)
+	{
+		fz_display_node n = *node;
+		size_t size = n.size;
+		fz_display_node *next;
+
+		if (size == INDIRECT_NODE_THRESHOLD)
 		{
-			if (n.cmd == FZ_CMD_BEGIN_TILE)
-				tile_skip_depth++;
-			else if (n.cmd == FZ_CMD_END_TILE)
-				tile_skip_depth--;
-			if (tile_skip_depth > 0)
-				continue;
+			memcpy(&size, &node[1], sizeof(size));
+			node += SIZE_IN_NODES(sizeof(size_t));
+			size -= SIZE_IN_NODES(sizeof(size_t));
 		}
 
-		trans_rect = fz_transform_rect(rect, top_ctm);
-
-		/* cull objects to draw using a quick visibility test */
+		next = node + size;
 
-		if (tiled ||
-			n.cmd == FZ_CMD_BEGIN_TILE || n.cmd == FZ_CMD_END_TILE ||
-			n.cmd == FZ_CMD_RENDER_FLAGS || n.cmd == FZ_CMD_DEFAULT_COLORSPACES ||
-			n.cmd == FZ_CMD_BEGIN_LAYER || n.cmd == FZ_CMD_END_LAYER ||
-			n.cmd == FZ_CMD_BEGIN_STRUCTURE || n.cmd == FZ_CMD_END_STRUCTURE ||
-			n.cmd == FZ_CMD_BEGIN_METATEXT || n.cmd == FZ_CMD_END_METATEXT
-			)
+		node++;
+		if (n.rect)
 		{
-			empty = 0;
+			node += SIZE_IN_NODES(sizeof(fz_rect));
 		}
-		else if (n.cmd == FZ_CMD_FILL_PATH || n.cmd == FZ_CMD_STROKE_PATH)
+		switch (n.cs)
 		{
-			/* Zero area paths are suitable for stroking. */
-			empty = !fz_is_valid_rect(fz_intersect_rect(trans_rect, scissor));
+		default:
+		case CS_UNCHANGED:
+			break;
+		case CS_GRAY_0:
+		case CS_GRAY_1:
+			cs_n = 1;
+			break;
+		case CS_RGB_0:
+		case CS_RGB_1:
+			cs_n = 3;
+			break;
+		case CS_CMYK_0:
+		case CS_CMYK_1:
+			cs_n = 4;
+			break;
+		case CS_OTHER_0:
+			align_node_for_pointer(&node);
+			cs = *(fz_colorspace **)node;
+			cs_n = fz_colorspace_n(ctx, cs);
+			fz_drop_colorspace(ctx, cs);
+			node += SIZE_IN_NODES(sizeof(fz_colorspace *));
+			break;
 		}
-		else if (n.cmd == FZ_CMD_FILL_TEXT || n.cmd == FZ_CMD_STROKE_TEXT ||
-			n.cmd == FZ_CMD_CLIP_TEXT || n.cmd == FZ_CMD_CLIP_STROKE_TEXT)
+		if (n.color == COLOR_REPEAT)
+			node += SIZE_IN_NODES(sizeof(unsigned int));
+		else if (n.color)
 		{
-			/* Zero area text (such as spaces) should be passed
-			 * through. Text that is completely outside the scissor
-			 * can be elided. */
-			empty = !fz_is_valid_rect(fz_intersect_rect(trans_rect, scissor));
+			node += SIZE_IN_NODES(cs_n * sizeof(float));
 		}
-		else
+		if (n.alpha == ALPHA_PRESENT)
 		{
-			empty = fz_is_empty_rect(fz_intersect_rect(trans_rect, scissor));
+			node += SIZE_IN_NODES(sizeof(float));
 		}
-
-		/* clipped starts out as 0. It only goes non-zero here if we move inside
-		 * an 'empty' region. Whenever clipped is non zero, or we are in an empty
-		 * region, we therefore may need to increment clipped according to the
-		 * nesting. */
-		if (clipped || empty)
+		if (n.ctm & CTM_CHANGE_AD)
+			node += SIZE_IN_NODES(2*sizeof(float));
+		if (n.ctm & CTM_CHANGE_BC)
+			node += SIZE_IN_NODES(2*sizeof(float));
+		if (n.ctm & CTM_CHANGE_EF)
+			node += SIZE_IN_NODES(2*sizeof(float));
+		if (n.stroke)
 		{
-			switch (n.cmd)
-			{
-			case FZ_CMD_CLIP_PATH:
-			case FZ_CMD_CLIP_STROKE_PATH:
-			case FZ_CMD_CLIP_TEXT:
-			case FZ_CMD_CLIP_STROKE_TEXT:
-			case FZ_CMD_CLIP_IMAGE_MASK:
-			case FZ_CMD_BEGIN_MASK:
-			case FZ_CMD_BEGIN_GROUP:
-				clipped++;
-				continue;
-			case FZ_CMD_BEGIN_STRUCTURE:
-			case FZ_CMD_END_STRUCTURE:
-			case FZ_CMD_BEGIN_METATEXT:
-			case FZ_CMD_END_METATEXT:
-				/* These may not nest as nicely as we'd like. Just ignore them for
-				 * the purposes of clipping. */
-				break;
-			case FZ_CMD_POP_CLIP:
-			case FZ_CMD_END_GROUP:
-				if (!clipped)
-					goto visible;
-				clipped--;
-				continue;
-			case FZ_CMD_END_MASK:
-				if (!clipped)
-					goto visible;
-				continue;
+			align_node_for_pointer(&node);
+			fz_drop_stroke_state(ctx, *(fz_stroke_state **)node);
+			node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+		}
+		if (n.path)
+		{
+			size_t path_size;
+			align_node_for_pointer(&node);
+			/* References own nothing; the copy they point at is
+			 * dropped with its own node. */
+			if (list_node_path(list, node, &path_size) == (fz_path *)node)
+				fz_drop_path(ctx, (fz_path *)node);
+			node += path_size;
+		}
+		switch(n.cmd)
+		{
+		case FZ_CMD_FILL_TEXT:
+		case FZ_CMD_STROKE_TEXT:
+		case FZ_CMD_CLIP_TEXT:
+		case FZ_CMD_CLIP_STROKE_TEXT:
+		case FZ_CMD_IGNORE_TEXT:
+			align_node_for_pointer(&node);
+			fz_drop_text(ctx, *(fz_text **)node);
+			break;
+		case FZ_CMD_FILL_SHADE:
+			align_node_for_pointer(&node);
+			fz_drop_shade(ctx, *(fz_shade **)node);
+			break;
+		case FZ_CMD_FILL_IMAGE:
+		case FZ_CMD_FILL_IMAGE_MASK:
+		case FZ_CMD_CLIP_IMAGE_MASK:
+			align_node_for_pointer(&node);
+			fz_drop_image(ctx, *(fz_image **)node);
+			break;
+		case FZ_CMD_END_MASK:
+			align_node_for_pointer(&node);
+			fz_drop_function(ctx, *(fz_function **)node);
+			break;
+		case FZ_CMD_DEFAULT_COLORSPACES:
+			align_node_for_pointer(&node);
+			fz_drop_default_colorspaces(ctx, *(fz_default_colorspaces **)node);
+			break;
+		}
+		node = next;
+	}
+	fz_drop_list_index(ctx, list->index);
+	fz_free(ctx, list->list);
+	fz_free(ctx, list);
+}
+
+fz_display_list *
+fz_new_display_list(fz_context *ctx, fz_rect mediabox)
+{
+	fz_display_list *list = fz_malloc_struct(ctx, fz_display_list);
+	FZ_INIT_STORABLE(list, 1, fz_drop_display_list_imp);
+	list->list = NULL;
+	list->mediabox = mediabox;
+	list->max = 0;
+	list->len = 0;
+	list->index = NULL;
+	return list;
+}
+
+fz_display_list *
+fz_keep_display_list(fz_context *ctx, fz_display_list *list)
+{
+	return fz_keep_storable(ctx, &list->storable);
+}
+
+void
+fz_drop_display_list(fz_context *ctx, fz_display_list *list)
+{
+	fz_defer_reap_start(ctx);
+	fz_drop_storable(ctx, &list->storable);
+	fz_defer_reap_end(ctx);
+}
+
+fz_rect
+fz_bound_display_list(fz_context *ctx, fz_display_list *list)
+{
+	return list->mediabox;
+}
+
+int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list)
+{
+	return !list || list->len == 0;
+}
+
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list, size_t *commands)
+{
+	if (commands)
+	{
+		const fz_display_node *node = list->list;
+		const fz_display_node *node_end = list->list + list->len;
+
+		*commands = 0;
+		while (node != node_end)
+		{
+			size_t size = node->size;
+			if (size == INDIRECT_NODE_THRESHOLD)
+				memcpy(&size, &node[1], sizeof(size_t));
+			node += size;
+			++*commands;
+		}
+	}
+	return list->len * sizeof(fz_display_node);
+}
+
+static size_t
+next_index_bit(const uint64_t *bits, size_t i, size_t n)
+{
+	uint64_t w;
+
+	if (i >= n)
+		return n;
+	w = bits[i >> 6] >> (i & 63);
+	if (w == 0)
+	{
+		i = (i | 63) + 1;
+		while (i < n && bits[i >> 6] == 0)
+			i += 64;
+		if (i >= n)
+			return n;
+		w = bits[i >> 6];
+	}
+	while (!(w & 1))
+	{
+		w >>= 1;
+		i++;
+	}
+	return i < n ? i : n;
+}
+
+/* Find the commands that a run with this ctm and scissor may need to
+ * visit. Returns NULL if the index can't help. */
+static uint64_t *
+query_list_index(fz_context *ctx, fz_list_index *index, fz_matrix ctm, fz_rect scissor)
+{
+	size_t words = index->ncmds / 64 + 1;
+	uint64_t *bits;
+	fz_matrix inv;
+	fz_rect q;
+	size_t i, k;
+	int level, x, y, x0, x1, y0, y1;
+
+	/* The playback loop culls on the bbox of the transformed rect,
+	 * which only matches the transformed bbox of the scissor for
+	 * rectilinear transforms. */
+	if (fz_is_infinite_rect(scissor) || !fz_is_rectilinear(ctm) || fz_try_invert_matrix(&inv, ctm))
+		return NULL;
+
+	/* Pad by a pixel so rounding can only ever add commands. */
+	q = fz_transform_rect(fz_expand_rect(scissor, 1), inv);
+	if (index->levels > 0 && q.x0 <= index->bounds.x0 && q.y0 <= index->bounds.y0 &&
+		q.x1 >= index->bounds.x1 && q.y1 >= index->bounds.y1)
+		return NULL;
+
+	bits = fz_malloc(ctx, words * sizeof(uint64_t));
+	memcpy(bits, index->always, words * sizeof(uint64_t));
+
+	for (level = 0; level < index->levels && fz_is_valid_rect(q); level++)
+	{
+		const fz_list_grid *g = &index->grid[level];
+		index_cells(g, index->bounds, q, &x0, &y0, &x1, &y1);
+		for (y = y0; y <= y1; y++)
+		{
+			for (x = x0; x <= x1; x++)
+			{
+				size_t c = (size_t)y * g->gw + x;
+				for (i = g->cell_start[c]; i < g->cell_start[c + 1]; i++)
+				{
+					k = g->cells[i].cmd;
+					if (g->cells[i].len == 1)
+						bits[k >> 6] |= (uint64_t)1 << (k & 63);
+					else
+						set_index_bits(bits, k, k + g->cells[i].len);
+				}
+			}
+		}
+	}
+
+	/* A clip, mask or group that lies outside the scissor culls
+	 * everything up to its matching pop. */
+	for (i = 0; i < index->nsubtrees; i++)
+	{
+		if (!fz_is_valid_rect(fz_intersect_rect(index->subtrees[i].rect, q)))
+			clear_index_bits(bits, index->subtrees[i].start, index->subtrees[i].end);
+	}
+
+	return bits;
+}
+
+/* Move the playback state to just before command 'target' and return
+ * its node. */
+static fz_display_node *
+seek_list_index(fz_context *ctx, fz_display_list *list, size_t target,
+	fz_rect *rect, fz_matrix *ctm, float *alpha, fz_colorspace **colorspace, float *color,
+	fz_stroke_state **stroke, fz_path **path)
+{
+	fz_list_index *index = list->index;
+	size_t chunk = target / INDEX_CHUNK;
+	fz_display_node *node = list->list + index->offset[chunk];
+	fz_list_state st = index->state[chunk];
+	fz_display_command cmd;
+	size_t i;
+	int k, n;
+
+	for (i = chunk * INDEX_CHUNK; i < target; i++)
+		node = decode_list_state(ctx, list, node, &st, &cmd);
+
+	*rect = st.rect;
+	*ctm = st.ctm;
+	*alpha = st.alpha;
+	if (*colorspace != st.colorspace)
+	{
+		fz_drop_colorspace(ctx, *colorspace);
+		*colorspace = fz_keep_colorspace(ctx, st.colorspace);
+	}
+	n = fz_colorspace_n(ctx, st.colorspace);
+	if (st.color)
+		memcpy(color, (float *)&list->list[st.color], n * sizeof(float));
+	else
+	{
+		for (k = 0; k < n; k++)
+			color[k] = 0.0f;
+		if (st.color_default == CS_GRAY_1 || st.color_default == CS_RGB_1)
+			for (k = 0; k < n; k++)
+				color[k] = 1.0f;
+		else if (st.color_default == CS_CMYK_1)
+			color[3] = 1.0f;
+	}
+	if (*stroke != st.stroke)
+	{
+		fz_drop_stroke_state(ctx, *stroke);
+		*stroke = fz_keep_stroke_state(ctx, st.stroke);
+	}
+	if (*path != st.path)
+	{
+		fz_drop_path(ctx, *path);
+		*path = fz_keep_path(ctx, st.path);
+	}
+
+	return node;
+}
+
+void
+fz_run_display_list(fz_context *ctx, fz_display_list *list, fz_device *dev, fz_matrix top_ctm, fz_rect scissor, fz_cookie *cookie)
+{
+	fz_display_node *node;
+	fz_display_node *node_end;
+	fz_display_node *next_node;
+	int clipped = 0;
+	int tiled = 0;
+	int progress = 0;
+
+	/* Current graphics state as unpacked from list */
+	fz_path *path = NULL;
+	float alpha = 1.0f;
+	fz_matrix ctm = fz_identity;
+	fz_stroke_state *stroke = NULL;
+	float color[FZ_MAX_COLORS] = { 0 };
+	fz_colorspace *colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
+	fz_color_params color_params;
+	fz_rect rect = { 0 };
+
+	/* Transformed versions of graphic state entries */
+	fz_rect trans_rect;
+	fz_matrix trans_ctm;
+	int tile_skip_depth = 0;
+
+	/* Commands to visit, from the list index (if any) */
+	uint64_t *visible = NULL;
+	size_t cmd_idx = 0;
+
+	if (cookie)
+	{
+		cookie->progress_max = list->len;
+		cookie->progress = 0;
+	}
+
+	color_params = fz_default_color_params;
+
+	if (list->index)
+	{
+		fz_try(ctx)
+			visible = query_list_index(ctx, list->index, top_ctm, scissor);
+		fz_catch(ctx)
+		{
+			/* Just run the list unindexed. */
+			fz_ignore_error(ctx);
+		}
+	}
+
+	node = list->list;
+	node_end = &list->list[list->len];
+	for (; node != node_end ; node = next_node)
+	{
+		int empty;
+		fz_display_node n;
+		size_t size;
+
+		/* Jump over commands the index says the scissor will cull. */
+		if (visible && !(visible[cmd_idx >> 6] & ((uint64_t)1 << (cmd_idx & 63))))
+		{
+			cmd_idx = next_index_bit(visible, cmd_idx, list->index->ncmds);
+			if (cmd_idx == list->index->ncmds)
+			{
+				progress = (int)list->len;
+				break;
+			}
+			node = seek_list_index(ctx, list, cmd_idx, &rect, &ctm, &alpha, &colorspace, color, &stroke, &path);
+			progress = (int)(node - list->list);
+		}
+		cmd_idx++;
+
+		n = *node;
+		size = n.size;
+
+		if (size == INDIRECT_NODE_THRESHOLD)
+		{
+			memcpy(&size, &node[1], sizeof(size_t));
+			node += SIZE_IN_NODES(sizeof(size_t));
+			size -= SIZE_IN_NODES(sizeof(size_t));
+		}
+
+		next_node = node + size;
+
+		/* Check the cookie for aborting */
+		if (cookie)
+		{
+			if (cookie->abort)
+				break;
+			cookie->progress = progress;
+			progress += (int)size;
+		}
+
+		node++;
+		if (n.rect)
+		{
+			rect = *(fz_rect *)node;
+			node += SIZE_IN_NODES(sizeof(fz_rect));
+		}
+		if (n.cs)
+		{
+			int i, en;
+
+			fz_drop_colorspace(ctx, colorspace);
+			switch (n.cs)
+			{
 			default:
-				continue;
+			case CS_GRAY_0:
+				colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
+				color[0] = 0.0f;
+				break;
+			case CS_GRAY_1:
+				colorspace = fz_keep_colorspace(ctx, fz_device_gray(ctx));
+				color[0] = 1.0f;
+				break;
+			case CS_RGB_0:
+				colorspace = fz_keep_colorspace(ctx, fz_device_rgb(ctx));
+				color[0] = 0.0f;
+				color[1] = 0.0f;
+				color[2] = 0.0f;
+				break;
+			case CS_RGB_1:
+				colorspace = fz_keep_colorspace(ctx, fz_device_rgb(ctx));
+				color[0] = 1.0f;
+				color[1] = 1.0f;
+				color[2] = 1.0f;
+				break;
+			case CS_CMYK_0:
+				colorspace = fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
+				color[0] = 0.0f;
+				color[1] = 0.0f;
+				color[2] = 0.0f;
+				color[3] = 0.0f;
+				break;
+			case CS_CMYK_1:
+				colorspace = fz_keep_colorspace(ctx, fz_device_cmyk(ctx));
+				color[0] = 0.0f;
+				color[1] = 0.0f;
+				color[2] = 0.0f;
+				color[3] = 1.0f;
+				break;
+			case CS_OTHER_0:
+				align_node_for_pointer(&node);
+				colorspace = fz_keep_colorspace(ctx, *(fz_colorspace **)(node));
+				node += SIZE_IN_NODES(sizeof(fz_colorspace *));
+				en = fz_colorspace_n(ctx, colorspace);
+				for (i = 0; i < en; i++)
+					color[i] = 0.0f;
+				break;
+			}
+		}
+		if (n.color == COLOR_REPEAT)
+		{
+			int nc = fz_colorspace_n(ctx, colorspace);
+			memcpy(color, &list->list[*(unsigned int *)node], nc * sizeof(float));
+			node += SIZE_IN_NODES(sizeof(unsigned int));
+		}
+		else if (n.color)
+		{
+			int nc = fz_colorspace_n(ctx, colorspace);
+			memcpy(color, (float *)node, nc * sizeof(float));
+			node += SIZE_IN_NODES(nc * sizeof(float));
+		}
+		if (n.alpha)
+		{
+			switch(n.alpha)
+			{
+			default:
+			case ALPHA_0:
+				alpha = 0.0f;
+				break;
+			case ALPHA_1:
+				alpha = 1.0f;
+				break;
+			case ALPHA_PRESENT:
+				alpha = *(float *)node;
+				node += SIZE_IN_NODES(sizeof(float));
+				break;
+			}
+		}
+		if (n.ctm != 0)
+		{
+			float *packed_ctm = (float *)node;
+			if (n.ctm & CTM_CHANGE_AD)
+			{
+				ctm.a = *packed_ctm++;
+				ctm.d = *packed_ctm++;
+				node += SIZE_IN_NODES(2*sizeof(float));
+			}
+			if (n.ctm & CTM_CHANGE_BC)
+			{
+				ctm.b = *packed_ctm++;
+				ctm.c = *packed_ctm++;
+				node += SIZE_IN_NODES(2*sizeof(float));
+			}
+			if (n.ctm & CTM_CHANGE_EF)
+			{
+				ctm.e = *packed_ctm++;
+				ctm.f = *packed_ctm;
+				node += SIZE_IN_NODES(2*sizeof(float));
+			}
+		}
+		if (n.stroke)
+		{
+			align_node_for_pointer(&node);
+			fz_drop_stroke_state(ctx, stroke);
+			stroke = fz_keep_stroke_state(ctx, *(fz_stroke_state **)node);
+			node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+		}
+		if (n.path)
+		{
+			size_t path_size;
+			align_node_for_pointer(&node);
+			fz_drop_path(ctx, path);
+			path = fz_keep_path(ctx, list_node_path(list, node, &path_size));
+			node += path_size;
+		}
+
+		if (tile_skip_depth > 0)
+		{
+			if (n.cmd == FZ_CMD_BEGIN_TILE)
+				tile_skip_depth++;
+			else if (n.cmd == FZ_CMD_END_TILE)
+				tile_skip_depth--;
+			if (tile_skip_depth > 0)
+				continue;
+		}
+
+		trans_rect = fz_transform_rect(rect, top_ctm);
+
+		/* cull objects to draw using a quick visibility test */
+
+		if (tiled ||
+			n.cmd == FZ_CMD_BEGIN_TILE || n.cmd == FZ_CMD_END_TILE ||
+			n.cmd == FZ_CMD_RENDER_FLAGS || n.cmd == FZ_CMD_DEFAULT_COLORSPACES ||
+			n.cmd == FZ_CMD_BEGIN_LAYER || n.cmd == FZ_CMD_END_LAYER ||
+			n.cmd == FZ_CMD_BEGIN_STRUCTURE || n.cmd == FZ_CMD_END_STRUCTURE ||
+			n.cmd == FZ_CMD_BEGIN_METATEXT || n.cmd == FZ_CMD_END_METATEXT
+			)
+		{
+			empty = 0;
+		}
+		else if (n.cmd == FZ_CMD_FILL_PATH || n.cmd == FZ_CMD_STROKE_PATH)
+		{
+			/* Zero area paths are suitable for stroking. */
+			empty = !fz_is_valid_rect(fz_intersect_rect(trans_rect, scissor));
+		}
+		else if (n.cmd == FZ_CMD_FILL_TEXT || n.cmd == FZ_CMD_STROKE_TEXT ||
+			n.cmd == FZ_CMD_CLIP_TEXT || n.cmd == FZ_CMD_CLIP_STROKE_TEXT)
+		{
+			/* Zero area text (such as spaces) should be passed
+			 * through. Text that is completely outside the scissor
+			 * can be elided. */
+			empty = !fz_is_valid_rect(fz_intersect_rect(trans_rect, scissor));
+		}
+		else
+		{
+			empty = fz_is_empty_rect(fz_intersect_rect(trans_rect, scissor));
+		}
+
+		/* clipped starts out as 0. It only goes non-zero here if we move inside
+		 * an 'empty' region. Whenever clipped is non zero, or we are in an empty
+		 * region, we therefore may need to increment clipped according to the
+		 * nesting. */
+		if (clipped || empty)
+		{
+			switch (n.cmd)
+			{
+			case FZ_CMD_CLIP_PATH:
+			case FZ_CMD_CLIP_STROKE_PATH:
+			case FZ_CMD_CLIP_TEXT:
+			case FZ_CMD_CLIP_STROKE_TEXT:
+			case FZ_CMD_CLIP_IMAGE_MASK:
+			case FZ_CMD_BEGIN_MASK:
+			case FZ_CMD_BEGIN_GROUP:
+				clipped++;
+				continue;
+			case FZ_CMD_BEGIN_STRUCTURE:
+			case FZ_CMD_END_STRUCTURE:
+			case FZ_CMD_BEGIN_METATEXT:
+			case FZ_CMD_END_METATEXT:
+				/* These may not nest as nicely as we'd like. Just ignore them for
+				 * the purposes of clipping. */
+				break;
+			case FZ_CMD_POP_CLIP:
+			case FZ_CMD_END_GROUP:
+				if (!clipped)
+					goto visible;
+				clipped--;
+				continue;
+			case FZ_CMD_END_MASK:
+				if (!clipped)
+					goto visible;
+				continue;
+			default:
+				continue;
+			}
+		}
+
+visible:
+		trans_ctm = fz_concat(ctm, top_ctm);
+
+		fz_try(ctx)
+		{
+			switch (n.cmd)
+			{
+			case FZ_CMD_FILL_PATH:
+				fz_unpack_color_params(&color_params, n.flags);
+				fz_fill_path(ctx, dev, path, n.flags & 1, trans_ctm, colorspace, color, alpha, color_params);
+				break;
+			case FZ_CMD_STROKE_PATH:
+				fz_unpack_color_params(&color_params, n.flags);
+				fz_stroke_path(ctx, dev, path, stroke, trans_ctm, colorspace, color, alpha, color_params);
+				break;
+			case FZ_CMD_CLIP_PATH:
+				fz_clip_path(ctx, dev, path, n.flags, trans_ctm, trans_rect);
+				break;
+			case FZ_CMD_CLIP_STROKE_PATH:
+				fz_clip_stroke_path(ctx, dev, path, stroke, trans_ctm, trans_rect);
+				break;
+			case FZ_CMD_FILL_TEXT:
+				fz_unpack_color_params(&color_params, n.flags);
+				align_node_for_pointer(&node);
+				fz_fill_text(ctx, dev, *(fz_text **)node, trans_ctm, colorspace, color, alpha, color_params);
+				break;
+			case FZ_CMD_STROKE_TEXT:
+				fz_unpack_color_params(&color_params, n.flags);
+				align_node_for_pointer(&node);
+				fz_stroke_text(ctx, dev, *(fz_text **)node, stroke, trans_ctm, colorspace, color, alpha, color_params);
+				break;
+			case FZ_CMD_CLIP_TEXT:
+				align_node_for_pointer(&node);
+				fz_clip_text(ctx, dev, *(fz_text **)node, trans_ctm, trans_rect);
+				break;
+			case FZ_CMD_CLIP_STROKE_TEXT:
+				align_node_for_pointer(&node);
+				fz_clip_stroke_text(ctx, dev, *(fz_text **)node, stroke, trans_ctm, trans_rect);
+				break;
+			case FZ_CMD_IGNORE_TEXT:
+				align_node_for_pointer(&node);
+				fz_ignore_text(ctx, dev, *(fz_text **)node, trans_ctm);
+				break;
+			case FZ_CMD_FILL_SHADE:
+				fz_unpack_color_params(&color_params, n.flags);
+				align_node_for_pointer(&node);
+				fz_fill_shade(ctx, dev, *(fz_shade **)node, trans_ctm, alpha, color_params);
+				break;
+			case FZ_CMD_FILL_IMAGE:
+				fz_unpack_color_params(&color_params, n.flags);
+				align_node_for_pointer(&node);
+				fz_fill_image(ctx, dev, *(fz_image **)node, trans_ctm, alpha, color_params);
+				break;
+			case FZ_CMD_FILL_IMAGE_MASK:
+				fz_unpack_color_params(&color_params, n.flags);
+				align_node_for_pointer(&node);
+				fz_fill_image_mask(ctx, dev, *(fz_image **)node, trans_ctm, colorspace, color, alpha, color_params);
+				break;
+			case FZ_CMD_CLIP_IMAGE_MASK:
+				align_node_for_pointer(&node);
+				fz_clip_image_mask(ctx, dev, *(fz_image **)node, trans_ctm, trans_rect);
+				break;
+			case FZ_CMD_POP_CLIP:
+				fz_pop_clip(ctx, dev);
+				break;
+			case FZ_CMD_BEGIN_MASK:
+				fz_unpack_color_params(&color_params, n.flags);
+				fz_begin_mask(ctx, dev, trans_rect, n.flags & 1, colorspace, color, color_params);
+				break;
+			case FZ_CMD_END_MASK:
+				align_node_for_pointer(&node);
+				fz_end_mask_tr(ctx, dev, *(fz_function **)node);
+				break;
+			case FZ_CMD_BEGIN_GROUP:
+				fz_begin_group(ctx, dev, trans_rect, colorspace, (n.flags & ISOLATED) != 0, (n.flags & KNOCKOUT) != 0, (n.flags>>2), alpha);
+				break;
+			case FZ_CMD_END_GROUP:
+				fz_end_group(ctx, dev);
+				break;
+			case FZ_CMD_BEGIN_TILE:
+			{
+				int cached;
+				fz_list_tile_data *data;
+				fz_rect tile_rect;
+				data = (fz_list_tile_data *)node;
+				tiled++;
+				tile_rect = data->view;
+				cached = fz_begin_tile_id(ctx, dev, rect, tile_rect, data->xstep, data->ystep, trans_ctm, data->id);
+				if (cached)
+					tile_skip_depth = 1;
+				break;
+			}
+			case FZ_CMD_END_TILE:
+				tiled--;
+				fz_end_tile(ctx, dev);
+				break;
+			case FZ_CMD_RENDER_FLAGS:
+				if (n.flags == 0)
+					fz_render_flags(ctx, dev, 0, FZ_DEVFLAG_GRIDFIT_AS_TILED);
+				else if (n.flags == 1)
+					fz_render_flags(ctx, dev, FZ_DEVFLAG_GRIDFIT_AS_TILED, 0);
+				break;
+			case FZ_CMD_DEFAULT_COLORSPACES:
+				align_node_for_pointer(&node);
+				fz_set_default_colorspaces(ctx, dev, *(fz_default_colorspaces **)node);
+				break;
+			case FZ_CMD_BEGIN_LAYER:
+				fz_begin_layer(ctx, dev, (const char *)node);
+				break;
+			case FZ_CMD_END_LAYER:
+				fz_end_layer(ctx, dev);
+				break;
+			case FZ_CMD_BEGIN_STRUCTURE:
+			{
+				const unsigned char *data;
+				int idx;
+				data = (const unsigned char *)node;
+				memcpy(&idx, data+1, sizeof(idx));
+				fz_begin_structure(ctx, dev, (fz_structure)data[0], (const char *)(&data[1+sizeof(idx)]), idx);
+				break;
+			}
+			case FZ_CMD_END_STRUCTURE:
+				fz_end_structure(ctx, dev);
+				break;
+			case FZ_CMD_BEGIN_METATEXT:
+			{
+				const unsigned char *data;
+				const char *text;
+				data = (const unsigned char *)node;
+				text = (const char *)&data[1];
+				fz_begin_metatext(ctx, dev, (fz_metatext)data[0], text);
+				break;
+			}
+			case FZ_CMD_END_METATEXT:
+				fz_end_metatext(ctx, dev);
+				break;
+			}
+		}
+		fz_catch(ctx)
+		{
+			if (fz_caught(ctx) == FZ_ERROR_SYSTEM)
+			{
+				fz_drop_colorspace(ctx, colorspace);
+				fz_drop_stroke_state(ctx, stroke);
+				fz_drop_path(ctx, path);
+				fz_free(ctx, visible);
+				fz_rethrow(ctx);
+			}
+			/* Swallow the error */
+			if (cookie)
+				cookie->errors++;
+			if (fz_caught(ctx) == FZ_ERROR_ABORT)
+			{
+				fz_ignore_error(ctx);
+				break;
+			}
+			fz_report_error(ctx);
+			fz_warn(ctx, "Ignoring error during interpretation");
+		}
+	}
+	fz_drop_colorspace(ctx, colorspace);
+	fz_drop_stroke_state(ctx, stroke);
+	fz_drop_path(ctx, path);
+	fz_free(ctx, visible);
+	if (cookie)
+		cookie->progress = progress;
+}
+
+/* Tile parallel rendering */
+
+#define DEFAULT_RENDER_TILE_SIZE 256
+
+typedef struct
+{
+	int idx;
+	int cost;
+} fz_render_tile;
+
+struct fz_tile_render
+{
+	fz_display_list *list;
+	fz_matrix ctm;
+	fz_irect area;
+	int tile_w, tile_h;
+	int cols, rows;
+	int count;
+	fz_render_tile *tiles;
+
+	/* Protected by FZ_LOCK_ALLOC */
+	int next;
+	int aborted;
+};
+
+static int
+cmd_paints(fz_display_command cmd)
+{
+	return (cmd == FZ_CMD_FILL_PATH ||
+		cmd == FZ_CMD_STROKE_PATH ||
+		cmd == FZ_CMD_FILL_TEXT ||
+		cmd == FZ_CMD_STROKE_TEXT ||
+		cmd == FZ_CMD_FILL_SHADE ||
+		cmd == FZ_CMD_FILL_IMAGE ||
+		cmd == FZ_CMD_FILL_IMAGE_MASK ||
+		cmd == FZ_CMD_BEGIN_TILE);
+}
+
+static int
+tile_index_clamp(float v, int n)
+{
+	if (v < 0)
+		return 0;
+	if (v >= n)
+		return n - 1;
+	return (int)v;
+}
+
+static void
+count_tile_costs(fz_context *ctx, fz_tile_render *tr, int *cost)
+{
+	fz_display_list *list = tr->list;
+	fz_display_node *node = list->list;
+	fz_display_node *node_end = list->list + list->len;
+	fz_rect rect = { 0 };
+	int tiled = 0;
+
+	while (node != node_end)
+	{
+		fz_display_node n = *node;
+		size_t size = n.size;
+		fz_display_node *next;
+
+		if (size == INDIRECT_NODE_THRESHOLD)
+		{
+			memcpy(&size, &node[1], sizeof(size));
+			node += SIZE_IN_NODES(sizeof(size_t));
+			size -= SIZE_IN_NODES(sizeof(size_t));
+		}
+		next = node + size;
+
+		if (n.rect)
+			rect = *(fz_rect *)&node[1];
+
+		/* Everything between begin and end tile lives in pattern
+		 * space; the begin tile node's rect covers the lot. */
+		if (n.cmd == FZ_CMD_END_TILE)
+		{
+			if (tiled > 0)
+				tiled--;
+		}
+		else if (!tiled && cmd_paints(n.cmd))
+		{
+			/* Pad by a pixel so that zero area strokes and
+			 * antialiased edges land in every tile they touch. */
+			fz_rect r = fz_transform_rect(rect, tr->ctm);
+			if (fz_is_valid_rect(r))
+			{
+				int x0 = tile_index_clamp((r.x0 - 1 - tr->area.x0) / tr->tile_w, tr->cols);
+				int y0 = tile_index_clamp((r.y0 - 1 - tr->area.y0) / tr->tile_h, tr->rows);
+				int x1 = tile_index_clamp((r.x1 + 1 - tr->area.x0) / tr->tile_w, tr->cols);
+				int y1 = tile_index_clamp((r.y1 + 1 - tr->area.y0) / tr->tile_h, tr->rows);
+				int x, y;
+
+				if (r.x1 + 1 > tr->area.x0 && r.x0 - 1 < tr->area.x1 &&
+					r.y1 + 1 > tr->area.y0 && r.y0 - 1 < tr->area.y1)
+				{
+					for (y = y0; y <= y1; y++)
+						for (x = x0; x <= x1; x++)
+							cost[y * tr->cols + x]++;
+				}
+			}
+		}
+		if (n.cmd == FZ_CMD_BEGIN_TILE)
+			tiled++;
+
+		node = next;
+	}
+}
+
+static int
+cmp_render_tile(const void *a_, const void *b_)
+{
+	const fz_render_tile *a = a_;
+	const fz_render_tile *b = b_;
+	if (a->cost != b->cost)
+		return b->cost - a->cost;
+	return a->idx - b->idx;
+}
+
+fz_tile_render *
+fz_new_tile_render(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_irect area, int tile_w, int tile_h)
+{
+	fz_tile_render *tr;
+	int *cost = NULL;
+	int i, n;
+
+	if (tile_w <= 0)
+		tile_w = DEFAULT_RENDER_TILE_SIZE;
+	if (tile_h <= 0)
+		tile_h = DEFAULT_RENDER_TILE_SIZE;
+
+	tr = fz_malloc_struct(ctx, fz_tile_render);
+	tr->ctm = ctm;
+	tr->area = area;
+	tr->tile_w = tile_w;
+	tr->tile_h = tile_h;
+	if (!fz_is_empty_irect(area))
+	{
+		tr->cols = (fz_irect_width(area) + tile_w - 1) / tile_w;
+		tr->rows = (fz_irect_height(area) + tile_h - 1) / tile_h;
+	}
+	n = tr->cols * tr->rows;
+
+	fz_var(cost);
+
+	fz_try(ctx)
+	{
+		tr->list = fz_keep_display_list(ctx, list);
+		cost = fz_calloc(ctx, n ? n : 1, sizeof(*cost));
+		tr->tiles = fz_malloc_array(ctx, n ? n : 1, fz_render_tile);
+		count_tile_costs(ctx, tr, cost);
+		for (i = 0; i < n; i++)
+		{
+			if (cost[i] == 0)
+				continue;
+			tr->tiles[tr->count].idx = i;
+			tr->tiles[tr->count].cost = cost[i];
+			tr->count++;
+		}
+		qsort(tr->tiles, tr->count, sizeof(*tr->tiles), cmp_render_tile);
+	}
+	fz_always(ctx)
+		fz_free(ctx, cost);
+	fz_catch(ctx)
+	{
+		fz_drop_tile_render(ctx, tr);
+		fz_rethrow(ctx);
+	}
+
+	return tr;
+}
+
+void
+fz_drop_tile_render(fz_context *ctx, fz_tile_render *tr)
+{
+	if (!tr)
+		return;
+	fz_drop_display_list(ctx, tr->list);
+	fz_free(ctx, tr->tiles);
+	fz_free(ctx, tr);
+}
+
+int
+fz_count_render_tiles(fz_context *ctx, fz_tile_render *tr)
+{
+	return tr->count;
+}
+
+void
+fz_abort_tile_render(fz_context *ctx, fz_tile_render *tr)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	tr->aborted = 1;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+int
+fz_next_render_tile(fz_context *ctx, fz_tile_render *tr, fz_irect *tile)
+{
+	int i, x, y;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (tr->aborted || tr->next >= tr->count)
+		i = -1;
+	else
+		i = tr->tiles[tr->next++].idx;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	if (i < 0)
+		return 0;
+
+	x = i % tr->cols;
+	y = i / tr->cols;
+	tile->x0 = tr->area.x0 + x * tr->tile_w;
+	tile->y0 = tr->area.y0 + y * tr->tile_h;
+	tile->x1 = fz_mini(tile->x0 + tr->tile_w, tr->area.x1);
+	tile->y1 = fz_mini(tile->y0 + tr->tile_h, tr->area.y1);
+	return 1;
+}
+
+void
+fz_run_tile_render(fz_context *ctx, fz_tile_render *tr, fz_pixmap *dest, fz_cookie *cookie, fz_tile_device_fn *new_device, void *arg)
+{
+	fz_pixmap *sub = NULL;
+	fz_device *dev = NULL;
+	fz_irect tile;
+
+	fz_var(sub);
+	fz_var(dev);
+
+	while (fz_next_render_tile(ctx, tr, &tile))
+	{
+		fz_try(ctx)
+		{
+			sub = fz_new_pixmap_from_pixmap(ctx, dest, &tile);
+			if (new_device)
+				dev = new_device(ctx, arg, sub);
+			else
+				dev = fz_new_draw_device(ctx, fz_identity, sub);
+			fz_run_display_list(ctx, tr->list, dev, tr->ctm, fz_rect_from_irect(tile), cookie);
+			fz_close_device(ctx, dev);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_device(ctx, dev);
+			dev = NULL;
+			fz_drop_pixmap(ctx, sub);
+			sub = NULL;
+		}
+		fz_catch(ctx)
+		{
+			fz_abort_tile_render(ctx, tr);
+			fz_rethrow(ctx);
+		}
+
+		if (cookie && cookie->abort)
+		{
+			fz_abort_tile_render(ctx, tr);
+			break;
+		}
+	}
+}
+
+/* Saving and loading */
+
+/*
+	A saved display list is a cache for the build of the library that
+	wrote it. The nodes are stored in their in-memory encoding, with
+	each object pointer replaced by the number of a record earlier in
+	the file. Loading copies the nodes back and swaps the numbers for
+	the recreated objects; no drawing commands are reinterpreted.
+
+	Font files, image data, ICC profiles and shading meshes are stored
+	as blobs, written once per file (by MD5) however many objects share
+	them. Tint transforms and transfer functions only exist as code, so
+	they are stored sampled. Type 3 fonts cannot be saved.
+
+	scripts/listcheck.c saves and loads the lists of whole documents,
+	and checks that they draw the same as the lists they came from.
+*/
+
+#define LIST_FILE_MAGIC "MuDL"
+#define LIST_FILE_VERSION 2
+
+typedef struct
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t byte_order;
+	uint8_t pointer_size;
+	uint8_t size_size;
+	uint8_t pointer_align;
+	uint8_t node_size;
+	char fz_version[16];
+} fz_list_file_header;
+
+enum
+{
+	LIST_REC_BLOB = 1,
+	LIST_REC_COLORSPACE,
+	LIST_REC_FUNCTION,
+	LIST_REC_STROKE,
+	LIST_REC_FONT,
+	LIST_REC_TEXT,
+	LIST_REC_IMAGE,
+	LIST_REC_SHADE,
+	LIST_REC_DEFAULT_CS,
+	LIST_REC_LIST,
+
+	/* Not records: a path packed into a node, or a reference to an
+	 * earlier one. */
+	LIST_SLOT_PATH,
+	LIST_SLOT_PATH_REF
+};
+
+enum
+{
+	LIST_CS_DEVICE,
+	LIST_CS_ICC,
+	LIST_CS_INDEXED,
+	LIST_CS_SEPARATION
+};
+
+enum
+{
+	LIST_IMAGE_COMPRESSED,
+	LIST_IMAGE_PIXMAP
+};
+
+typedef struct
+{
+	fz_compression_params params; /* with the jbig2 globals cleared */
+	int globals, data;
+} fz_list_compressed_buffer;
+
+typedef struct
+{
+	int w, h, bpc;
+	int imagemask, interpolate, use_colorkey, use_decode, orientation;
+	int xres, yres;
+	int colorspace, mask;
+	int colorkey[FZ_MAX_COLORS * 2];
+	float decode[FZ_MAX_COLORS * 2];
+} fz_list_image_header;
+
+typedef struct
+{
+	int w, h, n, alpha;
+	int colorspace, samples;
+} fz_list_pixmap_header;
+
+typedef struct
+{
+	int data;
+	char name[32];
+	int subfont, use_glyph_bbox;
+	fz_font_flags_t flags;
+	fz_rect bbox;
+	float ascender, descender;
+	int width_count, width_default;
+} fz_list_font_header;
+
+typedef struct
+{
+	int font;
+	fz_matrix trm;
+	int wmode, bidi_level, markup_dir, language;
+	int len;
+} fz_list_span_header;
+
+typedef struct
+{
+	int start_cap, dash_cap, end_cap, linejoin;
+	float linewidth, miterlimit, dash_phase;
+	int dash_len;
+} fz_list_stroke_header;
+
+typedef void *(fz_list_slot_fn)(fz_context *ctx, void *arg, int type, void **slot, size_t avail);
+
+static void **
+next_list_slot(fz_context *ctx, fz_display_node **node, fz_display_node *next)
+{
+	void **slot;
+
+	align_node_for_pointer(node);
+	slot = (void **)*node;
+	*node += SIZE_IN_NODES(sizeof(void *));
+	if (*node > next)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+	return slot;
+}
+
+/* Check that a node's inline string, which starts skip bytes into
+ * its private data, is terminated within the node. */
+static void
+check_list_string(fz_context *ctx, fz_display_node *node, fz_display_node *next, size_t skip)
+{
+	size_t avail = (char *)next - (char *)node;
+
+	if (avail <= skip || !memchr((char *)node + skip, 0, avail - skip))
+		fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+}
+
+/* Call fn on every object pointer (and every packed path, with the
+ * space left in its node) in a list. fn returns the object, so that
+ * we can tell how many color values follow a colorspace change. */
+static void
+walk_list_slots(fz_context *ctx, fz_display_node *node, fz_display_node *node_end, fz_list_slot_fn *fn, void *arg)
+{
+	fz_display_node *base = node;
+	int cs_n = 1;
+
+	while (node != node_end)
+	{
+		fz_display_node n = *node;
+		size_t size = n.size;
+		fz_display_node *next;
+
+		if (size == INDIRECT_NODE_THRESHOLD)
+		{
+			if ((size_t)(node_end - node) < 1 + SIZE_IN_NODES(sizeof(size_t)))
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+			memcpy(&size, &node[1], sizeof(size_t));
+			node += SIZE_IN_NODES(sizeof(size_t));
+			size -= SIZE_IN_NODES(sizeof(size_t));
+		}
+		if (size == 0 || size > (size_t)(node_end - node))
+			fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+
+		next = node + size;
+
+		node++;
+		if (n.rect)
+			node += SIZE_IN_NODES(sizeof(fz_rect));
+		switch (n.cs)
+		{
+		case CS_UNCHANGED:
+			break;
+		case CS_GRAY_0:
+		case CS_GRAY_1:
+			cs_n = 1;
+			break;
+		case CS_RGB_0:
+		case CS_RGB_1:
+			cs_n = 3;
+			break;
+		case CS_CMYK_0:
+		case CS_CMYK_1:
+			cs_n = 4;
+			break;
+		case CS_OTHER_0:
+			cs_n = fz_colorspace_n(ctx, fn(ctx, arg, LIST_REC_COLORSPACE, next_list_slot(ctx, &node, next), sizeof(void *)));
+			break;
+		}
+		if (n.color == COLOR_REPEAT)
+		{
+			size_t offset;
+			if (node >= next)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+			offset = *(unsigned int *)node;
+			if (offset > (size_t)(node - base) || (size_t)cs_n > (size_t)(node - base) - offset)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+			node += SIZE_IN_NODES(sizeof(unsigned int));
+		}
+		else if (n.color)
+			node += SIZE_IN_NODES(cs_n * sizeof(float));
+		if (n.alpha == ALPHA_PRESENT)
+			node += SIZE_IN_NODES(sizeof(float));
+		if (n.ctm & CTM_CHANGE_AD)
+			node += SIZE_IN_NODES(2*sizeof(float));
+		if (n.ctm & CTM_CHANGE_BC)
+			node += SIZE_IN_NODES(2*sizeof(float));
+		if (n.ctm & CTM_CHANGE_EF)
+			node += SIZE_IN_NODES(2*sizeof(float));
+		if (node > next)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+		if (n.stroke)
+			fn(ctx, arg, LIST_REC_STROKE, next_list_slot(ctx, &node, next), sizeof(void *));
+		if (n.path)
+		{
+			align_node_for_pointer(&node);
+			if (node >= next)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+			if (((fz_list_path_ref *)node)->packed == LIST_PATH_REF)
+			{
+				if ((size_t)(next - node) < SIZE_IN_NODES(sizeof(fz_list_path_ref)))
+					fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+				fn(ctx, arg, LIST_SLOT_PATH_REF, (void **)node, (char *)next - (char *)node);
+				node += SIZE_IN_NODES(sizeof(fz_list_path_ref));
+			}
+			else
+			{
+				fn(ctx, arg, LIST_SLOT_PATH, (void **)node, (char *)next - (char *)node);
+				node += SIZE_IN_NODES(fz_packed_path_size((fz_path *)node));
+			}
+			if (node > next)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+		}
+		switch (n.cmd)
+		{
+		case FZ_CMD_FILL_TEXT:
+		case FZ_CMD_STROKE_TEXT:
+		case FZ_CMD_CLIP_TEXT:
+		case FZ_CMD_CLIP_STROKE_TEXT:
+		case FZ_CMD_IGNORE_TEXT:
+			fn(ctx, arg, LIST_REC_TEXT, next_list_slot(ctx, &node, next), sizeof(void *));
+			break;
+		case FZ_CMD_FILL_SHADE:
+			fn(ctx, arg, LIST_REC_SHADE, next_list_slot(ctx, &node, next), sizeof(void *));
+			break;
+		case FZ_CMD_FILL_IMAGE:
+		case FZ_CMD_FILL_IMAGE_MASK:
+		case FZ_CMD_CLIP_IMAGE_MASK:
+			fn(ctx, arg, LIST_REC_IMAGE, next_list_slot(ctx, &node, next), sizeof(void *));
+			break;
+		case FZ_CMD_END_MASK:
+			fn(ctx, arg, LIST_REC_FUNCTION, next_list_slot(ctx, &node, next), sizeof(void *));
+			break;
+		case FZ_CMD_DEFAULT_COLORSPACES:
+			fn(ctx, arg, LIST_REC_DEFAULT_CS, next_list_slot(ctx, &node, next), sizeof(void *));
+			break;
+		case FZ_CMD_BEGIN_LAYER:
+			check_list_string(ctx, node, next, 0);
+			break;
+		case FZ_CMD_BEGIN_STRUCTURE:
+			check_list_string(ctx, node, next, 1 + sizeof(int));
+			break;
+		case FZ_CMD_BEGIN_METATEXT:
+			check_list_string(ctx, node, next, 1);
+			break;
+		}
+		node = next;
+	}
+}
+
+/* Sampled functions: each input is sampled at this many points over
+ * [0,1], and interpolated between them. */
+static int
+sampled_function_size(int m)
+{
+	static const int size[] = { 0, 256, 33, 17, 9 };
+	return (m >= 1 && m <= 4) ? size[m] : 0;
+}
+
+typedef struct
+{
+	fz_function super;
+	int size;
+	float *samples;
+} fz_list_sampled_function;
+
+static void
+eval_sampled_function(fz_context *ctx, fz_function *fn_, const float *in, float *out)
+{
+	fz_list_sampled_function *fn = (fz_list_sampled_function *)fn_;
+	int m = fn->super.m;
+	int n = fn->super.n;
+	int s = fn->size;
+	int i0[4];
+	float t[4];
+	int c, j, k;
+
+	for (k = 0; k < m; k++)
+	{
+		float x = in[k] > 0 ? (in[k] < 1 ? in[k] : 1) : 0;
+		x *= s - 1;
+		i0[k] = fz_mini((int)x, s - 2);
+		t[k] = x - i0[k];
+	}
+
+	for (j = 0; j < n; j++)
+		out[j] = 0;
+
+	for (c = 0; c < (1 << m); c++)
+	{
+		float weight = 1;
+		size_t idx = 0, stride = 1;
+		for (k = 0; k < m; k++)
+		{
+			int hi = (c >> k) & 1;
+			weight *= hi ? t[k] : 1 - t[k];
+			idx += (i0[k] + hi) * stride;
+			stride *= s;
+		}
+		if (weight == 0)
+			continue;
+		for (j = 0; j < n; j++)
+			out[j] += weight * fn->samples[idx * n + j];
+	}
+}
+
+static void
+drop_sampled_function(fz_context *ctx, fz_storable *fn_)
+{
+	fz_list_sampled_function *fn = (fz_list_sampled_function *)fn_;
+
+	fz_free(ctx, fn->samples);
+	fz_free(ctx, fn);
+}
+
+static void
+eval_sampled_tint(fz_context *ctx, void *tint, const float *s, int sn, float *d, int dn)
+{
+	fz_eval_function(ctx, tint, s, sn, d, dn);
+}
+
+static void
+drop_sampled_tint(fz_context *ctx, void *tint)
+{
+	fz_drop_function(ctx, tint);
+}
+
+static fz_colorspace *
+device_colorspace(fz_context *ctx, int type)
+{
+	switch (type)
+	{
+	case FZ_COLORSPACE_GRAY: return fz_device_gray(ctx);
+	case FZ_COLORSPACE_RGB: return fz_device_rgb(ctx);
+	case FZ_COLORSPACE_BGR: return fz_device_bgr(ctx);
+	case FZ_COLORSPACE_CMYK: return fz_device_cmyk(ctx);
+	case FZ_COLORSPACE_LAB: return fz_device_lab(ctx);
+	}
+	fz_throw(ctx, FZ_ERROR_FORMAT, "invalid colorspace type in display list file");
+}
+
+/* Writing */
+
+typedef struct
+{
+	fz_output *out;
+	int count;
+	fz_hash_table *objects; /* object pointer -> record number */
+	fz_hash_table *blobs; /* md5 -> record number */
+	fz_buffer *paths; /* out of line data for the packed paths */
+} fz_list_writer;
+
+static void
+write_data(fz_context *ctx, fz_list_writer *w, const void *data, size_t len)
+{
+	fz_write_data(ctx, w->out, data, len);
+}
+
+static void
+write_int(fz_context *ctx, fz_list_writer *w, int v)
+{
+	fz_write_data(ctx, w->out, &v, sizeof v);
+}
+
+static void
+write_size(fz_context *ctx, fz_list_writer *w, size_t len)
+{
+	uint64_t v = len;
+	fz_write_data(ctx, w->out, &v, sizeof v);
+}
+
+static void
+write_string(fz_context *ctx, fz_list_writer *w, const char *s)
+{
+	int len = s ? (int)strlen(s) + 1 : 0;
+	write_int(ctx, w, len);
+	write_data(ctx, w, s, len);
+}
+
+static int
+begin_record(fz_context *ctx, fz_list_writer *w, int type)
+{
+	write_int(ctx, w, type);
+	return ++w->count;
+}
+
+static int
+find_record(fz_context *ctx, fz_list_writer *w, const void *obj)
+{
+	return (int)(intptr_t)fz_hash_find(ctx, w->objects, &obj);
+}
+
+static int
+remember_record(fz_context *ctx, fz_list_writer *w, const void *obj, int num)
+{
+	fz_hash_insert(ctx, w->objects, &obj, (void *)(intptr_t)num);
+	return num;
+}
+
+static int
+write_blob(fz_context *ctx, fz_list_writer *w, const unsigned char *data, size_t len)
+{
+	unsigned char digest[16];
+	fz_md5 md5;
+	int num;
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, data, len);
+	fz_md5_final(&md5, digest);
+
+	num = (int)(intptr_t)fz_hash_find(ctx, w->blobs, digest);
+	if (num)
+		return num;
+
+	num = begin_record(ctx, w, LIST_REC_BLOB);
+	write_size(ctx, w, len);
+	write_data(ctx, w, data, len);
+	fz_hash_insert(ctx, w->blobs, digest, (void *)(intptr_t)num);
+	return num;
+}
+
+static int
+write_buffer_blob(fz_context *ctx, fz_list_writer *w, fz_buffer *buf)
+{
+	unsigned char *data;
+	size_t len = fz_buffer_storage(ctx, buf, &data);
+	return write_blob(ctx, w, data, len);
+}
+
+typedef void (fz_list_eval_fn)(fz_context *ctx, void *arg, const float *in, int m, float *out, int n);
+
+static void
+eval_tint_for_sampling(fz_context *ctx, void *arg, const float *in, int m, float *out, int n)
+{
+	fz_colorspace *cs = arg;
+	cs->u.separation.eval(ctx, cs->u.separation.tint, in, m, out, n);
+}
+
+static void
+eval_function_for_sampling(fz_context *ctx, void *arg, const float *in, int m, float *out, int n)
+{
+	fz_eval_function(ctx, arg, in, m, out, n);
+}
+
+static int
+write_sampled_function(fz_context *ctx, fz_list_writer *w, fz_list_eval_fn *eval, void *arg, int m, int n)
+{
+	float in[4], out[FZ_MAX_COLORS];
+	int s = sampled_function_size(m);
+	int total, i, j, k, num;
+
+	if (s == 0 || n < 1 || n > FZ_MAX_COLORS)
+		fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "cannot save function with %d inputs and %d outputs", m, n);
+
+	for (total = 1, k = 0; k < m; k++)
+		total *= s;
+
+	num = begin_record(ctx, w, LIST_REC_FUNCTION);
+	write_int(ctx, w, m);
+	write_int(ctx, w, n);
+	for (i = 0; i < total; i++)
+	{
+		for (j = i, k = 0; k < m; k++, j /= s)
+			in[k] = (float)(j % s) / (s - 1);
+		eval(ctx, arg, in, m, out, n);
+		write_data(ctx, w, out, n * sizeof(float));
+	}
+	return num;
+}
+
+static int
+write_function(fz_context *ctx, fz_list_writer *w, fz_function *fn)
+{
+	int num;
+
+	if (fn == NULL)
+		return 0;
+	num = find_record(ctx, w, fn);
+	if (num)
+		return num;
+
+	num = write_sampled_function(ctx, w, eval_function_for_sampling, fn, fn->m, fn->n);
+	return remember_record(ctx, w, fn, num);
+}
+
+static int
+write_colorspace(fz_context *ctx, fz_list_writer *w, fz_colorspace *cs)
+{
+	int num, base, tint, i;
+
+	if (cs == NULL)
+		return 0;
+	num = find_record(ctx, w, cs);
+	if (num)
+		return num;
+
+	switch (cs->type)
+	{
+	case FZ_COLORSPACE_INDEXED:
+		base = write_colorspace(ctx, w, cs->u.indexed.base);
+		num = begin_record(ctx, w, LIST_REC_COLORSPACE);
+		write_int(ctx, w, LIST_CS_INDEXED);
+		write_int(ctx, w, base);
+		write_int(ctx, w, cs->u.indexed.high);
+		write_data(ctx, w, cs->u.indexed.lookup, (size_t)(cs->u.indexed.high + 1) * cs->u.indexed.base->n);
+		break;
+	case FZ_COLORSPACE_SEPARATION:
+		base = write_colorspace(ctx, w, cs->u.separation.base);
+		tint = write_sampled_function(ctx, w, eval_tint_for_sampling, cs, cs->n, cs->u.separation.base->n);
+		num = begin_record(ctx, w, LIST_REC_COLORSPACE);
+		write_int(ctx, w, LIST_CS_SEPARATION);
+		write_int(ctx, w, base);
+		write_int(ctx, w, tint);
+		write_int(ctx, w, cs->n);
+		write_string(ctx, w, cs->name);
+		for (i = 0; i < cs->n; i++)
+			write_string(ctx, w, cs->u.separation.colorant[i]);
+		break;
+	default:
+#if FZ_ENABLE_ICC
+		if ((cs->flags & FZ_COLORSPACE_IS_ICC) && !(cs->flags & FZ_COLORSPACE_IS_DEVICE))
+		{
+			int data = write_buffer_blob(ctx, w, cs->u.icc.buffer);
+			num = begin_record(ctx, w, LIST_REC_COLORSPACE);
+			write_int(ctx, w, LIST_CS_ICC);
+			write_int(ctx, w, cs->type);
+			write_int(ctx, w, cs->flags);
+			write_string(ctx, w, cs->name);
+			write_int(ctx, w, data);
+			break;
+		}
+#endif
+		num = begin_record(ctx, w, LIST_REC_COLORSPACE);
+		write_int(ctx, w, LIST_CS_DEVICE);
+		write_int(ctx, w, cs->type);
+		break;
+	}
+
+	return remember_record(ctx, w, cs, num);
+}
+
+static int
+write_stroke_state(fz_context *ctx, fz_list_writer *w, fz_stroke_state *stroke)
+{
+	fz_list_stroke_header hdr = { 0 };
+	int num;
+
+	num = find_record(ctx, w, stroke);
+	if (num)
+		return num;
+
+	hdr.start_cap = stroke->start_cap;
+	hdr.dash_cap = stroke->dash_cap;
+	hdr.end_cap = stroke->end_cap;
+	hdr.linejoin = stroke->linejoin;
+	hdr.linewidth = stroke->linewidth;
+	hdr.miterlimit = stroke->miterlimit;
+	hdr.dash_phase = stroke->dash_phase;
+	hdr.dash_len = stroke->dash_len;
+
+	num = begin_record(ctx, w, LIST_REC_STROKE);
+	write_data(ctx, w, &hdr, sizeof hdr);
+	write_data(ctx, w, stroke->dash_list, stroke->dash_len * sizeof(float));
+	return remember_record(ctx, w, stroke, num);
+}
+
+static int
+write_font(fz_context *ctx, fz_list_writer *w, fz_font *font)
+{
+	fz_list_font_header hdr = { 0 };
+	int num;
+
+	num = find_record(ctx, w, font);
+	if (num)
+		return num;
+
+	if (font->t3procs)
+		fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "cannot save Type 3 font '%s'", font->name);
+	if (!font->buffer)
+		fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "cannot save font '%s' without data", font->name);
+
+	hdr.data = write_buffer_blob(ctx, w, font->buffer);
+	memcpy(hdr.name, font->name, sizeof hdr.name);
+	hdr.subfont = font->subfont;
+	hdr.use_glyph_bbox = font->use_glyph_bbox;
+	hdr.flags = font->flags;
+	hdr.bbox = font->bbox;
+	hdr.ascender = font->ascender;
+	hdr.descender = font->descender;
+	hdr.width_count = font->width_table ? font->width_count : 0;
+	hdr.width_default = font->width_default;
+
+	num = begin_record(ctx, w, LIST_REC_FONT);
+	write_data(ctx, w, &hdr, sizeof hdr);
+	write_data(ctx, w, font->width_table, hdr.width_count * sizeof(short));
+	return remember_record(ctx, w, font, num);
+}
+
+static int
+write_text(fz_context *ctx, fz_list_writer *w, fz_text *text)
+{
+	fz_text_span *span;
+	int num, count = 0;
+
+	num = find_record(ctx, w, text);
+	if (num)
+		return num;
+
+	for (span = text->head; span; span = span->next)
+	{
+		write_font(ctx, w, span->font);
+		count++;
+	}
+
+	num = begin_record(ctx, w, LIST_REC_TEXT);
+	write_int(ctx, w, count);
+	for (span = text->head; span; span = span->next)
+	{
+		fz_list_span_header hdr = { 0 };
+		hdr.font = find_record(ctx, w, span->font);
+		hdr.trm = span->trm;
+		hdr.wmode = span->wmode;
+		hdr.bidi_level = span->bidi_level;
+		hdr.markup_dir = span->markup_dir;
+		hdr.language = span->language;
+		hdr.len = span->len;
+		write_data(ctx, w, &hdr, sizeof hdr);
+		write_data(ctx, w, span->items, span->len * sizeof(fz_text_item));
+	}
+	return remember_record(ctx, w, text, num);
+}
+
+static fz_list_compressed_buffer
+write_compressed_buffer_blobs(fz_context *ctx, fz_list_writer *w, fz_compressed_buffer *cbuf)
+{
+	fz_list_compressed_buffer saved;
+
+	memset(&saved, 0, sizeof saved);
+	saved.params = cbuf->params;
+	if (saved.params.type == FZ_IMAGE_JBIG2)
+	{
+		if (saved.params.u.jbig2.globals)
+			saved.globals = write_buffer_blob(ctx, w, fz_jbig2_globals_data(ctx, saved.params.u.jbig2.globals));
+		saved.params.u.jbig2.globals = NULL;
+	}
+	saved.data = write_buffer_blob(ctx, w, cbuf->buffer);
+	return saved;
+}
+
+static int
+write_pixmap_blob(fz_context *ctx, fz_list_writer *w, fz_pixmap *pix)
+{
+	size_t row = (size_t)pix->w * pix->n;
+	unsigned char *samples;
+	int num, y;
+
+	if (pix->stride == (ptrdiff_t)row)
+		return write_blob(ctx, w, pix->samples, row * pix->h);
+
+	samples = fz_malloc(ctx, row * pix->h);
+	fz_try(ctx)
+	{
+		for (y = 0; y < pix->h; y++)
+			memcpy(samples + y * row, pix->samples + y * pix->stride, row);
+		num = write_blob(ctx, w, samples, row * pix->h);
+	}
+	fz_always(ctx)
+		fz_free(ctx, samples);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return num;
+}
+
+static int
+write_image(fz_context *ctx, fz_list_writer *w, fz_image *image)
+{
+	fz_list_image_header hdr = { 0 };
+	fz_compressed_buffer *cbuf;
+	fz_pixmap *pix = NULL;
+	int num;
+
+	if (image == NULL)
+		return 0;
+	num = find_record(ctx, w, image);
+	if (num)
+		return num;
+
+	hdr.w = image->w;
+	hdr.h = image->h;
+	hdr.bpc = image->bpc;
+	hdr.imagemask = image->imagemask;
+	hdr.interpolate = image->interpolate;
+	hdr.use_colorkey = image->use_colorkey;
+	hdr.use_decode = image->use_decode;
+	hdr.orientation = image->orientation;
+	hdr.xres = image->xres;
+	hdr.yres = image->yres;
+	memcpy(hdr.colorkey, image->colorkey, sizeof hdr.colorkey);
+	memcpy(hdr.decode, image->decode, sizeof hdr.decode);
+	hdr.colorspace = write_colorspace(ctx, w, image->colorspace);
+	hdr.mask = write_image(ctx, w, image->mask);
+
+	cbuf = fz_compressed_image_buffer(ctx, image);
+	if (cbuf)
+	{
+		fz_list_compressed_buffer saved = write_compressed_buffer_blobs(ctx, w, cbuf);
+		num = begin_record(ctx, w, LIST_REC_IMAGE);
+		write_int(ctx, w, LIST_IMAGE_COMPRESSED);
+		write_data(ctx, w, &hdr, sizeof hdr);
+		write_data(ctx, w, &saved, sizeof saved);
+		return remember_record(ctx, w, image, num);
+	}
+
+	/* Anything else is saved decoded. */
+	pix = fz_get_pixmap_from_image(ctx, image, NULL, NULL, NULL, NULL);
+	fz_try(ctx)
+	{
+		fz_list_pixmap_header phdr = { 0 };
+		if (pix->s > 0)
+			fz_throw(ctx, FZ_ERROR_UNSUPPORTED, "cannot save image with spot colors");
+		phdr.w = pix->w;
+		phdr.h = pix->h;
+		phdr.n = pix->n;
+		phdr.alpha = pix->alpha;
+		phdr.colorspace = write_colorspace(ctx, w, pix->colorspace);
+		phdr.samples = write_pixmap_blob(ctx, w, pix);
+		num = begin_record(ctx, w, LIST_REC_IMAGE);
+		write_int(ctx, w, LIST_IMAGE_PIXMAP);
+		write_data(ctx, w, &hdr, sizeof hdr);
+		write_data(ctx, w, &phdr, sizeof phdr);
+	}
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, pix);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return remember_record(ctx, w, image, num);
+}
+
+static int
+write_shade(fz_context *ctx, fz_list_writer *w, fz_shade *shade)
+{
+	fz_list_compressed_buffer mesh = { 0 };
+	fz_shade copy;
+	int num, cs;
+
+	num = find_record(ctx, w, shade);
+	if (num)
+		return num;
+
+	cs = write_colorspace(ctx, w, shade->colorspace);
+	if (shade->buffer)
+		mesh = write_compressed_buffer_blobs(ctx, w, shade->buffer);
+
+	copy = *shade;
+	memset(&copy.storable, 0, sizeof copy.storable);
+	copy.colorspace = NULL;
+	copy.function = NULL;
+	copy.buffer = NULL;
+	if (copy.type == FZ_FUNCTION_BASED)
+		copy.u.f.fn_vals = NULL;
+
+	num = begin_record(ctx, w, LIST_REC_SHADE);
+	write_data(ctx, w, &copy, sizeof copy);
+	write_int(ctx, w, cs);
+	write_int(ctx, w, shade->buffer != NULL);
+	write_data(ctx, w, &mesh, sizeof mesh);
+	write_data(ctx, w, shade->function, 256 * shade->function_stride * sizeof(float));
+	if (shade->type == FZ_FUNCTION_BASED)
+		write_data(ctx, w, shade->u.f.fn_vals, (size_t)(shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * shade->colorspace->n * sizeof(float));
+	return remember_record(ctx, w, shade, num);
+}
+
+static int
+write_default_colorspaces(fz_context *ctx, fz_list_writer *w, fz_default_colorspaces *default_cs)
+{
+	int num, gray, rgb, cmyk, oi;
+
+	num = find_record(ctx, w, default_cs);
+	if (num)
+		return num;
+
+	gray = write_colorspace(ctx, w, fz_default_gray(ctx, default_cs));
+	rgb = write_colorspace(ctx, w, fz_default_rgb(ctx, default_cs));
+	cmyk = write_colorspace(ctx, w, fz_default_cmyk(ctx, default_cs));
+	oi = write_colorspace(ctx, w, fz_default_output_intent(ctx, default_cs));
+
+	num = begin_record(ctx, w, LIST_REC_DEFAULT_CS);
+	write_int(ctx, w, gray);
+	write_int(ctx, w, rgb);
+	write_int(ctx, w, cmyk);
+	write_int(ctx, w, oi);
+	return remember_record(ctx, w, default_cs, num);
+}
+
+static void *
+save_list_slot(fz_context *ctx, void *arg, int type, void **slot, size_t avail)
+{
+	fz_list_writer *w = arg;
+	void *obj = *slot;
+	int num = 0;
+
+	switch (type)
+	{
+	case LIST_SLOT_PATH:
+		fz_save_packed_path_data(ctx, w->paths, (fz_path *)slot);
+		return NULL;
+	case LIST_SLOT_PATH_REF:
+		return NULL;
+	case LIST_REC_COLORSPACE:
+		num = write_colorspace(ctx, w, obj);
+		break;
+	case LIST_REC_STROKE:
+		num = write_stroke_state(ctx, w, obj);
+		break;
+	case LIST_REC_TEXT:
+		num = write_text(ctx, w, obj);
+		break;
+	case LIST_REC_SHADE:
+		num = write_shade(ctx, w, obj);
+		break;
+	case LIST_REC_IMAGE:
+		num = write_image(ctx, w, obj);
+		break;
+	case LIST_REC_FUNCTION:
+		num = write_function(ctx, w, obj);
+		break;
+	case LIST_REC_DEFAULT_CS:
+		num = write_default_colorspaces(ctx, w, obj);
+		break;
+	}
+
+	*slot = (void *)(intptr_t)num;
+	return obj;
+}
+
+static void
+write_list(fz_context *ctx, fz_list_writer *w, fz_display_list *list)
+{
+	fz_display_node *nodes = NULL;
+
+	fz_var(nodes);
+
+	fz_try(ctx)
+	{
+		/* Number the objects in a copy of the nodes, writing out
+		 * each object the first time it is seen. */
+		nodes = fz_malloc_array(ctx, list->len, fz_display_node);
+		memcpy(nodes, list->list, list->len * sizeof(fz_display_node));
+		w->paths = fz_new_buffer(ctx, 0);
+		walk_list_slots(ctx, nodes, nodes + list->len, save_list_slot, w);
+
+		begin_record(ctx, w, LIST_REC_LIST);
+		write_data(ctx, w, &list->mediabox, sizeof list->mediabox);
+		write_size(ctx, w, list->len);
+		write_data(ctx, w, nodes, list->len * sizeof(fz_display_node));
+		write_size(ctx, w, w->paths->len);
+		write_data(ctx, w, w->paths->data, w->paths->len);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, w->paths);
+		w->paths = NULL;
+		fz_free(ctx, nodes);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+fz_write_display_list(fz_context *ctx, fz_output *out, fz_display_list *list)
+{
+	fz_list_file_header header;
+	fz_list_writer w = { 0 };
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, LIST_FILE_MAGIC, sizeof header.magic);
+	header.version = LIST_FILE_VERSION;
+	header.byte_order = 0x01020304;
+	header.pointer_size = sizeof(void *);
+	header.size_size = sizeof(size_t);
+	header.pointer_align = FZ_POINTER_ALIGN_MOD;
+	header.node_size = sizeof(fz_display_node);
+	fz_strlcpy(header.fz_version, FZ_VERSION, sizeof header.fz_version);
+
+	w.out = out;
+
+	fz_var(w);
+
+	fz_try(ctx)
+	{
+		w.objects = fz_new_hash_table(ctx, 256, sizeof(void *), -1, NULL);
+		w.blobs = fz_new_hash_table(ctx, 64, 16, -1, NULL);
+		fz_write_data(ctx, out, &header, sizeof header);
+		write_list(ctx, &w, list);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_hash_table(ctx, w.objects);
+		fz_drop_hash_table(ctx, w.blobs);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+fz_save_display_list(fz_context *ctx, fz_display_list *list, const char *filename)
+{
+	fz_output *out = fz_new_output_with_path(ctx, filename, 0);
+	fz_try(ctx)
+	{
+		fz_write_display_list(ctx, out, list);
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Reading */
+
+enum
+{
+	LOAD_CHECK,
+	LOAD_OBJECTS,
+	LOAD_PATHS
+};
+
+typedef struct
+{
+	int type;
+	void *obj;
+} fz_list_record;
+
+typedef struct
+{
+	const unsigned char *data;
+	size_t len, pos;
+	int count, cap;
+	fz_list_record *rec;
+
+	/* State for the walk over the list being loaded. */
+	int pass;
+	const unsigned char *paths;
+	size_t paths_len, paths_needed;
+	fz_display_node *nodes;
+	uint64_t *path_starts; /* bit per node, for checking references */
+} fz_list_reader;
+
+static const void *
+read_data(fz_context *ctx, fz_list_reader *r, size_t len)
+{
+	const void *data;
+
+	if (len > r->len - r->pos)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "truncated display list file");
+	data = r->data + r->pos;
+	r->pos += len;
+	return data;
+}
+
+static int
+read_int(fz_context *ctx, fz_list_reader *r)
+{
+	int v;
+	memcpy(&v, read_data(ctx, r, sizeof v), sizeof v);
+	return v;
+}
+
+static size_t
+read_size(fz_context *ctx, fz_list_reader *r)
+{
+	uint64_t v;
+	memcpy(&v, read_data(ctx, r, sizeof v), sizeof v);
+	if (v > SIZE_MAX)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "truncated display list file");
+	return (size_t)v;
+}
+
+static const char *
+read_string(fz_context *ctx, fz_list_reader *r)
+{
+	int len = read_int(ctx, r);
+	const char *s;
+
+	if (len == 0)
+		return NULL;
+	if (len < 0)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid string in display list file");
+	s = read_data(ctx, r, len);
+	if (s[len - 1] != 0)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid string in display list file");
+	return s;
+}
+
+static void *
+find_list_record(fz_context *ctx, fz_list_reader *r, int num, int type)
+{
+	if (num == 0)
+		return NULL;
+	if (num < 0 || num > r->count || r->rec[num - 1].type != type)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid object reference in display list file");
+	return r->rec[num - 1].obj;
+}
+
+static void *
+need_list_record(fz_context *ctx, fz_list_reader *r, int num, int type)
+{
+	void *obj = find_list_record(ctx, r, num, type);
+	if (obj == NULL)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "missing object in display list file");
+	return obj;
+}
+
+static void *
+keep_list_record(fz_context *ctx, int type, void *obj)
+{
+	switch (type)
+	{
+	case LIST_REC_BLOB: return fz_keep_buffer(ctx, obj);
+	case LIST_REC_COLORSPACE: return fz_keep_colorspace(ctx, obj);
+	case LIST_REC_FUNCTION: return fz_keep_function(ctx, obj);
+	case LIST_REC_STROKE: return fz_keep_stroke_state(ctx, obj);
+	case LIST_REC_FONT: return fz_keep_font(ctx, obj);
+	case LIST_REC_TEXT: return fz_keep_text(ctx, obj);
+	case LIST_REC_IMAGE: return fz_keep_image(ctx, obj);
+	case LIST_REC_SHADE: return fz_keep_shade(ctx, obj);
+	case LIST_REC_DEFAULT_CS: return fz_keep_default_colorspaces(ctx, obj);
+	case LIST_REC_LIST: return fz_keep_display_list(ctx, obj);
+	}
+	return obj;
+}
+
+static void
+drop_list_record(fz_context *ctx, int type, void *obj)
+{
+	switch (type)
+	{
+	case LIST_REC_BLOB: fz_drop_buffer(ctx, obj); break;
+	case LIST_REC_COLORSPACE: fz_drop_colorspace(ctx, obj); break;
+	case LIST_REC_FUNCTION: fz_drop_function(ctx, obj); break;
+	case LIST_REC_STROKE: fz_drop_stroke_state(ctx, obj); break;
+	case LIST_REC_FONT: fz_drop_font(ctx, obj); break;
+	case LIST_REC_TEXT: fz_drop_text(ctx, obj); break;
+	case LIST_REC_IMAGE: fz_drop_image(ctx, obj); break;
+	case LIST_REC_SHADE: fz_drop_shade(ctx, obj); break;
+	case LIST_REC_DEFAULT_CS: fz_drop_default_colorspaces(ctx, obj); break;
+	case LIST_REC_LIST: fz_drop_display_list(ctx, obj); break;
+	}
+}
+
+static fz_buffer *
+read_blob(fz_context *ctx, fz_list_reader *r)
+{
+	size_t len = read_size(ctx, r);
+	return fz_new_buffer_from_copied_data(ctx, read_data(ctx, r, len), len);
+}
+
+static fz_function *
+read_function(fz_context *ctx, fz_list_reader *r)
+{
+	fz_list_sampled_function *fn;
+	int m = read_int(ctx, r);
+	int n = read_int(ctx, r);
+	int s = sampled_function_size(m);
+	size_t total;
+	const void *samples;
+	int k;
+
+	if (s == 0 || n < 1 || n > FZ_MAX_COLORS)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid function in display list file");
+	for (total = n, k = 0; k < m; k++)
+		total *= s;
+	samples = read_data(ctx, r, total * sizeof(float));
+
+	fn = fz_new_derived_function(ctx, fz_list_sampled_function, sizeof(fz_list_sampled_function), m, n, eval_sampled_function, drop_sampled_function);
+	fn->size = s;
+	fz_try(ctx)
+		fn->samples = fz_malloc_array(ctx, total, float);
+	fz_catch(ctx)
+	{
+		fz_drop_function(ctx, &fn->super);
+		fz_rethrow(ctx);
+	}
+	memcpy(fn->samples, samples, total * sizeof(float));
+
+	return &fn->super;
+}
+
+static fz_colorspace *
+read_colorspace(fz_context *ctx, fz_list_reader *r)
+{
+	int kind = read_int(ctx, r);
+	fz_colorspace *cs = NULL;
+	fz_colorspace *base;
+	fz_function *tint;
+	unsigned char *lookup;
+	const char *name;
+	int type, flags, high, n, i;
+	size_t len;
+
+	switch (kind)
+	{
+	default:
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid colorspace in display list file");
+
+	case LIST_CS_DEVICE:
+		type = read_int(ctx, r);
+		return fz_keep_colorspace(ctx, device_colorspace(ctx, type));
+
+	case LIST_CS_ICC:
+		type = read_int(ctx, r);
+		flags = read_int(ctx, r);
+		name = read_string(ctx, r);
+#if FZ_ENABLE_ICC
+		return fz_new_icc_colorspace(ctx, type, flags, name,
+			need_list_record(ctx, r, read_int(ctx, r), LIST_REC_BLOB));
+#else
+		(void)flags;
+		(void)name;
+		(void)read_int(ctx, r);
+		return fz_keep_colorspace(ctx, device_colorspace(ctx, type));
+#endif
+
+	case LIST_CS_INDEXED:
+		base = need_list_record(ctx, r, read_int(ctx, r), LIST_REC_COLORSPACE);
+		high = read_int(ctx, r);
+		if (high < 0 || high > 255)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "invalid colorspace in display list file");
+		len = (size_t)(high + 1) * base->n;
+		lookup = fz_malloc(ctx, len);
+		fz_try(ctx)
+		{
+			memcpy(lookup, read_data(ctx, r, len), len);
+			cs = fz_new_indexed_colorspace(ctx, base, high, lookup);
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, lookup);
+			fz_rethrow(ctx);
+		}
+		return cs;
+
+	case LIST_CS_SEPARATION:
+		base = need_list_record(ctx, r, read_int(ctx, r), LIST_REC_COLORSPACE);
+		tint = need_list_record(ctx, r, read_int(ctx, r), LIST_REC_FUNCTION);
+		n = read_int(ctx, r);
+		name = read_string(ctx, r);
+		if (n < 1 || n > FZ_MAX_COLORS || tint->m != n || tint->n != base->n)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "invalid colorspace in display list file");
+		cs = fz_new_colorspace(ctx, FZ_COLORSPACE_SEPARATION, 0, n, name ? name : "Separation");
+		cs->u.separation.eval = eval_sampled_tint;
+		cs->u.separation.drop = drop_sampled_tint;
+		cs->u.separation.base = fz_keep_colorspace(ctx, base);
+		cs->u.separation.tint = fz_keep_function(ctx, tint);
+		fz_try(ctx)
+		{
+			for (i = 0; i < n; i++)
+			{
+				name = read_string(ctx, r);
+				if (name)
+					fz_colorspace_name_colorant(ctx, cs, i, name);
 			}
 		}
+		fz_catch(ctx)
+		{
+			fz_drop_colorspace(ctx, cs);
+			fz_rethrow(ctx);
+		}
+		return cs;
+	}
+}
+
+static fz_stroke_state *
+read_stroke_state(fz_context *ctx, fz_list_reader *r)
+{
+	fz_list_stroke_header hdr;
+	fz_stroke_state *stroke;
+
+	memcpy(&hdr, read_data(ctx, r, sizeof hdr), sizeof hdr);
+	if (hdr.dash_len < 0 || hdr.dash_len > INT_MAX / (int)sizeof(float))
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid stroke state in display list file");
+
+	stroke = fz_new_stroke_state_with_dash_len(ctx, hdr.dash_len);
+	stroke->start_cap = hdr.start_cap;
+	stroke->dash_cap = hdr.dash_cap;
+	stroke->end_cap = hdr.end_cap;
+	stroke->linejoin = hdr.linejoin;
+	stroke->linewidth = hdr.linewidth;
+	stroke->miterlimit = hdr.miterlimit;
+	stroke->dash_phase = hdr.dash_phase;
+	stroke->dash_len = hdr.dash_len;
+	fz_try(ctx)
+		memcpy(stroke->dash_list, read_data(ctx, r, hdr.dash_len * sizeof(float)), hdr.dash_len * sizeof(float));
+	fz_catch(ctx)
+	{
+		fz_drop_stroke_state(ctx, stroke);
+		fz_rethrow(ctx);
+	}
+
+	return stroke;
+}
+
+static fz_font *
+read_font(fz_context *ctx, fz_list_reader *r)
+{
+	fz_list_font_header hdr;
+	const void *widths;
+	fz_font *font;
+
+	memcpy(&hdr, read_data(ctx, r, sizeof hdr), sizeof hdr);
+	hdr.name[sizeof hdr.name - 1] = 0;
+	if (hdr.width_count < 0)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid font in display list file");
+	widths = read_data(ctx, r, hdr.width_count * sizeof(short));
+
+	font = fz_new_font_from_buffer(ctx, hdr.name,
+		need_list_record(ctx, r, hdr.data, LIST_REC_BLOB),
+		hdr.subfont, hdr.use_glyph_bbox);
+	font->flags = hdr.flags;
+	font->bbox = hdr.bbox;
+	font->ascender = hdr.ascender;
+	font->descender = hdr.descender;
+	if (hdr.width_count > 0)
+	{
+		fz_try(ctx)
+			font->width_table = fz_malloc_array(ctx, hdr.width_count, short);
+		fz_catch(ctx)
+		{
+			fz_drop_font(ctx, font);
+			fz_rethrow(ctx);
+		}
+		memcpy(font->width_table, widths, hdr.width_count * sizeof(short));
+		font->width_count = hdr.width_count;
+		font->width_default = hdr.width_default;
+	}
 
-visible:
-		trans_ctm = fz_concat(ctm, top_ctm);
+	return font;
+}
+
+static fz_text *
+read_text(fz_context *ctx, fz_list_reader *r)
+{
+	fz_text *text;
+	fz_text_span *span;
+	fz_list_span_header hdr;
+	int i, count;
+
+	count = read_int(ctx, r);
+
+	text = fz_new_text(ctx);
+	fz_try(ctx)
+	{
+		for (i = 0; i < count; i++)
+		{
+			memcpy(&hdr, read_data(ctx, r, sizeof hdr), sizeof hdr);
+			if (hdr.len < 0)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid text in display list file");
+
+			span = fz_malloc_struct(ctx, fz_text_span);
+			if (text->tail)
+				text->tail->next = span;
+			else
+				text->head = span;
+			text->tail = span;
+
+			span->font = fz_keep_font(ctx, need_list_record(ctx, r, hdr.font, LIST_REC_FONT));
+			span->trm = hdr.trm;
+			span->wmode = hdr.wmode;
+			span->bidi_level = hdr.bidi_level;
+			span->markup_dir = hdr.markup_dir;
+			span->language = hdr.language;
+			span->items = fz_malloc_array(ctx, hdr.len, fz_text_item);
+			span->len = span->cap = hdr.len;
+			memcpy(span->items, read_data(ctx, r, hdr.len * sizeof(fz_text_item)), hdr.len * sizeof(fz_text_item));
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_text(ctx, text);
+		fz_rethrow(ctx);
+	}
+
+	return text;
+}
+
+static fz_compressed_buffer *
+read_compressed_buffer(fz_context *ctx, fz_list_reader *r, const fz_list_compressed_buffer *saved)
+{
+	fz_compressed_buffer *cbuf = fz_new_compressed_buffer(ctx);
+
+	fz_try(ctx)
+	{
+		cbuf->params = saved->params;
+		if (cbuf->params.type == FZ_IMAGE_JBIG2)
+		{
+			cbuf->params.u.jbig2.globals = NULL;
+			if (saved->globals)
+				cbuf->params.u.jbig2.globals = fz_load_jbig2_globals(ctx,
+					need_list_record(ctx, r, saved->globals, LIST_REC_BLOB));
+		}
+		cbuf->buffer = fz_keep_buffer(ctx, need_list_record(ctx, r, saved->data, LIST_REC_BLOB));
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_compressed_buffer(ctx, cbuf);
+		fz_rethrow(ctx);
+	}
+
+	return cbuf;
+}
+
+static fz_image *
+read_image(fz_context *ctx, fz_list_reader *r)
+{
+	fz_list_image_header hdr;
+	fz_colorspace *cs;
+	fz_image *mask, *image = NULL;
+	int kind = read_int(ctx, r);
+
+	memcpy(&hdr, read_data(ctx, r, sizeof hdr), sizeof hdr);
+	cs = find_list_record(ctx, r, hdr.colorspace, LIST_REC_COLORSPACE);
+	mask = find_list_record(ctx, r, hdr.mask, LIST_REC_IMAGE);
+
+	if (kind == LIST_IMAGE_COMPRESSED)
+	{
+		fz_list_compressed_buffer saved;
+		memcpy(&saved, read_data(ctx, r, sizeof saved), sizeof saved);
+		image = fz_new_image_from_compressed_buffer(ctx, hdr.w, hdr.h, hdr.bpc, cs,
+			hdr.xres, hdr.yres, hdr.interpolate, hdr.imagemask,
+			hdr.use_decode ? hdr.decode : NULL,
+			hdr.use_colorkey ? hdr.colorkey : NULL,
+			read_compressed_buffer(ctx, r, &saved), mask);
+	}
+	else if (kind == LIST_IMAGE_PIXMAP)
+	{
+		fz_list_pixmap_header phdr;
+		fz_pixmap *pix;
+		fz_buffer *samples;
+		size_t row;
+		int y;
 
+		memcpy(&phdr, read_data(ctx, r, sizeof phdr), sizeof phdr);
+		samples = need_list_record(ctx, r, phdr.samples, LIST_REC_BLOB);
+		pix = fz_new_pixmap(ctx, find_list_record(ctx, r, phdr.colorspace, LIST_REC_COLORSPACE), phdr.w, phdr.h, NULL, phdr.alpha);
 		fz_try(ctx)
 		{
-			switch (n.cmd)
-			{
-			case FZ_CMD_FILL_PATH:
-				fz_unpack_color_params(&color_params, n.flags);
-				fz_fill_path(ctx, dev, path, n.flags & 1, trans_ctm, colorspace, color, alpha, color_params);
-				break;
-			case FZ_CMD_STROKE_PATH:
-				fz_unpack_color_params(&color_params, n.flags);
-				fz_stroke_path(ctx, dev, path, stroke, trans_ctm, colorspace, color, alpha, color_params);
-				break;
-			case FZ_CMD_CLIP_PATH:
-				fz_clip_path(ctx, dev, path, n.flags, trans_ctm, trans_rect);
-				break;
-			case FZ_CMD_CLIP_STROKE_PATH:
-				fz_clip_stroke_path(ctx, dev, path, stroke, trans_ctm, trans_rect);
-				break;
-			case FZ_CMD_FILL_TEXT:
-				fz_unpack_color_params(&color_params, n.flags);
-				align_node_for_pointer(&node);
-				fz_fill_text(ctx, dev, *(fz_text **)node, trans_ctm, colorspace, color, alpha, color_params);
-				break;
-			case FZ_CMD_STROKE_TEXT:
-				fz_unpack_color_params(&color_params, n.flags);
-				align_node_for_pointer(&node);
-				fz_stroke_text(ctx, dev, *(fz_text **)node, stroke, trans_ctm, colorspace, color, alpha, color_params);
-				break;
-			case FZ_CMD_CLIP_TEXT:
-				align_node_for_pointer(&node);
-				fz_clip_text(ctx, dev, *(fz_text **)node, trans_ctm, trans_rect);
-				break;
-			case FZ_CMD_CLIP_STROKE_TEXT:
-				align_node_for_pointer(&node);
-				fz_clip_stroke_text(ctx, dev, *(fz_text **)node, stroke, trans_ctm, trans_rect);
-				break;
-			case FZ_CMD_IGNORE_TEXT:
-				align_node_for_pointer(&node);
-				fz_ignore_text(ctx, dev, *(fz_text **)node, trans_ctm);
-				break;
-			case FZ_CMD_FILL_SHADE:
-				fz_unpack_color_params(&color_params, n.flags);
-				align_node_for_pointer(&node);
-				fz_fill_shade(ctx, dev, *(fz_shade **)node, trans_ctm, alpha, color_params);
-				break;
-			case FZ_CMD_FILL_IMAGE:
-				fz_unpack_color_params(&color_params, n.flags);
-				align_node_for_pointer(&node);
-				fz_fill_image(ctx, dev, *(fz_image **)node, trans_ctm, alpha, color_params);
-				break;
-			case FZ_CMD_FILL_IMAGE_MASK:
-				fz_unpack_color_params(&color_params, n.flags);
-				align_node_for_pointer(&node);
-				fz_fill_image_mask(ctx, dev, *(fz_image **)node, trans_ctm, colorspace, color, alpha, color_params);
-				break;
-			case FZ_CMD_CLIP_IMAGE_MASK:
-				align_node_for_pointer(&node);
-				fz_clip_image_mask(ctx, dev, *(fz_image **)node, trans_ctm, trans_rect);
-				break;
-			case FZ_CMD_POP_CLIP:
-				fz_pop_clip(ctx, dev);
-				break;
-			case FZ_CMD_BEGIN_MASK:
-				fz_unpack_color_params(&color_params, n.flags);
-				fz_begin_mask(ctx, dev, trans_rect, n.flags & 1, colorspace, color, color_params);
-				break;
-			case FZ_CMD_END_MASK:
-				align_node_for_pointer(&node);
-				fz_end_mask_tr(ctx, dev, *(fz_function **)node);
-				break;
-			case FZ_CMD_BEGIN_GROUP:
-				fz_begin_group(ctx, dev, trans_rect, colorspace, (n.flags & ISOLATED) != 0, (n.flags & KNOCKOUT) != 0, (n.flags>>2), alpha);
-				break;
-			case FZ_CMD_END_GROUP:
-				fz_end_group(ctx, dev);
-				break;
-			case FZ_CMD_BEGIN_TILE:
-			{
-				int cached;
-				fz_list_tile_data *data;
-				fz_rect tile_rect;
-				data = (fz_list_tile_data *)node;
-				tiled++;
-				tile_rect = data->view;
-				cached = fz_begin_tile_id(ctx, dev, rect, tile_rect, data->xstep, data->ystep, trans_ctm, data->id);
-				if (cached)
-					tile_skip_depth = 1;
-				break;
-			}
-			case FZ_CMD_END_TILE:
-				tiled--;
-				fz_end_tile(ctx, dev);
-				break;
-			case FZ_CMD_RENDER_FLAGS:
-				if (n.flags == 0)
-					fz_render_flags(ctx, dev, 0, FZ_DEVFLAG_GRIDFIT_AS_TILED);
-				else if (n.flags == 1)
-					fz_render_flags(ctx, dev, FZ_DEVFLAG_GRIDFIT_AS_TILED, 0);
-				break;
-			case FZ_CMD_DEFAULT_COLORSPACES:
-				align_node_for_pointer(&node);
-				fz_set_default_colorspaces(ctx, dev, *(fz_default_colorspaces **)node);
-				break;
-			case FZ_CMD_BEGIN_LAYER:
-				fz_begin_layer(ctx, dev, (const char *)node);
-				break;
-			case FZ_CMD_END_LAYER:
-				fz_end_layer(ctx, dev);
-				break;
-			case FZ_CMD_BEGIN_STRUCTURE:
-			{
-				const unsigned char *data;
-				int idx;
-				data = (const unsigned char *)node;
-				memcpy(&idx, data+1, sizeof(idx));
-				fz_begin_structure(ctx, dev, (fz_structure)data[0], (const char *)(&data[1+sizeof(idx)]), idx);
-				break;
-			}
-			case FZ_CMD_END_STRUCTURE:
-				fz_end_structure(ctx, dev);
-				break;
-			case FZ_CMD_BEGIN_METATEXT:
-			{
-				const unsigned char *data;
-				const char *text;
-				data = (const unsigned char *)node;
-				text = (const char *)&data[1];
-				fz_begin_metatext(ctx, dev, (fz_metatext)data[0], text);
-				break;
-			}
-			case FZ_CMD_END_METATEXT:
-				fz_end_metatext(ctx, dev);
-				break;
-			}
+			row = (size_t)pix->w * pix->n;
+			if (pix->n != phdr.n || samples->len != row * pix->h)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid image in display list file");
+			for (y = 0; y < pix->h; y++)
+				memcpy(pix->samples + y * pix->stride, samples->data + y * row, row);
+			pix->xres = hdr.xres;
+			pix->yres = hdr.yres;
+			image = fz_new_image_from_pixmap(ctx, pix, mask);
 		}
+		fz_always(ctx)
+			fz_drop_pixmap(ctx, pix);
 		fz_catch(ctx)
+			fz_rethrow(ctx);
+		image->imagemask = hdr.imagemask;
+		image->interpolate = hdr.interpolate;
+	}
+	else
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid image in display list file");
+
+	image->orientation = hdr.orientation;
+	return image;
+}
+
+static fz_shade *
+read_shade(fz_context *ctx, fz_list_reader *r)
+{
+	fz_list_compressed_buffer mesh;
+	fz_colorspace *cs;
+	fz_shade *shade;
+	size_t fn_len = 0, vals_len = 0;
+	int has_mesh;
+
+	shade = fz_malloc_struct(ctx, fz_shade);
+	memcpy(shade, read_data(ctx, r, sizeof *shade), sizeof *shade);
+	FZ_INIT_STORABLE(shade, 1, fz_drop_shade_imp);
+	shade->colorspace = NULL;
+	shade->function = NULL;
+	shade->buffer = NULL;
+	if (shade->type == FZ_FUNCTION_BASED)
+		shade->u.f.fn_vals = NULL;
+
+	fz_try(ctx)
+	{
+		cs = need_list_record(ctx, r, read_int(ctx, r), LIST_REC_COLORSPACE);
+		shade->colorspace = fz_keep_colorspace(ctx, cs);
+		has_mesh = read_int(ctx, r);
+		memcpy(&mesh, read_data(ctx, r, sizeof mesh), sizeof mesh);
+		if (has_mesh)
+			shade->buffer = read_compressed_buffer(ctx, r, &mesh);
+
+		if (shade->type < FZ_FUNCTION_BASED || shade->type > FZ_MESH_TYPE7 ||
+			shade->function_stride < 0 || shade->function_stride > FZ_MAX_COLORS + 1)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "invalid shading in display list file");
+		fn_len = 256 * shade->function_stride * sizeof(float);
+		if (shade->type == FZ_FUNCTION_BASED)
 		{
-			if (fz_caught(ctx) == FZ_ERROR_SYSTEM)
+			if (shade->u.f.xdivs < 0 || shade->u.f.xdivs > 4096 || shade->u.f.ydivs < 0 || shade->u.f.ydivs > 4096)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "invalid shading in display list file");
+			vals_len = (size_t)(shade->u.f.xdivs + 1) * (shade->u.f.ydivs + 1) * cs->n * sizeof(float);
+		}
+
+		if (fn_len)
+		{
+			shade->function = fz_malloc(ctx, fn_len);
+			memcpy(shade->function, read_data(ctx, r, fn_len), fn_len);
+		}
+		if (shade->type == FZ_FUNCTION_BASED)
+		{
+			shade->u.f.fn_vals = fz_malloc(ctx, vals_len);
+			memcpy(shade->u.f.fn_vals, read_data(ctx, r, vals_len), vals_len);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_shade(ctx, shade);
+		fz_rethrow(ctx);
+	}
+
+	return shade;
+}
+
+static fz_default_colorspaces *
+read_default_colorspaces(fz_context *ctx, fz_list_reader *r)
+{
+	fz_default_colorspaces *default_cs;
+	fz_colorspace *cs[4];
+	int i;
+
+	for (i = 0; i < 4; i++)
+		cs[i] = find_list_record(ctx, r, read_int(ctx, r), LIST_REC_COLORSPACE);
+
+	default_cs = fz_new_default_colorspaces(ctx);
+	fz_try(ctx)
+	{
+		if (cs[0])
+			fz_set_default_gray(ctx, default_cs, cs[0]);
+		if (cs[1])
+			fz_set_default_rgb(ctx, default_cs, cs[1]);
+		if (cs[2])
+			fz_set_default_cmyk(ctx, default_cs, cs[2]);
+		if (cs[3])
+			fz_set_default_output_intent(ctx, default_cs, cs[3]);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_default_colorspaces(ctx, default_cs);
+		fz_rethrow(ctx);
+	}
+
+	return default_cs;
+}
+
+static void *
+load_list_slot(fz_context *ctx, void *arg, int type, void **slot, size_t avail)
+{
+	fz_list_reader *r = arg;
+	void *obj;
+
+	if (type == LIST_SLOT_PATH)
+	{
+		fz_path *path = (fz_path *)slot;
+		size_t len;
+
+		if (r->pass == LOAD_CHECK)
+		{
+			size_t at = (fz_display_node *)slot - r->nodes;
+			len = fz_packed_path_data_size(ctx, path, avail);
+			if (len > r->paths_len - r->paths_needed)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "truncated display list file");
+			r->paths_needed += len;
+			r->path_starts[at >> 6] |= (uint64_t)1 << (at & 63);
+		}
+		else if (r->pass == LOAD_PATHS)
+		{
+			len = fz_load_packed_path_data(ctx, path, r->paths, r->paths_len);
+			r->paths += len;
+			r->paths_len -= len;
+		}
+		return NULL;
+	}
+	if (type == LIST_SLOT_PATH_REF)
+	{
+		size_t at = ((fz_list_path_ref *)slot)->offset;
+
+		/* References only ever point back at real paths. */
+		if (r->pass == LOAD_CHECK &&
+			(at >= (size_t)((fz_display_node *)slot - r->nodes) ||
+			!(r->path_starts[at >> 6] & ((uint64_t)1 << (at & 63)))))
+			fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt display list node");
+		return NULL;
+	}
+
+	if (r->pass == LOAD_PATHS)
+		return *slot;
+
+	/* Groups may have no colorspace, and masks no transfer function. */
+	if (type == LIST_REC_COLORSPACE || type == LIST_REC_FUNCTION)
+		obj = find_list_record(ctx, r, (int)(intptr_t)*slot, type);
+	else
+		obj = need_list_record(ctx, r, (int)(intptr_t)*slot, type);
+	if (r->pass == LOAD_OBJECTS)
+		*slot = keep_list_record(ctx, type, obj);
+	return obj;
+}
+
+static fz_display_list *
+read_list(fz_context *ctx, fz_list_reader *r)
+{
+	fz_display_list *list;
+	fz_rect mediabox;
+	const void *nodes;
+	size_t len;
+
+	memcpy(&mediabox, read_data(ctx, r, sizeof mediabox), sizeof mediabox);
+	len = read_size(ctx, r);
+	if (len > SIZE_MAX / sizeof(fz_display_node))
+		fz_throw(ctx, FZ_ERROR_FORMAT, "truncated display list file");
+	nodes = read_data(ctx, r, len * sizeof(fz_display_node));
+	r->paths_len = read_size(ctx, r);
+	r->paths = read_data(ctx, r, r->paths_len);
+	r->paths_needed = 0;
+
+	list = fz_new_display_list(ctx, mediabox);
+	fz_try(ctx)
+	{
+		list->list = fz_malloc_array(ctx, len, fz_display_node);
+		list->max = len;
+		memcpy(list->list, nodes, len * sizeof(fz_display_node));
+
+		/* Check everything before taking any references, so
+		 * that the list is always safe to drop. */
+		r->pass = LOAD_CHECK;
+		r->nodes = list->list;
+		r->path_starts = fz_calloc(ctx, len / 64 + 1, sizeof(uint64_t));
+		walk_list_slots(ctx, list->list, list->list + len, load_list_slot, r);
+		fz_free(ctx, r->path_starts);
+		r->path_starts = NULL;
+		r->pass = LOAD_OBJECTS;
+		walk_list_slots(ctx, list->list, list->list + len, load_list_slot, r);
+		list->len = len;
+		r->pass = LOAD_PATHS;
+		walk_list_slots(ctx, list->list, list->list + len, load_list_slot, r);
+
+		index_display_list(ctx, list);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, r->path_starts);
+		r->path_starts = NULL;
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+
+	return list;
+}
+
+fz_display_list *
+fz_read_display_list(fz_context *ctx, fz_buffer *buf)
+{
+	fz_list_file_header header;
+	fz_list_reader r = { 0 };
+	fz_display_list *list = NULL;
+	unsigned char *data;
+	void *obj = NULL;
+	int type, i;
+
+	r.len = fz_buffer_storage(ctx, buf, &data);
+	r.data = data;
+
+	fz_var(r);
+
+	fz_try(ctx)
+	{
+		memcpy(&header, read_data(ctx, &r, sizeof header), sizeof header);
+		if (memcmp(header.magic, LIST_FILE_MAGIC, sizeof header.magic))
+			fz_throw(ctx, FZ_ERROR_FORMAT, "not a display list file");
+		header.fz_version[sizeof header.fz_version - 1] = 0;
+		if (header.version != LIST_FILE_VERSION ||
+			header.byte_order != 0x01020304 ||
+			header.pointer_size != sizeof(void *) ||
+			header.size_size != sizeof(size_t) ||
+			header.pointer_align != FZ_POINTER_ALIGN_MOD ||
+			header.node_size != sizeof(fz_display_node) ||
+			strcmp(header.fz_version, FZ_VERSION))
+			fz_throw(ctx, FZ_ERROR_FORMAT, "display list file was written by a different build");
+
+		while (r.pos < r.len)
+		{
+			type = read_int(ctx, &r);
+			if (r.count == r.cap)
 			{
-				fz_drop_colorspace(ctx, colorspace);
-				fz_drop_stroke_state(ctx, stroke);
-				fz_drop_path(ctx, path);
-				fz_rethrow(ctx);
+				int cap = r.cap ? r.cap * 2 : 64;
+				r.rec = fz_realloc_array(ctx, r.rec, cap, fz_list_record);
+				r.cap = cap;
 			}
-			/* Swallow the error */
-			if (cookie)
-				cookie->errors++;
-			if (fz_caught(ctx) == FZ_ERROR_ABORT)
+			switch (type)
 			{
-				fz_ignore_error(ctx);
-				break;
+			default: fz_throw(ctx, FZ_ERROR_FORMAT, "unknown record in display list file");
+			case LIST_REC_BLOB: obj = read_blob(ctx, &r); break;
+			case LIST_REC_COLORSPACE: obj = read_colorspace(ctx, &r); break;
+			case LIST_REC_FUNCTION: obj = read_function(ctx, &r); break;
+			case LIST_REC_STROKE: obj = read_stroke_state(ctx, &r); break;
+			case LIST_REC_FONT: obj = read_font(ctx, &r); break;
+			case LIST_REC_TEXT: obj = read_text(ctx, &r); break;
+			case LIST_REC_IMAGE: obj = read_image(ctx, &r); break;
+			case LIST_REC_SHADE: obj = read_shade(ctx, &r); break;
+			case LIST_REC_DEFAULT_CS: obj = read_default_colorspaces(ctx, &r); break;
+			case LIST_REC_LIST: obj = read_list(ctx, &r); break;
 			}
-			fz_report_error(ctx);
-			fz_warn(ctx, "Ignoring error during interpretation");
+			r.rec[r.count].type = type;
+			r.rec[r.count].obj = obj;
+			r.count++;
 		}
+
+		/* The list itself comes last. */
+		if (r.count == 0 || r.rec[r.count - 1].type != LIST_REC_LIST)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "no display list in file");
+		list = fz_keep_display_list(ctx, r.rec[r.count - 1].obj);
 	}
-	fz_drop_colorspace(ctx, colorspace);
-	fz_drop_stroke_state(ctx, stroke);
-	fz_drop_path(ctx, path);
-	if (cookie)
-		cookie->progress = progress;
+	fz_always(ctx)
+	{
+		for (i = 0; i < r.count; i++)
+			drop_list_record(ctx, r.rec[i].type, r.rec[i].obj);
+		fz_free(ctx, r.rec);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return list;
+}
+
+fz_display_list *
+fz_load_display_list(fz_context *ctx, const char *filename)
+{
+	fz_display_list *list = NULL;
+	fz_buffer *buf = fz_read_file(ctx, filename);
+
+	fz_try(ctx)
+		list = fz_read_display_list(ctx, buf);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return list;
 }
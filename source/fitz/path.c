@@ -92,6 +92,9 @@ typedef struct
 	that way, then they are PACKED_OPEN, where an fz_path is put
 	into the target block, and cmds and coords remain pointers to
 	allocated blocks.
+
+	The packed byte value 255 is never used here; display lists use
+	it to mark a reference to a path packed earlier in the list.
 */
 enum
 {
@@ -266,6 +269,140 @@ fz_pack_path(fz_context *ctx, uint8_t *pack_, const fz_path *path)
 	}
 }
 
+void
+fz_save_packed_path_data(fz_context *ctx, fz_buffer *buf, fz_path *pack)
+{
+	if (pack->packed != FZ_PATH_PACKED_OPEN)
+		return;
+
+	fz_append_data(ctx, buf, pack->coords, sizeof(float) * pack->coord_len);
+	fz_append_data(ctx, buf, pack->cmds, sizeof(uint8_t) * pack->cmd_len);
+	pack->coords = NULL;
+	pack->cmds = NULL;
+}
+
+size_t
+fz_packed_path_data_size(fz_context *ctx, const fz_path *pack, size_t avail)
+{
+	if (avail >= sizeof(fz_packed_path) && pack->packed == FZ_PATH_PACKED_FLAT)
+	{
+		if ((size_t)fz_packed_path_size(pack) > avail)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "invalid packed path");
+		return 0;
+	}
+	if (avail < sizeof(fz_path) || pack->packed != FZ_PATH_PACKED_OPEN ||
+		pack->coords || pack->cmds || pack->coord_len < 0 || pack->cmd_len < 0)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "invalid packed path");
+
+	return sizeof(float) * pack->coord_len + sizeof(uint8_t) * pack->cmd_len;
+}
+
+size_t
+fz_load_packed_path_data(fz_context *ctx, fz_path *pack, const unsigned char *data, size_t len)
+{
+	size_t size;
+
+	if (pack->packed == FZ_PATH_PACKED_FLAT)
+		return 0;
+	size = fz_packed_path_data_size(ctx, pack, sizeof(fz_path));
+	if (len < size)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "truncated packed path data");
+
+	pack->coords = Memento_label(fz_malloc_array(ctx, pack->coord_len, float), "path_packed_coords");
+	fz_try(ctx)
+		pack->cmds = Memento_label(fz_malloc_array(ctx, pack->cmd_len, uint8_t), "path_packed_cmds");
+	fz_catch(ctx)
+	{
+		fz_free(ctx, pack->coords);
+		pack->coords = NULL;
+		fz_rethrow(ctx);
+	}
+	memcpy(pack->coords, data, sizeof(float) * pack->coord_len);
+	memcpy(pack->cmds, data + sizeof(float) * pack->coord_len, sizeof(uint8_t) * pack->cmd_len);
+	pack->coord_cap = pack->coord_len;
+	pack->cmd_cap = pack->cmd_len;
+
+	return size;
+}
+
+static void
+path_contents(const fz_path *path, const uint8_t **cmds, int *cmd_len, const float **coords, int *coord_len)
+{
+	if (path->packed == FZ_PATH_PACKED_FLAT)
+	{
+		const fz_packed_path *pack = (const fz_packed_path *)path;
+		*cmd_len = pack->cmd_len;
+		*coord_len = pack->coord_len;
+		*coords = (const float *)&pack[1];
+		*cmds = (const uint8_t *)&(*coords)[pack->coord_len];
+	}
+	else
+	{
+		*cmd_len = path->cmd_len;
+		*coord_len = path->coord_len;
+		*coords = path->coords;
+		*cmds = path->cmds;
+	}
+}
+
+unsigned int
+fz_hash_path(fz_context *ctx, const fz_path *path)
+{
+	const uint8_t *cmds;
+	const float *coords;
+	int i, cmd_len, coord_len;
+	unsigned int h, v;
+
+	path_contents(path, &cmds, &cmd_len, &coords, &coord_len);
+
+	/* FNV-1a, a word at a time for the coordinates. */
+	h = 2166136261u ^ (unsigned int)cmd_len;
+	for (i = 0; i < coord_len; i++)
+	{
+		memcpy(&v, &coords[i], sizeof(v));
+		h = (h ^ v) * 16777619u;
+	}
+	for (i = 0; i < cmd_len; i++)
+		h = (h ^ cmds[i]) * 16777619u;
+
+	return h ^ (h >> 16);
+}
+
+void
+fz_digest_path(fz_context *ctx, const fz_path *path, fz_md5 *md5)
+{
+	const uint8_t *cmds;
+	const float *coords;
+	int cmd_len, coord_len;
+
+	path_contents(path, &cmds, &cmd_len, &coords, &coord_len);
+
+	fz_md5_update_int64(md5, cmd_len);
+	fz_md5_update_int64(md5, coord_len);
+	if (coord_len > 0)
+		fz_md5_update(md5, (const unsigned char *)coords, sizeof(float) * coord_len);
+	if (cmd_len > 0)
+		fz_md5_update(md5, cmds, cmd_len);
+}
+
+int
+fz_compare_paths(fz_context *ctx, const fz_path *a, const fz_path *b)
+{
+	const uint8_t *a_cmds, *b_cmds;
+	const float *a_coords, *b_coords;
+	int a_cmd_len, b_cmd_len, a_coord_len, b_coord_len;
+
+	path_contents(a, &a_cmds, &a_cmd_len, &a_coords, &a_coord_len);
+	path_contents(b, &b_cmds, &b_cmd_len, &b_coords, &b_coord_len);
+
+	if (a_cmd_len != b_cmd_len || a_coord_len != b_coord_len)
+		return 1;
+	/* Compare bit patterns, so that -0 and 0 stay distinct. */
+	if (a_coord_len > 0 && memcmp(a_coords, b_coords, sizeof(float) * a_coord_len))
+		return 1;
+	return a_cmd_len > 0 && memcmp(a_cmds, b_cmds, a_cmd_len) != 0;
+}
+
 static void
 push_cmd(fz_context *ctx, fz_path *path, int cmd)
 {
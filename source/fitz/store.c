@@ -36,22 +36,53 @@ typedef struct fz_item
 	struct fz_item *prev;
 	fz_store *store;
 	const fz_store_type *type;
+	unsigned char probation; /* in the probationary list (2Q policy) */
+	unsigned char weight; /* eviction passes survived (cost policy) */
+	unsigned char credit; /* eviction passes left to survive */
+	signed char slot; /* index into store->type, or -1 */
 } fz_item;
 
-/* Every entry in fz_store is protected by the alloc lock */
-struct fz_store
+enum
 {
-	int refs;
+	MAX_WEIGHT = 7
+};
+
+/* A shard holds the subset of the items in the store whose keys hash to
+ * it. An unsharded store has a single shard, protected by the alloc lock.
+ * A sharded store protects each shard with its own lock; the alloc lock
+ * is then only taken (inside the shard lock) to manipulate reference
+ * counts and the store size. */
+typedef struct
+{
+	int lock;
 
-	/* Every item in the store is kept in a doubly linked list, ordered
+	/* Every item in the shard is kept in a doubly linked list, ordered
 	 * by usage (so LRU entries are at the end). */
 	fz_item *head;
 	fz_item *tail;
 
+	/* With the 2Q policy, items start out in a probationary list, and
+	 * only move to the main list above once they are used again. */
+	fz_item *probation_head;
+	fz_item *probation_tail;
+	size_t main_size;
+
 	/* We have a hash table that allows to quickly find a subset of the
 	 * entries (those whose keys are indirect objects). */
 	fz_hash_table *hash;
 
+	fz_store_policy policy;
+	fz_store_counters counters;
+} fz_store_shard;
+
+/* Every global entry in fz_store is protected by the alloc lock */
+struct fz_store
+{
+	int refs;
+
+	int num_shards;
+	fz_store_shard shard[FZ_STORE_MAX_SHARDS];
+
 	/* We keep track of the size of the store, and keep it below max. */
 	size_t max;
 	size_t size;
@@ -59,6 +90,29 @@ struct fz_store
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
+
+	/* The shard at which the next eviction pass starts. */
+	int evict_shard;
+
+	fz_store_policy policy;
+
+	/* A running average of the cost per byte of the items stored. */
+	float cost_per_byte;
+
+	/* Statistics and limits for each type of item. An entry may be
+	 * created by fz_set_store_type_limit before any items of that
+	 * type are stored, in which case type is NULL until the first
+	 * item with a matching name arrives. */
+	int num_types;
+	struct
+	{
+		const fz_store_type *type;
+		char *name;
+		fz_store_type_stats stats;
+	} type[FZ_STORE_MAX_TYPES];
+
+	/* Directory for the on-disk second level cache, or NULL. */
+	char *disk_cache;
 };
 
 void
@@ -68,7 +122,7 @@ fz_new_store_context(fz_context *ctx, size_t max)
 	store = fz_malloc_struct(ctx, fz_store);
 	fz_try(ctx)
 	{
-		store->hash = fz_new_hash_table(ctx, 4096, sizeof(fz_store_hash), FZ_LOCK_ALLOC, NULL);
+		store->shard[0].hash = fz_new_hash_table(ctx, 4096, sizeof(fz_store_hash), FZ_LOCK_ALLOC, NULL);
 	}
 	fz_catch(ctx)
 	{
@@ -76,8 +130,10 @@ fz_new_store_context(fz_context *ctx, size_t max)
 		fz_rethrow(ctx);
 	}
 	store->refs = 1;
-	store->head = NULL;
-	store->tail = NULL;
+	store->num_shards = 1;
+	store->shard[0].lock = FZ_LOCK_ALLOC;
+	store->shard[0].head = NULL;
+	store->shard[0].tail = NULL;
 	store->size = 0;
 	store->max = max;
 	store->defer_reap_count = 0;
@@ -85,6 +141,258 @@ fz_new_store_context(fz_context *ctx, size_t max)
 	ctx->store = store;
 }
 
+/*
+	Find the index of the statistics for a type of item, creating
+	them if required. Returns -1 if there is no room for more types.
+
+	Entered with the alloc lock held.
+*/
+static int
+type_slot(fz_store *store, const fz_store_type *type)
+{
+	int i;
+
+	for (i = 0; i < store->num_types; i++)
+		if (store->type[i].type == type)
+			return i;
+	for (i = 0; i < store->num_types; i++)
+	{
+		if (store->type[i].type == NULL && !strcmp(store->type[i].stats.name, type->name))
+		{
+			store->type[i].type = type;
+			return i;
+		}
+	}
+	if (store->num_types == FZ_STORE_MAX_TYPES)
+		return -1;
+	store->type[i].type = type;
+	store->type[i].stats.name = type->name;
+	store->type[i].stats.max = FZ_STORE_UNLIMITED;
+	return store->num_types++;
+}
+
+static fz_store_shard *
+find_shard(fz_store *store, const fz_store_hash *hash, int use_hash, fz_store_drop_fn *drop)
+{
+	const unsigned char *s;
+	size_t i, n;
+	unsigned int h = 2166136261;
+
+	if (store->num_shards == 1)
+		return &store->shard[0];
+
+	/* Hashable keys are spread over the shards by their hash. Those
+	 * that are not have to be found by a linear search, so we keep all
+	 * of those of a given type together in the same shard. */
+	if (use_hash)
+	{
+		s = (const unsigned char *)hash;
+		n = sizeof(*hash);
+	}
+	else
+	{
+		s = (const unsigned char *)&drop;
+		n = sizeof(drop);
+	}
+	for (i = 0; i < n; i++)
+		h = (h ^ s[i]) * 16777619;
+
+	return &store->shard[h % store->num_shards];
+}
+
+/*
+	Given that we hold the shard lock, take (or release) the alloc lock.
+	For an unsharded store these are one and the same.
+*/
+static void
+lock_refs(fz_context *ctx, fz_store_shard *shard)
+{
+	if (shard->lock != FZ_LOCK_ALLOC)
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+}
+
+static void
+unlock_refs(fz_context *ctx, fz_store_shard *shard)
+{
+	if (shard->lock != FZ_LOCK_ALLOC)
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+/*
+	Entered with the alloc lock held. Exits with both the shard lock
+	and the alloc lock held. The alloc lock may be momentarily dropped
+	to respect the lock ordering.
+*/
+static void
+relock_shard(fz_context *ctx, fz_store_shard *shard)
+{
+	if (shard->lock != FZ_LOCK_ALLOC)
+	{
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_lock(ctx, shard->lock);
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+	}
+}
+
+/*
+	Entered with both the shard lock and the alloc lock held. Exits
+	with just the alloc lock held.
+*/
+static void
+release_shard(fz_context *ctx, fz_store_shard *shard)
+{
+	if (shard->lock != FZ_LOCK_ALLOC)
+		fz_unlock(ctx, shard->lock);
+}
+
+static void
+unlink_from_list(fz_store_shard *shard, fz_item *item)
+{
+	fz_item **head, **tail;
+
+	if (item->probation)
+	{
+		head = &shard->probation_head;
+		tail = &shard->probation_tail;
+	}
+	else
+	{
+		head = &shard->head;
+		tail = &shard->tail;
+		shard->main_size -= item->size;
+	}
+
+	if (item->next)
+		item->next->prev = item->prev;
+	else
+		*tail = item->prev;
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		*head = item->next;
+}
+
+static void
+link_at_head(fz_store_shard *shard, fz_item *item, int probation)
+{
+	fz_item **head, **tail;
+
+	if (probation)
+	{
+		head = &shard->probation_head;
+		tail = &shard->probation_tail;
+	}
+	else
+	{
+		head = &shard->head;
+		tail = &shard->tail;
+		shard->main_size += item->size;
+	}
+
+	item->probation = probation;
+	item->next = *head;
+	if (item->next)
+		item->next->prev = item;
+	else
+		*tail = item;
+	*head = item;
+	item->prev = NULL;
+}
+
+/*
+	Items are considered for eviction from the oldest to the newest;
+	those in the probationary list before those in the main list.
+*/
+static fz_item *
+oldest_item(fz_store_shard *shard)
+{
+	return shard->probation_tail ? shard->probation_tail : shard->tail;
+}
+
+static fz_item *
+next_oldest_item(fz_store_shard *shard, fz_item *item)
+{
+	if (item->prev == NULL && item->probation)
+		return shard->tail;
+	return item->prev;
+}
+
+/*
+	Remove an item from the linked list and the hash table of its shard,
+	and from the size of the store, and drop the reference that the store
+	held to its value. Returns non-zero if that was the last reference,
+	in which case the caller should drop the value once the locks have
+	been released.
+
+	Entered with both the shard lock and the alloc lock held.
+*/
+static int
+unlink_item(fz_context *ctx, fz_store *store, fz_store_shard *shard, fz_item *item)
+{
+	store->size -= item->size;
+	if (item->slot >= 0)
+	{
+		store->type[item->slot].stats.items--;
+		store->type[item->slot].stats.bytes -= item->size;
+	}
+
+	/* Unlink from the linked list */
+	unlink_from_list(shard, item);
+
+	/* Remove from the hash table */
+	if (item->type->make_hash_key)
+	{
+		fz_store_hash hash = { NULL };
+		hash.drop = item->val->drop;
+		if (item->type->make_hash_key(ctx, &hash, item->key))
+			fz_hash_remove(ctx, shard->hash, &hash);
+	}
+
+	/* Drop a reference to the value */
+	if (item->val->refs > 0)
+		(void)Memento_dropRef(item->val);
+	return (item->val->refs > 0 && --item->val->refs == 0);
+}
+
+/*
+	Unlink an item, and put it onto a removal chain to be freed later
+	by free_removal_chain.
+
+	Entered with both the shard lock and the alloc lock held.
+*/
+static void
+unlink_for_removal(fz_context *ctx, fz_store *store, fz_store_shard *shard, fz_item *item, fz_item **remove)
+{
+	/* Store whether to drop this value or not in 'prev' */
+	item->prev = unlink_item(ctx, store, shard, item) ? item : NULL;
+
+	/* Store it in our removal chain - just singly linked */
+	item->next = *remove;
+	*remove = item;
+}
+
+/*
+	Entered with no locks held.
+*/
+static void
+free_removal_chain(fz_context *ctx, fz_item *remove)
+{
+	fz_item *item;
+
+	for (item = remove; item != NULL; item = remove)
+	{
+		remove = item->next;
+
+		/* Drop a reference to the value (freeing if required) */
+		if (item->prev) /* See above for our abuse of prev here */
+			item->val->drop(ctx, item->val);
+
+		/* Always drops the key and drop the item */
+		item->type->drop_key(ctx, item->key);
+		fz_free(ctx, item);
+	}
+}
+
 void *
 fz_keep_storable(fz_context *ctx, const fz_storable *sc)
 {
@@ -109,6 +417,7 @@ do_reap(fz_context *ctx)
 {
 	fz_store *store = ctx->store;
 	fz_item *item, *prev, *remove;
+	int i;
 
 	if (store == NULL)
 	{
@@ -124,59 +433,27 @@ do_reap(fz_context *ctx)
 
 	/* Reap the items */
 	remove = NULL;
-	for (item = store->tail; item; item = prev)
+	for (i = 0; i < store->num_shards; i++)
 	{
-		prev = item->prev;
-
-		if (item->type->needs_reap == NULL || item->type->needs_reap(ctx, item->key) == 0)
-			continue;
-
-		/* We have to drop it */
-		store->size -= item->size;
+		fz_store_shard *shard = &store->shard[i];
 
-		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
-
-		/* Remove from the hash table */
-		if (item->type->make_hash_key)
+		relock_shard(ctx, shard);
+		for (item = oldest_item(shard); item; item = prev)
 		{
-			fz_store_hash hash = { NULL };
-			hash.drop = item->val->drop;
-			if (item->type->make_hash_key(ctx, &hash, item->key))
-				fz_hash_remove(ctx, store->hash, &hash);
-		}
+			prev = next_oldest_item(shard, item);
 
-		/* Store whether to drop this value or not in 'prev' */
-		if (item->val->refs > 0)
-			(void)Memento_dropRef(item->val);
-		item->prev = (item->val->refs > 0 && --item->val->refs == 0) ? item : NULL;
+			if (item->type->needs_reap == NULL || item->type->needs_reap(ctx, item->key) == 0)
+				continue;
 
-		/* Store it in our removal chain - just singly linked */
-		item->next = remove;
-		remove = item;
+			/* We have to drop it */
+			unlink_for_removal(ctx, store, shard, item, &remove);
+		}
+		release_shard(ctx, shard);
 	}
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	/* Now drop the remove chain */
-	for (item = remove; item != NULL; item = remove)
-	{
-		remove = item->next;
-
-		/* Drop a reference to the value (freeing if required) */
-		if (item->prev)
-			item->val->drop(ctx, item->val);
-
-		/* Always drops the key and drop the item */
-		item->type->drop_key(ctx, item->key);
-		fz_free(ctx, item);
-	}
+	free_removal_chain(ctx, remove);
 	FZ_LOG_DUMP_STORE(ctx, "After reaping store:\n");
 }
 
@@ -272,37 +549,19 @@ void fz_drop_key_storable_key(fz_context *ctx, const fz_key_storable *sc)
 		s->storable.drop(ctx, &s->storable);
 }
 
+/*
+	Entered with both the shard lock and the alloc lock held.
+	Drops both, then retakes the alloc lock.
+*/
 static void
-evict(fz_context *ctx, fz_item *item)
+evict(fz_context *ctx, fz_store_shard *shard, fz_item *item)
 {
 	fz_store *store = ctx->store;
 	int drop;
 
-	store->size -= item->size;
-	/* Unlink from the linked list */
-	if (item->next)
-		item->next->prev = item->prev;
-	else
-		store->tail = item->prev;
-	if (item->prev)
-		item->prev->next = item->next;
-	else
-		store->head = item->next;
-
-	/* Drop a reference to the value (freeing if required) */
-	if (item->val->refs > 0)
-		(void)Memento_dropRef(item->val);
-	drop = (item->val->refs > 0 && --item->val->refs == 0);
-
-	/* Remove from the hash table */
-	if (item->type->make_hash_key)
-	{
-		fz_store_hash hash = { NULL };
-		hash.drop = item->val->drop;
-		if (item->type->make_hash_key(ctx, &hash, item->key))
-			fz_hash_remove(ctx, store->hash, &hash);
-	}
+	drop = unlink_item(ctx, store, shard, item);
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	release_shard(ctx, shard);
 	if (drop)
 		item->val->drop(ctx, item->val);
 
@@ -312,136 +571,189 @@ evict(fz_context *ctx, fz_item *item)
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 }
 
+/*
+	Evict enough items (of any type if slot < 0, otherwise only those
+	of the given type) to free tofree bytes. Returns the number of bytes
+	freed, or 0 if that many cannot be freed.
+
+	Entered with the alloc lock held. Drops and retakes it.
+*/
 static size_t
-ensure_space(fz_context *ctx, size_t tofree)
+ensure_space(fz_context *ctx, size_t tofree, int slot)
 {
 	fz_item *item, *prev;
 	size_t count;
 	fz_store *store = ctx->store;
 	fz_item *to_be_freed = NULL;
+	int i, n = store->num_shards;
+	int aged;
 
 	fz_assert_lock_held(ctx, FZ_LOCK_ALLOC);
 
 	/* First check that we *can* free tofree; if not, we'd rather not
 	 * cache this. */
 	count = 0;
-	for (item = store->tail; item; item = item->prev)
+	for (i = 0; i < n && count < tofree; i++)
 	{
-		if (item->val->refs == 1)
+		fz_store_shard *shard = &store->shard[(store->evict_shard + i) % n];
+
+		relock_shard(ctx, shard);
+		for (item = oldest_item(shard); item; item = next_oldest_item(shard, item))
 		{
-			count += item->size;
-			if (count >= tofree)
-				break;
+			if (item->val->refs == 1 && (slot < 0 || item->slot == slot))
+			{
+				count += item->size;
+				if (count >= tofree)
+					break;
+			}
 		}
+		release_shard(ctx, shard);
 	}
 
 	/* If we ran out of items to search, then we can never free enough */
-	if (item == NULL)
+	if (count < tofree)
 	{
 		return 0;
 	}
 
-	/* Now move all the items to be freed onto 'to_be_freed' */
+	/* Now move all the items to be freed onto 'to_be_freed'. For a
+	 * sharded store we take from each shard in turn, and start with
+	 * a different shard next time round, so that no one shard bears
+	 * the brunt of the evictions. With the cost policy, costly items
+	 * survive a number of passes, so we may need to go round again. */
 	count = 0;
-	for (item = store->tail; item; item = prev)
+	do
 	{
-		prev = item->prev;
-		if (item->val->refs != 1)
-			continue;
-
-		store->size -= item->size;
+		aged = 0;
+		for (i = 0; i < n && count < tofree; i++)
+		{
+			fz_store_shard *shard = &store->shard[(store->evict_shard + i) % n];
 
-		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+			relock_shard(ctx, shard);
+			for (item = oldest_item(shard); item; item = prev)
+			{
+				prev = next_oldest_item(shard, item);
+				if (item->val->refs != 1 || (slot >= 0 && item->slot != slot))
+					continue;
 
-		/* Remove from the hash table */
-		if (item->type->make_hash_key)
-		{
-			fz_store_hash hash = { NULL };
-			hash.drop = item->val->drop;
-			if (item->type->make_hash_key(ctx, &hash, item->key))
-				fz_hash_remove(ctx, store->hash, &hash);
-		}
+				if (shard->policy == FZ_STORE_POLICY_COST && item->credit > 0)
+				{
+					item->credit--;
+					aged = 1;
+					continue;
+				}
 
-		/* Link into to_be_freed */
-		item->next = to_be_freed;
-		to_be_freed = item;
+				/* Link into to_be_freed */
+				shard->counters.evictions++;
+				shard->counters.evicted_bytes += item->size;
+				if (item->slot >= 0)
+					store->type[item->slot].stats.evictions++;
+				unlink_for_removal(ctx, store, shard, item, &to_be_freed);
 
-		count += item->size;
-		if (count >= tofree)
-			break;
+				count += item->size;
+				if (count >= tofree)
+					break;
+			}
+			release_shard(ctx, shard);
+		}
 	}
+	while (count < tofree && aged);
+	store->evict_shard = (store->evict_shard + 1) % n;
 
 	/* Now we can safely drop the lock and free our pending items. These
 	 * have all been removed from both the store list, and the hash table,
 	 * so they can't be 'found' by anyone else in the meantime. */
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	free_removal_chain(ctx, to_be_freed);
+	fz_lock(ctx, FZ_LOCK_ALLOC);
 
-	while (to_be_freed)
-	{
-		fz_item *item = to_be_freed;
-		int drop;
+	return count;
+}
 
-		to_be_freed = to_be_freed->next;
+static void
+touch(fz_store *store, fz_store_shard *shard, fz_item *item)
+{
+	int is_new = (item->next == item);
 
-		/* Drop a reference to the value (freeing if required) */
-		if (item->val->refs > 0)
-			(void)Memento_dropRef(item->val);
-		drop = (item->val->refs > 0 && --item->val->refs == 0);
+	/* If already in a list - unlink it */
+	if (!is_new)
+		unlink_from_list(shard, item);
 
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
-		if (drop)
-			item->val->drop(ctx, item->val);
+	/* Now relink it at the start of the appropriate LRU chain */
+	if (shard->policy == FZ_STORE_POLICY_2Q && is_new)
+		link_at_head(shard, item, 1);
+	else
+	{
+		link_at_head(shard, item, 0);
 
-		/* Always drops the key and drop the item */
-		item->type->drop_key(ctx, item->key);
-		fz_free(ctx, item);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
+		/* Limit the main list to 3/4 of the store, demoting its
+		 * oldest items back to probation, so that new items always
+		 * have room to prove themselves. */
+		if (shard->policy == FZ_STORE_POLICY_2Q && store->max != FZ_STORE_UNLIMITED)
+		{
+			size_t main_max = store->max / 4 * 3 / store->num_shards;
+			while (shard->main_size > main_max && shard->tail != item)
+			{
+				fz_item *old = shard->tail;
+				unlink_from_list(shard, old);
+				link_at_head(shard, old, 1);
+			}
+		}
 	}
 
-	return count;
+	item->credit = item->weight;
 }
 
-static void
-touch(fz_store *store, fz_item *item)
+/*
+	The number of eviction passes an item survives under the cost
+	policy: log2(1 + r), where r is the ratio of the cost per byte
+	of the item to the average cost per byte. Items of unknown cost
+	are taken to be of average cost.
+
+	Entered with the alloc lock held.
+*/
+static int
+cost_weight(fz_store *store, size_t size, float cost)
 {
-	if (item->next != item)
+	float r;
+	int weight = 0;
+
+	if (cost <= 0 || size == 0)
+		return 1;
+
+	r = cost / size;
+	if (store->cost_per_byte == 0)
+		store->cost_per_byte = r;
+	else
+		store->cost_per_byte += (r - store->cost_per_byte) / 16;
+
+	r = 1 + r / store->cost_per_byte;
+	while (r >= 2 && weight < MAX_WEIGHT)
 	{
-		/* Already in the list - unlink it */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+		r /= 2;
+		weight++;
 	}
-	/* Now relink it at the start of the LRU chain */
-	item->next = store->head;
-	if (item->next)
-		item->next->prev = item;
-	else
-		store->tail = item;
-	store->head = item;
-	item->prev = NULL;
+
+	return weight;
 }
 
 void *
-fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_store_type *type)
+fz_store_item(fz_context *ctx, void *key, void *val, size_t itemsize, const fz_store_type *type)
+{
+	return fz_store_item_with_cost(ctx, key, val, itemsize, 0, type);
+}
+
+void *
+fz_store_item_with_cost(fz_context *ctx, void *key, void *val_, size_t itemsize, float cost, const fz_store_type *type)
 {
 	fz_item *item = NULL;
 	size_t size;
 	fz_storable *val = (fz_storable *)val_;
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
+	int slot;
 
 	if (!store)
 		return NULL;
@@ -462,7 +774,8 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	}
 
 	type->keep_key(ctx, key);
-	fz_lock(ctx, FZ_LOCK_ALLOC);
+	shard = find_shard(store, &hash, use_hash, val->drop);
+	fz_lock(ctx, shard->lock);
 
 	/* Fill out the item. To start with, we always set item->next == item
 	 * and item->prev == item. This is so that we can spot items that have
@@ -474,6 +787,7 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	item->next = item;
 	item->prev = item;
 	item->type = type;
+	item->slot = -1;
 
 	/* If we can index it fast, put it into the hash table. This serves
 	 * to check whether we have one there already. */
@@ -484,13 +798,13 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 		fz_try(ctx)
 		{
 			/* May drop and retake the lock */
-			existing = fz_hash_insert(ctx, store->hash, &hash, item);
+			existing = fz_hash_insert(ctx, shard->hash, &hash, item);
 		}
 		fz_catch(ctx)
 		{
 			/* Any error here means that item never made it into the
 			 * hash - so no one else can have a reference. */
-			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			fz_unlock(ctx, shard->lock);
 			fz_free(ctx, item);
 			type->drop_key(ctx, key);
 			return NULL;
@@ -500,13 +814,15 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 			/* There was one there already! Take a new reference
 			 * to the existing one, and drop our current one. */
 			fz_warn(ctx, "found duplicate %s in the store", type->name);
-			touch(store, existing);
+			touch(store, shard, existing);
+			lock_refs(ctx, shard);
 			if (existing->val->refs > 0)
 			{
 				(void)Memento_takeRef(existing->val);
 				existing->val->refs++;
 			}
-			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			unlock_refs(ctx, shard);
+			fz_unlock(ctx, shard->lock);
 			fz_free(ctx, item);
 			type->drop_key(ctx, key);
 			return existing->val;
@@ -514,21 +830,41 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 	}
 
 	/* Now bump the ref */
+	lock_refs(ctx, shard);
 	if (val->refs > 0)
 	{
 		(void)Memento_takeRef(val);
 		val->refs++;
 	}
+	store->size += itemsize;
+	item->weight = cost_weight(store, itemsize, cost);
+	item->slot = slot = type_slot(store, type);
+	if (slot >= 0)
+	{
+		store->type[slot].stats.items++;
+		store->type[slot].stats.bytes += itemsize;
+	}
+	unlock_refs(ctx, shard);
+	shard->counters.stores++;
+
+	/* Regardless of whether it's indexed, it goes into the linked list.
+	 * As we hold a reference to it, it cannot be evicted again by the
+	 * ensure_space below. */
+	touch(store, shard, item);
+	if (shard->lock != FZ_LOCK_ALLOC)
+	{
+		fz_unlock(ctx, shard->lock);
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+	}
 
 	/* If we haven't got an infinite store, check for space within it */
 	if (store->max != FZ_STORE_UNLIMITED)
 	{
-		/* FIXME: Overflow? */
-		size = store->size + itemsize;
+		size = store->size;
 		if (size > store->max)
 		{
 			FZ_LOG_STORE(ctx, "Store size exceeded: item=%zu, size=%zu, max=%zu\n",
-				itemsize, store->size, store->max);
+				itemsize, store->size - itemsize, store->max);
 			while (size > store->max)
 			{
 				size_t saved;
@@ -539,12 +875,12 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 					do_reap(ctx); /* Drops alloc lock */
 					fz_lock(ctx, FZ_LOCK_ALLOC);
 				}
-				size = store->size + itemsize;
+				size = store->size;
 				if (size <= store->max)
 					break;
 
 				/* ensure_space may drop, then retake the lock */
-				saved = ensure_space(ctx, size - store->max);
+				saved = ensure_space(ctx, size - store->max, -1);
 				size -= saved;
 				if (saved == 0)
 				{
@@ -564,22 +900,61 @@ fz_store_item(fz_context *ctx, void *key, void *val_, size_t itemsize, const fz_
 			FZ_LOG_DUMP_STORE(ctx, "After eviction:\n");
 		}
 	}
-	store->size += itemsize;
 
-	/* Regardless of whether it's indexed, it goes into the linked list */
-	touch(store, item);
+	/* Keep items of this type within their own budget, if they have
+	 * one. As above, if we can't, we keep the item regardless. */
+	if (slot >= 0)
+	{
+		fz_store_type_stats *stats = &store->type[slot].stats;
+		while (stats->max != FZ_STORE_UNLIMITED && stats->bytes > stats->max)
+		{
+			/* ensure_space may drop, then retake the lock */
+			if (ensure_space(ctx, stats->bytes - stats->max, slot) == 0)
+				break;
+		}
+	}
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
 }
 
+static fz_item *
+find_item_locked(fz_context *ctx, fz_store_shard *shard, fz_store_drop_fn *drop, void *key, const fz_store_type *type, fz_store_hash *hash, int use_hash)
+{
+	fz_item *item;
+
+	if (use_hash)
+	{
+		/* We can find objects keyed on indirected objects quickly */
+		item = fz_hash_find(ctx, shard->hash, hash);
+	}
+	else
+	{
+		/* Others we have to hunt for slowly */
+		for (item = shard->head; item; item = item->next)
+		{
+			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
+				return item;
+		}
+		for (item = shard->probation_head; item; item = item->next)
+		{
+			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
+				return item;
+		}
+	}
+
+	return item;
+}
+
 void *
 fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_type *type)
 {
 	fz_item *item;
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
+	int slot;
 
 	if (!store)
 		return NULL;
@@ -593,38 +968,38 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 		use_hash = type->make_hash_key(ctx, &hash, key);
 	}
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
-	if (use_hash)
-	{
-		/* We can find objects keyed on indirected objects quickly */
-		item = fz_hash_find(ctx, store->hash, &hash);
-	}
-	else
-	{
-		/* Others we have to hunt for slowly */
-		for (item = store->head; item; item = item->next)
-		{
-			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
-				break;
-		}
-	}
+	shard = find_shard(store, &hash, use_hash, drop);
+	fz_lock(ctx, shard->lock);
+	item = find_item_locked(ctx, shard, drop, key, type, &hash, use_hash);
 	if (item)
 	{
+		shard->counters.hits++;
 		/* LRU the block. This also serves to ensure that any item
 		 * picked up from the hash before it has made it into the
 		 * linked list does not get whipped out again due to the
 		 * store being full. */
-		touch(store, item);
+		touch(store, shard, item);
 		/* And bump the refcount before returning */
+		lock_refs(ctx, shard);
 		if (item->val->refs > 0)
 		{
 			(void)Memento_takeRef(item->val);
 			item->val->refs++;
 		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		slot = type_slot(store, type);
+		if (slot >= 0)
+			store->type[slot].stats.hits++;
+		unlock_refs(ctx, shard);
+		fz_unlock(ctx, shard->lock);
 		return (void *)item->val;
 	}
-	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	shard->counters.misses++;
+	lock_refs(ctx, shard);
+	slot = type_slot(store, type);
+	if (slot >= 0)
+		store->type[slot].stats.misses++;
+	unlock_refs(ctx, shard);
+	fz_unlock(ctx, shard->lock);
 
 	return NULL;
 }
@@ -634,6 +1009,7 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 {
 	fz_item *item;
 	fz_store *store = ctx->store;
+	fz_store_shard *shard;
 	int dodrop;
 	fz_store_hash hash = { NULL };
 	int use_hash = 0;
@@ -644,63 +1020,328 @@ fz_remove_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_stor
 		use_hash = type->make_hash_key(ctx, &hash, key);
 	}
 
-	fz_lock(ctx, FZ_LOCK_ALLOC);
-	if (use_hash)
-	{
-		/* We can find objects keyed on indirect objects quickly */
-		item = fz_hash_find(ctx, store->hash, &hash);
-		if (item)
-			fz_hash_remove(ctx, store->hash, &hash);
-	}
-	else
-	{
-		/* Others we have to hunt for slowly */
-		for (item = store->head; item; item = item->next)
-			if (item->val->drop == drop && !type->cmp_key(ctx, item->key, key))
-				break;
-	}
+	shard = find_shard(store, &hash, use_hash, drop);
+	fz_lock(ctx, shard->lock);
+	item = find_item_locked(ctx, shard, drop, key, type, &hash, use_hash);
 	if (item)
 	{
-		/* Momentarily things can be in the hash table without being
-		 * in the list. Don't attempt to unlink these. We indicate
-		 * such items by setting item->next == item. */
-		if (item->next != item)
-		{
-			if (item->next)
-				item->next->prev = item->prev;
-			else
-				store->tail = item->prev;
-			if (item->prev)
-				item->prev->next = item->next;
-			else
-				store->head = item->next;
-		}
-		if (item->val->refs > 0)
-			(void)Memento_dropRef(item->val);
-		dodrop = (item->val->refs > 0 && --item->val->refs == 0);
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		lock_refs(ctx, shard);
+		dodrop = unlink_item(ctx, store, shard, item);
+		unlock_refs(ctx, shard);
+		fz_unlock(ctx, shard->lock);
 		if (dodrop)
 			item->val->drop(ctx, item->val);
 		type->drop_key(ctx, item->key);
 		fz_free(ctx, item);
 	}
 	else
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		fz_unlock(ctx, shard->lock);
 }
 
 void
 fz_empty_store(fz_context *ctx)
 {
 	fz_store *store = ctx->store;
+	int i;
 
 	if (store == NULL)
 		return;
 
 	fz_lock(ctx, FZ_LOCK_ALLOC);
 	/* Run through all the items in the store */
-	while (store->head)
-		evict(ctx, store->head); /* Drops then retakes lock */
+	for (i = 0; i < store->num_shards; i++)
+	{
+		fz_store_shard *shard = &store->shard[i];
+
+		fz_item *item;
+
+		relock_shard(ctx, shard);
+		while ((item = oldest_item(shard)) != NULL)
+		{
+			evict(ctx, shard, item); /* Drops then retakes lock */
+			relock_shard(ctx, shard);
+		}
+		release_shard(ctx, shard);
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_set_store_shards(fz_context *ctx, int shards)
+{
+	fz_store *store = ctx->store;
+	fz_hash_table *hash[FZ_STORE_MAX_SHARDS] = { NULL };
+	int i, n;
+
+	if (store == NULL)
+		return;
+
+	if (shards < 1)
+		shards = 1;
+	if (shards > FZ_STORE_MAX_SHARDS)
+		shards = FZ_STORE_MAX_SHARDS;
+	if (shards == store->num_shards)
+		return;
+
+	/* Make the new hash tables before we touch anything, so that we can
+	 * fail cleanly. */
+	fz_try(ctx)
+	{
+		if (shards == 1)
+			hash[0] = fz_new_hash_table(ctx, 4096, sizeof(fz_store_hash), FZ_LOCK_ALLOC, NULL);
+		else
+			for (i = 0; i < shards; i++)
+				hash[i] = fz_new_hash_table(ctx, 4096 / shards, sizeof(fz_store_hash), FZ_LOCK_STORE + i, NULL);
+	}
+	fz_catch(ctx)
+	{
+		for (i = 0; i < shards; i++)
+			fz_drop_hash_table(ctx, hash[i]);
+		fz_rethrow(ctx);
+	}
+
+	/* Items cannot move between shards, so start from an empty store. */
+	fz_empty_store(ctx);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	n = store->num_shards;
+	for (i = 0; i < FZ_STORE_MAX_SHARDS; i++)
+	{
+		fz_hash_table *old = store->shard[i].hash;
+		store->shard[i].lock = (shards == 1) ? FZ_LOCK_ALLOC : FZ_LOCK_STORE + i;
+		store->shard[i].head = NULL;
+		store->shard[i].tail = NULL;
+		store->shard[i].probation_head = NULL;
+		store->shard[i].probation_tail = NULL;
+		store->shard[i].main_size = 0;
+		store->shard[i].policy = store->policy;
+		store->shard[i].hash = hash[i];
+		hash[i] = old;
+	}
+	store->num_shards = shards;
+	store->evict_shard = 0;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	for (i = 0; i < n; i++)
+		fz_drop_hash_table(ctx, hash[i]);
+}
+
+void
+fz_set_store_policy(fz_context *ctx, fz_store_policy policy)
+{
+	fz_store *store = ctx->store;
+	int i;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->policy = policy;
+	for (i = 0; i < store->num_shards; i++)
+	{
+		fz_store_shard *shard = &store->shard[i];
+		fz_item *item;
+
+		relock_shard(ctx, shard);
+		shard->policy = policy;
+
+		/* Without the 2Q policy, there is no probation; treat any
+		 * items on probation as the oldest of the main list. */
+		if (policy != FZ_STORE_POLICY_2Q)
+		{
+			while ((item = shard->probation_head) != NULL)
+			{
+				unlink_from_list(shard, item);
+				item->probation = 0;
+				item->next = NULL;
+				item->prev = shard->tail;
+				if (shard->tail)
+					shard->tail->next = item;
+				else
+					shard->head = item;
+				shard->tail = item;
+				shard->main_size += item->size;
+			}
+		}
+		release_shard(ctx, shard);
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+fz_store_policy
+fz_store_policy_from_string(const char *policy)
+{
+	if (!strcmp(policy, "2q"))
+		return FZ_STORE_POLICY_2Q;
+	if (!strcmp(policy, "cost"))
+		return FZ_STORE_POLICY_COST;
+	return FZ_STORE_POLICY_LRU;
+}
+
+const char *
+fz_store_policy_to_string(fz_store_policy policy)
+{
+	switch (policy)
+	{
+	default:
+	case FZ_STORE_POLICY_LRU: return "lru";
+	case FZ_STORE_POLICY_2Q: return "2q";
+	case FZ_STORE_POLICY_COST: return "cost";
+	}
+}
+
+void
+fz_get_store_counters(fz_context *ctx, fz_store_counters *counters)
+{
+	fz_store *store = ctx->store;
+	int i;
+
+	memset(counters, 0, sizeof(*counters));
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (i = 0; i < store->num_shards; i++)
+	{
+		fz_store_shard *shard = &store->shard[i];
+
+		relock_shard(ctx, shard);
+		counters->hits += shard->counters.hits;
+		counters->misses += shard->counters.misses;
+		counters->stores += shard->counters.stores;
+		counters->evictions += shard->counters.evictions;
+		counters->evicted_bytes += shard->counters.evicted_bytes;
+		release_shard(ctx, shard);
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_reset_store_counters(fz_context *ctx)
+{
+	fz_store *store = ctx->store;
+	int i;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (i = 0; i < store->num_shards; i++)
+	{
+		fz_store_shard *shard = &store->shard[i];
+
+		relock_shard(ctx, shard);
+		memset(&shard->counters, 0, sizeof(shard->counters));
+		release_shard(ctx, shard);
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_set_store_type_limit(fz_context *ctx, const char *name, size_t max)
+{
+	fz_store *store = ctx->store;
+	char *copy;
+	int i;
+
+	if (store == NULL)
+		return;
+
+	copy = fz_strdup(ctx, name);
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (i = 0; i < store->num_types; i++)
+		if (!strcmp(store->type[i].stats.name, name))
+			break;
+	if (i == store->num_types)
+	{
+		if (i == FZ_STORE_MAX_TYPES)
+		{
+			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			fz_free(ctx, copy);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "too many store types to limit %s", name);
+		}
+		store->type[i].type = NULL;
+		store->type[i].name = copy;
+		store->type[i].stats.name = copy;
+		store->num_types++;
+		copy = NULL;
+	}
+	store->type[i].stats.max = max;
+
+	/* Items already in the store are brought within the limit
+	 * as far as possible. */
+	while (max != FZ_STORE_UNLIMITED && store->type[i].stats.bytes > max)
+	{
+		/* ensure_space may drop, then retake the lock */
+		if (ensure_space(ctx, store->type[i].stats.bytes - max, i) == 0)
+			break;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	fz_free(ctx, copy);
+}
+
+void
+fz_get_store_stats(fz_context *ctx, fz_store_stats *stats)
+{
+	fz_store *store = ctx->store;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	stats->max = store->max;
+	stats->size = store->size;
+	stats->num_types = store->num_types;
+	for (i = 0; i < store->num_types; i++)
+		stats->type[i] = store->type[i].stats;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_set_store_disk_cache(fz_context *ctx, const char *dir)
+{
+	fz_store *store = ctx->store;
+	char *copy;
+
+	if (store == NULL)
+		return;
+
+	if (dir == NULL || *dir == 0)
+		return;
+
+	/* Render threads use the directory without holding a lock, so it
+	 * can be set only once, and is only freed with the store. */
+	copy = fz_strdup(ctx, dir);
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (store->disk_cache == NULL)
+	{
+		store->disk_cache = copy;
+		copy = NULL;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	if (copy)
+	{
+		fz_warn(ctx, "store disk cache already set");
+		fz_free(ctx, copy);
+	}
+}
+
+const char *
+fz_store_disk_cache(fz_context *ctx)
+{
+	const char *dir;
+
+	if (ctx->store == NULL)
+		return NULL;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	dir = ctx->store->disk_cache;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return dir;
 }
 
 fz_store *
@@ -714,28 +1355,43 @@ fz_keep_store_context(fz_context *ctx)
 void
 fz_drop_store_context(fz_context *ctx)
 {
+	int i;
+
 	if (!ctx)
 		return;
 	if (fz_drop_imp(ctx, ctx->store, &ctx->store->refs))
 	{
 		fz_empty_store(ctx);
-		fz_drop_hash_table(ctx, ctx->store->hash);
+		for (i = 0; i < ctx->store->num_shards; i++)
+			fz_drop_hash_table(ctx, ctx->store->shard[i].hash);
+		for (i = 0; i < ctx->store->num_types; i++)
+			fz_free(ctx, ctx->store->type[i].name);
+		fz_free(ctx, ctx->store->disk_cache);
 		fz_free(ctx, ctx->store);
 		ctx->store = NULL;
 	}
 }
 
+typedef struct
+{
+	fz_output *out;
+	fz_store_shard *shard;
+} fz_debug_store_state;
+
 static void
-fz_debug_store_item(fz_context *ctx, void *state, void *key_, int keylen, void *item_)
+fz_debug_store_item(fz_context *ctx, void *state_, void *key_, int keylen, void *item_)
 {
+	fz_debug_store_state *state = state_;
 	unsigned char *key = key_;
 	fz_item *item = item_;
 	int i;
 	char buf[256];
-	fz_output *out = (fz_output *)state;
+	fz_output *out = state->out;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	release_shard(ctx, state->shard);
 	item->type->format_key(ctx, buf, sizeof buf, item->key);
 	fz_lock(ctx, FZ_LOCK_ALLOC);
+	relock_shard(ctx, state->shard);
 	fz_write_printf(ctx, out, "STORE\thash[");
 	for (i=0; i < keylen; ++i)
 		fz_write_printf(ctx, out,"%02x", key[i]);
@@ -749,35 +1405,66 @@ fz_debug_store_locked(fz_context *ctx, fz_output *out)
 	char buf[256];
 	fz_store *store = ctx->store;
 	size_t list_total = 0;
+	int i;
 
 	fz_write_printf(ctx, out, "STORE\t-- resource store contents --\n");
 
-	for (item = store->head; item; item = next)
+	for (i = 0; i < store->num_shards; i++)
 	{
-		next = item->next;
-		if (next)
-		{
-			(void)Memento_takeRef(next->val);
-			next->val->refs++;
-		}
-		fz_unlock(ctx, FZ_LOCK_ALLOC);
-		item->type->format_key(ctx, buf, sizeof buf, item->key);
-		fz_lock(ctx, FZ_LOCK_ALLOC);
-		fz_write_printf(ctx, out, "STORE\tstore[*][refs=%d][size=%d] key=%s val=%p\n",
-				item->val->refs, (int)item->size, buf, (void *)item->val);
-		list_total += item->size;
-		if (next)
+		fz_store_shard *shard = &store->shard[i];
+
+		if (store->num_shards > 1)
+			fz_write_printf(ctx, out, "STORE\t-- shard %d --\n", i);
+
+		relock_shard(ctx, shard);
+		for (item = shard->head ? shard->head : shard->probation_head; item; item = next)
 		{
-			(void)Memento_dropRef(next->val);
-			next->val->refs--;
+			next = item->next;
+			if (next == NULL && !item->probation)
+				next = shard->probation_head;
+			if (next)
+			{
+				(void)Memento_takeRef(next->val);
+				next->val->refs++;
+			}
+			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			release_shard(ctx, shard);
+			item->type->format_key(ctx, buf, sizeof buf, item->key);
+			fz_lock(ctx, FZ_LOCK_ALLOC);
+			relock_shard(ctx, shard);
+			fz_write_printf(ctx, out, "STORE\tstore[*][refs=%d][size=%d] key=%s val=%p\n",
+					item->val->refs, (int)item->size, buf, (void *)item->val);
+			list_total += item->size;
+			if (next)
+			{
+				(void)Memento_dropRef(next->val);
+				next->val->refs--;
+			}
 		}
+		release_shard(ctx, shard);
 	}
 
 	fz_write_printf(ctx, out, "STORE\t-- resource store hash contents --\n");
-	fz_hash_for_each(ctx, store->hash, out, fz_debug_store_item);
+	for (i = 0; i < store->num_shards; i++)
+	{
+		fz_debug_store_state state;
+
+		state.out = out;
+		state.shard = &store->shard[i];
+		relock_shard(ctx, state.shard);
+		fz_hash_for_each(ctx, state.shard->hash, &state, fz_debug_store_item);
+		release_shard(ctx, state.shard);
+	}
 	fz_write_printf(ctx, out, "STORE\t-- end --\n");
 
 	fz_write_printf(ctx, out, "STORE\tmax=%zu, size=%zu, actual size=%zu\n", store->max, store->size, list_total);
+	for (i = 0; i < store->num_types; i++)
+	{
+		fz_store_type_stats *stats = &store->type[i].stats;
+		fz_write_printf(ctx, out, "STORE\ttype=%s items=%d bytes=%zu max=%zu hits=%lu misses=%lu evictions=%lu scavenges=%lu\n",
+			stats->name, stats->items, stats->bytes, stats->max,
+			stats->hits, stats->misses, stats->evictions, stats->scavenges);
+	}
 }
 
 void
@@ -810,6 +1497,9 @@ fz_debug_store(fz_context *ctx, fz_output *out)
 	momentarily, which means we have to start the scan process all over again, so
 	we repeat. This guarantees we only evict a minimum of blocks, but does mean we
 	scan more blocks than we'd ideally like.
+
+	For a sharded store, each shard has its own LRU list, so we apply the above to
+	one shard at a time, moving on to the next shard after each eviction.
  */
 static int
 scavenge(fz_context *ctx, size_t tofree)
@@ -817,6 +1507,7 @@ scavenge(fz_context *ctx, size_t tofree)
 	fz_store *store = ctx->store;
 	size_t freed = 0;
 	fz_item *item;
+	int i, n = store->num_shards;
 
 	if (store->scavenging)
 		return 0;
@@ -825,34 +1516,62 @@ scavenge(fz_context *ctx, size_t tofree)
 
 	do
 	{
-		/* Count through a suffix of objects in the store until
-		 * we find enough to give us what we need to evict. */
-		size_t suffix_size = 0;
+		fz_store_shard *shard = NULL;
 		fz_item *largest = NULL;
+		int aged = 0;
 
-		for (item = store->tail; item; item = item->prev)
+		for (i = 0; i < n && largest == NULL; i++)
 		{
-			if (item->val->refs == 1 && (item->val->droppable == NULL || item->val->droppable(ctx, item->val)))
+			/* Count through a suffix of objects in the store until
+			 * we find enough to give us what we need to evict. */
+			size_t suffix_size = 0;
+
+			shard = &store->shard[(store->evict_shard + i) % n];
+			relock_shard(ctx, shard);
+			for (item = oldest_item(shard); item; item = next_oldest_item(shard, item))
 			{
-				/* This one is evictable */
-				suffix_size += item->size;
-				if (largest == NULL || item->size > largest->size)
-					largest = item;
-				if (suffix_size >= tofree - freed)
-					break;
+				if (item->val->refs == 1 && (item->val->droppable == NULL || item->val->droppable(ctx, item->val)))
+				{
+					if (shard->policy == FZ_STORE_POLICY_COST && item->credit > 0)
+					{
+						/* Costly items survive a number of passes. */
+						item->credit--;
+						aged = 1;
+						continue;
+					}
+
+					/* This one is evictable */
+					suffix_size += item->size;
+					if (largest == NULL || item->size > largest->size)
+						largest = item;
+					if (suffix_size >= tofree - freed)
+						break;
+				}
 			}
+			if (largest == NULL)
+				release_shard(ctx, shard);
 		}
 
-		/* If there are no evictable blocks, we can't find anything to free. */
+		/* If there are no evictable blocks, we can't find anything to
+		 * free, unless some costly ones just need another pass. */
 		if (largest == NULL)
+		{
+			if (aged)
+				continue;
 			break;
+		}
+		store->evict_shard = (store->evict_shard + i) % n;
 
 		/* Free largest. */
 		if (freed == 0) {
 			FZ_LOG_DUMP_STORE(ctx, "Before scavenge:\n");
 		}
 		freed += largest->size;
-		evict(ctx, largest); /* Drops then retakes lock */
+		shard->counters.evictions++;
+		shard->counters.evicted_bytes += largest->size;
+		if (largest->slot >= 0)
+			store->type[largest->slot].stats.scavenges++;
+		evict(ctx, shard, largest); /* Drops then retakes lock */
 	}
 	while (freed < tofree);
 
@@ -1008,6 +1727,7 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 {
 	fz_store *store;
 	fz_item *item, *prev, *remove;
+	int i;
 
 	store = ctx->store;
 	if (store == NULL)
@@ -1017,61 +1737,29 @@ void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const f
 
 	/* Filter the items */
 	remove = NULL;
-	for (item = store->tail; item; item = prev)
+	for (i = 0; i < store->num_shards; i++)
 	{
-		prev = item->prev;
-		if (item->type != type)
-			continue;
-
-		if (fn(ctx, arg, item->key) == 0)
-			continue;
-
-		/* We have to drop it */
-		store->size -= item->size;
-
-		/* Unlink from the linked list */
-		if (item->next)
-			item->next->prev = item->prev;
-		else
-			store->tail = item->prev;
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			store->head = item->next;
+		fz_store_shard *shard = &store->shard[i];
 
-		/* Remove from the hash table */
-		if (item->type->make_hash_key)
+		relock_shard(ctx, shard);
+		for (item = oldest_item(shard); item; item = prev)
 		{
-			fz_store_hash hash = { NULL };
-			hash.drop = item->val->drop;
-			if (item->type->make_hash_key(ctx, &hash, item->key))
-				fz_hash_remove(ctx, store->hash, &hash);
-		}
+			prev = next_oldest_item(shard, item);
+			if (item->type != type)
+				continue;
 
-		/* Store whether to drop this value or not in 'prev' */
-		if (item->val->refs > 0)
-			(void)Memento_dropRef(item->val);
-		item->prev = (item->val->refs > 0 && --item->val->refs == 0) ? item : NULL;
+			if (fn(ctx, arg, item->key) == 0)
+				continue;
 
-		/* Store it in our removal chain - just singly linked */
-		item->next = remove;
-		remove = item;
+			/* We have to drop it */
+			unlink_for_removal(ctx, store, shard, item, &remove);
+		}
+		release_shard(ctx, shard);
 	}
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	/* Now drop the remove chain */
-	for (item = remove; item != NULL; item = remove)
-	{
-		remove = item->next;
-
-		/* Drop a reference to the value (freeing if required) */
-		if (item->prev) /* See above for our abuse of prev here */
-			item->val->drop(ctx, item->val);
-
-		/* Always drops the key and drop the item */
-		item->type->drop_key(ctx, item->key);
-		fz_free(ctx, item);
-	}
+	free_removal_chain(ctx, remove);
 }
 
 void fz_defer_reap_start(fz_context *ctx)
@@ -35,9 +35,15 @@
 #include <windows.h>
 #include <wchar.h>
 #else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
+static fz_stream *map_file(fz_context *ctx, const char *name, const char **why);
+static void drop_mapped_file(fz_context *ctx, void *state_);
+
 int
 fz_file_exists(fz_context *ctx, const char *path)
 {
@@ -120,6 +126,16 @@ typedef struct
 	unsigned char buffer[4096];
 } fz_file_stream;
 
+typedef struct
+{
+	unsigned char *data;
+	size_t len;
+	char *filename;
+#ifdef _WIN32
+	HANDLE map;
+#endif
+} fz_mapped_file;
+
 static int next_file(fz_context *ctx, fz_stream *stm, size_t n)
 {
 	fz_file_stream *state = stm->state;
@@ -255,6 +271,15 @@ fz_stream *
 fz_open_file(fz_context *ctx, const char *name)
 {
 	FILE *file;
+	const char *why;
+
+	if (ctx->mmap_files)
+	{
+		fz_stream *stm = map_file(ctx, name, &why);
+		if (stm)
+			return stm;
+	}
+
 #ifdef _WIN32
 	file = fz_fopen_utf8(name, "rb");
 #else
@@ -283,6 +308,15 @@ fz_stream *
 fz_try_open_file(fz_context *ctx, const char *name)
 {
 	FILE *file;
+	const char *why;
+
+	if (ctx->mmap_files)
+	{
+		fz_stream *stm = map_file(ctx, name, &why);
+		if (stm)
+			return stm;
+	}
+
 #ifdef _WIN32
 	file = fz_fopen_utf8(name, "rb");
 #else
@@ -308,6 +342,8 @@ fz_open_file_w(fz_context *ctx, const wchar_t *name)
 const char *
 fz_stream_filename(fz_context *ctx, fz_stream *stm)
 {
+	if (stm && stm->drop == drop_mapped_file)
+		return ((fz_mapped_file *)stm->state)->filename;
 	if (!stm || stm->next != next_file)
 		return NULL;
 
@@ -382,3 +418,197 @@ fz_open_memory(fz_context *ctx, const unsigned char *data, size_t len)
 
 	return stm;
 }
+
+static void drop_slice(fz_context *ctx, void *state_)
+{
+	fz_drop_stream(ctx, (fz_stream *)state_);
+}
+
+fz_stream *
+fz_open_memory_slice(fz_context *ctx, fz_stream *chain, int64_t offset, uint64_t len)
+{
+	unsigned char *base;
+	uint64_t size;
+	fz_stream *stm;
+
+	if (chain == NULL || chain->next != next_buffer || offset < 0)
+		return NULL;
+
+	/* Memory streams hold all their data between wp - pos and wp. */
+	size = (uint64_t)chain->pos;
+	base = chain->wp - (size_t)size;
+	if ((uint64_t)offset > size)
+		offset = (int64_t)size;
+	if (len > size - (uint64_t)offset)
+		len = size - (uint64_t)offset;
+
+	stm = fz_new_stream(ctx, fz_keep_stream(ctx, chain), next_buffer, drop_slice);
+	stm->seek = seek_buffer;
+
+	stm->rp = base + offset;
+	stm->wp = stm->rp + len;
+
+	stm->pos = (int64_t)len;
+
+	return stm;
+}
+
+/* Memory mapped file stream */
+
+static void drop_mapped_file(fz_context *ctx, void *state_)
+{
+	fz_mapped_file *state = state_;
+	if (state->data)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(state->data);
+		CloseHandle(state->map);
+#else
+		munmap(state->data, state->len);
+#endif
+	}
+	fz_free(ctx, state->filename);
+	fz_free(ctx, state);
+}
+
+/* Map a regular file into memory, and wrap it in a stream. Returns
+ * NULL (with the reason in *why) if the file cannot be mapped. */
+static fz_stream *
+map_file(fz_context *ctx, const char *name, const char **why)
+{
+	fz_mapped_file *state = NULL;
+	unsigned char *data = NULL;
+	size_t len = 0;
+	fz_stream *stm;
+#ifdef _WIN32
+	wchar_t *wname;
+	HANDLE file;
+	HANDLE map = NULL;
+	LARGE_INTEGER size;
+
+	wname = fz_wchar_from_utf8(ctx, name);
+	file = CreateFileW(wname, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	fz_free(ctx, wname);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		*why = "cannot open file";
+		return NULL;
+	}
+	if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		*why = "not a regular file";
+		return NULL;
+	}
+	if ((uint64_t)size.QuadPart > SIZE_MAX)
+	{
+		CloseHandle(file);
+		*why = "file too large to map";
+		return NULL;
+	}
+	len = (size_t)size.QuadPart;
+	if (len > 0)
+	{
+		map = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map)
+		{
+			data = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			if (!data)
+				CloseHandle(map);
+		}
+		if (!data)
+		{
+			CloseHandle(file);
+			*why = "cannot map file";
+			return NULL;
+		}
+	}
+	CloseHandle(file);
+#else
+	struct stat info;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+	{
+		*why = strerror(errno);
+		return NULL;
+	}
+	if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode))
+	{
+		close(fd);
+		*why = "not a regular file";
+		return NULL;
+	}
+	if ((uint64_t)info.st_size > SIZE_MAX)
+	{
+		close(fd);
+		*why = "file too large to map";
+		return NULL;
+	}
+	len = (size_t)info.st_size;
+	if (len > 0)
+	{
+		data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close(fd);
+			*why = strerror(errno);
+			return NULL;
+		}
+	}
+	close(fd);
+#endif
+
+	fz_try(ctx)
+	{
+		state = fz_malloc_struct(ctx, fz_mapped_file);
+		state->data = data;
+		state->len = len;
+#ifdef _WIN32
+		state->map = map;
+#endif
+		state->filename = fz_strdup(ctx, name);
+	}
+	fz_catch(ctx)
+	{
+		if (state)
+			drop_mapped_file(ctx, state);
+		else if (data)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(data);
+			CloseHandle(map);
+#else
+			munmap(data, len);
+#endif
+		}
+		fz_rethrow(ctx);
+	}
+
+	stm = fz_new_stream(ctx, state, next_buffer, drop_mapped_file);
+	stm->seek = seek_buffer;
+
+	stm->rp = data;
+	stm->wp = data + len;
+
+	stm->pos = (int64_t)len;
+
+	return stm;
+}
+
+fz_stream *
+fz_open_file_mmap(fz_context *ctx, const char *name)
+{
+	const char *why = "unknown error";
+	fz_stream *stm = map_file(ctx, name, &why);
+	if (stm == NULL)
+		fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot map %s: %s", name, why);
+	return stm;
+}
+
+void
+fz_set_mmap_files(fz_context *ctx, int enable)
+{
+	ctx->mmap_files = enable;
+}
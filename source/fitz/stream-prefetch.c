@@ -0,0 +1,384 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+#include "mupdf/fitz.h"
+
+#include <string.h>
+
+/*
+ * Prefetching streams.
+ *
+ * The file is read in aligned blocks of PREFETCH_BLOCK bytes. Hints
+ * queue up the blocks they cover; fz_prefetch_work (running on some
+ * other thread) takes them from the queue one at a time, and reads
+ * them from its own stream into a small cache of blocks. Reads from
+ * the prefetch stream copy out of that cache when they can, and read
+ * from their own stream when they cannot.
+ *
+ * Everything shared is protected by FZ_LOCK_ALLOC, which is never
+ * held while reading from a file. A block being read into is marked
+ * PENDING, and a block being copied out of is pinned, so that neither
+ * can be reused for another block in the meantime.
+ */
+
+#define PREFETCH_BLOCK (64 << 10)
+#define PREFETCH_SLOTS 64
+#define PREFETCH_QUEUE 256
+
+enum
+{
+	SLOT_EMPTY,
+	SLOT_PENDING,
+	SLOT_READY
+};
+
+typedef struct
+{
+	int64_t block;
+	int state;
+	int pins;
+	size_t len;
+	unsigned int used; /* For LRU reuse. */
+	unsigned char *data;
+} fz_prefetch_slot;
+
+struct fz_prefetch
+{
+	int refs;
+	int closed;
+	fz_stream *source;
+	fz_prefetch_wake_fn *wake;
+	void *wake_arg;
+
+	unsigned int clock;
+	fz_prefetch_slot slot[PREFETCH_SLOTS];
+
+	int head, len;
+	int64_t queue[PREFETCH_QUEUE];
+
+	/* Statistics. */
+	int hits, misses;
+};
+
+typedef struct
+{
+	fz_prefetch *pf;
+	fz_stream *chain;
+	int64_t last_block;
+	unsigned char buffer[PREFETCH_BLOCK];
+} fz_prefetch_stream;
+
+fz_prefetch *
+fz_new_prefetch(fz_context *ctx, fz_stream *source, fz_prefetch_wake_fn *wake, void *arg)
+{
+	fz_prefetch *pf = fz_malloc_struct(ctx, fz_prefetch);
+	int i;
+
+	pf->refs = 1;
+	pf->source = fz_keep_stream(ctx, source);
+	pf->wake = wake;
+	pf->wake_arg = arg;
+	for (i = 0; i < PREFETCH_SLOTS; i++)
+		pf->slot[i].block = -1;
+
+	return pf;
+}
+
+fz_prefetch *
+fz_keep_prefetch(fz_context *ctx, fz_prefetch *pf)
+{
+	return fz_keep_imp(ctx, pf, &pf->refs);
+}
+
+void
+fz_drop_prefetch(fz_context *ctx, fz_prefetch *pf)
+{
+	int i;
+
+	if (fz_drop_imp(ctx, pf, &pf->refs))
+	{
+		for (i = 0; i < PREFETCH_SLOTS; i++)
+			fz_free(ctx, pf->slot[i].data);
+		fz_drop_stream(ctx, pf->source);
+		fz_free(ctx, pf);
+	}
+}
+
+void
+fz_close_prefetch(fz_context *ctx, fz_prefetch *pf)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	pf->closed = 1;
+	pf->len = 0;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	if (pf->wake)
+		pf->wake(pf->wake_arg);
+}
+
+void
+fz_prefetch_stats(fz_context *ctx, fz_prefetch *pf, int *hits, int *misses)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	*hits = pf->hits;
+	*misses = pf->misses;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+/* Call with FZ_LOCK_ALLOC held. */
+static fz_prefetch_slot *
+find_slot(fz_prefetch *pf, int64_t block)
+{
+	int i;
+	for (i = 0; i < PREFETCH_SLOTS; i++)
+		if (pf->slot[i].block == block)
+			return &pf->slot[i];
+	return NULL;
+}
+
+/* Call with FZ_LOCK_ALLOC held. Returns 1 if the block was queued. */
+static int
+queue_block(fz_prefetch *pf, int64_t block)
+{
+	int i;
+
+	if (pf->closed || pf->len == PREFETCH_QUEUE)
+		return 0;
+	if (find_slot(pf, block))
+		return 0;
+	for (i = 0; i < pf->len; i++)
+		if (pf->queue[(pf->head + i) % PREFETCH_QUEUE] == block)
+			return 0;
+
+	pf->queue[(pf->head + pf->len) % PREFETCH_QUEUE] = block;
+	pf->len++;
+	return 1;
+}
+
+static void
+hint_blocks(fz_context *ctx, fz_prefetch *pf, int64_t first, int64_t last)
+{
+	int queued = 0;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	for (; first <= last; first++)
+		queued |= queue_block(pf, first);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	if (queued && pf->wake)
+		pf->wake(pf->wake_arg);
+}
+
+int
+fz_prefetch_work(fz_context *ctx, fz_prefetch *pf)
+{
+	fz_prefetch_slot *slot = NULL;
+	int64_t block = 0;
+	size_t n = 0;
+	int i;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (pf->closed)
+	{
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		return -1;
+	}
+	while (pf->len > 0 && slot == NULL)
+	{
+		block = pf->queue[pf->head];
+		pf->head = (pf->head + 1) % PREFETCH_QUEUE;
+		pf->len--;
+
+		/* Read in the meantime? */
+		if (find_slot(pf, block))
+			continue;
+
+		/* Reuse the least recently used block that is not busy. */
+		for (i = 0; i < PREFETCH_SLOTS; i++)
+		{
+			fz_prefetch_slot *s = &pf->slot[i];
+			if (s->state == SLOT_PENDING || s->pins)
+				continue;
+			if (slot == NULL || s->state == SLOT_EMPTY || (slot->state != SLOT_EMPTY && s->used < slot->used))
+				slot = s;
+		}
+		if (slot == NULL)
+			break;
+		slot->block = block;
+		slot->state = SLOT_PENDING;
+		slot->len = 0;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	if (slot == NULL)
+		return 0;
+
+	fz_var(n);
+
+	fz_try(ctx)
+	{
+		if (slot->data == NULL)
+			slot->data = Memento_label(fz_malloc(ctx, PREFETCH_BLOCK), "prefetch_block");
+		fz_seek(ctx, pf->source, block * PREFETCH_BLOCK, 0);
+		n = fz_read(ctx, pf->source, slot->data, PREFETCH_BLOCK);
+	}
+	fz_catch(ctx)
+	{
+		/* The reader will find out for itself. */
+		fz_report_error(ctx);
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		slot->block = -1;
+		slot->state = SLOT_EMPTY;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+		return 1;
+	}
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	slot->len = n;
+	slot->state = SLOT_READY;
+	slot->used = ++pf->clock;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	return 1;
+}
+
+static int
+next_prefetch(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	fz_prefetch_stream *state = stm->state;
+	fz_prefetch *pf = state->pf;
+	fz_prefetch_slot *slot;
+	int64_t pos = stm->pos;
+	int64_t block = pos / PREFETCH_BLOCK;
+	size_t within = (size_t)(pos % PREFETCH_BLOCK);
+	size_t n = 0;
+	int sequential = (block == state->last_block + 1);
+
+	state->last_block = block;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	slot = find_slot(pf, block);
+	if (slot && slot->state == SLOT_READY)
+	{
+		slot->pins++;
+		slot->used = ++pf->clock;
+		pf->hits++;
+	}
+	else
+	{
+		slot = NULL;
+		pf->misses++;
+	}
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	/* Reading straight through; keep a block ahead. */
+	if (sequential)
+		hint_blocks(ctx, pf, block + 1, block + 1);
+
+	if (slot)
+	{
+		if (within < slot->len)
+		{
+			n = slot->len - within;
+			memcpy(state->buffer, slot->data + within, n);
+		}
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		slot->pins--;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+	}
+	else
+	{
+		fz_seek(ctx, state->chain, pos, 0);
+		n = fz_read(ctx, state->chain, state->buffer, PREFETCH_BLOCK - within);
+	}
+
+	stm->rp = state->buffer;
+	stm->wp = state->buffer + n;
+	stm->pos += (int64_t)n;
+
+	if (n == 0)
+		return EOF;
+	return *stm->rp++;
+}
+
+static void
+seek_prefetch(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
+{
+	fz_prefetch_stream *state = stm->state;
+
+	if (whence == 2)
+	{
+		fz_seek(ctx, state->chain, offset, 2);
+		offset = fz_tell(ctx, state->chain);
+	}
+	if (offset < 0)
+		fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot seek before start of stream");
+
+	stm->pos = offset;
+	stm->rp = state->buffer;
+	stm->wp = state->buffer;
+}
+
+static void
+drop_prefetch_stream(fz_context *ctx, void *state_)
+{
+	fz_prefetch_stream *state = state_;
+	fz_drop_stream(ctx, state->chain);
+	fz_drop_prefetch(ctx, state->pf);
+	fz_free(ctx, state);
+}
+
+fz_stream *
+fz_open_prefetch(fz_context *ctx, fz_prefetch *pf, fz_stream *chain)
+{
+	fz_prefetch_stream *state;
+	fz_stream *stm;
+
+	state = fz_malloc_struct(ctx, fz_prefetch_stream);
+	state->pf = fz_keep_prefetch(ctx, pf);
+	state->chain = fz_keep_stream(ctx, chain);
+	state->last_block = -2;
+
+	stm = fz_new_stream(ctx, state, next_prefetch, drop_prefetch_stream);
+	stm->seek = seek_prefetch;
+	stm->pos = fz_tell(ctx, chain);
+
+	return stm;
+}
+
+void
+fz_prefetch_stream_range(fz_context *ctx, fz_stream *stm, int64_t offset, int64_t len)
+{
+	fz_prefetch_stream *state;
+
+	if (!fz_is_prefetch_stream(ctx, stm) || offset < 0 || len <= 0)
+		return;
+
+	state = stm->state;
+	hint_blocks(ctx, state->pf, offset / PREFETCH_BLOCK, (offset + len - 1) / PREFETCH_BLOCK);
+}
+
+int
+fz_is_prefetch_stream(fz_context *ctx, fz_stream *stm)
+{
+	return stm != NULL && stm->next == next_prefetch;
+}
@@ -248,8 +248,20 @@ fz_mkdir(char *path)
 	return ret;
 }
 
+int64_t
+fz_time_us(void)
+{
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (int64_t)(count.QuadPart / freq.QuadPart * 1000000 + count.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+}
+
 #else
 
+#include <sys/time.h>
+
 int64_t
 fz_stat_ctime(const char *path)
 {
@@ -274,4 +286,13 @@ fz_mkdir(char *path)
 	return mkdir(path, S_IRWXU | S_IRWXG | S_IRWXO);
 }
 
+int64_t
+fz_time_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 #endif /* _WIN32 */
@@ -481,6 +481,9 @@ void pdf_clean_file(fz_context *ctx, char *infile, char *outfile, char *password
 			if (!pdf_authenticate_password(ctx, pdf, password))
 				fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot authenticate password: %s", infile);
 
+		if (opts && opts->preload)
+			opts->preload(ctx, pdf, opts->preload_arg);
+
 		len = cap = 0;
 
 		/* Only retain the specified subset of the pages */
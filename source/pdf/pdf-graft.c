@@ -22,6 +22,7 @@
 
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
+#include "pdf-imp.h"
 
 #include <assert.h>
 
@@ -73,10 +74,11 @@ pdf_graft_object(fz_context *ctx, pdf_document *dst, pdf_obj *obj)
 	pdf_document *src;
 	pdf_graft_map *map;
 
-	/* Primitive objects are not bound to a document, so can be re-used as is. */
+	/* Primitive objects are not bound to a document, so can be re-used as is
+	 * (unless they are in the source document's arena). */
 	src = pdf_get_bound_document(ctx, obj);
 	if (src == NULL)
-		return pdf_keep_obj(ctx, obj);
+		return pdf_keep_unbound_obj(ctx, obj);
 
 	map = pdf_new_graft_map(ctx, dst);
 
@@ -102,10 +104,11 @@ pdf_graft_mapped_object(fz_context *ctx, pdf_graft_map *map, pdf_obj *obj)
 	pdf_document *src;
 	int new_num, src_num, len, i;
 
-	/* Primitive objects are not bound to a document, so can be re-used as is. */
+	/* Primitive objects are not bound to a document, so can be re-used as is
+	 * (unless they are in the source document's arena). */
 	src = pdf_get_bound_document(ctx, obj);
 	if (!src)
-		return pdf_keep_obj(ctx, obj);
+		return pdf_keep_unbound_obj(ctx, obj);
 
 	if (map->src && src != map->src)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "grafted objects must all belong to the same source document");
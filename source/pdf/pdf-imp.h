@@ -30,4 +30,26 @@
 
 void pdf_repair_xref_aux(fz_context *ctx, pdf_document *doc, void (*mid)(fz_context *ctx, pdf_document *doc));
 
+int pdf_stream_has_crypt(fz_context *ctx, pdf_obj *stm);
+
+/* Object arenas (see pdf_open_options). */
+pdf_obj_arena *pdf_new_obj_arena(fz_context *ctx);
+void pdf_drop_obj_arena(fz_context *ctx, pdf_obj_arena *arena);
+
+/* Objects made between these calls (which nest) go into doc's arena,
+ * if it has one. Only use them around parsing objects from the file. */
+void pdf_open_obj_arena(fz_context *ctx, pdf_document *doc);
+void pdf_close_obj_arena(fz_context *ctx, pdf_document *doc);
+
+/* Like pdf_new_int and friends, but made in doc's arena if it is open. */
+pdf_obj *pdf_new_parsed_int(fz_context *ctx, pdf_document *doc, int64_t i);
+pdf_obj *pdf_new_parsed_real(fz_context *ctx, pdf_document *doc, float f);
+pdf_obj *pdf_new_parsed_string(fz_context *ctx, pdf_document *doc, const char *str, size_t len);
+
+int pdf_obj_in_arena(fz_context *ctx, pdf_obj *obj);
+
+/* Keep obj, or copy it if it is a number or string in an arena (and
+ * so cannot outlive its document, but does not say which that is). */
+pdf_obj *pdf_keep_unbound_obj(fz_context *ctx, pdf_obj *obj);
+
 #endif /* MUPDF_PDF_PDF_IMP_H */
@@ -67,6 +67,12 @@ static inline int lex_byte(fz_context *ctx, fz_stream *stm)
 #define lex_byte(C,S) fz_read_byte(C,S)
 #endif
 
+/* The fast paths would bypass the dump. (scripts/lexcheck.c also
+ * builds the lexer without them, to check them against.) */
+#ifdef DUMP_LEXER_STREAM
+#define PDF_LEX_NO_FAST_PATHS
+#endif
+
 static inline int iswhite(int ch)
 {
 	return
@@ -91,10 +97,122 @@ static inline int unhex(int ch)
 	return 0;
 }
 
+/*
+ * Fast paths.
+ *
+ * Most tokens lie wholly within the data already buffered in the
+ * stream, so rather than read them a byte at a time we find where they
+ * end by classifying the buffered bytes (16 at a time, with SSE or
+ * NEON), and take them in one go. Any token that might need special
+ * handling (because it runs to the end of the buffer, is too long for
+ * the lexbuf, or holds anything unusual) is left, unread, to the byte
+ * at a time code.
+ */
+
+enum
+{
+	LEX_WHITE = 1,
+	LEX_DELIM = 2,
+	LEX_NUMBER = 4, /* '0' to '9' and '.' */
+	LEX_EOL = 8,
+	LEX_HASH = 16,
+	LEX_SPECIAL = LEX_WHITE | LEX_DELIM | LEX_HASH
+};
+
+static const unsigned char lex_class[256] =
+{
+	1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 9, 0, 1, 9, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 0, 0, 16, 0, 2, 0, 0, 2, 2, 0, 0, 0, 0, 4, 2,
+	4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 2, 0, 2, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 2, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 2, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+#if ARCH_HAS_SSE || ARCH_HAS_NEON
+
+/* Index of the lowest set bit of a non-zero mask. */
+static fz_forceinline int
+lex_ctz(uint64_t m)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(m);
+#else
+	int n = 0;
+	while (!(m & 1))
+	{
+		m >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+#if ARCH_HAS_SSE
+#include "pdf-lex_sse.h"
+#define lex_span_number_simd lex_span_number_sse
+#define lex_span_white_simd lex_span_white_sse
+#define lex_span_regular_simd lex_span_regular_sse
+#define lex_span_line_simd lex_span_line_sse
+#else
+#include "pdf-lex_neon.h"
+#define lex_span_number_simd lex_span_number_neon
+#define lex_span_white_simd lex_span_white_neon
+#define lex_span_regular_simd lex_span_regular_neon
+#define lex_span_line_simd lex_span_line_neon
+#endif
+
+#endif
+
+/* Count the bytes from s (up to e) whose class, masked by mask, is
+ * match. The only spans used are of LEX_NUMBER or LEX_WHITE bytes
+ * (match == mask), and of bytes that are not LEX_SPECIAL or not
+ * LEX_EOL (match == 0); the SIMD cores are picked on mask alone. */
+static fz_forceinline size_t
+lex_span(const unsigned char *s, const unsigned char *e, int mask, int match)
+{
+	const unsigned char *p = s;
+#if ARCH_HAS_SSE || ARCH_HAS_NEON
+	while (e - p >= 16)
+	{
+		int n;
+		if (mask == LEX_NUMBER)
+			n = lex_span_number_simd(p);
+		else if (mask == LEX_WHITE)
+			n = lex_span_white_simd(p);
+		else if (mask == LEX_SPECIAL)
+			n = lex_span_regular_simd(p);
+		else
+			n = lex_span_line_simd(p);
+		p += n;
+		if (n < 16)
+			return p - s;
+	}
+#endif
+	while (p < e && (lex_class[*p] & mask) == match)
+		p++;
+	return p - s;
+}
+
 static void
 lex_white(fz_context *ctx, fz_stream *f)
 {
 	int c;
+#ifndef PDF_LEX_NO_FAST_PATHS
+	f->rp += lex_span(f->rp, f->wp, LEX_WHITE, LEX_WHITE);
+	if (f->rp < f->wp)
+		return;
+#endif
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c <= 32) && (iswhite(c)));
@@ -106,6 +224,14 @@ static void
 lex_comment(fz_context *ctx, fz_stream *f)
 {
 	int c;
+#ifndef PDF_LEX_NO_FAST_PATHS
+	f->rp += lex_span(f->rp, f->wp, LEX_EOL, 0);
+	if (f->rp < f->wp)
+	{
+		f->rp++;
+		return;
+	}
+#endif
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c != '\012') && (c != '\015') && (c != EOF));
@@ -184,6 +310,74 @@ static int64_t fast_atoi(char *s)
 	return neg ? -i : i;
 }
 
+#ifndef PDF_LEX_NO_FAST_PATHS
+static const double lex_pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8 };
+
+/*
+ * Read a number that runs from c (already read) over digits and at
+ * most one point to a white space or delimiter within the buffer,
+ * straight from the buffer. Reals of no more than 8 digits are the
+ * quotient of two exact doubles, which rounds to the same float as
+ * fz_atof gives; longer ones are left to lex_number, as is anything
+ * else it would not take in one straight run. Returns PDF_TOK_ERROR,
+ * having read nothing more, for those.
+ */
+static int
+lex_number_fast(fz_stream *f, pdf_lexbuf *buf, int c)
+{
+	const unsigned char *p = f->rp;
+	size_t n = lex_span(p, f->wp, LEX_NUMBER, LEX_NUMBER);
+	const unsigned char *end = p + n;
+	int64_t i = 0;
+	int digits = 0;
+	int point = -1;
+
+	if (end == f->wp || !(lex_class[*end] & (LEX_WHITE | LEX_DELIM)) || n + 2 >= buf->size)
+		return PDF_TOK_ERROR;
+
+	if (c == '.')
+		point = 0;
+	else if (c >= '0' && c <= '9')
+	{
+		i = c - '0';
+		digits = 1;
+	}
+	for (; p < end; p++)
+	{
+		if (*p == '.')
+		{
+			if (point >= 0)
+				return PDF_TOK_ERROR;
+			point = digits;
+		}
+		else
+		{
+			/* We deliberately ignore overflow here, as fast_atoi does. */
+			i = i * 10 + (*p - '0');
+			digits++;
+		}
+	}
+
+	if (point >= 0 && (digits == 0 || digits > 8))
+		return PDF_TOK_ERROR;
+
+	buf->scratch[0] = c;
+	memcpy(buf->scratch + 1, f->rp, n);
+	buf->scratch[n + 1] = 0;
+	f->rp += n;
+
+	if (point >= 0)
+	{
+		buf->f = (float)((double)i / lex_pow10[digits - point]);
+		if (c == '-')
+			buf->f = -buf->f;
+		return PDF_TOK_REAL;
+	}
+	buf->i = (c == '-') ? -i : i;
+	return PDF_TOK_INT;
+}
+#endif
+
 static int
 lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 {
@@ -193,6 +387,12 @@ lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 	int neg = (c == '-');
 	int isbad = 0;
 
+#ifndef PDF_LEX_NO_FAST_PATHS
+	int tok = lex_number_fast(f, buf, c);
+	if (tok != PDF_TOK_ERROR)
+		return tok;
+#endif
+
 	*s++ = c;
 
 	c = lex_byte(ctx, f);
@@ -271,6 +471,18 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 	char *e = s + fz_minz(127, lb->size);
 	int c;
 
+#ifndef PDF_LEX_NO_FAST_PATHS
+	size_t n = lex_span(f->rp, f->wp, LEX_SPECIAL, 0);
+	if (f->rp + n < f->wp && (lex_class[f->rp[n]] & (LEX_WHITE | LEX_DELIM)) && s + n < e)
+	{
+		memcpy(s, f->rp, n);
+		s[n] = '\0';
+		lb->len = n;
+		f->rp += n;
+		return;
+	}
+#endif
+
 	while (1)
 	{
 		if (s == e)
@@ -0,0 +1,92 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+
+/* This file is included from pdf-lex.c if NEON cores are allowed.
+ * Each function classifies the 16 bytes at p, and returns how many
+ * of them at the start belong to the class (16 if they all do). */
+
+#include <arm_neon.h>
+
+static fz_forceinline int
+lex_leading_neon(uint8x16_t in)
+{
+	/* Narrow each byte of the mask to a nibble. */
+	uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(in), 4);
+	uint64_t m = ~vget_lane_u64(vreinterpret_u64_u8(n), 0);
+	return m ? lex_ctz(m) >> 2 : 16;
+}
+
+/* '0' to '9' and '.' */
+static fz_forceinline int
+lex_span_number_neon(const unsigned char *p)
+{
+	uint8x16_t x = vld1q_u8(p);
+	uint8x16_t digit = vcleq_u8(vsubq_u8(x, vdupq_n_u8('0')), vdupq_n_u8(9));
+	uint8x16_t dot = vceqq_u8(x, vdupq_n_u8('.'));
+	return lex_leading_neon(vorrq_u8(digit, dot));
+}
+
+static fz_forceinline uint8x16_t
+lex_white_neon(uint8x16_t x)
+{
+	/* 9, 10, 12 and 13 are the bytes from 9 to 13 other than 11. */
+	uint8x16_t w = vcleq_u8(vsubq_u8(x, vdupq_n_u8(9)), vdupq_n_u8(4));
+	w = vbicq_u8(w, vceqq_u8(x, vdupq_n_u8(11)));
+	w = vorrq_u8(w, vceqq_u8(x, vdupq_n_u8(0)));
+	return vorrq_u8(w, vceqq_u8(x, vdupq_n_u8(' ')));
+}
+
+static fz_forceinline int
+lex_span_white_neon(const unsigned char *p)
+{
+	return lex_leading_neon(lex_white_neon(vld1q_u8(p)));
+}
+
+/* Anything but white space, delimiters and '#'. */
+static fz_forceinline int
+lex_span_regular_neon(const unsigned char *p)
+{
+	uint8x16_t x = vld1q_u8(p);
+	uint8x16_t s = lex_white_neon(x);
+	/* '(' and ')' are adjacent. */
+	s = vorrq_u8(s, vcleq_u8(vsubq_u8(x, vdupq_n_u8('(')), vdupq_n_u8(1)));
+	s = vorrq_u8(s, vceqq_u8(x, vdupq_n_u8('<')));
+	s = vorrq_u8(s, vceqq_u8(x, vdupq_n_u8('>')));
+	s = vorrq_u8(s, vceqq_u8(x, vdupq_n_u8('/')));
+	s = vorrq_u8(s, vceqq_u8(x, vdupq_n_u8('%')));
+	s = vorrq_u8(s, vceqq_u8(x, vdupq_n_u8('#')));
+	/* '[' and ']', '{' and '}' differ only in the bit 0x20. */
+	x = vandq_u8(x, vdupq_n_u8(0xDF));
+	s = vorrq_u8(s, vceqq_u8(x, vdupq_n_u8('[')));
+	s = vorrq_u8(s, vceqq_u8(x, vdupq_n_u8(']')));
+	return lex_leading_neon(vmvnq_u8(s));
+}
+
+/* Anything but '\r' and '\n'. */
+static fz_forceinline int
+lex_span_line_neon(const unsigned char *p)
+{
+	uint8x16_t x = vld1q_u8(p);
+	uint8x16_t eol = vorrq_u8(vceqq_u8(x, vdupq_n_u8('\r')), vceqq_u8(x, vdupq_n_u8('\n')));
+	return lex_leading_neon(vmvnq_u8(eol));
+}
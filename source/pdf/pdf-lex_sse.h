@@ -0,0 +1,88 @@
+// Copyright (C) 2004-2024 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 39 Mesa Street, Suite 108A, San Francisco,
+// CA 94129, USA, for further information.
+
+
+/* This file is included from pdf-lex.c if SSE cores are allowed.
+ * Each function classifies the 16 bytes at p, and returns how many
+ * of them at the start belong to the class (16 if they all do). */
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <smmintrin.h>
+
+static fz_forceinline int
+lex_leading_sse(__m128i in)
+{
+	unsigned int m = ~(unsigned int)_mm_movemask_epi8(in) & 0xFFFF;
+	return m ? lex_ctz(m) : 16;
+}
+
+/* '0' to '9' and '.' */
+static fz_forceinline int
+lex_span_number_sse(const unsigned char *p)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)p);
+	__m128i d = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+	__m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	__m128i dot = _mm_cmpeq_epi8(x, _mm_set1_epi8('.'));
+	return lex_leading_sse(_mm_or_si128(digit, dot));
+}
+
+static fz_forceinline int
+lex_span_white_sse(const unsigned char *p)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)p);
+	/* 9, 10, 12 and 13 are the bytes from 9 to 13 other than 11. */
+	__m128i d = _mm_sub_epi8(x, _mm_set1_epi8(9));
+	__m128i w = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(4)), d);
+	w = _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(11)), w);
+	w = _mm_or_si128(w, _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+	w = _mm_or_si128(w, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+	return lex_leading_sse(w);
+}
+
+/* Anything but white space, delimiters and '#'. These 17 bytes are
+ * found by looking up each nibble in a table of bits, one bit per
+ * group of high nibbles (0, 2, 3, and 5 or 7), and checking whether
+ * the two lookups have a bit in common. */
+static fz_forceinline int
+lex_span_regular_sse(const unsigned char *p)
+{
+	const __m128i lo_bits = _mm_setr_epi8(3, 0, 0, 2, 0, 2, 0, 0, 2, 3, 1, 8, 5, 9, 4, 2);
+	const __m128i hi_bits = _mm_setr_epi8(1, 0, 2, 4, 0, 8, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	__m128i x = _mm_loadu_si128((const __m128i *)p);
+	__m128i lo = _mm_shuffle_epi8(lo_bits, _mm_and_si128(x, nibble));
+	__m128i hi = _mm_shuffle_epi8(hi_bits, _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+	return lex_leading_sse(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128()));
+}
+
+/* Anything but '\r' and '\n'. */
+static fz_forceinline int
+lex_span_line_sse(const unsigned char *p)
+{
+	__m128i x = _mm_loadu_si128((const __m128i *)p);
+	__m128i eol = _mm_or_si128(
+		_mm_cmpeq_epi8(x, _mm_set1_epi8('\r')),
+		_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+	return lex_leading_sse(_mm_cmpeq_epi8(eol, _mm_setzero_si128()));
+}
@@ -22,6 +22,7 @@
 
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
+#include "pdf-imp.h"
 
 #include <stdarg.h>
 #include <stdlib.h>
@@ -61,11 +62,20 @@ enum
 	PDF_FLAGS_MEMO_BASE_BOOL = 16
 };
 
+/* Where an object's storage comes from (see the object arenas below). */
+enum
+{
+	PDF_ARENA_OBJ = 1, /* The object itself is in its document's arena. */
+	PDF_ARENA_ITEMS = 2, /* So are the items of an array or dict. */
+	PDF_ARENA_TEXT = 4 /* A string's text is yet to be made, in u.arena. */
+};
+
 struct pdf_obj
 {
 	short refs;
 	unsigned char kind;
 	unsigned char flags;
+	unsigned char arena;
 };
 
 typedef struct
@@ -81,7 +91,11 @@ typedef struct
 typedef struct
 {
 	pdf_obj super;
-	char *text; /* utf8 encoded text string */
+	union
+	{
+		char *text; /* utf8 encoded text string */
+		pdf_obj_arena *arena;
+	} u;
 	size_t len;
 	char buf[FZ_FLEXIBLE_ARRAY];
 } pdf_obj_string;
@@ -170,32 +184,220 @@ struct pdf_journal
 #define ARRAY(obj) ((pdf_obj_array *)(obj))
 #define REF(obj) ((pdf_obj_ref *)(obj))
 
-pdf_obj *
-pdf_new_int(fz_context *ctx, int64_t i)
+/*
+ * Object arenas.
+ *
+ * While a document with an arena is parsing objects from its file, the
+ * objects it makes (other than names, which can outlive the document
+ * as keys in the store) are carved out of a pool, and so are the items
+ * of its arrays and dicts. Arena objects are not reference counted;
+ * they all go at once when the document drops the arena.
+ *
+ * The items of an arena array or dict hold no references either. Any
+ * object from elsewhere that is put into them is kept by the arena
+ * instead (in 'owned'). Before an arena array or dict is edited, it is
+ * given a copy of its items on the heap, which hold references as
+ * usual, and which the arena frees in the end (see 'unshared').
+ */
+
+struct pdf_obj_arena
+{
+	fz_pool *pool;
+	int open;
+	int unshared_len, unshared_cap;
+	pdf_obj **unshared;
+	int owned_len, owned_cap;
+	pdf_obj **owned;
+};
+
+static void pdf_drop_array_items(fz_context *ctx, pdf_obj *obj);
+static void pdf_drop_dict_items(fz_context *ctx, pdf_obj *obj);
+
+pdf_obj_arena *
+pdf_new_obj_arena(fz_context *ctx)
+{
+	pdf_obj_arena *arena = fz_malloc_struct(ctx, pdf_obj_arena);
+	fz_try(ctx)
+		arena->pool = fz_new_pool(ctx);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, arena);
+		fz_rethrow(ctx);
+	}
+	return arena;
+}
+
+void
+pdf_drop_obj_arena(fz_context *ctx, pdf_obj_arena *arena)
+{
+	int i;
+
+	if (!arena)
+		return;
+
+	/* Arena objects may still be looked at until the pool goes. */
+	for (i = 0; i < arena->unshared_len; i++)
+	{
+		if (arena->unshared[i]->kind == PDF_ARRAY)
+			pdf_drop_array_items(ctx, arena->unshared[i]);
+		else
+			pdf_drop_dict_items(ctx, arena->unshared[i]);
+	}
+	for (i = 0; i < arena->owned_len; i++)
+		pdf_drop_obj(ctx, arena->owned[i]);
+
+	fz_free(ctx, arena->unshared);
+	fz_free(ctx, arena->owned);
+	fz_drop_pool(ctx, arena->pool);
+	fz_free(ctx, arena);
+}
+
+void
+pdf_open_obj_arena(fz_context *ctx, pdf_document *doc)
+{
+	if (doc->obj_arena)
+		doc->obj_arena->open++;
+}
+
+void
+pdf_close_obj_arena(fz_context *ctx, pdf_document *doc)
+{
+	if (doc->obj_arena)
+		doc->obj_arena->open--;
+}
+
+static pdf_obj_arena *
+open_arena(pdf_document *doc)
+{
+	if (doc && doc->obj_arena && doc->obj_arena->open > 0)
+		return doc->obj_arena;
+	return NULL;
+}
+
+static void *
+arena_alloc(fz_context *ctx, pdf_obj_arena *arena, size_t size)
+{
+	/* The pool only aligns to pointers; pdf_obj_num holds an int64_t. */
+	return fz_pool_alloc(ctx, arena->pool, (size + 7) & ~(size_t)7);
+}
+
+static void *
+obj_alloc(fz_context *ctx, pdf_obj_arena *arena, size_t size, const char *label)
+{
+	if (arena)
+		return arena_alloc(ctx, arena, size);
+	return Memento_label(fz_malloc(ctx, size), label);
+}
+
+static pdf_obj **
+grow_arena_list(fz_context *ctx, pdf_obj **list, int len, int *cap)
+{
+	if (len == *cap)
+	{
+		int new_cap = *cap ? *cap * 2 : 64;
+		list = fz_realloc_array(ctx, list, new_cap, pdf_obj *);
+		*cap = new_cap;
+	}
+	return list;
+}
+
+/* Take a reference to an item being put into an array or dict. If the
+ * items are in an arena, the arena holds the reference for them. */
+static pdf_obj *
+keep_item(fz_context *ctx, pdf_obj *obj, pdf_obj *item)
+{
+	pdf_obj_arena *arena;
+
+	if (!(obj->arena & PDF_ARENA_ITEMS) || item < PDF_LIMIT || (item->arena & PDF_ARENA_OBJ))
+		return pdf_keep_obj(ctx, item);
+
+	/* Arrays and dicts both start with the document. */
+	arena = DICT(obj)->doc->obj_arena;
+	arena->owned = grow_arena_list(ctx, arena->owned, arena->owned_len, &arena->owned_cap);
+	arena->owned[arena->owned_len++] = pdf_keep_obj(ctx, item);
+	return item;
+}
+
+/* Drop an item taken out of an array or dict. */
+static void
+drop_item(fz_context *ctx, pdf_obj *obj, pdf_obj *item)
+{
+	if (!(obj->arena & PDF_ARENA_ITEMS))
+		pdf_drop_obj(ctx, item);
+}
+
+/* Copy on write: give an arena array or dict items of its own on the
+ * heap, that can be edited like any others. */
+static void
+unshare_items(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
+{
+	pdf_obj_arena *arena = doc->obj_arena;
+	int i;
+
+	/* Still parsing; the items can be built up where they are. */
+	if (!(obj->arena & PDF_ARENA_ITEMS) || arena->open > 0)
+		return;
+
+	arena->unshared = grow_arena_list(ctx, arena->unshared, arena->unshared_len, &arena->unshared_cap);
+
+	if (obj->kind == PDF_ARRAY)
+	{
+		pdf_obj **items = Memento_label(fz_malloc_array(ctx, ARRAY(obj)->cap, pdf_obj*), "pdf_array_items");
+		memcpy(items, ARRAY(obj)->items, ARRAY(obj)->cap * sizeof(pdf_obj*));
+		for (i = 0; i < ARRAY(obj)->len; i++)
+			pdf_keep_obj(ctx, items[i]);
+		ARRAY(obj)->items = items;
+	}
+	else
+	{
+		struct keyval *items = Memento_label(fz_malloc_array(ctx, DICT(obj)->cap, struct keyval), "dict_items");
+		memcpy(items, DICT(obj)->items, DICT(obj)->cap * sizeof(struct keyval));
+		for (i = 0; i < DICT(obj)->len; i++)
+		{
+			pdf_keep_obj(ctx, items[i].k);
+			pdf_keep_obj(ctx, items[i].v);
+		}
+		DICT(obj)->items = items;
+	}
+
+	arena->unshared[arena->unshared_len++] = obj;
+	obj->arena &= ~PDF_ARENA_ITEMS;
+}
+
+int
+pdf_obj_in_arena(fz_context *ctx, pdf_obj *obj)
+{
+	return obj >= PDF_LIMIT && (obj->arena & PDF_ARENA_OBJ);
+}
+
+static pdf_obj *
+new_int(fz_context *ctx, pdf_obj_arena *arena, int64_t i)
 {
 	pdf_obj_num *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(int)");
+	obj = obj_alloc(ctx, arena, sizeof(pdf_obj_num), "pdf_obj(int)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INT;
 	obj->super.flags = 0;
+	obj->super.arena = arena ? PDF_ARENA_OBJ : 0;
 	obj->u.i = i;
 	return &obj->super;
 }
 
-pdf_obj *
-pdf_new_real(fz_context *ctx, float f)
+static pdf_obj *
+new_real(fz_context *ctx, pdf_obj_arena *arena, float f)
 {
 	pdf_obj_num *obj;
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_num)), "pdf_obj(real)");
+	obj = obj_alloc(ctx, arena, sizeof(pdf_obj_num), "pdf_obj(real)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_REAL;
 	obj->super.flags = 0;
+	obj->super.arena = arena ? PDF_ARENA_OBJ : 0;
 	obj->u.f = f;
 	return &obj->super;
 }
 
-pdf_obj *
-pdf_new_string(fz_context *ctx, const char *str, size_t len)
+static pdf_obj *
+new_string(fz_context *ctx, pdf_obj_arena *arena, const char *str, size_t len)
 {
 	pdf_obj_string *obj;
 	unsigned int l = (unsigned int)len;
@@ -203,17 +405,77 @@ pdf_new_string(fz_context *ctx, const char *str, size_t len)
 	if ((size_t)l != len)
 		fz_throw(ctx, FZ_ERROR_LIMIT, "Overflow in pdf string");
 
-	obj = Memento_label(fz_malloc(ctx, offsetof(pdf_obj_string, buf) + len + 1), "pdf_obj(string)");
+	obj = obj_alloc(ctx, arena, offsetof(pdf_obj_string, buf) + len + 1, "pdf_obj(string)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_STRING;
 	obj->super.flags = 0;
-	obj->text = NULL;
+	if (arena)
+	{
+		/* The text, if it is ever asked for, goes into the arena too. */
+		obj->super.arena = PDF_ARENA_OBJ | PDF_ARENA_TEXT;
+		obj->u.arena = arena;
+	}
+	else
+	{
+		obj->super.arena = 0;
+		obj->u.text = NULL;
+	}
 	obj->len = l;
 	memcpy(obj->buf, str, len);
 	obj->buf[len] = '\0';
 	return &obj->super;
 }
 
+pdf_obj *
+pdf_new_int(fz_context *ctx, int64_t i)
+{
+	return new_int(ctx, NULL, i);
+}
+
+pdf_obj *
+pdf_new_real(fz_context *ctx, float f)
+{
+	return new_real(ctx, NULL, f);
+}
+
+pdf_obj *
+pdf_new_string(fz_context *ctx, const char *str, size_t len)
+{
+	return new_string(ctx, NULL, str, len);
+}
+
+pdf_obj *
+pdf_new_parsed_int(fz_context *ctx, pdf_document *doc, int64_t i)
+{
+	return new_int(ctx, open_arena(doc), i);
+}
+
+pdf_obj *
+pdf_new_parsed_real(fz_context *ctx, pdf_document *doc, float f)
+{
+	return new_real(ctx, open_arena(doc), f);
+}
+
+pdf_obj *
+pdf_new_parsed_string(fz_context *ctx, pdf_document *doc, const char *str, size_t len)
+{
+	return new_string(ctx, open_arena(doc), str, len);
+}
+
+pdf_obj *
+pdf_keep_unbound_obj(fz_context *ctx, pdf_obj *obj)
+{
+	if (!pdf_obj_in_arena(ctx, obj))
+		return pdf_keep_obj(ctx, obj);
+	switch (obj->kind)
+	{
+	case PDF_INT: return pdf_new_int(ctx, NUM(obj)->u.i);
+	case PDF_REAL: return pdf_new_real(ctx, NUM(obj)->u.f);
+	case PDF_STRING: return pdf_new_string(ctx, STRING(obj)->buf, STRING(obj)->len);
+	}
+	return obj;
+}
+
 pdf_obj *
 pdf_new_name(fz_context *ctx, const char *str)
 {
@@ -236,6 +498,7 @@ pdf_new_name(fz_context *ctx, const char *str)
 	obj->super.refs = 1;
 	obj->super.kind = PDF_NAME;
 	obj->super.flags = 0;
+	obj->super.arena = 0;
 	strcpy(obj->n, str);
 	return &obj->super;
 }
@@ -243,6 +506,7 @@ pdf_new_name(fz_context *ctx, const char *str)
 pdf_obj *
 pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
 {
+	pdf_obj_arena *arena;
 	pdf_obj_ref *obj;
 	if (num < 0 || num > PDF_MAX_OBJECT_NUMBER)
 	{
@@ -254,10 +518,12 @@ pdf_new_indirect(fz_context *ctx, pdf_document *doc, int num, int gen)
 		fz_warn(ctx, "invalid generation number (%d)", gen);
 		return PDF_NULL;
 	}
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_ref)), "pdf_obj(indirect)");
+	arena = open_arena(doc);
+	obj = obj_alloc(ctx, arena, sizeof(pdf_obj_ref), "pdf_obj(indirect)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_INDIRECT;
 	obj->super.flags = 0;
+	obj->super.arena = arena ? PDF_ARENA_OBJ : 0;
 	obj->doc = doc;
 	obj->num = num;
 	obj->gen = gen;
@@ -458,14 +724,37 @@ const char *pdf_to_string(fz_context *ctx, pdf_obj *obj, size_t *sizep)
 	return "";
 }
 
+static void
+make_arena_text(fz_context *ctx, pdf_obj_string *obj)
+{
+	char *text = pdf_new_utf8_from_pdf_string(ctx, obj->buf, obj->len);
+	size_t n = strlen(text) + 1;
+	char *copy = NULL;
+
+	fz_try(ctx)
+		copy = arena_alloc(ctx, obj->u.arena, n);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, text);
+		fz_rethrow(ctx);
+	}
+	memcpy(copy, text, n);
+	fz_free(ctx, text);
+
+	obj->u.text = copy;
+	obj->super.arena &= ~PDF_ARENA_TEXT;
+}
+
 const char *pdf_to_text_string(fz_context *ctx, pdf_obj *obj)
 {
 	RESOLVE(obj);
 	if (OBJ_IS_STRING(obj))
 	{
-		if (!STRING(obj)->text)
-			STRING(obj)->text = pdf_new_utf8_from_pdf_string(ctx, STRING(obj)->buf, STRING(obj)->len);
-		return STRING(obj)->text;
+		if (obj->arena & PDF_ARENA_TEXT)
+			make_arena_text(ctx, STRING(obj));
+		else if (!STRING(obj)->u.text)
+			STRING(obj)->u.text = pdf_new_utf8_from_pdf_string(ctx, STRING(obj)->buf, STRING(obj)->len);
+		return STRING(obj)->u.text;
 	}
 	return "";
 }
@@ -774,16 +1063,19 @@ pdf_objkindstr(pdf_obj *obj)
 pdf_obj *
 pdf_new_array(fz_context *ctx, pdf_document *doc, int initialcap)
 {
+	pdf_obj_arena *arena;
 	pdf_obj_array *obj;
 	int i;
 
 	if (doc == NULL)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot create array without a document");
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_array)), "pdf_obj(array)");
+	arena = open_arena(doc);
+	obj = obj_alloc(ctx, arena, sizeof(pdf_obj_array), "pdf_obj(array)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_ARRAY;
 	obj->super.flags = 0;
+	obj->super.arena = arena ? PDF_ARENA_OBJ | PDF_ARENA_ITEMS : 0;
 	obj->doc = doc;
 	obj->parent_num = 0;
 
@@ -792,11 +1084,12 @@ pdf_new_array(fz_context *ctx, pdf_document *doc, int initialcap)
 
 	fz_try(ctx)
 	{
-		obj->items = Memento_label(fz_malloc_array(ctx, obj->cap, pdf_obj*), "pdf_array_items");
+		obj->items = obj_alloc(ctx, arena, obj->cap * sizeof(pdf_obj*), "pdf_array_items");
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		if (!arena)
+			fz_free(ctx, obj);
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < obj->cap; i++)
@@ -811,7 +1104,14 @@ pdf_array_grow(fz_context *ctx, pdf_obj_array *obj)
 	int i;
 	int new_cap = (obj->cap * 3) / 2;
 
-	obj->items = fz_realloc_array(ctx, obj->items, new_cap, pdf_obj*);
+	if (obj->super.arena & PDF_ARENA_ITEMS)
+	{
+		pdf_obj **items = arena_alloc(ctx, obj->doc->obj_arena, new_cap * sizeof(pdf_obj*));
+		memcpy(items, obj->items, obj->len * sizeof(pdf_obj*));
+		obj->items = items;
+	}
+	else
+		obj->items = fz_realloc_array(ctx, obj->items, new_cap, pdf_obj*);
 	obj->cap = new_cap;
 
 	for (i = obj->len ; i < obj->cap; i++)
@@ -1799,6 +2099,8 @@ static void prepare_object_for_alteration(fz_context *ctx, pdf_obj *obj, pdf_obj
 
 	assert(doc != NULL);
 
+	unshare_items(ctx, doc, obj);
+
 	/* Do we need to drop the page maps? */
 	if (doc->rev_page_map || doc->fwd_page_map)
 	{
@@ -1950,8 +2252,8 @@ pdf_array_put(fz_context *ctx, pdf_obj *obj, int i, pdf_obj *item)
 	if (i < 0 || i > ARRAY(obj)->len)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "index out of bounds");
 	prepare_object_for_alteration(ctx, obj, item);
-	pdf_drop_obj(ctx, ARRAY(obj)->items[i]);
-	ARRAY(obj)->items[i] = pdf_keep_obj(ctx, item);
+	drop_item(ctx, obj, ARRAY(obj)->items[i]);
+	ARRAY(obj)->items[i] = keep_item(ctx, obj, item);
 }
 
 void
@@ -1974,7 +2276,7 @@ pdf_array_push(fz_context *ctx, pdf_obj *obj, pdf_obj *item)
 	prepare_object_for_alteration(ctx, obj, item);
 	if (ARRAY(obj)->len + 1 > ARRAY(obj)->cap)
 		pdf_array_grow(ctx, ARRAY(obj));
-	ARRAY(obj)->items[ARRAY(obj)->len] = pdf_keep_obj(ctx, item);
+	ARRAY(obj)->items[ARRAY(obj)->len] = keep_item(ctx, obj, item);
 	ARRAY(obj)->len++;
 }
 
@@ -2000,8 +2302,9 @@ pdf_array_insert(fz_context *ctx, pdf_obj *obj, pdf_obj *item, int i)
 	prepare_object_for_alteration(ctx, obj, item);
 	if (ARRAY(obj)->len + 1 > ARRAY(obj)->cap)
 		pdf_array_grow(ctx, ARRAY(obj));
+	item = keep_item(ctx, obj, item);
 	memmove(ARRAY(obj)->items + i + 1, ARRAY(obj)->items + i, (ARRAY(obj)->len - i) * sizeof(pdf_obj*));
-	ARRAY(obj)->items[i] = pdf_keep_obj(ctx, item);
+	ARRAY(obj)->items[i] = item;
 	ARRAY(obj)->len++;
 }
 
@@ -2025,7 +2328,7 @@ pdf_array_delete(fz_context *ctx, pdf_obj *obj, int i)
 	if (i < 0 || i >= ARRAY(obj)->len)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "index out of bounds");
 	prepare_object_for_alteration(ctx, obj, NULL);
-	pdf_drop_obj(ctx, ARRAY(obj)->items[i]);
+	drop_item(ctx, obj, ARRAY(obj)->items[i]);
 	ARRAY(obj)->items[i] = 0;
 	ARRAY(obj)->len--;
 	memmove(ARRAY(obj)->items + i, ARRAY(obj)->items + i + 1, (ARRAY(obj)->len - i) * sizeof(pdf_obj*));
@@ -2151,16 +2454,19 @@ static int keyvalcmp(const void *ap, const void *bp)
 pdf_obj *
 pdf_new_dict(fz_context *ctx, pdf_document *doc, int initialcap)
 {
+	pdf_obj_arena *arena;
 	pdf_obj_dict *obj;
 	int i;
 
 	if (doc == NULL)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "cannot create dictionary without a document");
 
-	obj = Memento_label(fz_malloc(ctx, sizeof(pdf_obj_dict)), "pdf_obj(dict)");
+	arena = open_arena(doc);
+	obj = obj_alloc(ctx, arena, sizeof(pdf_obj_dict), "pdf_obj(dict)");
 	obj->super.refs = 1;
 	obj->super.kind = PDF_DICT;
 	obj->super.flags = 0;
+	obj->super.arena = arena ? PDF_ARENA_OBJ | PDF_ARENA_ITEMS : 0;
 	obj->doc = doc;
 	obj->parent_num = 0;
 
@@ -2169,11 +2475,12 @@ pdf_new_dict(fz_context *ctx, pdf_document *doc, int initialcap)
 
 	fz_try(ctx)
 	{
-		DICT(obj)->items = Memento_label(fz_malloc_array(ctx, DICT(obj)->cap, struct keyval), "dict_items");
+		DICT(obj)->items = obj_alloc(ctx, arena, DICT(obj)->cap * sizeof(struct keyval), "dict_items");
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, obj);
+		if (!arena)
+			fz_free(ctx, obj);
 		fz_rethrow(ctx);
 	}
 	for (i = 0; i < DICT(obj)->cap; i++)
@@ -2191,7 +2498,14 @@ pdf_dict_grow(fz_context *ctx, pdf_obj *obj)
 	int i;
 	int new_cap = (DICT(obj)->cap * 3) / 2;
 
-	DICT(obj)->items = fz_realloc_array(ctx, DICT(obj)->items, new_cap, struct keyval);
+	if (obj->arena & PDF_ARENA_ITEMS)
+	{
+		struct keyval *items = arena_alloc(ctx, DICT(obj)->doc->obj_arena, new_cap * sizeof(struct keyval));
+		memcpy(items, DICT(obj)->items, DICT(obj)->len * sizeof(struct keyval));
+		DICT(obj)->items = items;
+	}
+	else
+		DICT(obj)->items = fz_realloc_array(ctx, DICT(obj)->items, new_cap, struct keyval);
 	DICT(obj)->cap = new_cap;
 
 	for (i = DICT(obj)->len; i < DICT(obj)->cap; i++)
@@ -2268,7 +2582,7 @@ pdf_dict_put_val_null(fz_context *ctx, pdf_obj *obj, int idx)
 		fz_throw(ctx, FZ_ERROR_ARGUMENT, "index out of bounds");
 
 	prepare_object_for_alteration(ctx, obj, NULL);
-	pdf_drop_obj(ctx, DICT(obj)->items[idx].v);
+	drop_item(ctx, obj, DICT(obj)->items[idx].v);
 	DICT(obj)->items[idx].v = PDF_NULL;
 }
 
@@ -2503,11 +2817,11 @@ pdf_dict_get_put(fz_context *ctx, pdf_obj *obj, pdf_obj *key, pdf_obj *val, pdf_
 		if (DICT(obj)->items[i].v != val)
 		{
 			pdf_obj *d = DICT(obj)->items[i].v;
-			DICT(obj)->items[i].v = pdf_keep_obj(ctx, val);
+			DICT(obj)->items[i].v = keep_item(ctx, obj, val);
 			if (old_val)
-				*old_val = d;
+				*old_val = (obj->arena & PDF_ARENA_ITEMS) ? pdf_keep_obj(ctx, d) : d;
 			else
-				pdf_drop_obj(ctx, d);
+				drop_item(ctx, obj, d);
 		}
 	}
 	else
@@ -2515,14 +2829,17 @@ pdf_dict_get_put(fz_context *ctx, pdf_obj *obj, pdf_obj *key, pdf_obj *val, pdf_
 		if (DICT(obj)->len + 1 > DICT(obj)->cap)
 			pdf_dict_grow(ctx, obj);
 
+		key = keep_item(ctx, obj, key);
+		val = keep_item(ctx, obj, val);
+
 		i = -1-i;
 		if ((obj->flags & PDF_FLAGS_SORTED) && DICT(obj)->len > 0)
 			memmove(&DICT(obj)->items[i + 1],
 					&DICT(obj)->items[i],
 					(DICT(obj)->len - i) * sizeof(struct keyval));
 
-		DICT(obj)->items[i].k = pdf_keep_obj(ctx, key);
-		DICT(obj)->items[i].v = pdf_keep_obj(ctx, val);
+		DICT(obj)->items[i].k = key;
+		DICT(obj)->items[i].v = val;
 		DICT(obj)->len ++;
 	}
 }
@@ -2761,8 +3078,8 @@ pdf_dict_dels(fz_context *ctx, pdf_obj *obj, const char *key)
 	i = pdf_dict_finds(ctx, obj, key);
 	if (i >= 0)
 	{
-		pdf_drop_obj(ctx, DICT(obj)->items[i].k);
-		pdf_drop_obj(ctx, DICT(obj)->items[i].v);
+		drop_item(ctx, obj, DICT(obj)->items[i].k);
+		drop_item(ctx, obj, DICT(obj)->items[i].v);
 		obj->flags &= ~PDF_FLAGS_SORTED;
 		DICT(obj)->items[i] = DICT(obj)->items[DICT(obj)->len-1];
 		DICT(obj)->len --;
@@ -3065,7 +3382,7 @@ void pdf_clean_obj(fz_context *ctx, pdf_obj *obj)
 }
 
 static void
-pdf_drop_array(fz_context *ctx, pdf_obj *obj)
+pdf_drop_array_items(fz_context *ctx, pdf_obj *obj)
 {
 	int i;
 
@@ -3073,11 +3390,17 @@ pdf_drop_array(fz_context *ctx, pdf_obj *obj)
 		pdf_drop_obj(ctx, ARRAY(obj)->items[i]);
 
 	fz_free(ctx, DICT(obj)->items);
+}
+
+static void
+pdf_drop_array(fz_context *ctx, pdf_obj *obj)
+{
+	pdf_drop_array_items(ctx, obj);
 	fz_free(ctx, obj);
 }
 
 static void
-pdf_drop_dict(fz_context *ctx, pdf_obj *obj)
+pdf_drop_dict_items(fz_context *ctx, pdf_obj *obj)
 {
 	int i;
 
@@ -3087,13 +3410,19 @@ pdf_drop_dict(fz_context *ctx, pdf_obj *obj)
 	}
 
 	fz_free(ctx, DICT(obj)->items);
+}
+
+static void
+pdf_drop_dict(fz_context *ctx, pdf_obj *obj)
+{
+	pdf_drop_dict_items(ctx, obj);
 	fz_free(ctx, obj);
 }
 
 pdf_obj *
 pdf_keep_obj(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj >= PDF_LIMIT)
+	if (obj >= PDF_LIMIT && !(obj->arena & PDF_ARENA_OBJ))
 		return fz_keep_imp16(ctx, obj, &obj->refs);
 	return obj;
 }
@@ -3101,7 +3430,8 @@ pdf_keep_obj(fz_context *ctx, pdf_obj *obj)
 void
 pdf_drop_obj(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj >= PDF_LIMIT)
+	/* Arena objects live as long as their document. */
+	if (obj >= PDF_LIMIT && !(obj->arena & PDF_ARENA_OBJ))
 	{
 		if (fz_drop_imp16(ctx, obj, &obj->refs))
 		{
@@ -3111,7 +3441,7 @@ pdf_drop_obj(fz_context *ctx, pdf_obj *obj)
 				pdf_drop_dict(ctx, obj);
 			else if (obj->kind == PDF_STRING)
 			{
-				fz_free(ctx, STRING(obj)->text);
+				fz_free(ctx, STRING(obj)->u.text);
 				fz_free(ctx, obj);
 			}
 			else
@@ -3131,6 +3461,10 @@ pdf_drop_singleton_obj(fz_context *ctx, pdf_obj *obj)
 	if (obj < PDF_LIMIT)
 		return obj;
 
+	/* Nor is there any point for objects in an arena. */
+	if (obj->arena & PDF_ARENA_OBJ)
+		return obj;
+
 	/* See if it's a singleton object. We can only drop if
 	 * it's a singleton object. If not, just exit leaving
 	 * everything unchanged. */
@@ -3147,7 +3481,7 @@ pdf_drop_singleton_obj(fz_context *ctx, pdf_obj *obj)
 		pdf_drop_dict(ctx, obj);
 	else if (obj->kind == PDF_STRING)
 	{
-		fz_free(ctx, STRING(obj)->text);
+		fz_free(ctx, STRING(obj)->u.text);
 		fz_free(ctx, obj);
 	}
 	else
@@ -3730,7 +4064,8 @@ void pdf_debug_ref(fz_context *ctx, pdf_obj *obj)
 
 int pdf_obj_refs(fz_context *ctx, pdf_obj *obj)
 {
-	if (obj < PDF_LIMIT)
+	/* Neither of these are reference counted. */
+	if (obj < PDF_LIMIT || (obj->arena & PDF_ARENA_OBJ))
 		return 0;
 	return obj->refs;
 }
@@ -252,6 +252,15 @@ pdf_lookup_page_loc(fz_context *ctx, pdf_document *doc, int needle, pdf_obj **pa
 pdf_obj *
 pdf_lookup_page_obj(fz_context *ctx, pdf_document *doc, int needle)
 {
+	/* Building the map reads every page object, which is just what a
+	 * lazily loaded xref is meant to avoid. So the first page is found
+	 * by walking the tree, and the map is only built for the next. */
+	if (doc->fwd_page_map == NULL && !doc->page_tree_broken && doc->lazy_xref && !doc->page_tree_walked)
+	{
+		doc->page_tree_walked = 1;
+		return pdf_lookup_page_loc(ctx, doc, needle, NULL, NULL);
+	}
+
 	if (doc->fwd_page_map == NULL && !doc->page_tree_broken)
 	{
 		fz_try(ctx)
@@ -1331,6 +1340,78 @@ pdf_page_has_transparency(fz_context *ctx, pdf_page *page)
 	return page->transparency;
 }
 
+/* Hint the file offset of an indirect object that is yet to be loaded. */
+static void
+prefetch_object(fz_context *ctx, pdf_document *doc, pdf_obj *ref)
+{
+	pdf_xref_entry *x;
+	int num;
+
+	if (!pdf_is_indirect(ctx, ref))
+		return;
+	num = pdf_to_num(ctx, ref);
+	if (num <= 0 || num >= pdf_xref_len(ctx, doc))
+		return;
+	x = pdf_get_xref_entry_no_change(ctx, doc, num);
+	if (x == NULL || x->obj)
+		return;
+
+	/* Objects in object streams are found by way of their stream. */
+	if (x->type == 'o' && x->ofs > 0 && x->ofs < pdf_xref_len(ctx, doc))
+	{
+		x = pdf_get_xref_entry_no_change(ctx, doc, (int)x->ofs);
+		if (x == NULL || x->obj)
+			return;
+	}
+	if (x->type == 'n' && x->ofs > 0)
+		fz_prefetch_stream_range(ctx, doc->file, x->ofs, 1);
+}
+
+/*
+	When reading through a prefetch stream, hint the objects that
+	running the page is about to need, so that they can be read in
+	while the annotations are being loaded. Only the contents and the
+	first level of resources are hinted; the rest is read on demand.
+*/
+static void
+prefetch_page(fz_context *ctx, pdf_document *doc, pdf_obj *pageobj)
+{
+	static pdf_obj * const res_types[] = {
+		PDF_NAME(Font), PDF_NAME(XObject), PDF_NAME(ExtGState),
+		PDF_NAME(ColorSpace), PDF_NAME(Pattern), PDF_NAME(Shading)
+	};
+	pdf_obj *contents, *res, *dict;
+	int i, k, n;
+
+	if (!fz_is_prefetch_stream(ctx, doc->file))
+		return;
+
+	fz_try(ctx)
+	{
+		contents = pdf_dict_get(ctx, pageobj, PDF_NAME(Contents));
+		prefetch_object(ctx, doc, contents);
+		n = pdf_array_len(ctx, contents);
+		for (i = 0; i < n; i++)
+			prefetch_object(ctx, doc, pdf_array_get(ctx, contents, i));
+
+		res = pdf_dict_get_inheritable(ctx, pageobj, PDF_NAME(Resources));
+		prefetch_object(ctx, doc, res);
+		for (k = 0; k < (int)nelem(res_types); k++)
+		{
+			dict = pdf_dict_get(ctx, res, res_types[k]);
+			prefetch_object(ctx, doc, dict);
+			n = pdf_dict_len(ctx, dict);
+			for (i = 0; i < n; i++)
+				prefetch_object(ctx, doc, pdf_dict_get_val(ctx, dict, i));
+		}
+	}
+	fz_catch(ctx)
+	{
+		/* Loading the page proper will report any problems. */
+		fz_ignore_error(ctx);
+	}
+}
+
 fz_page *
 pdf_load_page_imp(fz_context *ctx, fz_document *doc_, int chapter, int number)
 {
@@ -1357,6 +1438,8 @@ pdf_load_page_imp(fz_context *ctx, fz_document *doc_, int chapter, int number)
 	else
 		pageobj = pdf_lookup_page_obj(ctx, doc, number);
 
+	prefetch_page(ctx, doc, pageobj);
+
 	page = pdf_new_page(ctx, doc);
 	page->obj = pdf_keep_obj(ctx, pageobj);
 
@@ -22,6 +22,7 @@
 
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
+#include "pdf-imp.h"
 
 #include <string.h>
 
@@ -58,7 +59,7 @@ pdf_is_stream(fz_context *ctx, pdf_obj *ref)
 /*
  * Scan stream dictionary for an explicit /Crypt filter
  */
-static int
+int
 pdf_stream_has_crypt(fz_context *ctx, pdf_obj *stm)
 {
 	pdf_obj *filters;
@@ -335,6 +336,7 @@ pdf_open_raw_filter(fz_context *ctx, fz_stream *file_stm, pdf_document *doc, pdf
 	len = pdf_dict_get_int64(ctx, stmobj, PDF_NAME(Length));
 	if (len < 0)
 		len = 0;
+	fz_prefetch_stream_range(ctx, file_stm, offset, len);
 	null_stm = fz_open_endstream_filter(ctx, file_stm, (uint64_t)len, offset);
 	if (doc->crypt && !hascrypt)
 	{
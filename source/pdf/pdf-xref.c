@@ -45,6 +45,307 @@ static inline int iswhite(int ch)
 		ch == '\014' || ch == '\015' || ch == '\040';
 }
 
+/*
+ * Parse the fields of an old style xref table row, which may start
+ * with white space.
+ */
+static void
+parse_xref_table_row(fz_context *ctx, pdf_xref_entry *entry, int num, char *s, char *e)
+{
+	entry->num = num;
+
+	/* broken pdfs where line start with white space */
+	while (s < e && iswhite(*s))
+		s++;
+
+	if (s == e || !isdigit(*s))
+		fz_throw(ctx, FZ_ERROR_FORMAT, "xref offset missing");
+	while (s < e && isdigit(*s))
+		entry->ofs = entry->ofs * 10 + *s++ - '0';
+
+	while (s < e && iswhite(*s))
+		s++;
+	if (s == e || !isdigit(*s))
+		fz_throw(ctx, FZ_ERROR_FORMAT, "xref generation number missing");
+	while (s < e && isdigit(*s))
+		entry->gen = entry->gen * 10 + *s++ - '0';
+
+	while (s < e && iswhite(*s))
+		s++;
+	if (s == e || (*s != 'f' && *s != 'n' && *s != 'o'))
+		fz_throw(ctx, FZ_ERROR_FORMAT, "unexpected xref type: 0x%x (%d %d R)", s == e ? 0 : *s, entry->num, entry->gen);
+	entry->type = *s;
+}
+
+/* Fill in an entry from the fields of an xref stream row. */
+static void
+set_xref_stream_entry(pdf_xref_entry *entry, int num, int a, int64_t b, int c, int w0, int w1, int w2)
+{
+	int t = w0 ? a : 1;
+	entry->type = t == 0 ? 'f' : t == 1 ? 'n' : t == 2 ? 'o' : 0;
+	entry->ofs = w1 ? b : 0;
+	entry->gen = w2 ? c : 0;
+	entry->num = num;
+}
+
+/*
+ * Lazily loaded xref entries.
+ *
+ * When loading lazily, each large xref subsection is added with a NULL
+ * table, and its entries are left in their packed form until they are
+ * needed: the rows of an old style xref table stay in the file (20
+ * bytes each), and those of an xref stream are kept in their
+ * (decompressed) binary form, w0+w1+w2 bytes each. Looking up an entry
+ * expands only the page of LAZY_XREF_PAGE entries around it into full
+ * pdf_xref_entry structures. Pages stay where they are once expanded,
+ * so pointers to their entries remain valid for as long as those in an
+ * ordinary table would.
+ *
+ * Code that walks every entry in a subsection must either expand all
+ * its pages first, or use peek_subsec_entry and skip the entries that
+ * have not been expanded yet (they hold no objects).
+ */
+
+#define LAZY_XREF_MIN 4096
+#define LAZY_XREF_PAGE 256
+
+#define lazy_xref_pages(len) (((len) + LAZY_XREF_PAGE - 1) / LAZY_XREF_PAGE)
+
+typedef struct
+{
+	int refs;
+	fz_buffer *data;
+	int w0, w1, w2;
+} pdf_xref_stream_rows;
+
+struct pdf_xref_lazy
+{
+	pdf_xref_stream_rows *rows; /* NULL for an old style xref table */
+	int64_t pos; /* file offset of the first row, or offset into rows->data */
+	int rowsize;
+	pdf_xref_entry **page; /* expanded pages, each NULL until needed */
+};
+
+static void
+drop_xref_stream_rows(fz_context *ctx, pdf_xref_stream_rows *rows)
+{
+	if (fz_drop_imp(ctx, rows, &rows->refs))
+	{
+		fz_drop_buffer(ctx, rows->data);
+		fz_free(ctx, rows);
+	}
+}
+
+/* Frees the pages, but not any objects held in them. */
+static void
+drop_xref_lazy(fz_context *ctx, struct pdf_xref_lazy *lazy, int len)
+{
+	int p;
+
+	if (lazy)
+	{
+		if (lazy->page)
+			for (p = 0; p < lazy_xref_pages(len); p++)
+				fz_free(ctx, lazy->page[p]);
+		fz_free(ctx, lazy->page);
+		if (lazy->rows)
+			drop_xref_stream_rows(ctx, lazy->rows);
+		fz_free(ctx, lazy);
+	}
+}
+
+static void
+read_lazy_xref_table(fz_context *ctx, pdf_document *doc, struct pdf_xref_lazy *lazy, pdf_xref_entry *table, int num, int row, int n)
+{
+	fz_stream *file = doc->file;
+	int64_t save = fz_tell(ctx, file);
+	unsigned char *data = NULL;
+	int i;
+
+	fz_var(data);
+
+	fz_try(ctx)
+	{
+		data = fz_malloc(ctx, (size_t)n * 20);
+		fz_seek(ctx, file, lazy->pos + (int64_t)row * 20, SEEK_SET);
+		if (fz_read(ctx, file, data, (size_t)n * 20) != (size_t)n * 20)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "unexpected EOF in xref table");
+		for (i = 0; i < n; i++)
+		{
+			char *s = (char *)data + i * 20;
+			parse_xref_table_row(ctx, &table[i], num + i, s, s + 20);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, data);
+		fz_seek(ctx, file, save, SEEK_SET);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+read_lazy_xref_stream(fz_context *ctx, struct pdf_xref_lazy *lazy, pdf_xref_entry *table, int num, int row, int n)
+{
+	pdf_xref_stream_rows *rows = lazy->rows;
+	unsigned char *p = rows->data->data + lazy->pos + (int64_t)row * lazy->rowsize;
+	int i, k;
+
+	for (i = 0; i < n; i++)
+	{
+		int a = 0;
+		int64_t b = 0;
+		int c = 0;
+
+		for (k = 0; k < rows->w0; k++)
+			a = (a << 8) + *p++;
+		for (k = 0; k < rows->w1; k++)
+			b = (b << 8) + *p++;
+		for (k = 0; k < rows->w2; k++)
+			c = (c << 8) + *p++;
+
+		set_xref_stream_entry(&table[i], num + i, a, b, c, rows->w0, rows->w1, rows->w2);
+	}
+}
+
+/*
+ * Expand page p of a lazily loaded subsection. This never throws:
+ * entries that cannot be read are left unset (with a warning, and the
+ * document marked damaged), and if the page cannot even be allocated,
+ * NULL is returned (and it will be tried again next time).
+ *
+ * Entries are checked as pdf_load_xref would check them; if any fail,
+ * the document is marked damaged and pdf_cache_object repairs it.
+ * References to object streams can only be checked once the whole
+ * xref is known, so pdf_cache_object checks those as they are used.
+ */
+static pdf_xref_entry *
+load_lazy_page(fz_context *ctx, pdf_document *doc, pdf_xref_subsec *sub, int p)
+{
+	struct pdf_xref_lazy *lazy = sub->lazy;
+	int row = p * LAZY_XREF_PAGE;
+	int n = fz_mini(sub->len - row, LAZY_XREF_PAGE);
+	pdf_xref_entry *page = NULL;
+	int i;
+
+	if (lazy->page[p])
+		return lazy->page[p];
+
+	fz_var(page);
+
+	fz_try(ctx)
+		page = fz_malloc_struct_array(ctx, n, pdf_xref_entry);
+	fz_catch(ctx)
+	{
+		fz_report_error(ctx);
+		return NULL;
+	}
+
+	fz_try(ctx)
+	{
+		if (lazy->rows)
+			read_lazy_xref_stream(ctx, lazy, page, sub->start + row, row, n);
+		else
+			read_lazy_xref_table(ctx, doc, lazy, page, sub->start + row, row, n);
+
+		/* Special case code: "0000000000 * n" means free,
+		 * according to some producers (inc Quartz) */
+		for (i = 0; i < n; i++)
+		{
+			if (page[i].type != 'n')
+				continue;
+			if (page[i].ofs == 0)
+				page[i].type = 'f';
+			else if (page[i].ofs < 0 || page[i].ofs >= doc->file_size)
+			{
+				fz_warn(ctx, "object offset out of range: %d (%d 0 R)", (int)page[i].ofs, sub->start + row + i);
+				doc->lazy_xref_damaged = 1;
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_report_error(ctx);
+		fz_warn(ctx, "cannot read xref entries for objects %d to %d", sub->start + row, sub->start + row + n - 1);
+		memset(page, 0, n * sizeof(*page));
+		doc->lazy_xref_damaged = 1;
+	}
+
+	lazy->page[p] = page;
+	return page;
+}
+
+/* Expand every page of a lazily loaded subsection, or throw. */
+static void
+load_lazy_pages(fz_context *ctx, pdf_document *doc, pdf_xref_subsec *sub)
+{
+	int p;
+
+	if (sub->lazy == NULL)
+		return;
+	for (p = 0; p < lazy_xref_pages(sub->len); p++)
+		if (load_lazy_page(ctx, doc, sub, p) == NULL)
+			fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot allocate xref entries");
+}
+
+/*
+ * Turn a lazily loaded subsection into an ordinary one, reading all of
+ * its entries. This moves any entries already expanded, so only use it
+ * where held entries are expected to be invalidated anyway.
+ */
+static void
+ensure_subsec_loaded(fz_context *ctx, pdf_document *doc, pdf_xref_subsec *sub)
+{
+	struct pdf_xref_lazy *lazy = sub->lazy;
+	pdf_xref_entry *table;
+	int p;
+
+	if (lazy == NULL)
+		return;
+
+	load_lazy_pages(ctx, doc, sub);
+	table = fz_malloc_struct_array(ctx, sub->len, pdf_xref_entry);
+	for (p = 0; p < lazy_xref_pages(sub->len); p++)
+		memcpy(&table[p * LAZY_XREF_PAGE], lazy->page[p],
+			fz_mini(sub->len - p * LAZY_XREF_PAGE, LAZY_XREF_PAGE) * sizeof(pdf_xref_entry));
+
+	sub->table = table;
+	sub->lazy = NULL;
+	drop_xref_lazy(ctx, lazy, sub->len);
+}
+
+/* Return the entry for num (which must lie within sub), expanding its
+ * page first if need be. Returns NULL if it cannot be read. */
+static pdf_xref_entry *
+subsec_entry(fz_context *ctx, pdf_document *doc, pdf_xref_subsec *sub, int num)
+{
+	pdf_xref_entry *page;
+	int k = num - sub->start;
+
+	if (sub->lazy == NULL)
+		return &sub->table[k];
+	page = load_lazy_page(ctx, doc, sub, k / LAZY_XREF_PAGE);
+	if (page == NULL)
+		return NULL;
+	return &page[k % LAZY_XREF_PAGE];
+}
+
+/* Return entry k of sub if it has been expanded, without reading
+ * anything. Entries that have not been expanded hold no objects. */
+static pdf_xref_entry *
+peek_subsec_entry(pdf_xref_subsec *sub, int k)
+{
+	pdf_xref_entry *page;
+
+	if (sub->lazy == NULL)
+		return &sub->table[k];
+	page = sub->lazy->page[k / LAZY_XREF_PAGE];
+	if (page == NULL)
+		return NULL;
+	return &page[k % LAZY_XREF_PAGE];
+}
+
 /*
  * xref tables
  */
@@ -61,10 +362,14 @@ pdf_drop_xref_subsec(fz_context *ctx, pdf_xref *xref)
 		pdf_xref_subsec *next_sub = sub->next;
 		for (e = 0; e < sub->len; e++)
 		{
-			pdf_xref_entry *entry = &sub->table[e];
-			pdf_drop_obj(ctx, entry->obj);
-			fz_drop_buffer(ctx, entry->stm_buf);
+			pdf_xref_entry *entry = peek_subsec_entry(sub, e);
+			if (entry)
+			{
+				pdf_drop_obj(ctx, entry->obj);
+				fz_drop_buffer(ctx, entry->stm_buf);
+			}
 		}
+		drop_xref_lazy(ctx, sub->lazy, sub->len);
 		fz_free(ctx, sub->table);
 		fz_free(ctx, sub);
 		sub = next_sub;
@@ -220,6 +525,9 @@ ensure_solid_xref(fz_context *ctx, pdf_document *doc, int num, int which)
 	if (sub != NULL && sub->next == NULL && sub->start == 0 && sub->len >= num)
 		return;
 
+	for (sub = xref->subsec; sub != NULL; sub = sub->next)
+		load_lazy_pages(ctx, doc, sub);
+
 	new_sub = fz_malloc_struct(ctx, pdf_xref_subsec);
 	fz_try(ctx)
 	{
@@ -244,8 +552,9 @@ ensure_solid_xref(fz_context *ctx, pdf_document *doc, int num, int which)
 
 		for (i = 0; i < sub->len; i++)
 		{
-			new_sub->table[i+sub->start] = sub->table[i];
+			new_sub->table[i+sub->start] = *peek_subsec_entry(sub, i);
 		}
+		drop_xref_lazy(ctx, sub->lazy, sub->len);
 		fz_free(ctx, sub->table);
 		fz_free(ctx, sub);
 		sub = next;
@@ -302,7 +611,12 @@ pdf_xref_entry *pdf_get_populating_xref_entry(fz_context *ctx, pdf_document *doc
 	for (sub = xref->subsec; sub != NULL; sub = sub->next)
 	{
 		if (num >= sub->start && num < sub->start + sub->len)
-			return &sub->table[num-sub->start];
+		{
+			pdf_xref_entry *entry = subsec_entry(ctx, doc, sub, num);
+			if (entry == NULL)
+				fz_throw(ctx, FZ_ERROR_SYSTEM, "cannot allocate xref entries");
+			return entry;
+		}
 	}
 
 	/* We've been asked for an object that's not in a subsec. */
@@ -314,7 +628,9 @@ pdf_xref_entry *pdf_get_populating_xref_entry(fz_context *ctx, pdf_document *doc
 }
 
 /* It is vital that pdf_get_xref_entry_aux called with !solidify_if_needed
- * and a value object number, does NOT try/catch or throw. */
+ * and a value object number, does NOT try/catch or throw. (Reading in a
+ * lazily loaded chunk of entries catches its own errors, and only ever
+ * happens the first time an object number in the chunk is asked for.) */
 static
 pdf_xref_entry *pdf_get_xref_entry_aux(fz_context *ctx, pdf_document *doc, int i, int solidify_if_needed)
 {
@@ -373,8 +689,8 @@ pdf_xref_entry *pdf_get_xref_entry_aux(fz_context *ctx, pdf_document *doc, int i
 				if (i < sub->start || i >= sub->start + sub->len)
 					continue;
 
-				entry = &sub->table[i - sub->start];
-				if (entry->type)
+				entry = subsec_entry(ctx, doc, sub, i);
+				if (entry && entry->type)
 				{
 					/* Don't update xref_index if xref_base may have
 					 * influenced the value of j */
@@ -411,8 +727,14 @@ pdf_xref_entry *pdf_get_xref_entry_aux(fz_context *ctx, pdf_document *doc, int i
 		xref = &doc->xref_sections[doc->xref_base];
 		for (sub = xref->subsec; sub != NULL; sub = sub->next)
 		{
-			if (i >= sub->start && i < sub->start + sub->len)
-				return &sub->table[i - sub->start];
+			pdf_xref_entry *entry;
+
+			if (i < sub->start || i >= sub->start + sub->len)
+				continue;
+
+			entry = subsec_entry(ctx, doc, sub, i);
+			if (entry)
+				return entry;
 		}
 	}
 
@@ -496,9 +818,10 @@ void pdf_xref_entry_map(fz_context *ctx, pdf_document *doc, void (*fn)(fz_contex
 
 			for (sub = xref->subsec; sub != NULL; sub = sub->next)
 			{
+				load_lazy_pages(ctx, doc, sub);
 				for (i = sub->start; i < sub->start + sub->len; i++)
 				{
-					pdf_xref_entry *entry = &sub->table[i - sub->start];
+					pdf_xref_entry *entry = peek_subsec_entry(sub, i - sub->start);
 					if (entry->type)
 						fn(ctx, entry, i, doc, arg);
 				}
@@ -707,8 +1030,12 @@ int pdf_xref_ensure_incremental_object(fz_context *ctx, pdf_document *doc, int n
 			break;
 		for (sub = xref->subsec; sub != NULL; sub = sub->next)
 		{
-			if (sub->start <= num && num < sub->start + sub->len && sub->table[num - sub->start].type)
-				break;
+			if (sub->start <= num && num < sub->start + sub->len)
+			{
+				pdf_xref_entry *entry = subsec_entry(ctx, doc, sub, num);
+				if (entry && entry->type)
+					break;
+			}
 		}
 		if (sub != NULL)
 			break;
@@ -719,12 +1046,12 @@ int pdf_xref_ensure_incremental_object(fz_context *ctx, pdf_document *doc, int n
 	if (i == 0 || sub == NULL)
 		return 0;
 
-	copy = pdf_deep_copy_obj(ctx, sub->table[num - sub->start].obj);
+	old_entry = peek_subsec_entry(sub, num - sub->start);
+	copy = pdf_deep_copy_obj(ctx, old_entry->obj);
 
 	/* Move the object to the incremental section */
 	i = doc->xref_index[num];
 	doc->xref_index[num] = 0;
-	old_entry = &sub->table[num - sub->start];
 	fz_try(ctx)
 		new_entry = pdf_get_incremental_xref_entry(ctx, doc, num);
 	fz_catch(ctx)
@@ -776,8 +1103,12 @@ void pdf_xref_ensure_local_object(fz_context *ctx, pdf_document *doc, int num)
 			break;
 		for (sub = xref->subsec; sub != NULL; sub = sub->next)
 		{
-			if (sub->start <= num && num < sub->start + sub->len && sub->table[num - sub->start].type)
-				break;
+			if (sub->start <= num && num < sub->start + sub->len)
+			{
+				pdf_xref_entry *entry = subsec_entry(ctx, doc, sub, num);
+				if (entry && entry->type)
+					break;
+			}
 		}
 		if (sub != NULL)
 			break;
@@ -786,12 +1117,12 @@ void pdf_xref_ensure_local_object(fz_context *ctx, pdf_document *doc, int num)
 	if (sub == NULL)
 		return; /* No object to find */
 
-	copy = pdf_deep_copy_obj(ctx, sub->table[num - sub->start].obj);
+	old_entry = peek_subsec_entry(sub, num - sub->start);
+	copy = pdf_deep_copy_obj(ctx, old_entry->obj);
 
 	/* Copy the object to the local section */
 	i = doc->xref_index[num];
 	doc->xref_index[num] = 0;
-	old_entry = &sub->table[num - sub->start];
 	fz_try(ctx)
 		new_entry = pdf_get_local_xref_entry(ctx, doc, num);
 	fz_catch(ctx)
@@ -1152,6 +1483,12 @@ pdf_xref_find_subsection(fz_context *ctx, pdf_document *doc, int start, int len)
 	 *         allocate it.
 	 */
 
+	/* Any lazily loaded subsections we might overlap or extend must be
+	 * turned into ordinary ones first. */
+	for (sub = xref->subsec; sub != NULL; sub = sub->next)
+		if (sub->lazy && start <= sub->start + sub->len && start + len >= sub->start)
+			ensure_subsec_loaded(ctx, doc, sub);
+
 	/* Sanity check */
 	for (sub = xref->subsec; sub != NULL; sub = sub->next)
 	{
@@ -1254,6 +1591,102 @@ validate_object_number_range(fz_context *ctx, int first, int len, const char *wh
 		fz_throw(ctx, FZ_ERROR_FORMAT, "last object number in %s out of range", what);
 }
 
+static int
+overlaps_subsec(pdf_xref *xref, int start, int len)
+{
+	pdf_xref_subsec *sub;
+	for (sub = xref->subsec; sub != NULL; sub = sub->next)
+		if (start < sub->start + sub->len && start + len > sub->start)
+			return 1;
+	return 0;
+}
+
+/* Add the objects start to start+len-1 to the xref being populated as
+ * a lazily loaded subsection, with rows of rowsize bytes from pos
+ * onwards. */
+static void
+add_lazy_subsec(fz_context *ctx, pdf_document *doc, int start, int len, pdf_xref_stream_rows *rows, int64_t pos, int rowsize)
+{
+	pdf_xref *xref = &doc->xref_sections[doc->num_xref_sections-1];
+	struct pdf_xref_lazy *lazy;
+	pdf_xref_subsec *sub = NULL;
+
+	fz_var(sub);
+
+	lazy = fz_malloc_struct(ctx, struct pdf_xref_lazy);
+	fz_try(ctx)
+	{
+		lazy->page = fz_malloc_struct_array(ctx, lazy_xref_pages(len), pdf_xref_entry *);
+		sub = fz_malloc_struct(ctx, pdf_xref_subsec);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, lazy->page);
+		fz_free(ctx, lazy);
+		fz_rethrow(ctx);
+	}
+	lazy->rows = rows ? fz_keep_imp(ctx, rows, &rows->refs) : NULL;
+	lazy->pos = pos;
+	lazy->rowsize = rowsize;
+	sub->start = start;
+	sub->len = len;
+	sub->table = NULL;
+	sub->lazy = lazy;
+	sub->next = xref->subsec;
+	xref->subsec = sub;
+
+	if (xref->num_objects < start + len)
+		xref->num_objects = start + len;
+	if (doc->max_xref_len < start + len)
+		extend_xref_index(ctx, doc, start + len);
+}
+
+/* Check for a well formed 20 byte xref table row at the given offset. */
+static int
+is_xref_table_row(fz_context *ctx, fz_stream *file, int64_t ofs)
+{
+	unsigned char row[20];
+	int i;
+
+	fz_seek(ctx, file, ofs, SEEK_SET);
+	if (fz_read(ctx, file, row, 20) != 20)
+		return 0;
+	for (i = 0; i < 16; i++)
+		if (i != 10 && !isdigit(row[i]))
+			return 0;
+	if (row[10] != ' ' || row[16] != ' ')
+		return 0;
+	if (row[17] != 'f' && row[17] != 'n')
+		return 0;
+	return iswhite(row[18]) && iswhite(row[19]);
+}
+
+/*
+ * Try to add a subsection of an old style xref table, whose rows start
+ * at the current file position, as a lazily loaded subsection. This
+ * only works when the rows are all 20 bytes long, as they should be; we
+ * check the first and last ones. Leaves the file positioned after the
+ * rows if it works, and where it was (returning 0) if it does not.
+ */
+static int
+add_lazy_xref_table(fz_context *ctx, pdf_document *doc, int start, int len)
+{
+	fz_stream *file = doc->file;
+	int64_t pos = fz_tell(ctx, file);
+
+	if (overlaps_subsec(&doc->xref_sections[doc->num_xref_sections-1], start, len) ||
+		!is_xref_table_row(ctx, file, pos) ||
+		!is_xref_table_row(ctx, file, pos + 20 * (int64_t)(len - 1)))
+	{
+		fz_seek(ctx, file, pos, SEEK_SET);
+		return 0;
+	}
+
+	add_lazy_subsec(ctx, doc, start, len, NULL, pos, 20);
+	fz_seek(ctx, file, pos + 20 * (int64_t)len, SEEK_SET);
+	return 1;
+}
+
 static pdf_obj *
 pdf_read_old_xref(fz_context *ctx, pdf_document *doc)
 {
@@ -1298,6 +1731,9 @@ pdf_read_old_xref(fz_context *ctx, pdf_document *doc)
 			fz_warn(ctx, "broken xref subsection, proceeding anyway.");
 		}
 
+		if (doc->lazy_xref && len >= LAZY_XREF_MIN && add_lazy_xref_table(ctx, doc, start, len))
+			continue;
+
 		table = pdf_xref_find_subsection(ctx, doc, start, len);
 
 		/* Xref entries SHOULD be 20 bytes long, but we see 19 byte
@@ -1317,29 +1753,7 @@ pdf_read_old_xref(fz_context *ctx, pdf_document *doc)
 				s = buf->scratch;
 				e = s + n;
 
-				entry->num = start + i;
-
-				/* broken pdfs where line start with white space */
-				while (s < e && iswhite(*s))
-					s++;
-
-				if (s == e || !isdigit(*s))
-					fz_throw(ctx, FZ_ERROR_FORMAT, "xref offset missing");
-				while (s < e && isdigit(*s))
-					entry->ofs = entry->ofs * 10 + *s++ - '0';
-
-				while (s < e && iswhite(*s))
-					s++;
-				if (s == e || !isdigit(*s))
-					fz_throw(ctx, FZ_ERROR_FORMAT, "xref generation number missing");
-				while (s < e && isdigit(*s))
-					entry->gen = entry->gen * 10 + *s++ - '0';
-
-				while (s < e && iswhite(*s))
-					s++;
-				if (s == e || (*s != 'f' && *s != 'n' && *s != 'o'))
-					fz_throw(ctx, FZ_ERROR_FORMAT, "unexpected xref type: 0x%x (%d %d R)", s == e ? 0 : *s, entry->num, entry->gen);
-				entry->type = *s++;
+				parse_xref_table_row(ctx, entry, start + i, s, e);
 
 				/* If the last byte of our buffer isn't an EOL (or space), carry one byte forward */
 				carried = buf->scratch[19] > 32;
@@ -1364,14 +1778,55 @@ pdf_read_old_xref(fz_context *ctx, pdf_document *doc)
 	return pdf_parse_dict(ctx, doc, file, buf);
 }
 
+/*
+ * Add a subsection of an xref stream as a lazily loaded subsection,
+ * keeping its rows in *rowsp (which is shared between all the
+ * subsections of the stream, and created on first use).
+ */
+static void
+add_lazy_xref_stream(fz_context *ctx, pdf_document *doc, fz_stream *stm, pdf_xref_stream_rows **rowsp, int i0, int i1, int w0, int w1, int w2)
+{
+	pdf_xref_stream_rows *rows = *rowsp;
+	size_t w = (size_t)(w0 + w1 + w2);
+	size_t need = (size_t)i1 * w;
+	size_t pos;
+
+	if (rows == NULL)
+	{
+		rows = *rowsp = fz_malloc_struct(ctx, pdf_xref_stream_rows);
+		rows->refs = 1;
+		rows->w0 = w0;
+		rows->w1 = w1;
+		rows->w2 = w2;
+		rows->data = fz_new_buffer(ctx, need);
+	}
+
+	pos = rows->data->len;
+	fz_resize_buffer(ctx, rows->data, pos + need);
+	if (fz_read(ctx, stm, rows->data->data + pos, need) != need)
+		fz_throw(ctx, FZ_ERROR_FORMAT, "truncated xref stream");
+	rows->data->len = pos + need;
+
+	add_lazy_subsec(ctx, doc, i0, i1, rows, (int64_t)pos, (int)w);
+}
+
 static void
-pdf_read_new_xref_section(fz_context *ctx, pdf_document *doc, fz_stream *stm, int i0, int i1, int w0, int w1, int w2)
+pdf_read_new_xref_section(fz_context *ctx, pdf_document *doc, fz_stream *stm, pdf_xref_stream_rows **rowsp, int i0, int i1, int w0, int w1, int w2)
 {
 	pdf_xref_entry *table;
 	int i, n;
 
 	validate_object_number_range(ctx, i0, i1, "xref subsection");
 
+	if (doc->lazy_xref && i1 >= LAZY_XREF_MIN &&
+		w0 <= 4 && w1 <= 8 && w2 <= 4 && w0 + w1 + w2 > 0 &&
+		!overlaps_subsec(&doc->xref_sections[doc->num_xref_sections-1], i0, i1))
+	{
+		add_lazy_xref_stream(ctx, doc, stm, rowsp, i0, i1, w0, w1, w2);
+		doc->last_xref_was_old_style = 0;
+		return;
+	}
+
 	table = pdf_xref_find_subsection(ctx, doc, i0, i1);
 	for (i = i0; i < i0 + i1; i++)
 	{
@@ -1391,13 +1846,7 @@ pdf_read_new_xref_section(fz_context *ctx, pdf_document *doc, fz_stream *stm, in
 			c = (c << 8) + fz_read_byte(ctx, stm);
 
 		if (!entry->type)
-		{
-			int t = w0 ? a : 1;
-			entry->type = t == 0 ? 'f' : t == 1 ? 'n' : t == 2 ? 'o' : 0;
-			entry->ofs = w1 ? b : 0;
-			entry->gen = w2 ? c : 0;
-			entry->num = i;
-		}
+			set_xref_stream_entry(entry, i, a, b, c, w0, w1, w2);
 	}
 
 	doc->last_xref_was_old_style = 0;
@@ -1408,6 +1857,7 @@ static pdf_obj *
 pdf_read_new_xref(fz_context *ctx, pdf_document *doc)
 {
 	fz_stream *stm = NULL;
+	pdf_xref_stream_rows *rows = NULL;
 	pdf_obj *trailer = NULL;
 	pdf_obj *index = NULL;
 	pdf_obj *obj = NULL;
@@ -1418,6 +1868,7 @@ pdf_read_new_xref(fz_context *ctx, pdf_document *doc)
 
 	fz_var(trailer);
 	fz_var(stm);
+	fz_var(rows);
 
 	fz_try(ctx)
 	{
@@ -1482,7 +1933,7 @@ pdf_read_new_xref(fz_context *ctx, pdf_document *doc)
 
 		if (!index)
 		{
-			pdf_read_new_xref_section(ctx, doc, stm, 0, size, w0, w1, w2);
+			pdf_read_new_xref_section(ctx, doc, stm, &rows, 0, size, w0, w1, w2);
 		}
 		else
 		{
@@ -1491,7 +1942,7 @@ pdf_read_new_xref(fz_context *ctx, pdf_document *doc)
 			{
 				int i0 = pdf_array_get_int(ctx, index, t + 0);
 				int i1 = pdf_array_get_int(ctx, index, t + 1);
-				pdf_read_new_xref_section(ctx, doc, stm, i0, i1, w0, w1, w2);
+				pdf_read_new_xref_section(ctx, doc, stm, &rows, i0, i1, w0, w1, w2);
 			}
 		}
 		entry = pdf_get_populating_xref_entry(ctx, doc, num);
@@ -1507,6 +1958,8 @@ pdf_read_new_xref(fz_context *ctx, pdf_document *doc)
 	fz_always(ctx)
 	{
 		fz_drop_stream(ctx, stm);
+		if (rows)
+			drop_xref_stream_rows(ctx, rows);
 	}
 	fz_catch(ctx)
 	{
@@ -1629,8 +2082,10 @@ pdf_read_xref_sections(fz_context *ctx, pdf_document *doc, int64_t ofs, int read
 
 		/* For pathological files, such as chinese-example.pdf, where the original
 		 * xref in the file is highly fragmented, we can safely solidify it here
-		 * with no ill effects. */
-		ensure_solid_xref(ctx, doc, 0, doc->num_xref_sections-1);
+		 * with no ill effects. (Unless we are loading lazily, when that would
+		 * read everything in.) */
+		if (!doc->lazy_xref)
+			ensure_solid_xref(ctx, doc, 0, doc->num_xref_sections-1);
 
 		size = pdf_dict_get_int(ctx, pdf_trailer(ctx, doc), PDF_NAME(Size));
 		xref_len = pdf_xref_len(ctx, doc);
@@ -1666,11 +2121,10 @@ pdf_prime_xref_index(fz_context *ctx, pdf_document *doc)
 		while (subsec != NULL)
 		{
 			int start = subsec->start;
-			int end = subsec->start + subsec->len;
-			for (j = start; j < end; j++)
+			for (j = start; j < start + subsec->len; j++)
 			{
-				char t = subsec->table[j-start].type;
-				if (t != 0 && t != 'f')
+				pdf_xref_entry *entry = peek_subsec_entry(subsec, j - start);
+				if (entry && entry->type != 0 && entry->type != 'f')
 					idx[j] = i;
 			}
 
@@ -1723,6 +2177,20 @@ pdf_load_xref(fz_context *ctx, pdf_document *doc)
 	if (pdf_xref_len(ctx, doc) == 0)
 		fz_throw(ctx, FZ_ERROR_FORMAT, "found xref was empty");
 
+	/* When loading lazily, the index is filled in by lookups instead, and
+	 * entries are checked as they are read. */
+	if (doc->lazy_xref)
+	{
+		entry = pdf_get_xref_entry_no_null(ctx, doc, 0);
+		if (!entry->type)
+		{
+			entry->type = 'f';
+			entry->gen = 65535;
+			entry->num = 0;
+		}
+		return;
+	}
+
 	pdf_prime_xref_index(ctx, doc);
 
 	entry = pdf_get_xref_entry_no_null(ctx, doc, 0);
@@ -1883,7 +2351,11 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 		/* Try to load the linearized file if we are in progressive
 		 * mode. */
 		if (doc->file_reading_linearly)
+		{
+			/* Progressive loading fills the xref in as it goes. */
+			doc->lazy_xref = 0;
 			pdf_load_linear(ctx, doc);
+		}
 		else
 			/* Even if we're not in progressive mode, check to see
 			 * if the file claims to be linearized. This is important
@@ -2010,6 +2482,9 @@ pdf_drop_document_imp(fz_context *ctx, fz_document *doc_)
 	fz_defer_reap_end(ctx);
 
 	pdf_invalidate_xfa(ctx, doc);
+
+	/* Last of all, as everything above may still look at objects in it. */
+	pdf_drop_obj_arena(ctx, doc->obj_arena);
 }
 
 void
@@ -2028,6 +2503,114 @@ pdf_keep_document(fz_context *ctx, pdf_document *doc)
  * compressed object streams
  */
 
+/* Read the object numbers and offsets at the start of object stream
+ * num. Returns the number of entries that are usable. */
+static int
+read_obj_stm_index(fz_context *ctx, fz_stream *stm, pdf_lexbuf *buf, int num, int count, int xref_len, int *numbuf, int64_t *ofsbuf)
+{
+	pdf_token tok;
+	int i, found = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		tok = pdf_lex(ctx, stm, buf);
+		if (tok != PDF_TOK_INT)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt object stream (%d 0 R)", num);
+		numbuf[found] = buf->i;
+
+		tok = pdf_lex(ctx, stm, buf);
+		if (tok != PDF_TOK_INT)
+			fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt object stream (%d 0 R)", num);
+		ofsbuf[found] = buf->i;
+
+		if (numbuf[found] <= 0 || numbuf[found] >= xref_len)
+			fz_warn(ctx, "object stream object out of range, skipping");
+		else
+			found++;
+	}
+
+	return found;
+}
+
+/* Parse the i'th of the found objects in an object stream. */
+static pdf_obj *
+parse_obj_stm_obj(fz_context *ctx, pdf_document *doc, fz_stream *stm, pdf_lexbuf *buf, int64_t first, int64_t *ofsbuf, int i, int found)
+{
+	fz_stream *sub;
+	pdf_obj *obj = NULL;
+	uint64_t length;
+
+	if (i+1 < found)
+		length = ofsbuf[i+1] - ofsbuf[i];
+	else
+		length = UINT64_MAX;
+
+	sub = fz_open_null_filter(ctx, stm, length, first + ofsbuf[i]);
+	fz_try(ctx)
+		obj = pdf_parse_stm_obj(ctx, doc, sub, buf);
+	fz_always(ctx)
+		fz_drop_stream(ctx, sub);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return obj;
+}
+
+/*
+	Put obj (taking ownership of it) into the xref entry for object
+	onum, if that says it is to be found in object stream num. Returns
+	1 if it does.
+*/
+static int
+install_obj_stm_obj(fz_context *ctx, pdf_document *doc, int num, int onum, pdf_obj *obj)
+{
+	pdf_xref_entry *entry;
+
+	fz_try(ctx)
+		entry = pdf_get_xref_entry_no_null(ctx, doc, onum);
+	fz_catch(ctx)
+	{
+		pdf_drop_obj(ctx, obj);
+		fz_rethrow(ctx);
+	}
+
+	pdf_set_obj_parent(ctx, obj, onum);
+
+	/* We may have set entry->type to be 'O' from being 'o' to avoid nasty
+	 * recursions in pdf_cache_object. Accept the type being 'O' here. */
+	if ((entry->type == 'o' || entry->type == 'O') && entry->ofs == num)
+	{
+		/* If we already have an entry for this object,
+		 * we'd like to drop it and use the new one -
+		 * but this means that anyone currently holding
+		 * a pointer to the old one will be left with a
+		 * stale pointer. Instead, we drop the new one
+		 * and trust that the old one is correct. */
+		if (entry->obj)
+		{
+			if (pdf_objcmp(ctx, entry->obj, obj))
+				fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", onum);
+			pdf_drop_obj(ctx, obj);
+		}
+		else
+		{
+			entry->obj = obj;
+			/* If we've just read a 'null' object, don't leave this as a NULL 'o' object,
+			 * as that will a) confuse the code that called us into thinking that nothing
+			 * was loaded, and b) cause the entire objstm to be reloaded every time that
+			 * object is accessed. Instead, just mark it as an 'f'. */
+			if (obj == NULL)
+				entry->type = 'f';
+			fz_drop_buffer(ctx, entry->stm_buf);
+			entry->stm_buf = NULL;
+		}
+		return 1;
+	}
+
+	pdf_drop_obj(ctx, obj);
+	return 0;
+}
+
 /*
 	Do not hold pdf_xref_entry's over call to this function as they
 	may be invalidated!
@@ -2044,18 +2627,14 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 	int64_t first;
 	int count;
 	int i;
-	pdf_token tok;
 	pdf_xref_entry *ret_entry = NULL;
 	int ret_idx;
-	int xref_len;
 	int found;
-	fz_stream *sub = NULL;
 
 	fz_var(numbuf);
 	fz_var(ofsbuf);
 	fz_var(objstm);
 	fz_var(stm);
-	fz_var(sub);
 
 	fz_try(ctx)
 	{
@@ -2083,88 +2662,24 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 		numbuf = fz_calloc(ctx, count, sizeof(*numbuf));
 		ofsbuf = fz_calloc(ctx, count, sizeof(*ofsbuf));
 
-		xref_len = pdf_xref_len(ctx, doc);
-
-		found = 0;
-
 		stm = pdf_open_stream_number(ctx, doc, num);
-		for (i = 0; i < count; i++)
-		{
-			tok = pdf_lex(ctx, stm, buf);
-			if (tok != PDF_TOK_INT)
-				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt object stream (%d 0 R)", num);
-			numbuf[found] = buf->i;
-
-			tok = pdf_lex(ctx, stm, buf);
-			if (tok != PDF_TOK_INT)
-				fz_throw(ctx, FZ_ERROR_FORMAT, "corrupt object stream (%d 0 R)", num);
-			ofsbuf[found] = buf->i;
-
-			if (numbuf[found] <= 0 || numbuf[found] >= xref_len)
-				fz_warn(ctx, "object stream object out of range, skipping");
-			else
-				found++;
-		}
+		found = read_obj_stm_index(ctx, stm, buf, num, count, pdf_xref_len(ctx, doc), numbuf, ofsbuf);
 
 		ret_idx = -1;
-		for (i = 0; i < found; i++)
+		pdf_open_obj_arena(ctx, doc);
+		fz_try(ctx)
 		{
-			pdf_xref_entry *entry;
-			uint64_t length;
-			int64_t offset;
-
-			offset = first + ofsbuf[i];
-			if (i+1 < found)
-				length = ofsbuf[i+1] - ofsbuf[i];
-			else
-				length = UINT64_MAX;
-
-			sub = fz_open_null_filter(ctx, stm, length, offset);
-
-			obj = pdf_parse_stm_obj(ctx, doc, sub, buf);
-			fz_drop_stream(ctx, sub);
-			sub = NULL;
-
-			entry = pdf_get_xref_entry_no_null(ctx, doc, numbuf[i]);
-
-			pdf_set_obj_parent(ctx, obj, numbuf[i]);
-
-			/* We may have set entry->type to be 'O' from being 'o' to avoid nasty
-			 * recursions in pdf_cache_object. Accept the type being 'O' here. */
-			if ((entry->type == 'o' || entry->type == 'O') && entry->ofs == num)
+			for (i = 0; i < found; i++)
 			{
-				/* If we already have an entry for this object,
-				 * we'd like to drop it and use the new one -
-				 * but this means that anyone currently holding
-				 * a pointer to the old one will be left with a
-				 * stale pointer. Instead, we drop the new one
-				 * and trust that the old one is correct. */
-				if (entry->obj)
-				{
-					if (pdf_objcmp(ctx, entry->obj, obj))
-						fz_warn(ctx, "Encountered new definition for object %d - keeping the original one", numbuf[i]);
-					pdf_drop_obj(ctx, obj);
-				}
-				else
-				{
-					entry->obj = obj;
-					/* If we've just read a 'null' object, don't leave this as a NULL 'o' object,
-					 * as that will a) confuse the code that called us into thinking that nothing
-					 * was loaded, and b) cause the entire objstm to be reloaded every time that
-					 * object is accessed. Instead, just mark it as an 'f'. */
-					if (obj == NULL)
-						entry->type = 'f';
-					fz_drop_buffer(ctx, entry->stm_buf);
-					entry->stm_buf = NULL;
-				}
-				if (numbuf[i] == target)
+				obj = parse_obj_stm_obj(ctx, doc, stm, buf, first, ofsbuf, i, found);
+				if (install_obj_stm_obj(ctx, doc, num, numbuf[i], obj) && numbuf[i] == target)
 					ret_idx = i;
 			}
-			else
-			{
-				pdf_drop_obj(ctx, obj);
-			}
 		}
+		fz_always(ctx)
+			pdf_close_obj_arena(ctx, doc);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
 		/* Parsing our way through the stream can cause the xref to be
 		 * solidified, which will move an entry. We therefore can't
 		 * read the entry for returning until no more parsing is to be
@@ -2175,7 +2690,6 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 	fz_always(ctx)
 	{
 		fz_drop_stream(ctx, stm);
-		fz_drop_stream(ctx, sub);
 		fz_free(ctx, ofsbuf);
 		fz_free(ctx, numbuf);
 		pdf_unmark_obj(ctx, objstm);
@@ -2188,6 +2702,283 @@ pdf_load_obj_stm(fz_context *ctx, pdf_document *doc, int num, pdf_lexbuf *buf, i
 	return ret_entry;
 }
 
+/*
+ * Decoding object streams in bulk, on several threads.
+ *
+ * pdf_new_obj_stm_batch finds the object streams that hold objects not
+ * loaded yet, and reads their (compressed, but decrypted) data. Any
+ * number of threads, each with its own cloned context, can then call
+ * pdf_decode_obj_stm_batch to take the streams one at a time from the
+ * batch, decompress them, and parse the objects in them. This never
+ * touches the xref, but the document must not be used by anyone else
+ * until all the decoding is done. pdf_merge_obj_stm_batch then puts the
+ * objects in the xref, on the thread that owns the document.
+ *
+ * Streams that cannot be read or decoded here, or whose filters refer to
+ * other objects, are skipped; they are loaded (and repaired, if need be)
+ * as usual when their objects are.
+ *
+ * A document's object arena (if it has one) is a single unlocked pool,
+ * so the objects decoded here are allocated on the heap as usual.
+ */
+
+typedef struct
+{
+	int num;
+	int count;
+	int64_t first;
+	pdf_obj *dict; /* direct copies of the filters, for any thread */
+	fz_buffer *data;
+
+	int found;
+	int *nums;
+	pdf_obj **objs;
+} pdf_obj_stm_job;
+
+struct pdf_obj_stm_batch
+{
+	pdf_document *doc;
+	int xref_len;
+	int len, next;
+	pdf_obj_stm_job *job;
+};
+
+static int
+cmp_obj_stm_num(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_;
+	int b = *(const int *)b_;
+	return a < b ? -1 : a > b;
+}
+
+/* Resolving a reference reads the xref (and maybe the file), which the
+ * decoding threads must not do; so they only get direct objects. */
+static int
+has_indirect_obj(fz_context *ctx, pdf_obj *obj, int depth)
+{
+	int i, n;
+
+	if (pdf_is_indirect(ctx, obj))
+		return 1;
+	if (depth > 32)
+		return 1;
+	if (pdf_is_array(ctx, obj))
+	{
+		n = pdf_array_len(ctx, obj);
+		for (i = 0; i < n; i++)
+			if (has_indirect_obj(ctx, pdf_array_get(ctx, obj, i), depth + 1))
+				return 1;
+	}
+	else if (pdf_is_dict(ctx, obj))
+	{
+		n = pdf_dict_len(ctx, obj);
+		for (i = 0; i < n; i++)
+			if (has_indirect_obj(ctx, pdf_dict_get_val(ctx, obj, i), depth + 1))
+				return 1;
+	}
+	return 0;
+}
+
+static void
+add_obj_stm_job(fz_context *ctx, pdf_obj_stm_batch *batch, int num)
+{
+	pdf_obj_stm_job *job = &batch->job[batch->len];
+	pdf_obj *dict, *filter, *parms;
+
+	dict = pdf_load_object(ctx, batch->doc, num);
+	fz_try(ctx)
+	{
+		filter = pdf_dict_geta(ctx, dict, PDF_NAME(Filter), PDF_NAME(F));
+		parms = pdf_dict_geta(ctx, dict, PDF_NAME(DecodeParms), PDF_NAME(DP));
+
+		/* Explicit crypt filters need the object number to seed them. */
+		if (!pdf_stream_has_crypt(ctx, dict) && !has_indirect_obj(ctx, filter, 0) && !has_indirect_obj(ctx, parms, 0))
+		{
+			job->count = pdf_dict_get_int(ctx, dict, PDF_NAME(N));
+			job->first = pdf_dict_get_int(ctx, dict, PDF_NAME(First));
+			if (job->count < 0 || job->count > PDF_MAX_OBJECT_NUMBER)
+				fz_throw(ctx, FZ_ERROR_FORMAT, "number of objects in object stream out of range");
+			job->data = pdf_load_raw_stream_number(ctx, batch->doc, num);
+			job->dict = pdf_new_dict(ctx, batch->doc, 2);
+			if (filter)
+				pdf_dict_put_drop(ctx, job->dict, PDF_NAME(Filter), pdf_deep_copy_obj(ctx, filter));
+			if (parms)
+				pdf_dict_put_drop(ctx, job->dict, PDF_NAME(DecodeParms), pdf_deep_copy_obj(ctx, parms));
+			job->num = num;
+			batch->len++;
+		}
+	}
+	fz_always(ctx)
+		pdf_drop_obj(ctx, dict);
+	fz_catch(ctx)
+	{
+		pdf_drop_obj(ctx, job->dict);
+		job->dict = NULL;
+		fz_drop_buffer(ctx, job->data);
+		job->data = NULL;
+		fz_rethrow(ctx);
+	}
+}
+
+pdf_obj_stm_batch *
+pdf_new_obj_stm_batch(fz_context *ctx, pdf_document *doc)
+{
+	pdf_obj_stm_batch *batch;
+	int *nums = NULL;
+	int i, len, cap, n;
+
+	fz_var(nums);
+
+	batch = fz_malloc_struct(ctx, pdf_obj_stm_batch);
+	batch->doc = pdf_keep_document(ctx, doc);
+
+	fz_try(ctx)
+	{
+		/* Find the object streams we need, in order and without repeats. */
+		batch->xref_len = pdf_xref_len(ctx, doc);
+		len = cap = 0;
+		for (i = 1; i < batch->xref_len; i++)
+		{
+			pdf_xref_entry *x = pdf_get_xref_entry_no_change(ctx, doc, i);
+			if (x == NULL || x->type != 'o' || x->obj != NULL)
+				continue;
+			if (len == cap)
+			{
+				cap = cap ? cap * 2 : 64;
+				nums = fz_realloc_array(ctx, nums, cap, int);
+			}
+			nums[len++] = (int)x->ofs;
+		}
+		qsort(nums, len, sizeof(*nums), cmp_obj_stm_num);
+		for (i = n = 0; i < len; i++)
+			if (n == 0 || nums[i] != nums[n-1])
+				nums[n++] = nums[i];
+
+		batch->job = fz_malloc_struct_array(ctx, n, pdf_obj_stm_job);
+		for (i = 0; i < n; i++)
+		{
+			fz_try(ctx)
+				add_obj_stm_job(ctx, batch, nums[i]);
+			fz_catch(ctx)
+			{
+				fz_rethrow_if(ctx, FZ_ERROR_SYSTEM);
+				fz_report_error(ctx);
+			}
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, nums);
+	fz_catch(ctx)
+	{
+		pdf_drop_obj_stm_batch(ctx, batch);
+		fz_rethrow(ctx);
+	}
+
+	return batch;
+}
+
+int
+pdf_decode_obj_stm_batch(fz_context *ctx, pdf_obj_stm_batch *batch)
+{
+	pdf_obj_stm_job *job = NULL;
+	fz_stream *raw = NULL;
+	fz_stream *stm = NULL;
+	int64_t *ofsbuf = NULL;
+	pdf_lexbuf buf;
+	int i, found;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (batch->next < batch->len)
+		job = &batch->job[batch->next++];
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	if (job == NULL)
+		return 0;
+
+	fz_var(raw);
+	fz_var(stm);
+	fz_var(ofsbuf);
+
+	pdf_lexbuf_init(ctx, &buf, PDF_LEXBUF_SMALL);
+	fz_try(ctx)
+	{
+		job->nums = fz_calloc(ctx, job->count, sizeof(*job->nums));
+		job->objs = fz_calloc(ctx, job->count, sizeof(*job->objs));
+		ofsbuf = fz_calloc(ctx, job->count, sizeof(*ofsbuf));
+
+		raw = fz_open_buffer(ctx, job->data);
+		stm = pdf_open_inline_stream(ctx, batch->doc, job->dict, (int)fz_minz(job->data->len, INT_MAX), raw, NULL);
+		found = read_obj_stm_index(ctx, stm, &buf, job->num, job->count, batch->xref_len, job->nums, ofsbuf);
+		for (i = 0; i < found; i++)
+		{
+			job->objs[i] = parse_obj_stm_obj(ctx, batch->doc, stm, &buf, job->first, ofsbuf, i, found);
+			job->found = i + 1;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_drop_stream(ctx, raw);
+		fz_free(ctx, ofsbuf);
+		pdf_lexbuf_fin(ctx, &buf);
+		fz_drop_buffer(ctx, job->data);
+		job->data = NULL;
+		pdf_drop_obj(ctx, job->dict);
+		job->dict = NULL;
+	}
+	fz_catch(ctx)
+	{
+		/* Leave the whole stream to be loaded as usual. */
+		fz_report_error(ctx);
+		for (i = 0; i < job->found; i++)
+			pdf_drop_obj(ctx, job->objs[i]);
+		job->found = 0;
+	}
+
+	return 1;
+}
+
+void
+pdf_merge_obj_stm_batch(fz_context *ctx, pdf_obj_stm_batch *batch)
+{
+	int i, k;
+
+	for (i = 0; i < batch->len; i++)
+	{
+		pdf_obj_stm_job *job = &batch->job[i];
+		for (k = 0; k < job->found; k++)
+		{
+			pdf_obj *obj = job->objs[k];
+			job->objs[k] = NULL;
+			install_obj_stm_obj(ctx, batch->doc, job->num, job->nums[k], obj);
+		}
+		job->found = 0;
+	}
+}
+
+void
+pdf_drop_obj_stm_batch(fz_context *ctx, pdf_obj_stm_batch *batch)
+{
+	int i, k;
+
+	if (batch == NULL)
+		return;
+
+	for (i = 0; i < batch->len; i++)
+	{
+		pdf_obj_stm_job *job = &batch->job[i];
+		for (k = 0; k < job->found; k++)
+			pdf_drop_obj(ctx, job->objs[k]);
+		fz_free(ctx, job->objs);
+		fz_free(ctx, job->nums);
+		pdf_drop_obj(ctx, job->dict);
+		fz_drop_buffer(ctx, job->data);
+	}
+	fz_free(ctx, batch->job);
+	pdf_drop_document(ctx, batch->doc);
+	fz_free(ctx, batch);
+}
+
 /*
  * object loading
  */
@@ -2465,6 +3256,25 @@ object_updated:
 	if (x->obj != NULL)
 		return x;
 
+	/* Entries read lazily are only checked as they are read. */
+	if (doc->lazy_xref_damaged && !doc->repair_attempted)
+	{
+		doc->lazy_xref_damaged = 0;
+		goto perform_repair;
+	}
+	if (doc->lazy_xref && x->type == 'o' && !doc->repair_attempted)
+	{
+		int64_t ofs = x->ofs;
+		pdf_xref_entry *ostm = NULL;
+		if (ofs > 0 && ofs < pdf_xref_len(ctx, doc))
+			ostm = pdf_get_xref_entry_no_change(ctx, doc, (int)ofs);
+		if (ostm == NULL || ostm->type != 'n')
+		{
+			fz_warn(ctx, "invalid reference to an objstm that does not exist: %d (%d 0 R)", (int)ofs, num);
+			goto perform_repair;
+		}
+	}
+
 	if (x->type == 'f')
 	{
 		x->obj = PDF_NULL;
@@ -2473,11 +3283,14 @@ object_updated:
 	{
 		fz_seek(ctx, doc->file, doc->bias + x->ofs, SEEK_SET);
 
+		pdf_open_obj_arena(ctx, doc);
 		fz_try(ctx)
 		{
 			x->obj = pdf_parse_ind_obj(ctx, doc, doc->file,
 					&rnum, &rgen, &x->stm_ofs, &try_repair);
 		}
+		fz_always(ctx)
+			pdf_close_obj_arena(ctx, doc);
 		fz_catch(ctx)
 		{
 			fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
@@ -2793,8 +3606,8 @@ pdf_delete_object(fz_context *ctx, pdf_document *doc, int num)
 				if (num < sub->start || num >= sub->start + sub->len)
 					continue;
 
-				entry = &sub->table[num - sub->start];
-				if (entry->type)
+				entry = subsec_entry(ctx, doc, sub, num);
+				if (entry && entry->type)
 				{
 					if (entry->type == 'f')
 					{
@@ -3098,7 +3911,7 @@ void pdf_run_document_structure_imp(fz_context *ctx, fz_document *doc, fz_device
 
 
 static pdf_document *
-pdf_new_document(fz_context *ctx, fz_stream *file)
+pdf_new_document(fz_context *ctx, fz_stream *file, const pdf_open_options *opts)
 {
 	pdf_document *doc = fz_new_derived_document(ctx, pdf_document);
 
@@ -3128,6 +3941,12 @@ pdf_new_document(fz_context *ctx, fz_stream *file)
 	pdf_lexbuf_init(ctx, &doc->lexbuf.base, PDF_LEXBUF_LARGE);
 	doc->file = fz_keep_stream(ctx, file);
 
+	/* Only documents read from a file have anything to put in an arena. */
+	if (file && opts && opts->obj_arena)
+		doc->obj_arena = pdf_new_obj_arena(ctx);
+	if (opts)
+		doc->lazy_xref = opts->lazy_xref;
+
 	/* Default to PDF-1.7 if the version header is missing and for new documents */
 	doc->version = 17;
 
@@ -3135,9 +3954,9 @@ pdf_new_document(fz_context *ctx, fz_stream *file)
 }
 
 pdf_document *
-pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
+pdf_open_document_with_stream_and_options(fz_context *ctx, fz_stream *file, const pdf_open_options *opts)
 {
-	pdf_document *doc = pdf_new_document(ctx, file);
+	pdf_document *doc = pdf_new_document(ctx, file, opts);
 	fz_try(ctx)
 	{
 		pdf_init_document(ctx, doc);
@@ -3154,11 +3973,17 @@ pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
 	return doc;
 }
 
+pdf_document *
+pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
+{
+	return pdf_open_document_with_stream_and_options(ctx, file, NULL);
+}
+
 /* Uncomment the following to test progressive loading. */
 /* #define TEST_PROGRESSIVE_HACK */
 
 pdf_document *
-pdf_open_document(fz_context *ctx, const char *filename)
+pdf_open_document_with_options(fz_context *ctx, const char *filename, const pdf_open_options *opts)
 {
 	fz_stream *file = NULL;
 	pdf_document *doc = NULL;
@@ -3172,7 +3997,7 @@ pdf_open_document(fz_context *ctx, const char *filename)
 #ifdef TEST_PROGRESSIVE_HACK
 		file->progressive = 1;
 #endif
-		doc = pdf_new_document(ctx, file);
+		doc = pdf_new_document(ctx, file, opts);
 		pdf_init_document(ctx, doc);
 	}
 	fz_always(ctx)
@@ -3205,6 +4030,12 @@ pdf_open_document(fz_context *ctx, const char *filename)
 	return doc;
 }
 
+pdf_document *
+pdf_open_document(fz_context *ctx, const char *filename)
+{
+	return pdf_open_document_with_options(ctx, filename, NULL);
+}
+
 static void
 pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum)
 {
@@ -3632,7 +4463,7 @@ pdf_document *pdf_create_document(fz_context *ctx)
 
 	fz_var(trailer);
 
-	doc = pdf_new_document(ctx, NULL);
+	doc = pdf_new_document(ctx, NULL, NULL);
 	fz_try(ctx)
 	{
 		doc->file_size = 0;
@@ -3749,8 +4580,8 @@ void pdf_mark_xref(fz_context *ctx, pdf_document *doc)
 		{
 			for (e = 0; e < sub->len; e++)
 			{
-				pdf_xref_entry *entry = &sub->table[e];
-				if (entry->obj)
+				pdf_xref_entry *entry = peek_subsec_entry(sub, e);
+				if (entry && entry->obj)
 				{
 					entry->marked = 1;
 				}
@@ -3772,10 +4603,10 @@ void pdf_clear_xref(fz_context *ctx, pdf_document *doc)
 		{
 			for (e = 0; e < sub->len; e++)
 			{
-				pdf_xref_entry *entry = &sub->table[e];
+				pdf_xref_entry *entry = peek_subsec_entry(sub, e);
 				/* We cannot drop objects if the stream
 				 * buffer has been updated */
-				if (entry->obj != NULL && entry->stm_buf == NULL)
+				if (entry && entry->obj != NULL && entry->stm_buf == NULL)
 				{
 					if (pdf_obj_refs(ctx, entry->obj) == 1)
 					{
@@ -3801,11 +4632,11 @@ void pdf_clear_xref_to_mark(fz_context *ctx, pdf_document *doc)
 		{
 			for (e = 0; e < sub->len; e++)
 			{
-				pdf_xref_entry *entry = &sub->table[e];
+				pdf_xref_entry *entry = peek_subsec_entry(sub, e);
 
 				/* We cannot drop objects if the stream buffer has
 				 * been updated */
-				if (entry->obj != NULL && entry->stm_buf == NULL)
+				if (entry && entry->obj != NULL && entry->stm_buf == NULL)
 				{
 					if (!entry->marked && pdf_obj_refs(ctx, entry->obj) == 1)
 					{
@@ -3839,6 +4670,7 @@ pdf_doc_was_linearized(fz_context *ctx, pdf_document *doc)
 static int pdf_obj_exists(fz_context *ctx, pdf_document *doc, int i)
 {
 	pdf_xref_subsec *sub;
+	pdf_xref_entry *entry;
 	int j;
 
 	if (i < 0)
@@ -3866,7 +4698,8 @@ static int pdf_obj_exists(fz_context *ctx, pdf_document *doc, int i)
 				if (i < sub->start || i >= sub->start + sub->len)
 					continue;
 
-				if (sub->table[i - sub->start].type)
+				entry = subsec_entry(ctx, doc, sub, i);
+				if (entry && entry->type)
 					return 1;
 			}
 		}
@@ -4989,8 +5822,8 @@ pdf_find_incremental_update_num_for_obj(fz_context *ctx, pdf_document *doc, pdf_
 				if (i < sub->start || i >= sub->start + sub->len)
 					continue;
 
-				entry = &sub->table[i - sub->start];
-				if (entry->obj == obj)
+				entry = peek_subsec_entry(sub, i - sub->start);
+				if (entry && entry->obj == obj)
 					return j;
 			}
 		}
@@ -5257,12 +6090,11 @@ void pdf_minimize_document(fz_context *ctx, pdf_document *doc)
 
 		for (sub = xref->subsec; sub; sub = sub->next)
 		{
-			int len = sub->len;
 			int j;
-			for (j = 0; j < len; j++)
+			for (j = 0; j < sub->len; j++)
 			{
-				pdf_xref_entry *e = &sub->table[j];
-				if (e->obj == NULL)
+				pdf_xref_entry *e = peek_subsec_entry(sub, j);
+				if (e == NULL || e->obj == NULL)
 					continue;
 				e->obj = pdf_drop_singleton_obj(ctx, e->obj);
 			}
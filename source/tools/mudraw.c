@@ -292,6 +292,8 @@ typedef struct worker_t {
 	fz_rect tbounds;
 	fz_pixmap *pix;
 	fz_bitmap *bit;
+	fz_tile_render *tiles; /* set when rendering tiles of a shared page pixmap */
+	fz_pixmap *tile_pix;
 	fz_cookie cookie;
 #ifndef DISABLE_MUTHREADS
 	mu_semaphore start;
@@ -326,7 +328,9 @@ static float min_line_width = 0.0f;
 static int showfeatures = 0;
 static int showtime = 0;
 static int showmemory = 0;
+static int showcache = 0;
 static int showmd5 = 0;
+static int showlist = 0;
 
 #if FZ_ENABLE_PDF
 static pdf_document *pdfout = NULL;
@@ -347,6 +351,22 @@ static int invert = 0;
 static int s_kill = 0; /* Using `kill` causes problems on Android. */
 static int band_height = 0;
 static int lowmemory = 0;
+static int batch_paths = 0;
+static int cache_paths = 0;
+static int mmap_files = 0;
+static int prefetch = 0;
+static int slow_read_ms = 0;
+static int lazy_xref = 0;
+static int obj_arena = 0;
+static int store_shards = 0;
+static int store_policy = -1;
+static int num_store_limits = 0;
+static const char *store_limit_type[8];
+static size_t store_limit_max[8];
+static const char *shared_glyph_cache = NULL;
+static size_t shared_glyph_cache_size = 64 << 20;
+static size_t glyph_cache_size = 0;
+static int per_thread_freetype = 0;
 
 static int quiet = 0;
 static int errored = 0;
@@ -398,6 +418,15 @@ static struct {
 	fz_separations *seps;
 } bgprint;
 
+#ifndef DISABLE_MUTHREADS
+static struct {
+	fz_context *ctx;
+	fz_prefetch *pf;
+	mu_thread thread;
+	mu_semaphore wake;
+} prefetcher;
+#endif
+
 static struct {
 	int count, total;
 	int min, max;
@@ -435,6 +464,8 @@ static int usage(void)
 		"\t\tt - show timings\n"
 		"\t\tf - show page features\n"
 		"\t\t5 - show md5 checksum of rendered image\n"
+		"\t\tl - show display list size\n"
+		"\t\tc - show store and glyph cache counters\n"
 		"\n"
 		"\t-R -\trotate clockwise (default: 0 degrees)\n"
 		"\t-r -\tresolution in dpi (default: 72)\n"
@@ -444,7 +475,7 @@ static int usage(void)
 		"\t-b -\tuse named page box (MediaBox, CropBox, BleedBox, TrimBox, or ArtBox)\n"
 		"\t-B -\tmaximum band_height (pXm, pcl, pclm, ocr.pdf, ps, psd and png output only)\n"
 #ifndef DISABLE_MUTHREADS
-		"\t-T -\tnumber of threads to use for rendering (banded mode only)\n"
+		"\t-T -\tnumber of threads to use for rendering (per band, or per tile if not banded)\n"
 #else
 		"\t-T -\tnumber of threads to use for rendering (disabled in this non-threading build)\n"
 #endif
@@ -464,17 +495,34 @@ static int usage(void)
 		"\t-A -\tnumber of bits of antialiasing (0 to 8)\n"
 		"\t-A -/-\tnumber of bits of antialiasing (0 to 8) (graphics, text)\n"
 		"\t-l -\tminimum stroked line width (in pixels)\n"
+		"\t-g\tbatch opaque paths of the same color (faster for CAD drawings and maps)\n"
+		"\t-u\tkeep flattened paths for reuse by later bands and tiles\n"
 		"\t-K\tdo not draw text\n"
 		"\t-KK\tonly draw text\n"
 		"\t-D\tdisable use of display list\n"
 		"\t-i\tignore errors\n"
 		"\t-m -\tlimit memory usage in bytes\n"
 		"\t-L\tlow memory mode (avoid caching, clear objects after each page)\n"
+		"\t-M\tmap input files into memory rather than reading them\n"
+#ifndef DISABLE_MUTHREADS
+		"\t-J\tread ahead in input files on a background thread\n"
+#else
+		"\t-J\tread ahead in input files on a background thread (disabled in this non-threading build)\n"
+#endif
+		"\t-Q -\tsimulate slow storage, delaying each read of input files by this many milliseconds\n"
+		"\t-E\tread PDF cross reference tables lazily (faster opening of huge files)\n"
+		"\t-C\tallocate the objects read from PDF files in bulk (faster loading and closing)\n"
 #ifndef DISABLE_MUTHREADS
 		"\t-P\tparallel interpretation/rendering\n"
 #else
 		"\t-P\tparallel interpretation/rendering (disabled in this non-threading build)\n"
 #endif
+		"\t--store-shards=-\tsplit the resource store into this many shards (up to 16; less lock contention with -T or -P)\n"
+		"\t--store-policy=-\tchoose which items the resource store evicts first (lru, 2q or cost)\n"
+		"\t--store-limit=-:-\tlimit the bytes taken by one type of item in the resource store (may be repeated)\n"
+		"\t--shared-glyph-cache=-[,-]\tshare rendered glyphs with other processes through this file (of this many bytes, default 64MB)\n"
+		"\t--glyph-cache-size=-\tlimit the glyph cache to this many bytes (default 1MB)\n"
+		"\t--per-thread-freetype=yes|no\tload glyphs with a FreeType library for each thread (default no)\n"
 		"\t-N\tdisable ICC workflow (\"N\"o color management)\n"
 		"\t-O -\tControl spot/overprint rendering\n"
 #if FZ_ENABLE_SPOT_RENDERING
@@ -631,6 +679,17 @@ static void apply_kill_switch(fz_device *dev)
 	}
 }
 
+static void finishband(fz_context *ctx, int band_start, fz_pixmap *pix, fz_bitmap **bit)
+{
+	if (invert)
+		fz_invert_pixmap(ctx, pix);
+	if (gamma_value != 1)
+		fz_gamma_pixmap(ctx, pix, gamma_value);
+
+	if (((output_format == OUT_PCL || output_format == OUT_PWG) && out_cs == CS_MONO) || (output_format == OUT_PBM) || (output_format == OUT_PKM))
+		*bit = fz_new_bitmap_from_pixmap_band(ctx, pix, NULL, band_start);
+}
+
 static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_matrix ctm, fz_rect tbounds, fz_cookie *cookie, int band_start, fz_pixmap *pix, fz_bitmap **bit)
 {
 	fz_device *dev = NULL;
@@ -652,6 +711,10 @@ static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_m
 			fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
 		if (alphabits_graphics == 0)
 			fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+		if (batch_paths)
+			fz_enable_device_hints(ctx, dev, FZ_BATCH_PATHS);
+		if (cache_paths && !lowmemory)
+			fz_enable_device_hints(ctx, dev, FZ_CACHE_FLATTENED_PATHS);
 		if (list)
 			fz_run_display_list(ctx, list, dev, ctm, tbounds, cookie);
 		else
@@ -660,13 +723,7 @@ static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_m
 		fz_drop_device(ctx, dev);
 		dev = NULL;
 
-		if (invert)
-			fz_invert_pixmap(ctx, pix);
-		if (gamma_value != 1)
-			fz_gamma_pixmap(ctx, pix, gamma_value);
-
-		if (((output_format == OUT_PCL || output_format == OUT_PWG) && out_cs == CS_MONO) || (output_format == OUT_PBM) || (output_format == OUT_PKM))
-			*bit = fz_new_bitmap_from_pixmap_band(ctx, pix, NULL, band_start);
+		finishband(ctx, band_start, pix, bit);
 	}
 	fz_catch(ctx)
 	{
@@ -675,6 +732,81 @@ static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, fz_m
 	}
 }
 
+#ifndef DISABLE_MUTHREADS
+/* Create the draw device for one tile, set up as drawband does. */
+static fz_device *new_tile_device(fz_context *ctx, void *arg, fz_pixmap *tile)
+{
+	fz_device *dev = fz_new_draw_device_with_proof(ctx, fz_identity, tile, proof_cs);
+	apply_kill_switch(dev);
+	if (lowmemory)
+		fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
+	if (alphabits_graphics == 0)
+		fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+	if (batch_paths)
+		fz_enable_device_hints(ctx, dev, FZ_BATCH_PATHS);
+	if (cache_paths && !lowmemory)
+		fz_enable_device_hints(ctx, dev, FZ_CACHE_FLATTENED_PATHS);
+	return dev;
+}
+#endif
+
+/* Render a whole page by splitting it into tiles shared out between
+ * the worker threads. */
+static void drawtiles(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_cookie *cookie, fz_pixmap *pix, fz_bitmap **bit)
+{
+#ifndef DISABLE_MUTHREADS
+	fz_tile_render *tr = NULL;
+	int i, failed = 0;
+
+	fz_var(tr);
+
+	*bit = NULL;
+
+	fz_try(ctx)
+	{
+		if (pix->alpha)
+			fz_clear_pixmap(ctx, pix);
+		else
+			fz_clear_pixmap_with_value(ctx, pix, 255);
+
+		tr = fz_new_tile_render(ctx, list, ctm, fz_pixmap_bbox(ctx, pix), 0, 0);
+		DEBUG_THREADS(("Using %d tiles\n", fz_count_render_tiles(ctx, tr)));
+
+		for (i = 0; i < num_workers; i++)
+		{
+			workers[i].band = 0;
+			workers[i].error = 0;
+			workers[i].list = list;
+			workers[i].ctm = ctm;
+			workers[i].tiles = tr;
+			workers[i].tile_pix = pix;
+			memset(&workers[i].cookie, 0, sizeof(fz_cookie));
+			workers[i].running = 1;
+			mu_trigger_semaphore(&workers[i].start);
+		}
+		for (i = 0; i < num_workers; i++)
+		{
+			mu_wait_semaphore(&workers[i].stop);
+			workers[i].running = 0;
+			workers[i].tiles = NULL;
+			workers[i].tile_pix = NULL;
+			cookie->errors += workers[i].cookie.errors;
+			failed |= workers[i].error;
+		}
+		if (failed)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "worker failed to render tile");
+
+		finishband(ctx, 0, pix, bit);
+	}
+	fz_always(ctx)
+		fz_drop_tile_render(ctx, tr);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+#else
+	fz_throw(ctx, FZ_ERROR_GENERIC, "Threads not enabled in this build");
+#endif
+}
+
 static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, int pagenum, fz_cookie *cookie, int start, int interptime, char *fname, int bg, fz_separations *seps)
 {
 	fz_rect mediabox;
@@ -997,6 +1129,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 		fz_pixmap *pix = NULL;
 		int w, h;
 		fz_bitmap *bit = NULL;
+		int tiled = (num_workers > 0 && band_height == 0);
 
 		fz_var(pix);
 		fz_var(bander);
@@ -1079,7 +1212,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 				DEBUG_THREADS(("Using %d Bands\n", bands));
 			}
 
-			if (num_workers > 0)
+			if (num_workers > 0 && !tiled)
 			{
 				for (band = 0; band < fz_mini(num_workers, bands); band++)
 				{
@@ -1151,7 +1284,9 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 
 			for (band = 0; band < bands; band++)
 			{
-				if (num_workers > 0)
+				if (tiled)
+					drawtiles(ctx, list, ctm, cookie, pix, &bit);
+				else if (num_workers > 0)
 				{
 					worker_t *w = &workers[band % num_workers];
 #ifndef DISABLE_MUTHREADS
@@ -1186,7 +1321,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 					bit = NULL;
 				}
 
-				if (num_workers > 0 && band + num_workers < bands)
+				if (num_workers > 0 && !tiled && band + num_workers < bands)
 				{
 					worker_t *w = &workers[band % num_workers];
 					w->band = band + num_workers;
@@ -1200,7 +1335,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 					mu_trigger_semaphore(&w->start);
 #endif
 				}
-				if (num_workers <= 0)
+				if (num_workers <= 0 || tiled)
 					pix->y += band_height;
 				tbounds.y0 += band_height;
 				tbounds.y1 += band_height;
@@ -1234,7 +1369,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 			}
 			fz_drop_bitmap(ctx, bit);
 			bit = NULL;
-			if (num_workers > 0)
+			if (num_workers > 0 && !tiled)
 			{
 				int i;
 				DEBUG_THREADS(("Stopping workers and removing their pixmaps\n"));
@@ -1317,7 +1452,7 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 		}
 	}
 
-	if (!quiet || showfeatures || showtime || showmd5)
+	if (!quiet || showfeatures || showtime || showmd5 || showlist)
 		fprintf(stderr, "\n");
 
 	if (lowmemory)
@@ -1332,6 +1467,39 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 		errored = 1;
 }
 
+static void show_cache_counters(fz_context *ctx)
+{
+	fz_store_counters counters;
+	fz_store_stats stats;
+	fz_glyph_cache_stats glyphs;
+	int i;
+
+	fz_get_store_counters(ctx, &counters);
+	fprintf(stderr, "store (%s): %llu hits, %llu misses, %llu stores, %llu evictions (%llu bytes)\n",
+		fz_store_policy_to_string(store_policy < 0 ? FZ_STORE_POLICY_LRU : store_policy),
+		(unsigned long long)counters.hits, (unsigned long long)counters.misses,
+		(unsigned long long)counters.stores, (unsigned long long)counters.evictions,
+		(unsigned long long)counters.evicted_bytes);
+
+	fz_get_store_stats(ctx, &stats);
+	for (i = 0; i < stats.num_types; i++)
+	{
+		fz_store_type_stats *type = &stats.type[i];
+		fprintf(stderr, "\t%s: %d items (%zu bytes", type->name, type->items, type->bytes);
+		if (type->max != FZ_STORE_UNLIMITED)
+			fprintf(stderr, ", limit %zu", type->max);
+		fprintf(stderr, "), %llu hits, %llu misses, %llu evictions, %llu scavenges\n",
+			(unsigned long long)type->hits, (unsigned long long)type->misses,
+			(unsigned long long)type->evictions, (unsigned long long)type->scavenges);
+	}
+
+	fz_get_glyph_cache_stats(ctx, &glyphs);
+	fprintf(stderr, "glyph cache: %zu of %zu bytes, %llu hits, %llu misses, %llu evictions (%llu bytes)\n",
+		glyphs.size, glyphs.max,
+		(unsigned long long)glyphs.hits, (unsigned long long)glyphs.misses,
+		(unsigned long long)glyphs.evictions, (unsigned long long)glyphs.evicted_bytes);
+}
+
 static void bgprint_flush(void)
 {
 	if (!bgprint.active || !bgprint.started)
@@ -1352,6 +1520,7 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 	fz_cookie cookie = { 0 };
 	fz_separations *seps = NULL;
 	const char *features = "";
+	char liststats[80] = "";
 
 	fz_var(list);
 	fz_var(dev);
@@ -1441,6 +1610,14 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 			int end = gettime();
 			start = end - start;
 		}
+
+		if (showlist)
+		{
+			size_t commands;
+			size_t bytes = fz_display_list_size(ctx, list, &commands);
+			fz_snprintf(liststats, sizeof liststats, " list %zu commands %zu bytes (%.1f bytes/command)",
+				commands, bytes, commands ? (float)bytes / commands : 0.0f);
+		}
 	}
 
 	if (showfeatures)
@@ -1487,8 +1664,8 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 		}
 		else if (bgprint.active)
 		{
-			if (!quiet || showfeatures || showtime || showmd5)
-				fprintf(stderr, "page %s %d%s", filename, pagenum, features);
+			if (!quiet || showfeatures || showtime || showmd5 || showlist)
+				fprintf(stderr, "page %s %d%s%s", filename, pagenum, features, liststats);
 
 			bgprint.started = 1;
 			bgprint.page = page;
@@ -1509,8 +1686,8 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 	}
 	else
 	{
-		if (!quiet || showfeatures || showtime || showmd5)
-			fprintf(stderr, "page %s %d%s", filename, pagenum, features);
+		if (!quiet || showfeatures || showtime || showmd5 || showlist)
+			fprintf(stderr, "page %s %d%s%s", filename, pagenum, features, liststats);
 		fz_try(ctx)
 			dodrawpage(ctx, page, list, pagenum, &cookie, start, 0, filename, 0, seps);
 		fz_always(ctx)
@@ -1708,7 +1885,10 @@ static void worker_thread(void *arg)
 		{
 			fz_try(me->ctx)
 			{
-				drawband(me->ctx, NULL, me->list, me->ctm, me->tbounds, &me->cookie, band * band_height, me->pix, &me->bit);
+				if (me->tiles)
+					fz_run_tile_render(me->ctx, me->tiles, me->tile_pix, &me->cookie, new_tile_device, NULL);
+				else
+					drawband(me->ctx, NULL, me->list, me->ctm, me->tbounds, &me->cookie, band * band_height, me->pix, &me->bit);
 				DEBUG_THREADS(("Worker %d completed band %d\n", me->num, band));
 			}
 			fz_catch(me->ctx)
@@ -1765,6 +1945,232 @@ static void bgprint_worker(void *arg)
 }
 #endif
 
+/*
+	A stream that delays every read, to see how readahead fares
+	against slow storage (network file systems and the like) without
+	needing any. Each read fetches up to 64K, as a readahead would.
+*/
+typedef struct
+{
+	fz_stream *chain;
+	unsigned char buffer[64 << 10];
+} slow_state;
+
+static int next_slow(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	slow_state *state = stm->state;
+	size_t n;
+
+	(void)max;
+
+#ifdef _WIN32
+	Sleep(slow_read_ms);
+#else
+	usleep(slow_read_ms * 1000);
+#endif
+
+	fz_seek(ctx, state->chain, stm->pos, 0);
+	n = fz_read(ctx, state->chain, state->buffer, sizeof state->buffer);
+	stm->rp = state->buffer;
+	stm->wp = state->buffer + n;
+	stm->pos += (int64_t)n;
+
+	if (n == 0)
+		return EOF;
+	return *stm->rp++;
+}
+
+static void seek_slow(fz_context *ctx, fz_stream *stm, int64_t offset, int whence)
+{
+	slow_state *state = stm->state;
+
+	if (whence == 2)
+	{
+		fz_seek(ctx, state->chain, offset, 2);
+		offset = fz_tell(ctx, state->chain);
+	}
+	stm->pos = offset;
+	stm->rp = state->buffer;
+	stm->wp = state->buffer;
+}
+
+static void drop_slow(fz_context *ctx, void *state_)
+{
+	slow_state *state = state_;
+	fz_drop_stream(ctx, state->chain);
+	fz_free(ctx, state);
+}
+
+static fz_stream *open_input(fz_context *ctx, const char *name)
+{
+	fz_stream *file = fz_open_file(ctx, name);
+	slow_state *state = NULL;
+	fz_stream *stm = NULL;
+
+	if (slow_read_ms <= 0)
+		return file;
+
+	fz_var(state);
+
+	fz_try(ctx)
+	{
+		state = fz_malloc_struct(ctx, slow_state);
+		state->chain = file;
+		stm = fz_new_stream(ctx, state, next_slow, drop_slow);
+		stm->seek = seek_slow;
+	}
+	fz_catch(ctx)
+	{
+		/* fz_new_stream drops the state (and so the file) on failure. */
+		if (state == NULL)
+			fz_drop_stream(ctx, file);
+		fz_rethrow(ctx);
+	}
+
+	return stm;
+}
+
+#ifndef DISABLE_MUTHREADS
+static void prefetch_wake(void *arg)
+{
+	(void)arg;
+	mu_trigger_semaphore(&prefetcher.wake);
+}
+
+static void prefetch_worker(void *arg)
+{
+	int result;
+
+	(void)arg;
+
+	while ((result = fz_prefetch_work(prefetcher.ctx, prefetcher.pf)) >= 0)
+		if (result == 0)
+			mu_wait_semaphore(&prefetcher.wake);
+	DEBUG_THREADS(("Prefetcher shutting down\n"));
+}
+
+static void stop_prefetch(fz_context *ctx)
+{
+	int hits, misses;
+
+	if (prefetcher.pf == NULL)
+		return;
+
+	fz_close_prefetch(ctx, prefetcher.pf);
+	mu_destroy_thread(&prefetcher.thread);
+	mu_destroy_semaphore(&prefetcher.wake);
+	fz_drop_context(prefetcher.ctx);
+
+	if (showtime)
+	{
+		fz_prefetch_stats(ctx, prefetcher.pf, &hits, &misses);
+		fprintf(stderr, "prefetch: %d hits, %d misses\n", hits, misses);
+	}
+
+	fz_drop_prefetch(ctx, prefetcher.pf);
+	prefetcher.pf = NULL;
+	prefetcher.ctx = NULL;
+}
+
+/* Open the file with a prefetcher reading ahead in it on a thread of its own. */
+static fz_stream *open_prefetch_input(fz_context *ctx, const char *name)
+{
+	fz_stream *file = NULL;
+	fz_stream *source = NULL;
+	fz_stream *stm = NULL;
+	int started = 0;
+
+	fz_var(file);
+	fz_var(source);
+	fz_var(started);
+
+	fz_try(ctx)
+	{
+		file = open_input(ctx, name);
+		source = open_input(ctx, name);
+		prefetcher.pf = fz_new_prefetch(ctx, source, prefetch_wake, NULL);
+		prefetcher.ctx = fz_clone_context(ctx);
+		if (prefetcher.ctx == NULL || mu_create_semaphore(&prefetcher.wake))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot start prefetcher");
+		if (mu_create_thread(&prefetcher.thread, prefetch_worker, NULL))
+		{
+			mu_destroy_semaphore(&prefetcher.wake);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot start prefetcher");
+		}
+		started = 1;
+		stm = fz_open_prefetch(ctx, prefetcher.pf, file);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, file);
+		fz_drop_stream(ctx, source);
+	}
+	fz_catch(ctx)
+	{
+		if (started)
+			stop_prefetch(ctx);
+		else
+		{
+			fz_drop_context(prefetcher.ctx);
+			fz_drop_prefetch(ctx, prefetcher.pf);
+			prefetcher.ctx = NULL;
+			prefetcher.pf = NULL;
+		}
+		fz_rethrow(ctx);
+	}
+
+	return stm;
+}
+#endif
+
+#if FZ_ENABLE_PDF
+extern fz_document_handler pdf_document_handler;
+#endif
+
+static fz_document *open_input_document(fz_context *ctx, const char *name, const char *accel)
+{
+	fz_stream *stm = NULL;
+	fz_stream *accel_stm = NULL;
+	fz_document *doc = NULL;
+#if FZ_ENABLE_PDF
+	pdf_open_options opts = { 0 };
+
+	opts.lazy_xref = lazy_xref;
+	opts.obj_arena = obj_arena;
+#endif
+
+	fz_var(stm);
+	fz_var(accel_stm);
+
+	fz_try(ctx)
+	{
+#ifndef DISABLE_MUTHREADS
+		if (prefetch)
+			stm = open_prefetch_input(ctx, name);
+		else
+#endif
+			stm = open_input(ctx, name);
+		if (accel)
+			accel_stm = fz_open_file(ctx, accel);
+#if FZ_ENABLE_PDF
+		/* -E and -C are PDF open options, so PDF files are opened directly. */
+		if ((opts.lazy_xref || opts.obj_arena) && fz_recognize_document_stream_content(ctx, stm, name) == &pdf_document_handler)
+			doc = (fz_document *)pdf_open_document_with_stream_and_options(ctx, stm, &opts);
+		else
+#endif
+			doc = fz_open_accelerated_document_with_stream(ctx, name, stm, accel_stm);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_drop_stream(ctx, accel_stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return doc;
+}
+
 static inline int iswhite(int ch)
 {
 	return
@@ -2027,22 +2433,71 @@ int mudraw_main(int argc, char **argv)
 {
 	char *password = "";
 	fz_document *doc = NULL;
-	int c;
+	int c, i;
 	fz_context *ctx;
 	trace_info trace_info = { 0, 0, 0, 0, 0, 0 };
 	fz_alloc_context trace_alloc_ctx = { &trace_info, trace_malloc, trace_realloc, trace_free };
 	fz_alloc_context *alloc_ctx = NULL;
 	fz_locks_context *locks = NULL;
 	size_t max_store = FZ_STORE_DEFAULT;
+	const fz_getopt_long_options longopts[] =
+	{
+		{ "store-shards:", &store_shards, (void *)1 },
+		{ "store-policy:", NULL, (void *)2 },
+		{ "store-limit:", NULL, (void *)3 },
+		{ "shared-glyph-cache:", NULL, (void *)4 },
+		{ "glyph-cache-size:", NULL, (void *)5 },
+		{ "per-thread-freetype:", &per_thread_freetype, (void *)6 },
+		{ NULL, NULL, NULL }
+	};
 
 	fz_var(doc);
 
-	while ((c = fz_getopt(argc, argv, "qp:o:F:R:r:w:h:fB:c:e:G:Is:A:DiW:H:S:T:t:d:U:XLvPl:y:Yz:Z:NO:am:Kb:k:")) != -1)
+	while ((c = fz_getopt_long(argc, argv, "qp:o:F:R:r:w:h:fB:c:e:G:Is:A:DiW:H:S:T:t:d:U:XLMJQ:ECvPl:guy:Yz:Z:NO:am:Kb:k:", longopts)) != -1)
 	{
 		switch (c)
 		{
 		default: return usage();
 
+		case 0:
+			switch ((int)(intptr_t)fz_optlong->opaque)
+			{
+			case 1: /* --store-shards, read into store_shards */
+			case 6: /* --per-thread-freetype, read into per_thread_freetype */
+				break;
+			case 2:
+				store_policy = fz_store_policy_from_string(fz_optarg);
+				if (strcmp(fz_store_policy_to_string(store_policy), fz_optarg))
+					return usage();
+				break;
+			case 3:
+			{
+				char *sep = strchr(fz_optarg, ':');
+				if (!sep || num_store_limits == (int)nelem(store_limit_type))
+					return usage();
+				*sep = 0;
+				store_limit_type[num_store_limits] = fz_optarg;
+				store_limit_max[num_store_limits] = fz_atoi64(sep + 1);
+				num_store_limits++;
+				break;
+			}
+			case 4:
+			{
+				char *sep = strchr(fz_optarg, ',');
+				if (sep)
+				{
+					*sep = 0;
+					shared_glyph_cache_size = fz_atoi64(sep + 1);
+				}
+				shared_glyph_cache = fz_optarg;
+				break;
+			}
+			case 5:
+				glyph_cache_size = fz_atoi64(fz_optarg);
+				break;
+			}
+			break;
+
 		case 'q': quiet = 1; break;
 
 		case 'p': password = fz_optarg; break;
@@ -2090,6 +2545,8 @@ int mudraw_main(int argc, char **argv)
 			if (strchr(fz_optarg, 'm')) ++showmemory;
 			if (strchr(fz_optarg, 'f')) ++showfeatures;
 			if (strchr(fz_optarg, '5')) ++showmd5;
+			if (strchr(fz_optarg, 'l')) ++showlist;
+			if (strchr(fz_optarg, 'c')) ++showcache;
 			break;
 
 		case 'A':
@@ -2135,6 +2592,19 @@ int mudraw_main(int argc, char **argv)
 			else trace_info.mem_limit = fz_atoi64(fz_optarg);
 			break;
 		case 'L': lowmemory = 1; break;
+		case 'M': mmap_files = 1; break;
+		case 'J':
+#ifndef DISABLE_MUTHREADS
+			prefetch = 1; break;
+#else
+			fprintf(stderr, "Threads not enabled in this build\n");
+			break;
+#endif
+		case 'Q': slow_read_ms = fz_atoi(fz_optarg); break;
+		case 'E': lazy_xref = 1; break;
+		case 'C': obj_arena = 1; break;
+		case 'g': batch_paths = 1; break;
+		case 'u': cache_paths = 1; break;
 		case 'P':
 #ifndef DISABLE_MUTHREADS
 			bgprint.active = 1; break;
@@ -2174,11 +2644,6 @@ int mudraw_main(int argc, char **argv)
 			fprintf(stderr, "cannot use multiple threads without using display list\n");
 			exit(1);
 		}
-
-		if (band_height == 0)
-		{
-			fprintf(stderr, "Using multiple threads without banding is pointless\n");
-		}
 	}
 
 	if (bgprint.active)
@@ -2214,6 +2679,19 @@ int mudraw_main(int argc, char **argv)
 
 	fz_try(ctx)
 	{
+		if (store_shards > 1)
+			fz_set_store_shards(ctx, store_shards);
+		if (store_policy >= 0)
+			fz_set_store_policy(ctx, store_policy);
+		for (i = 0; i < num_store_limits; i++)
+			fz_set_store_type_limit(ctx, store_limit_type[i], store_limit_max[i]);
+		if (shared_glyph_cache)
+			fz_use_shared_glyph_cache(ctx, shared_glyph_cache, shared_glyph_cache_size);
+		if (glyph_cache_size)
+			fz_set_glyph_cache_size(ctx, glyph_cache_size);
+		if (per_thread_freetype)
+			fz_set_per_thread_freetype(ctx, 1);
+
 		if (proof_filename)
 		{
 			fz_buffer *proof_buffer = fz_read_file(ctx, proof_filename);
@@ -2224,6 +2702,7 @@ int mudraw_main(int argc, char **argv)
 		fz_set_text_aa_level(ctx, alphabits_text);
 		fz_set_graphics_aa_level(ctx, alphabits_graphics);
 		fz_set_graphics_min_line_width(ctx, min_line_width);
+		fz_set_mmap_files(ctx, mmap_files);
 		if (no_icc)
 			fz_disable_icc(ctx);
 		else
@@ -2543,6 +3022,8 @@ int mudraw_main(int argc, char **argv)
 				time_t atime;
 				time_t dtime;
 				int layouttime;
+				int opentime;
+				int droptime;
 
 				fz_try(ctx)
 				{
@@ -2576,7 +3057,14 @@ int mudraw_main(int argc, char **argv)
 						}
 					}
 
-					doc = fz_open_accelerated_document(ctx, filename, accel);
+					opentime = gettime();
+					if (prefetch || slow_read_ms > 0 || lazy_xref || obj_arena)
+						doc = open_input_document(ctx, filename, accel);
+					else
+						doc = fz_open_accelerated_document(ctx, filename, accel);
+					opentime = gettime() - opentime;
+					if (showtime)
+						fprintf(stderr, "open %s %dms\n", filename, opentime);
 
 #ifdef CLUSTER
 					/* Load and then drop the outline if we're running under the cluster.
@@ -2663,8 +3151,14 @@ int mudraw_main(int argc, char **argv)
 				}
 				fz_always(ctx)
 				{
+					droptime = gettime();
 					fz_drop_document(ctx, doc);
+					if (showtime && doc)
+						fprintf(stderr, "drop %s %dms\n", filename, gettime() - droptime);
 					doc = NULL;
+#ifndef DISABLE_MUTHREADS
+					stop_prefetch(ctx);
+#endif
 				}
 				fz_catch(ctx)
 				{
@@ -2738,6 +3232,9 @@ int mudraw_main(int argc, char **argv)
 			}
 		}
 
+		if (showcache)
+			show_cache_counters(ctx);
+
 #ifndef DISABLE_MUTHREADS
 		if (num_workers > 0)
 		{
@@ -34,10 +34,135 @@
 #include "mupdf/fitz.h"
 #include "mupdf/pdf.h"
 
+#ifndef DISABLE_MUTHREADS
+#include "mupdf/helpers/mu-threads.h"
+#endif
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+#ifndef DISABLE_MUTHREADS
+
+static mu_mutex mutexes[FZ_LOCK_MAX];
+
+static void pdfclean_lock(void *user, int lock)
+{
+	mu_lock_mutex(&mutexes[lock]);
+}
+
+static void pdfclean_unlock(void *user, int lock)
+{
+	mu_unlock_mutex(&mutexes[lock]);
+}
+
+static fz_locks_context pdfclean_locks =
+{
+	NULL, pdfclean_lock, pdfclean_unlock
+};
+
+static void fin_pdfclean_locks(void)
+{
+	int i;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		mu_destroy_mutex(&mutexes[i]);
+}
+
+static fz_locks_context *init_pdfclean_locks(void)
+{
+	int i;
+	int failed = 0;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		failed |= mu_create_mutex(&mutexes[i]);
+
+	if (failed)
+	{
+		fin_pdfclean_locks();
+		return NULL;
+	}
+
+	return &pdfclean_locks;
+}
+
+typedef struct
+{
+	fz_context *ctx;
+	pdf_obj_stm_batch *batch;
+	mu_thread thread;
+	int started;
+} objstm_worker;
+
+static void objstm_worker_thread(void *arg)
+{
+	objstm_worker *me = arg;
+
+	while (pdf_decode_obj_stm_batch(me->ctx, me->batch))
+		;
+}
+
+/* Decode all the object streams up front, on as many threads as asked
+ * for (counting this one), before the document is written. */
+static void decode_obj_stms(fz_context *ctx, pdf_document *doc, void *arg)
+{
+	int threads = *(int *)arg;
+	objstm_worker *workers = NULL;
+	pdf_obj_stm_batch *batch;
+	int i;
+
+	batch = pdf_new_obj_stm_batch(ctx, doc);
+
+	fz_var(workers);
+
+	fz_try(ctx)
+	{
+		workers = fz_malloc_struct_array(ctx, threads - 1, objstm_worker);
+		for (i = 0; i < threads - 1; i++)
+		{
+			workers[i].batch = batch;
+			workers[i].ctx = fz_clone_context(ctx);
+			if (workers[i].ctx == NULL)
+				break;
+			if (mu_create_thread(&workers[i].thread, objstm_worker_thread, &workers[i]))
+			{
+				fz_drop_context(workers[i].ctx);
+				workers[i].ctx = NULL;
+				break;
+			}
+			workers[i].started = 1;
+		}
+
+		/* Lend a hand, which also copes with no threads starting. */
+		while (pdf_decode_obj_stm_batch(ctx, batch))
+			;
+	}
+	fz_always(ctx)
+	{
+		for (i = 0; workers && i < threads - 1; i++)
+		{
+			if (workers[i].started)
+				mu_destroy_thread(&workers[i].thread);
+			fz_drop_context(workers[i].ctx);
+		}
+		fz_free(ctx, workers);
+	}
+	fz_catch(ctx)
+	{
+		pdf_drop_obj_stm_batch(ctx, batch);
+		fz_rethrow(ctx);
+	}
+
+	fz_try(ctx)
+		pdf_merge_obj_stm_batch(ctx, batch);
+	fz_always(ctx)
+		pdf_drop_obj_stm_batch(ctx, batch);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+#endif
+
 static int usage(void)
 {
 	fprintf(stderr,
@@ -69,6 +194,9 @@ static int usage(void)
 		"\t-m\tpreserve metadata\n"
 		"\t-S\tsubset fonts if possible [EXPERIMENTAL!]\n"
 		"\t-Z\tuse objstms if possible for extra compression\n"
+#ifndef DISABLE_MUTHREADS
+		"\t-j -\tdecode object streams using this many threads\n"
+#endif
 		"\t--{color,gray,bitonal}-{,lossy-,lossless-}image-subsample-method -\n\t\taverage, bicubic\n"
 		"\t--{color,gray,bitonal}-{,lossy-,lossless-}image-subsample-dpi -[,-]\n\t\tDPI at which to subsample [+ target dpi]\n"
 		"\t--{color,gray,bitonal}-{,lossy-,lossless-}image-recompress-method -[:quality]\n\t\tnever, same, lossless, jpeg, j2k, fax, jbig2\n"
@@ -98,6 +226,10 @@ int pdfclean_main(int argc, char **argv)
 	int errors = 0;
 	fz_context *ctx;
 	int structure;
+	fz_locks_context *locks = NULL;
+#ifndef DISABLE_MUTHREADS
+	int threads = 0;
+#endif
 	const fz_getopt_long_options longopts[] =
 	{
 		{ "color-lossy-image-subsample-method=average|bicubic", &opts.image.color_lossy_image_subsample_method, (void *)1 },
@@ -133,7 +265,7 @@ int pdfclean_main(int argc, char **argv)
 	opts.write = pdf_default_write_options;
 	opts.write.dont_regenerate_id = 1;
 
-	while ((c = fz_getopt_long(argc, argv, "ade:fgilmp:stczDAE:LO:U:P:SZ", longopts)) != -1)
+	while ((c = fz_getopt_long(argc, argv, "ade:fgij:lmp:stczDAE:LO:U:P:SZ", longopts)) != -1)
 	{
 		switch (c)
 		{
@@ -145,6 +277,9 @@ int pdfclean_main(int argc, char **argv)
 		case 'i': opts.write.do_compress_images += 1; break;
 		case 'a': opts.write.do_ascii += 1; break;
 		case 'e': opts.write.compression_effort = fz_atoi(fz_optarg); break;
+#ifndef DISABLE_MUTHREADS
+		case 'j': threads = fz_atoi(fz_optarg); break;
+#endif
 		case 'g': opts.write.do_garbage += 1; break;
 		case 'l': opts.write.do_linear += 1; break;
 		case 'c': opts.write.do_clean += 1; break;
@@ -268,7 +403,21 @@ int pdfclean_main(int argc, char **argv)
 		outfile = argv[fz_optind++];
 	}
 
-	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+#ifndef DISABLE_MUTHREADS
+	if (threads > 1)
+	{
+		locks = init_pdfclean_locks();
+		if (locks == NULL)
+		{
+			fprintf(stderr, "cannot initialise mutexes\n");
+			exit(1);
+		}
+		opts.preload = decode_obj_stms;
+		opts.preload_arg = &threads;
+	}
+#endif
+
+	ctx = fz_new_context(NULL, locks, FZ_STORE_UNLIMITED);
 	if (!ctx)
 	{
 		fprintf(stderr, "cannot initialise context\n");
@@ -286,5 +435,10 @@ int pdfclean_main(int argc, char **argv)
 	}
 	fz_drop_context(ctx);
 
+#ifndef DISABLE_MUTHREADS
+	if (locks)
+		fin_pdfclean_locks();
+#endif
+
 	return errors != 0;
 }